@@ -53,10 +53,86 @@
 #define CHECK_OUTPUT_BYTES(__needed) \
 	__CHECK_BYTES(max_compressed_size, compressed_pos, __needed)
 
-ssize_t lzxpress_compress(const uint8_t *uncompressed,
-			  uint32_t uncompressed_size,
-			  uint8_t *compressed,
-			  uint32_t max_compressed_size)
+/*
+ * Matches can only reach back 8192 bytes, so we keep hash chains
+ * over the 3 byte prefixes of the last 8192 positions. The chains
+ * are walked from the nearest position backwards, which gives
+ * exactly the same matches as trying every offset in turn.
+ */
+#define LZXPRESS_MAX_OFFSET 0x2000
+#define LZXPRESS_HASH_BITS 13
+#define LZXPRESS_HASH_SIZE (1 << LZXPRESS_HASH_BITS)
+
+struct lzxpress_match_finder {
+	/* most recent position + 1 for each hash, 0 means empty */
+	uint32_t head[LZXPRESS_HASH_SIZE];
+	/* distance to the previous position with the same hash */
+	uint16_t prev[LZXPRESS_MAX_OFFSET];
+};
+
+static inline uint32_t lzxpress_hash(const uint8_t *p)
+{
+	uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+
+	return (v * 2654435761U) >> (32 - LZXPRESS_HASH_BITS);
+}
+
+static inline void lzxpress_insert(struct lzxpress_match_finder *mf,
+				   const uint8_t *data,
+				   uint32_t data_size,
+				   uint32_t pos)
+{
+	uint32_t h;
+	uint32_t last;
+	uint32_t dist = 0;
+
+	if (data_size - pos < 3) {
+		return;
+	}
+
+	h = lzxpress_hash(data + pos);
+	last = mf->head[h];
+	if (last != 0) {
+		/* anything further away than the window ends the chain */
+		dist = MIN(pos + 1 - last, LZXPRESS_MAX_OFFSET + 1);
+	}
+	mf->prev[pos % LZXPRESS_MAX_OFFSET] = dist;
+	mf->head[h] = pos + 1;
+}
+
+/*
+ * Returns how many bytes of a and b (up to max_len) are equal, 8 bytes
+ * at a time while possible. The two regions may overlap.
+ */
+static inline uint32_t lzxpress_match_len(const uint8_t *a,
+					  const uint8_t *b,
+					  uint32_t max_len)
+{
+	uint32_t len = 0;
+
+	while (max_len - len >= sizeof(uint64_t)) {
+		uint64_t va, vb;
+
+		memcpy(&va, a + len, sizeof(va));
+		memcpy(&vb, b + len, sizeof(vb));
+		if (va != vb) {
+			break;
+		}
+		len += sizeof(uint64_t);
+	}
+
+	while ((len < max_len) && (a[len] == b[len])) {
+		len++;
+	}
+
+	return len;
+}
+
+static ssize_t lzxpress_compress_mf(struct lzxpress_match_finder *mf,
+				    const uint8_t *uncompressed,
+				    uint32_t uncompressed_size,
+				    uint8_t *compressed,
+				    uint32_t max_compressed_size)
 {
 	/*
 	 * This is the algorithm in [MS-XCA] 2.3 "Plain LZ77 Compression".
@@ -95,20 +171,39 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 		uint32_t best_len = 2;
 		uint32_t best_offset = 0;
 
-		int32_t offset;
+		uint32_t cand;
 
-		const uint32_t max_offset = MIN(0x2000, uncompressed_pos);
 		/* maximum len we can encode into metadata */
 		const uint32_t max_len = MIN(0xFFFF + 3, uncompressed_size - uncompressed_pos);
 
-		/* search for the longest match in the window for the lookahead buffer */
-		for (offset = 1; (uint32_t)offset <= max_offset; offset++) {
-			uint32_t len;
+		/*
+		 * search for the longest match in the window for the
+		 * lookahead buffer, nearest candidates first.
+		 */
+		cand = 0;
+		if (max_len >= 3) {
+			cand = mf->head[lzxpress_hash(uncompressed + uncompressed_pos)];
+		}
+		while (cand != 0) {
+			uint32_t offset = uncompressed_pos + 1 - cand;
+			uint32_t dist;
+			uint32_t len = 0;
 
-			for (len = 0;
-			     (len < max_len) && (uncompressed[uncompressed_pos + len] ==
-						 uncompressed[uncompressed_pos + len - offset]);
-			     len++);
+			if (offset > LZXPRESS_MAX_OFFSET) {
+				break;
+			}
+
+			/*
+			 * A candidate can only be better if it also
+			 * matches at best_len, which is cheap to check.
+			 */
+			if (uncompressed[uncompressed_pos + best_len] ==
+			    uncompressed[uncompressed_pos + best_len - offset]) {
+				len = lzxpress_match_len(
+					uncompressed + uncompressed_pos,
+					uncompressed + uncompressed_pos - offset,
+					max_len);
+			}
 
 			/*
 			 * We check if len is better than the value found before, including the
@@ -123,6 +218,12 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 					break;
 				}
 			}
+
+			dist = mf->prev[(cand - 1) % LZXPRESS_MAX_OFFSET];
+			if ((dist == 0) || (dist >= cand)) {
+				break;
+			}
+			cand -= dist;
 		}
 
 		if (!found) {
@@ -133,6 +234,8 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 			 */
 			CHECK_INPUT_BYTES(sizeof(uint8_t));
 			CHECK_OUTPUT_BYTES(sizeof(uint8_t));
+			lzxpress_insert(mf, uncompressed, uncompressed_size,
+					uncompressed_pos);
 			compressed[compressed_pos++] = uncompressed[uncompressed_pos++];
 
 			indic <<= 1;
@@ -212,10 +315,22 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 				compressed_pos += sizeof(uint32_t);
 			}
 
-			uncompressed_pos += best_len;
+			for (; best_len > 0; best_len--) {
+				lzxpress_insert(mf, uncompressed, uncompressed_size,
+						uncompressed_pos);
+				uncompressed_pos++;
+			}
 		}
 	}
 
+	if (uncompressed_pos < uncompressed_size) {
+		/*
+		 * We ran out of output space, don't return a
+		 * silently truncated stream.
+		 */
+		return -1;
+	}
+
 	if (indic_bit != 0) {
 		indic <<= 32 - indic_bit;
 	}
@@ -225,6 +340,34 @@ ssize_t lzxpress_compress(const uint8_t *uncompressed,
 	return compressed_pos;
 }
 
+ssize_t lzxpress_compress(const uint8_t *uncompressed,
+			  uint32_t uncompressed_size,
+			  uint8_t *compressed,
+			  uint32_t max_compressed_size)
+{
+	struct lzxpress_match_finder *mf = NULL;
+	ssize_t ret;
+
+	if (!uncompressed_size) {
+		return 0;
+	}
+
+	mf = malloc(sizeof(*mf));
+	if (mf == NULL) {
+		return -1;
+	}
+	memset(mf->head, 0, sizeof(mf->head));
+
+	ret = lzxpress_compress_mf(mf,
+				   uncompressed,
+				   uncompressed_size,
+				   compressed,
+				   max_compressed_size);
+
+	free(mf);
+	return ret;
+}
+
 ssize_t lzxpress_decompress(const uint8_t *input,
 			    uint32_t input_size,
 			    uint8_t *output,
@@ -332,13 +475,37 @@ ssize_t lzxpress_decompress(const uint8_t *input,
 				return -1;
 			}
 
-			for (; length > 0; --length) {
-				if (offset > output_index) {
-					return -1;
+			if (offset > output_index) {
+				return -1;
+			}
+			CHECK_OUTPUT_BYTES(length);
+
+			if (offset >= length) {
+				memcpy(output + output_index,
+				       output + output_index - offset,
+				       length);
+				output_index += length;
+			} else {
+				/*
+				 * The match overlaps the bytes it is
+				 * producing, e.g. a run of one byte with
+				 * offset 1. Everything written so far
+				 * repeats every 'offset' bytes, so we can
+				 * copy in non-overlapping chunks that
+				 * double in size each time.
+				 */
+				uint8_t *dst = output + output_index;
+				size_t step = offset;
+				uint32_t done = 0;
+
+				while (done < length) {
+					uint32_t n = MIN(step, length - done);
+
+					memcpy(dst + done, dst + done - step, n);
+					done += n;
+					step *= 2;
 				}
-				CHECK_OUTPUT_BYTES(sizeof(uint8_t));
-				output[output_index] = output[output_index - offset];
-				output_index += sizeof(uint8_t);
+				output_index += length;
 			}
 		}
 	} while ((output_index < max_output_size) && (input_index < (input_size)));
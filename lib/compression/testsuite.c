@@ -465,6 +465,126 @@ static bool test_lzxpress_round_trip(struct torture_context *test)
 }
 
 
+static uint64_t lzxpress_bench_ns(void)
+{
+	struct timespec t;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) != 0) {
+		if (clock_gettime(CUSTOM_CLOCK_MONOTONIC, &t) != 0) {
+			clock_gettime(CLOCK_REALTIME, &t);
+		}
+	}
+	return (t.tv_sec * 1000U * 1000U * 1000U) + t.tv_nsec;
+}
+
+
+static bool test_lzxpress_speed(struct torture_context *test)
+{
+	/*
+	 * Report the compression and decompression speed in MB/s on
+	 * repetitive, LDAP-ish data, vaguely similar to what we see in
+	 * DRS replication blobs.
+	 *
+	 * The data is built from a small vocabulary of "words" with a
+	 * sprinkling of random bytes, using a fixed seed so that the
+	 * numbers are comparable between runs.
+	 *
+	 * As a benchmark this only runs with --option=torture:bench=yes.
+	 */
+	TALLOC_CTX *tmp_ctx = NULL;
+	const size_t data_size = 4 * 1024 * 1024;
+	const size_t chunk_size = XPRESS_BLOCK_SIZE;
+	const char *words[] = {
+		"objectClass", "user", "CN=", ",DC=samba,DC=example,DC=com",
+		"sAMAccountName", "nTSecurityDescriptor", "member",
+		"whenChanged", "20221017", "replPropertyMetaData",
+	};
+	uint8_t *data = NULL;
+	uint8_t *comp = NULL;
+	uint8_t *decomp = NULL;
+	size_t comp_offsets[(4 * 1024 * 1024) / XPRESS_BLOCK_SIZE + 1];
+	uint32_t seed = 42;
+	uint64_t t_start, t_comp, t_decomp;
+	size_t comp_total = 0;
+	size_t i, n;
+
+	if (!torture_setting_bool(test, "bench", false)) {
+		torture_skip(test, "benchmark - enable with "
+			     "--option=torture:bench=yes\n");
+	}
+
+	tmp_ctx = talloc_new(test);
+	torture_assert(test, tmp_ctx != NULL, "out of memory");
+	data = talloc_array(tmp_ctx, uint8_t, data_size);
+	comp = talloc_array(tmp_ctx, uint8_t, data_size + 1024);
+	decomp = talloc_array(tmp_ctx, uint8_t, data_size);
+	torture_assert(test, data != NULL && comp != NULL && decomp != NULL,
+		       "out of memory");
+
+	i = 0;
+	while (i < data_size) {
+		const char *w;
+		size_t len;
+
+		seed = seed * 1103515245 + 12345;
+		if (((seed >> 16) & 7) == 0) {
+			data[i++] = seed >> 8;
+			continue;
+		}
+		w = words[(seed >> 16) % ARRAY_SIZE(words)];
+		len = MIN(strlen(w), data_size - i);
+		memcpy(data + i, w, len);
+		i += len;
+	}
+
+	/*
+	 * Like ndr_compression.c we work on 64k chunks.
+	 */
+	t_start = lzxpress_bench_ns();
+	for (i = 0, n = 0; i < data_size; i += chunk_size, n++) {
+		ssize_t c_size;
+
+		comp_offsets[n] = comp_total;
+		c_size = lzxpress_compress(data + i,
+					   MIN(chunk_size, data_size - i),
+					   comp + comp_total,
+					   data_size + 1024 - comp_total);
+		torture_assert(test, c_size > 0, "lzxpress_compress failed");
+		comp_total += c_size;
+	}
+	comp_offsets[n] = comp_total;
+	t_comp = lzxpress_bench_ns() - t_start;
+
+	t_start = lzxpress_bench_ns();
+	for (i = 0, n = 0; i < data_size; i += chunk_size, n++) {
+		size_t expected = MIN(chunk_size, data_size - i);
+		ssize_t d_size;
+
+		d_size = lzxpress_decompress(comp + comp_offsets[n],
+					     comp_offsets[n + 1] - comp_offsets[n],
+					     decomp + i,
+					     expected);
+		torture_assert_int_equal(test, d_size, expected,
+					 "lzxpress_decompress size");
+	}
+	t_decomp = lzxpress_bench_ns() - t_start;
+
+	torture_assert_mem_equal(test, decomp, data, data_size,
+				 "lzxpress round trip data");
+
+	torture_comment(test,
+			"%zu bytes compressed to %zu bytes\n"
+			"compression:   %.1f MB/s\n"
+			"decompression: %.1f MB/s\n",
+			data_size, comp_total,
+			data_size * 1000.0 / MAX(t_comp, 1),
+			data_size * 1000.0 / MAX(t_decomp, 1));
+
+	talloc_free(tmp_ctx);
+	return true;
+}
+
+
 struct torture_suite *torture_local_compression(TALLOC_CTX *mem_ctx)
 {
 	struct torture_suite *suite = torture_suite_create(mem_ctx, "compression");
@@ -479,5 +599,7 @@ struct torture_suite *torture_local_compression(TALLOC_CTX *mem_ctx)
 				      test_lzxpress_many_zeros);
 	torture_suite_add_simple_test(suite, "lzxpress_round_trip",
 				      test_lzxpress_round_trip);
+	torture_suite_add_simple_test(suite, "lzxpress_speed",
+				      test_lzxpress_speed);
 	return suite;
 }
@@ -212,12 +212,27 @@ int samba_ldb_connect(struct ldb_context *ldb, struct loadparm_context *lp_ctx,
 {
 	int ret;
 	char *real_url = NULL;
+	const char *options[] = { NULL, NULL };
+	int scan_threads;
 
 	/* allow admins to force non-sync ldb for all databases */
 	if (lpcfg_parm_bool(lp_ctx, NULL, "ldb", "nosync", false)) {
 		flags |= LDB_FLG_NOSYNC;
 	}
 
+	/*
+	 * allow admins to unpack records in helper threads during full
+	 * scans and re-indexing; the sam.ldb partitions inherit this
+	 */
+	scan_threads = lpcfg_parm_int(lp_ctx, NULL, "ldb", "scan threads", 0);
+	if (scan_threads > 0) {
+		options[0] = talloc_asprintf(ldb, "scan_threads:%d",
+					     scan_threads);
+		if (options[0] == NULL) {
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+	}
+
 	if (DEBUGLVL(10)) {
 		flags |= LDB_FLG_ENABLE_TRACING;
 	}
@@ -227,7 +242,7 @@ int samba_ldb_connect(struct ldb_context *ldb, struct loadparm_context *lp_ctx,
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
 
-	ret = ldb_connect(ldb, real_url, flags, NULL);
+	ret = ldb_connect(ldb, real_url, flags, options);
 
 	if (ret != LDB_SUCCESS) {
 		return ret;
@@ -76,6 +76,29 @@ static int ldb_match_scope(struct ldb_context *ldb,
 }
 
 
+/*
+  match if any value of a present element passes the syntax check
+*/
+static int ldb_match_present_values(struct ldb_context *ldb,
+				    const struct ldb_schema_attribute *a,
+				    const struct ldb_message_element *el,
+				    bool *matched)
+{
+	if (a->syntax->operator_fn) {
+		unsigned int i;
+		for (i = 0; i < el->num_values; i++) {
+			int ret = a->syntax->operator_fn(ldb, LDB_OP_PRESENT, a, &el->values[i], NULL, matched);
+			if (ret != LDB_SUCCESS) return ret;
+			if (*matched) return LDB_SUCCESS;
+		}
+		*matched = false;
+		return LDB_SUCCESS;
+	}
+
+	*matched = true;
+	return LDB_SUCCESS;
+}
+
 /*
   match if node is present
 */
@@ -103,18 +126,42 @@ static int ldb_match_present(struct ldb_context *ldb,
 		return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
 	}
 
-	if (a->syntax->operator_fn) {
-		unsigned int i;
-		for (i = 0; i < el->num_values; i++) {
-			int ret = a->syntax->operator_fn(ldb, LDB_OP_PRESENT, a, &el->values[i], NULL, matched);
+	return ldb_match_present_values(ldb, a, el, matched);
+}
+
+static int ldb_match_comparison_values(struct ldb_context *ldb,
+				       const struct ldb_schema_attribute *a,
+				       const struct ldb_message_element *el,
+				       const struct ldb_val *value,
+				       enum ldb_parse_op comp_op, bool *matched)
+{
+	unsigned int i;
+
+	for (i = 0; i < el->num_values; i++) {
+		if (a->syntax->operator_fn) {
+			int ret;
+			ret = a->syntax->operator_fn(ldb, comp_op, a, &el->values[i], value, matched);
 			if (ret != LDB_SUCCESS) return ret;
 			if (*matched) return LDB_SUCCESS;
+		} else {
+			int ret = a->syntax->comparison_fn(ldb, ldb, &el->values[i], value);
+
+			if (ret == 0) {
+				*matched = true;
+				return LDB_SUCCESS;
+			}
+			if (ret > 0 && comp_op == LDB_OP_GREATER) {
+				*matched = true;
+				return LDB_SUCCESS;
+			}
+			if (ret < 0 && comp_op == LDB_OP_LESS) {
+				*matched = true;
+				return LDB_SUCCESS;
+			}
 		}
-		*matched = false;
-		return LDB_SUCCESS;
 	}
 
-	*matched = true;
+	*matched = false;
 	return LDB_SUCCESS;
 }
 
@@ -124,7 +171,6 @@ static int ldb_match_comparison(struct ldb_context *ldb,
 				enum ldb_scope scope,
 				enum ldb_parse_op comp_op, bool *matched)
 {
-	unsigned int i;
 	struct ldb_message_element *el;
 	const struct ldb_schema_attribute *a;
 
@@ -144,24 +190,29 @@ static int ldb_match_comparison(struct ldb_context *ldb,
 		return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
 	}
 
-	for (i = 0; i < el->num_values; i++) {
+	return ldb_match_comparison_values(ldb, a, el,
+					   &tree->u.comparison.value,
+					   comp_op, matched);
+}
+
+static int ldb_match_equality_values(struct ldb_context *ldb,
+				     const struct ldb_schema_attribute *a,
+				     const struct ldb_message_element *el,
+				     const struct ldb_val *value,
+				     bool *matched)
+{
+	unsigned int i;
+	int ret;
+
+	for (i=0;i<el->num_values;i++) {
 		if (a->syntax->operator_fn) {
-			int ret;
-			ret = a->syntax->operator_fn(ldb, comp_op, a, &el->values[i], &tree->u.comparison.value, matched);
+			ret = a->syntax->operator_fn(ldb, LDB_OP_EQUALITY, a,
+						     value, &el->values[i], matched);
 			if (ret != LDB_SUCCESS) return ret;
 			if (*matched) return LDB_SUCCESS;
 		} else {
-			int ret = a->syntax->comparison_fn(ldb, ldb, &el->values[i], &tree->u.comparison.value);
-
-			if (ret == 0) {
-				*matched = true;
-				return LDB_SUCCESS;
-			}
-			if (ret > 0 && comp_op == LDB_OP_GREATER) {
-				*matched = true;
-				return LDB_SUCCESS;
-			}
-			if (ret < 0 && comp_op == LDB_OP_LESS) {
+			if (a->syntax->comparison_fn(ldb, ldb, value,
+						     &el->values[i]) == 0) {
 				*matched = true;
 				return LDB_SUCCESS;
 			}
@@ -181,7 +232,6 @@ static int ldb_match_equality(struct ldb_context *ldb,
 			      enum ldb_scope scope,
 			      bool *matched)
 {
-	unsigned int i;
 	struct ldb_message_element *el;
 	const struct ldb_schema_attribute *a;
 	struct ldb_dn *valuedn;
@@ -214,114 +264,76 @@ static int ldb_match_equality(struct ldb_context *ldb,
 		return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
 	}
 
-	for (i=0;i<el->num_values;i++) {
-		if (a->syntax->operator_fn) {
-			ret = a->syntax->operator_fn(ldb, LDB_OP_EQUALITY, a,
-						     &tree->u.equality.value, &el->values[i], matched);
-			if (ret != LDB_SUCCESS) return ret;
-			if (*matched) return LDB_SUCCESS;
-		} else {
-			if (a->syntax->comparison_fn(ldb, ldb, &tree->u.equality.value,
-						     &el->values[i]) == 0) {
-				*matched = true;
-				return LDB_SUCCESS;
-			}
-		}
-	}
-
-	*matched = false;
-	return LDB_SUCCESS;
+	return ldb_match_equality_values(ldb, a, el,
+					 &tree->u.equality.value, matched);
 }
 
-static int ldb_wildcard_compare(struct ldb_context *ldb,
-				const struct ldb_parse_tree *tree,
-				const struct ldb_val value, bool *matched)
+/*
+  match a canonicalised value against canonicalised substring chunks
+*/
+static bool ldb_wildcard_match(struct ldb_val val,
+			       const struct ldb_val *chunks,
+			       unsigned int num_chunks,
+			       bool start_with_wildcard,
+			       bool end_with_wildcard)
 {
-	const struct ldb_schema_attribute *a;
-	struct ldb_val val;
-	struct ldb_val cnk;
-	struct ldb_val *chunk;
-	uint8_t *save_p = NULL;
+	const struct ldb_val *cnk;
 	unsigned int c = 0;
 
-	if (tree->operation != LDB_OP_SUBSTRING) {
-		*matched = false;
-		return LDB_ERR_INAPPROPRIATE_MATCHING;
-	}
-
-	a = ldb_schema_attribute_by_name(ldb, tree->u.substring.attr);
-	if (!a) {
-		return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
-	}
+	if ( ! start_with_wildcard ) {
 
-	if (tree->u.substring.chunks == NULL) {
-		*matched = false;
-		return LDB_SUCCESS;
-	}
-
-	if (a->syntax->canonicalise_fn(ldb, ldb, &value, &val) != 0) {
-		return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
-	}
-
-	save_p = val.data;
-	cnk.data = NULL;
-
-	if ( ! tree->u.substring.start_with_wildcard ) {
-
-		chunk = tree->u.substring.chunks[c];
-		if (a->syntax->canonicalise_fn(ldb, ldb, chunk, &cnk) != 0) goto mismatch;
+		if (num_chunks == 0) {
+			return false;
+		}
+		cnk = &chunks[c];
 
 		/* This deals with wildcard prefix searches on binary attributes (eg objectGUID) */
-		if (cnk.length > val.length) {
-			goto mismatch;
+		if (cnk->length > val.length) {
+			return false;
 		}
 		/*
 		 * Empty strings are returned as length 0. Ensure
 		 * we can cope with this.
 		 */
-		if (cnk.length == 0) {
-			goto mismatch;
+		if (cnk->length == 0) {
+			return false;
 		}
 
-		if (memcmp((char *)val.data, (char *)cnk.data, cnk.length) != 0) goto mismatch;
-		val.length -= cnk.length;
-		val.data += cnk.length;
+		if (memcmp((char *)val.data, (char *)cnk->data, cnk->length) != 0) {
+			return false;
+		}
+		val.length -= cnk->length;
+		val.data += cnk->length;
 		c++;
-		talloc_free(cnk.data);
-		cnk.data = NULL;
 	}
 
-	while (tree->u.substring.chunks[c]) {
+	for (; c < num_chunks; c++) {
 		uint8_t *p;
 
-		chunk = tree->u.substring.chunks[c];
-		if(a->syntax->canonicalise_fn(ldb, ldb, chunk, &cnk) != 0) {
-			goto mismatch;
-		}
+		cnk = &chunks[c];
 		/*
 		 * Empty strings are returned as length 0. Ensure
 		 * we can cope with this.
 		 */
-		if (cnk.length == 0) {
-			goto mismatch;
+		if (cnk->length == 0) {
+			return false;
 		}
-		if (cnk.length > val.length) {
-			goto mismatch;
+		if (cnk->length > val.length) {
+			return false;
 		}
 
-		if ( (tree->u.substring.chunks[c + 1]) == NULL &&
-		     (! tree->u.substring.end_with_wildcard) ) {
+		if (c + 1 == num_chunks && ! end_with_wildcard) {
 			/*
 			 * The last bit, after all the asterisks, must match
 			 * exactly the last bit of the string.
 			 */
 			int cmp;
-			p = val.data + val.length - cnk.length;
+			p = val.data + val.length - cnk->length;
 			cmp = memcmp(p,
-				     cnk.data,
-				     cnk.length);
+				     cnk->data,
+				     cnk->length);
 			if (cmp != 0) {
-				goto mismatch;
+				return false;
 			}
 		} else {
 			/*
@@ -329,27 +341,78 @@ static int ldb_wildcard_compare(struct ldb_context *ldb,
 			 * search, but memory search instead.
 			 */
 			p = memmem((const void *)val.data, val.length,
-				   (const void *)cnk.data, cnk.length);
+				   (const void *)cnk->data, cnk->length);
 			if (p == NULL) {
-				goto mismatch;
+				return false;
 			}
 			/* move val to the end of the match */
-			p += cnk.length;
+			p += cnk->length;
 			val.length -= (p - val.data);
 			val.data = p;
 		}
-		c++;
-		TALLOC_FREE(cnk.data);
 	}
 
-	talloc_free(save_p);
-	*matched = true;
+	return true;
+}
+
+static int ldb_wildcard_compare(struct ldb_context *ldb,
+				const struct ldb_parse_tree *tree,
+				const struct ldb_val value, bool *matched)
+{
+	const struct ldb_schema_attribute *a;
+	struct ldb_val val;
+	struct ldb_val *chunks = NULL;
+	unsigned int num_chunks;
+	unsigned int c;
+
+	if (tree->operation != LDB_OP_SUBSTRING) {
+		*matched = false;
+		return LDB_ERR_INAPPROPRIATE_MATCHING;
+	}
+
+	a = ldb_schema_attribute_by_name(ldb, tree->u.substring.attr);
+	if (!a) {
+		return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
+	}
+
+	if (tree->u.substring.chunks == NULL) {
+		*matched = false;
+		return LDB_SUCCESS;
+	}
+
+	if (a->syntax->canonicalise_fn(ldb, ldb, &value, &val) != 0) {
+		return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
+	}
+
+	for (num_chunks = 0;
+	     tree->u.substring.chunks[num_chunks] != NULL;
+	     num_chunks++) ;
+
+	chunks = talloc_array(ldb, struct ldb_val, num_chunks);
+	if (chunks == NULL) {
+		goto mismatch;
+	}
+
+	for (c = 0; c < num_chunks; c++) {
+		int ret = a->syntax->canonicalise_fn(ldb, chunks,
+						     tree->u.substring.chunks[c],
+						     &chunks[c]);
+		if (ret != 0) {
+			goto mismatch;
+		}
+	}
+
+	*matched = ldb_wildcard_match(val, chunks, num_chunks,
+				      tree->u.substring.start_with_wildcard,
+				      tree->u.substring.end_with_wildcard);
+	talloc_free(chunks);
+	talloc_free(val.data);
 	return LDB_SUCCESS;
 
 mismatch:
 	*matched = false;
-	talloc_free(save_p);
-	talloc_free(cnk.data);
+	talloc_free(chunks);
+	talloc_free(val.data);
 	return LDB_SUCCESS;
 }
 
@@ -649,6 +712,577 @@ int ldb_match_msg_error(struct ldb_context *ldb,
 	return ldb_match_message(ldb, msg, tree, scope, matched);
 }
 
+/*
+  A parse tree flattened for matching many messages against it
+
+  The ops are stored in prefix order, the children of an AND, OR or
+  NOT follow their parent and next points behind the whole subtree,
+  so a branch can be skipped without looking at it.
+*/
+struct ldb_match_op {
+	const struct ldb_parse_tree *tree;
+	unsigned int next;
+
+	/* the attribute handler, looked up at compile time */
+	const struct ldb_schema_attribute *a;
+
+	/* true for attributes that refer to the DN of the message */
+	bool is_dn;
+
+	/* true if an equality match compares values as standard DNs */
+	bool dn_syntax;
+
+	/*
+	 * the parsed assertion value for equality matches on the DN or
+	 * on an attribute with the standard DN syntax
+	 */
+	struct ldb_dn *dn;
+
+	/* canonicalised substring chunks */
+	struct ldb_val *chunks;
+	unsigned int num_chunks;
+	bool chunks_invalid;
+
+	/* the extended match rule, or an error found while compiling */
+	const struct ldb_extended_match_rule *rule;
+	int error;
+};
+
+struct ldb_match_program {
+	struct ldb_context *ldb;
+	struct ldb_dn *base;
+	enum ldb_scope scope;
+	struct ldb_match_op *ops;
+	unsigned int num_ops;
+};
+
+struct ldb_match_child {
+	const struct ldb_parse_tree *tree;
+	unsigned int cost;
+	unsigned int idx;
+};
+
+static unsigned int ldb_match_tree_size(const struct ldb_parse_tree *tree)
+{
+	unsigned int i, n = 1;
+
+	switch (tree->operation) {
+	case LDB_OP_AND:
+	case LDB_OP_OR:
+		for (i = 0; i < tree->u.list.num_elements; i++) {
+			n += ldb_match_tree_size(tree->u.list.elements[i]);
+		}
+		break;
+	case LDB_OP_NOT:
+		n += ldb_match_tree_size(tree->u.isnot.child);
+		break;
+	default:
+		break;
+	}
+
+	return n;
+}
+
+/*
+  a rough guess of how expensive evaluating a subtree is, used to try
+  the cheap branches of an AND or OR first
+*/
+static unsigned int ldb_match_tree_cost(const struct ldb_parse_tree *tree)
+{
+	unsigned int i, cost = 0;
+
+	switch (tree->operation) {
+	case LDB_OP_AND:
+	case LDB_OP_OR:
+		for (i = 0; i < tree->u.list.num_elements; i++) {
+			cost += ldb_match_tree_cost(tree->u.list.elements[i]);
+		}
+		return cost;
+	case LDB_OP_NOT:
+		return ldb_match_tree_cost(tree->u.isnot.child);
+	case LDB_OP_PRESENT:
+		return 1;
+	case LDB_OP_EQUALITY:
+	case LDB_OP_GREATER:
+	case LDB_OP_LESS:
+	case LDB_OP_APPROX:
+		return 2;
+	case LDB_OP_SUBSTRING:
+		return 4;
+	case LDB_OP_EXTENDED:
+		/* may well be a recursive search, see LDAP_MATCHING_RULE_IN_CHAIN */
+		return 64;
+	}
+
+	return 64;
+}
+
+static int ldb_match_child_cmp(const struct ldb_match_child *c1,
+			       const struct ldb_match_child *c2)
+{
+	if (c1->cost != c2->cost) {
+		return c1->cost < c2->cost ? -1 : 1;
+	}
+	/* keep the order of the filter for equally expensive terms */
+	if (c1->idx != c2->idx) {
+		return c1->idx < c2->idx ? -1 : 1;
+	}
+	return 0;
+}
+
+static int ldb_match_compile_op(struct ldb_match_program *program,
+				const struct ldb_parse_tree *tree);
+
+static int ldb_match_compile_list(struct ldb_match_program *program,
+				  const struct ldb_parse_tree *tree)
+{
+	struct ldb_match_child *children = NULL;
+	unsigned int i, n = tree->u.list.num_elements;
+	int ret = LDB_SUCCESS;
+
+	if (n == 0) {
+		return LDB_SUCCESS;
+	}
+
+	children = talloc_array(program, struct ldb_match_child, n);
+	if (children == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	for (i = 0; i < n; i++) {
+		children[i] = (struct ldb_match_child) {
+			.tree = tree->u.list.elements[i],
+			.cost = ldb_match_tree_cost(tree->u.list.elements[i]),
+			.idx = i,
+		};
+	}
+	TYPESAFE_QSORT(children, n, ldb_match_child_cmp);
+
+	for (i = 0; i < n; i++) {
+		ret = ldb_match_compile_op(program, children[i].tree);
+		if (ret != LDB_SUCCESS) {
+			break;
+		}
+	}
+
+	talloc_free(children);
+	return ret;
+}
+
+static int ldb_match_compile_substring(struct ldb_match_program *program,
+				       struct ldb_match_op *op)
+{
+	struct ldb_context *ldb = program->ldb;
+	const struct ldb_parse_tree *tree = op->tree;
+	unsigned int c;
+
+	if (op->a == NULL || tree->u.substring.chunks == NULL) {
+		return LDB_SUCCESS;
+	}
+
+	while (tree->u.substring.chunks[op->num_chunks] != NULL) {
+		op->num_chunks++;
+	}
+
+	op->chunks = talloc_array(program, struct ldb_val, op->num_chunks);
+	if (op->chunks == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	for (c = 0; c < op->num_chunks; c++) {
+		int ret = op->a->syntax->canonicalise_fn(ldb, op->chunks,
+							 tree->u.substring.chunks[c],
+							 &op->chunks[c]);
+		if (ret != 0) {
+			/*
+			 * ldb_wildcard_compare() treats this as a
+			 * mismatch for every value
+			 */
+			op->chunks_invalid = true;
+			break;
+		}
+	}
+
+	return LDB_SUCCESS;
+}
+
+static int ldb_match_compile_extended(struct ldb_match_program *program,
+				      struct ldb_match_op *op)
+{
+	struct ldb_context *ldb = program->ldb;
+	const struct ldb_parse_tree *tree = op->tree;
+
+	if (tree->u.extended.dnAttributes) {
+		/* see ldb_match_extended() */
+		ldb_debug(ldb, LDB_DEBUG_WARNING, "ldb: dnAttributes extended match not supported yet");
+	}
+	if (tree->u.extended.rule_id == NULL) {
+		ldb_debug(ldb, LDB_DEBUG_ERROR, "ldb: no-rule extended matches not supported yet");
+		op->error = LDB_ERR_INAPPROPRIATE_MATCHING;
+		return LDB_SUCCESS;
+	}
+	if (tree->u.extended.attr == NULL) {
+		ldb_debug(ldb, LDB_DEBUG_ERROR, "ldb: no-attribute extended matches not supported yet");
+		op->error = LDB_ERR_INAPPROPRIATE_MATCHING;
+		return LDB_SUCCESS;
+	}
+
+	op->rule = ldb_find_extended_match_rule(ldb, tree->u.extended.rule_id);
+	if (op->rule == NULL) {
+		ldb_debug(ldb, LDB_DEBUG_ERROR, "ldb: unknown extended rule_id %s",
+			  tree->u.extended.rule_id);
+	}
+
+	return LDB_SUCCESS;
+}
+
+static int ldb_match_compile_op(struct ldb_match_program *program,
+				const struct ldb_parse_tree *tree)
+{
+	struct ldb_context *ldb = program->ldb;
+	unsigned int idx = program->num_ops++;
+	struct ldb_match_op *op = &program->ops[idx];
+	int ret = LDB_SUCCESS;
+
+	*op = (struct ldb_match_op) {
+		.tree = tree,
+	};
+
+	switch (tree->operation) {
+	case LDB_OP_AND:
+	case LDB_OP_OR:
+		ret = ldb_match_compile_list(program, tree);
+		break;
+
+	case LDB_OP_NOT:
+		ret = ldb_match_compile_op(program, tree->u.isnot.child);
+		break;
+
+	case LDB_OP_PRESENT:
+		op->is_dn = (ldb_attr_dn(tree->u.present.attr) == 0);
+		op->a = ldb_schema_attribute_by_name(ldb, tree->u.present.attr);
+		break;
+
+	case LDB_OP_EQUALITY:
+		op->is_dn = (ldb_attr_dn(tree->u.equality.attr) == 0);
+		if (op->is_dn) {
+			/* NULL is reported when the op is run */
+			op->dn = ldb_dn_from_ldb_val(program, ldb,
+						     &tree->u.equality.value);
+			if (op->dn != NULL) {
+				ldb_dn_get_casefold(op->dn);
+			}
+			break;
+		}
+		op->a = ldb_schema_attribute_by_name(ldb, tree->u.equality.attr);
+		op->dn_syntax = (op->a != NULL &&
+				 op->a->syntax->operator_fn == NULL &&
+				 op->a->syntax ==
+				 ldb_standard_syntax_by_name(ldb,
+							     LDB_SYNTAX_DN));
+		if (op->dn_syntax) {
+			/*
+			 * Avoid parsing the assertion again for every
+			 * value, as ldb_comparison_dn() would. An invalid
+			 * DN never matches, which is kept as op->dn ==
+			 * NULL.
+			 */
+			op->dn = ldb_dn_from_ldb_val(program, ldb,
+						     &tree->u.equality.value);
+			if (!ldb_dn_validate(op->dn)) {
+				TALLOC_FREE(op->dn);
+			} else {
+				ldb_dn_get_casefold(op->dn);
+			}
+		}
+		break;
+
+	case LDB_OP_GREATER:
+	case LDB_OP_LESS:
+	case LDB_OP_APPROX:
+		op->a = ldb_schema_attribute_by_name(ldb, tree->u.comparison.attr);
+		break;
+
+	case LDB_OP_SUBSTRING:
+		op->a = ldb_schema_attribute_by_name(ldb, tree->u.substring.attr);
+		ret = ldb_match_compile_substring(program, op);
+		break;
+
+	case LDB_OP_EXTENDED:
+		ret = ldb_match_compile_extended(program, op);
+		break;
+
+	default:
+		op->error = LDB_ERR_INAPPROPRIATE_MATCHING;
+		break;
+	}
+
+	/* the op array was sized by ldb_match_tree_size() */
+	program->ops[idx].next = program->num_ops;
+	return ret;
+}
+
+/*
+  compile a parse tree for ldb_match_program_run()
+
+  The tree and the base DN are referenced, not copied, they have to
+  stay around as long as the program is used. The same applies to the
+  schema and the extended match rules of the ldb context.
+*/
+int ldb_match_program_compile(struct ldb_context *ldb,
+			      TALLOC_CTX *mem_ctx,
+			      const struct ldb_parse_tree *tree,
+			      struct ldb_dn *base,
+			      enum ldb_scope scope,
+			      struct ldb_match_program **_program)
+{
+	struct ldb_match_program *program = NULL;
+	unsigned int num_ops;
+	int ret;
+
+	program = talloc_zero(mem_ctx, struct ldb_match_program);
+	if (program == NULL) {
+		return ldb_oom(ldb);
+	}
+	program->ldb = ldb;
+	program->base = base;
+	program->scope = scope;
+
+	num_ops = ldb_match_tree_size(tree);
+	program->ops = talloc_array(program, struct ldb_match_op, num_ops);
+	if (program->ops == NULL) {
+		talloc_free(program);
+		return ldb_oom(ldb);
+	}
+
+	ret = ldb_match_compile_op(program, tree);
+	if (ret != LDB_SUCCESS) {
+		talloc_free(program);
+		return ldb_oom(ldb);
+	}
+
+	*_program = program;
+	return LDB_SUCCESS;
+}
+
+static int ldb_match_op_equality(struct ldb_context *ldb,
+				 const struct ldb_match_op *op,
+				 const struct ldb_message *msg,
+				 bool *matched)
+{
+	struct ldb_message_element *el;
+	unsigned int i;
+
+	if (op->is_dn) {
+		if (op->dn == NULL) {
+			return LDB_ERR_INVALID_DN_SYNTAX;
+		}
+		*matched = (ldb_dn_compare(msg->dn, op->dn) == 0);
+		return LDB_SUCCESS;
+	}
+
+	el = ldb_msg_find_element(msg, op->tree->u.equality.attr);
+	if (el == NULL) {
+		*matched = false;
+		return LDB_SUCCESS;
+	}
+
+	if (op->a == NULL) {
+		return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
+	}
+
+	if (!op->dn_syntax) {
+		return ldb_match_equality_values(ldb, op->a, el,
+						 &op->tree->u.equality.value,
+						 matched);
+	}
+
+	*matched = false;
+	if (op->dn == NULL) {
+		return LDB_SUCCESS;
+	}
+
+	for (i = 0; i < el->num_values; i++) {
+		struct ldb_dn *dn = ldb_dn_from_ldb_val(ldb, ldb,
+							&el->values[i]);
+		if (ldb_dn_validate(dn)) {
+			*matched = (ldb_dn_compare(op->dn, dn) == 0);
+		}
+		talloc_free(dn);
+		if (*matched) {
+			break;
+		}
+	}
+
+	return LDB_SUCCESS;
+}
+
+static int ldb_match_op_substring(struct ldb_context *ldb,
+				  const struct ldb_match_op *op,
+				  const struct ldb_message *msg,
+				  bool *matched)
+{
+	const struct ldb_parse_tree *tree = op->tree;
+	struct ldb_message_element *el;
+	unsigned int i;
+
+	*matched = false;
+
+	el = ldb_msg_find_element(msg, tree->u.substring.attr);
+	if (el == NULL) {
+		return LDB_SUCCESS;
+	}
+
+	for (i = 0; i < el->num_values; i++) {
+		struct ldb_val val;
+		int ret;
+
+		if (op->a == NULL) {
+			return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
+		}
+		if (tree->u.substring.chunks == NULL) {
+			continue;
+		}
+
+		ret = op->a->syntax->canonicalise_fn(ldb, ldb, &el->values[i], &val);
+		if (ret != 0) {
+			return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
+		}
+		if (!op->chunks_invalid) {
+			*matched = ldb_wildcard_match(val,
+						      op->chunks,
+						      op->num_chunks,
+						      tree->u.substring.start_with_wildcard,
+						      tree->u.substring.end_with_wildcard);
+		}
+		talloc_free(val.data);
+		if (*matched) {
+			break;
+		}
+	}
+
+	return LDB_SUCCESS;
+}
+
+static int ldb_match_op_run(const struct ldb_match_program *program,
+			    unsigned int idx,
+			    const struct ldb_message *msg,
+			    bool *matched)
+{
+	struct ldb_context *ldb = program->ldb;
+	const struct ldb_match_op *op = &program->ops[idx];
+	const struct ldb_parse_tree *tree = op->tree;
+	struct ldb_message_element *el;
+	unsigned int i;
+	int ret;
+
+	*matched = false;
+
+	if (op->error != LDB_SUCCESS) {
+		return op->error;
+	}
+
+	switch (tree->operation) {
+	case LDB_OP_AND:
+		for (i = idx + 1; i < op->next; i = program->ops[i].next) {
+			ret = ldb_match_op_run(program, i, msg, matched);
+			if (ret != LDB_SUCCESS) return ret;
+			if (!*matched) return LDB_SUCCESS;
+		}
+		*matched = true;
+		return LDB_SUCCESS;
+
+	case LDB_OP_OR:
+		for (i = idx + 1; i < op->next; i = program->ops[i].next) {
+			ret = ldb_match_op_run(program, i, msg, matched);
+			if (ret != LDB_SUCCESS) return ret;
+			if (*matched) return LDB_SUCCESS;
+		}
+		*matched = false;
+		return LDB_SUCCESS;
+
+	case LDB_OP_NOT:
+		ret = ldb_match_op_run(program, idx + 1, msg, matched);
+		if (ret != LDB_SUCCESS) return ret;
+		*matched = ! *matched;
+		return LDB_SUCCESS;
+
+	case LDB_OP_EQUALITY:
+		return ldb_match_op_equality(ldb, op, msg, matched);
+
+	case LDB_OP_SUBSTRING:
+		return ldb_match_op_substring(ldb, op, msg, matched);
+
+	case LDB_OP_PRESENT:
+		if (op->is_dn) {
+			*matched = true;
+			return LDB_SUCCESS;
+		}
+		el = ldb_msg_find_element(msg, tree->u.present.attr);
+		if (el == NULL) {
+			return LDB_SUCCESS;
+		}
+		if (op->a == NULL) {
+			return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
+		}
+		return ldb_match_present_values(ldb, op->a, el, matched);
+
+	case LDB_OP_GREATER:
+	case LDB_OP_LESS:
+		el = ldb_msg_find_element(msg, tree->u.comparison.attr);
+		if (el == NULL) {
+			return LDB_SUCCESS;
+		}
+		if (op->a == NULL) {
+			return LDB_ERR_INVALID_ATTRIBUTE_SYNTAX;
+		}
+		return ldb_match_comparison_values(ldb, op->a, el,
+						   &tree->u.comparison.value,
+						   tree->operation, matched);
+
+	case LDB_OP_APPROX:
+		/* FIXME: APPROX comparison not handled yet */
+		return LDB_ERR_INAPPROPRIATE_MATCHING;
+
+	case LDB_OP_EXTENDED:
+		if (op->rule == NULL) {
+			return LDB_SUCCESS;
+		}
+		return op->rule->callback(ldb, op->rule->oid, msg,
+					  tree->u.extended.attr,
+					  &tree->u.extended.value, matched);
+	}
+
+	return LDB_ERR_INAPPROPRIATE_MATCHING;
+}
+
+/*
+  Check if a message matches a compiled parse tree, in the same way as
+  ldb_match_msg_error() does for the tree.
+
+  Only the order in which the branches of an AND or OR are tried may
+  differ, which can change which error is returned for an invalid
+  filter, but not the result for a valid one.
+ */
+int ldb_match_program_run(const struct ldb_match_program *program,
+			  const struct ldb_message *msg,
+			  bool *matched)
+{
+	*matched = false;
+
+	if ( ! ldb_match_scope(program->ldb, program->base, msg->dn,
+			       program->scope) ) {
+		return LDB_SUCCESS;
+	}
+
+	if (program->scope != LDB_SCOPE_BASE && ldb_dn_is_special(msg->dn)) {
+		/* don't match special records except on base searches */
+		return LDB_SUCCESS;
+	}
+
+	return ldb_match_op_run(program, 0, msg, matched);
+}
+
 int ldb_match_msg_objectclass(const struct ldb_message *msg,
 			      const char *objectclass)
 {
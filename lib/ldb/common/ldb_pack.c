@@ -530,12 +530,38 @@ int ldb_pack_data(struct ldb_context *ldb,
 	}
 }
 
+/*
+ * Is the attribute of the packed element in the list of attributes to
+ * unpack? Comparing the length first avoids most of the
+ * ldb_attr_cmp() calls for the elements that are skipped.
+ */
+static bool ldb_unpack_attr_wanted(const char * const *attrs,
+				   const char *attr,
+				   size_t attr_len)
+{
+	unsigned int i;
+
+	if (attrs == NULL) {
+		return true;
+	}
+
+	for (i = 0; attrs[i] != NULL; i++) {
+		if (strlen(attrs[i]) == attr_len &&
+		    ldb_attr_cmp(attrs[i], attr) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 /*
  * Unpack a ldb message from a linear buffer in ldb_val
  */
 static int ldb_unpack_data_flags_v1(struct ldb_context *ldb,
 				    const struct ldb_val *data,
 				    struct ldb_message *message,
+				    const char * const *attrs,
 				    unsigned int flags,
 				    unsigned format)
 {
@@ -651,6 +677,7 @@ static int ldb_unpack_data_flags_v1(struct ldb_context *ldb,
 		const char *attr = NULL;
 		size_t attr_len;
 		struct ldb_message_element *element = NULL;
+		bool keep;
 
 		/*
 		 * Sanity check: Element must be at least the size of empty
@@ -675,6 +702,7 @@ static int ldb_unpack_data_flags_v1(struct ldb_context *ldb,
 			goto failed;
 		}
 		attr = (char *)p;
+		keep = ldb_unpack_attr_wanted(attrs, attr, attr_len);
 
 		element = &message->elements[nelem];
 		element->name = attr;
@@ -688,7 +716,9 @@ static int ldb_unpack_data_flags_v1(struct ldb_context *ldb,
 		p += attr_len + NULL_PAD_BYTE_LEN;
 		element->num_values = PULL_LE_U32(p, 0);
 		element->values = NULL;
-		if ((flags & LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC) && element->num_values == 1) {
+		if (!keep) {
+			/* only walk over the values */
+		} else if ((flags & LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC) && element->num_values == 1) {
 			element->values = &ldb_val_single_array[nelem];
 		} else if (element->num_values != 0) {
 			element->values = talloc_array(message->elements,
@@ -726,12 +756,16 @@ static int ldb_unpack_data_flags_v1(struct ldb_context *ldb,
 				goto failed;
 			}
 
-			element->values[j].length = len;
-			element->values[j].data = p + U32_LEN;
+			if (keep) {
+				element->values[j].length = len;
+				element->values[j].data = p + U32_LEN;
+			}
 			remaining -= len;
 			p += len + U32_LEN + NULL_PAD_BYTE_LEN;
 		}
-		nelem++;
+		if (keep) {
+			nelem++;
+		}
 	}
 	/*
 	 * Adapt the number of elements to the real number of unpacked elements,
@@ -766,6 +800,7 @@ failed:
 static int ldb_unpack_data_flags_v2(struct ldb_context *ldb,
 				    const struct ldb_val *data,
 				    struct ldb_message *message,
+				    const char * const *attrs,
 				    unsigned int flags)
 {
 	uint8_t *p, *q, *end_p, *value_section_p;
@@ -929,19 +964,6 @@ static int ldb_unpack_data_flags_v2(struct ldb_context *ldb,
 
 		element->num_values = PULL_LE_U32(p, 0);
 		element->values = NULL;
-		if ((flags & LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC) &&
-		    element->num_values == 1) {
-			element->values = &ldb_val_single_array[nelem];
-		} else if (element->num_values != 0) {
-			element->values = talloc_array(message->elements,
-						       struct ldb_val,
-						       element->num_values);
-			if (!element->values) {
-				errno = ENOMEM;
-				goto failed;
-			}
-		}
-
 		p += U32_LEN;
 
 		/*
@@ -952,12 +974,63 @@ static int ldb_unpack_data_flags_v2(struct ldb_context *ldb,
 		val_len_width = *p;
 		p += U8_LEN;
 
-		if (p + val_len_width * element->num_values >
-		    value_section_p) {
+		if (val_len_width != U8_LEN &&
+		    val_len_width != U16_LEN &&
+		    val_len_width != U32_LEN) {
+			errno = ERANGE;
+			goto failed;
+		}
+
+		/*
+		 * The lengths must fit before the value section, written
+		 * as a division so a huge num_values can't wrap around.
+		 */
+		if (element->num_values >
+		    (size_t)(value_section_p - p) / val_len_width) {
 			errno = EIO;
 			goto failed;
 		}
 
+		if (!ldb_unpack_attr_wanted(attrs, attr, attr_len)) {
+			/*
+			 * Not asked for, only move q behind the values
+			 */
+			for (j = 0; j < element->num_values; j++) {
+				if (val_len_width == U8_LEN) {
+					len = PULL_LE_U8(p, 0);
+				} else if (val_len_width == U16_LEN) {
+					len = PULL_LE_U16(p, 0);
+				} else {
+					len = PULL_LE_U32(p, 0);
+				}
+				p += val_len_width;
+
+				if (len + NULL_PAD_BYTE_LEN < len) {
+					errno = EIO;
+					goto failed;
+				}
+				if (q + len + NULL_PAD_BYTE_LEN > end_p) {
+					errno = EIO;
+					goto failed;
+				}
+				q += len + NULL_PAD_BYTE_LEN;
+			}
+			continue;
+		}
+
+		if ((flags & LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC) &&
+		    element->num_values == 1) {
+			element->values = &ldb_val_single_array[nelem];
+		} else if (element->num_values != 0) {
+			element->values = talloc_array(message->elements,
+						       struct ldb_val,
+						       element->num_values);
+			if (!element->values) {
+				errno = ENOMEM;
+				goto failed;
+			}
+		}
+
 		/*
 		 * This is structured weird for compiler optimization
 		 * purposes, but we need to pull the array of widths
@@ -974,14 +1047,11 @@ static int ldb_unpack_data_flags_v2(struct ldb_context *ldb,
 				element->values[j].length = PULL_LE_U16(p, 0);
 				p += U16_LEN;
 			}
-		} else if (val_len_width == U32_LEN) {
+		} else {
 			for (j = 0; j < element->num_values; j++) {
 				element->values[j].length = PULL_LE_U32(p, 0);
 				p += U32_LEN;
 			}
-		} else {
-			errno = ERANGE;
-			goto failed;
 		}
 
 		for (j = 0; j < element->num_values; j++) {
@@ -1052,11 +1122,13 @@ int ldb_unpack_get_format(const struct ldb_val *data,
 }
 
 /*
- * Unpack a ldb message from a linear buffer in ldb_val
+ * Unpack a ldb message from a linear buffer in ldb_val, only keeping
+ * the elements named in attrs (all of them if attrs is NULL)
  */
-int ldb_unpack_data_flags(struct ldb_context *ldb,
+int ldb_unpack_data_attrs(struct ldb_context *ldb,
 			  const struct ldb_val *data,
 			  struct ldb_message *message,
+			  const char * const *attrs,
 			  unsigned int flags)
 {
 	unsigned format;
@@ -1068,7 +1140,8 @@ int ldb_unpack_data_flags(struct ldb_context *ldb,
 
 	format = PULL_LE_U32(data->data, 0);
 	if (format == LDB_PACKING_FORMAT_V2) {
-		return ldb_unpack_data_flags_v2(ldb, data, message, flags);
+		return ldb_unpack_data_flags_v2(ldb, data, message, attrs,
+						flags);
 	}
 
 	/*
@@ -1077,7 +1150,19 @@ int ldb_unpack_data_flags(struct ldb_context *ldb,
 	 * if given some other version, so we don't need to do any further
 	 * checks on 'format'.
 	 */
-	return ldb_unpack_data_flags_v1(ldb, data, message, flags, format);
+	return ldb_unpack_data_flags_v1(ldb, data, message, attrs, flags,
+					format);
+}
+
+/*
+ * Unpack a ldb message from a linear buffer in ldb_val
+ */
+int ldb_unpack_data_flags(struct ldb_context *ldb,
+			  const struct ldb_val *data,
+			  struct ldb_message *message,
+			  unsigned int flags)
+{
+	return ldb_unpack_data_attrs(ldb, data, message, NULL, flags);
 }
 
 
@@ -577,6 +577,16 @@ typedef int (*ldb_qsort_cmp_fn_t) (void *v1, void *v2, void *opaque);
 #define LDB_CONTROL_PROVISION_OID "1.3.6.1.4.1.7165.4.3.16"
 #define LDB_CONTROL_PROVISION_NAME	"provision"
 
+/**
+   LDB_CONTROL_SEARCH_EXPLAIN_OID asks the backend to describe how it
+   evaluated a search: which index lists it loaded, in which order and
+   with how many entries, or that it had to fall back to a full scan.
+   The description is returned in a control with the same OID attached
+   to the final (done) reply, see struct ldb_search_explain_control.
+*/
+#define LDB_CONTROL_SEARCH_EXPLAIN_OID "1.3.6.1.4.1.7165.4.3.35"
+#define LDB_CONTROL_SEARCH_EXPLAIN_NAME	"explain"
+
 /* AD controls */
 
 /**
@@ -915,6 +925,11 @@ struct ldb_verify_name_control {
 	char *gc;
 };
 
+struct ldb_search_explain_control {
+	/* one step per line */
+	const char *plan;
+};
+
 struct ldb_control {
 	const char *oid;
 	int critical;
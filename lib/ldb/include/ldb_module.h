@@ -246,6 +246,25 @@ int ldb_match_msg_error(struct ldb_context *ldb,
 			enum ldb_scope scope,
 			bool *matched);
 
+/*
+ * A parse tree compiled for matching many messages: the attribute
+ * handlers and extended match rules are looked up once, assertion
+ * values are canonicalised or parsed up front where that is possible
+ * and cheap terms of AND and OR are tried first.
+ */
+struct ldb_match_program;
+
+int ldb_match_program_compile(struct ldb_context *ldb,
+			      TALLOC_CTX *mem_ctx,
+			      const struct ldb_parse_tree *tree,
+			      struct ldb_dn *base,
+			      enum ldb_scope scope,
+			      struct ldb_match_program **_program);
+
+int ldb_match_program_run(const struct ldb_match_program *program,
+			  const struct ldb_message *msg,
+			  bool *matched);
+
 int ldb_match_msg_objectclass(const struct ldb_message *msg,
 			      const char *objectclass);
 
@@ -550,6 +569,18 @@ int ldb_unpack_data_flags(struct ldb_context *ldb,
 			  struct ldb_message *message,
 			  unsigned int flags);
 
+/*
+ * Like ldb_unpack_data_flags(), but only unpack the attributes in the
+ * NULL terminated list attrs, the other elements are skipped without
+ * allocating anything for them. attrs == NULL unpacks all attributes,
+ * "*" and other special names have no meaning here.
+ */
+int ldb_unpack_data_attrs(struct ldb_context *ldb,
+			  const struct ldb_val *data,
+			  struct ldb_message *message,
+			  const char * const *attrs,
+			  unsigned int flags);
+
 int ldb_unpack_get_format(const struct ldb_val *data,
 			  uint32_t *pack_format_version);
 
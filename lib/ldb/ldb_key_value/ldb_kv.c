@@ -1882,6 +1882,30 @@ static void ldb_kv_request_done(struct ldb_kv_context *ctx, int error)
 	ares->type = LDB_REPLY_DONE;
 	ares->error = error;
 
+	if (ctx->explain != NULL) {
+		struct ldb_search_explain_control *explain = NULL;
+		int ret;
+
+		explain = talloc_zero(ares, struct ldb_search_explain_control);
+		if (explain == NULL) {
+			ldb_oom(ldb);
+			TALLOC_FREE(ares);
+			req->callback(req, NULL);
+			return;
+		}
+		explain->plan = talloc_move(explain, &ctx->explain);
+
+		ret = ldb_reply_add_control(ares,
+					    LDB_CONTROL_SEARCH_EXPLAIN_OID,
+					    false,
+					    explain);
+		if (ret != LDB_SUCCESS) {
+			TALLOC_FREE(ares);
+			req->callback(req, NULL);
+			return;
+		}
+	}
+
 	req->callback(req, ares);
 }
 
@@ -2022,6 +2046,7 @@ static int ldb_kv_handle_request(struct ldb_module *module,
 				 struct ldb_request *req)
 {
 	struct ldb_control *control_permissive;
+	struct ldb_control *control_explain = NULL;
 	struct ldb_context *ldb;
 	struct tevent_context *ev;
 	struct ldb_kv_context *ac;
@@ -2033,10 +2058,15 @@ static int ldb_kv_handle_request(struct ldb_module *module,
 
 	control_permissive = ldb_request_get_control(req,
 					LDB_CONTROL_PERMISSIVE_MODIFY_OID);
+	if (req->operation == LDB_SEARCH) {
+		control_explain = ldb_request_get_control(req,
+					LDB_CONTROL_SEARCH_EXPLAIN_OID);
+	}
 
 	for (i = 0; req->controls && req->controls[i]; i++) {
 		if (req->controls[i]->critical &&
-		    req->controls[i] != control_permissive) {
+		    req->controls[i] != control_permissive &&
+		    req->controls[i] != control_explain) {
 			ldb_asprintf_errstring(ldb, "Unsupported critical extension %s",
 					       req->controls[i]->oid);
 			return LDB_ERR_UNSUPPORTED_CRITICAL_EXTENSION;
@@ -2272,6 +2302,47 @@ int ldb_kv_init_store(struct ldb_kv_private *ldb_kv,
 			}
 		}
 	}
+	/*
+	 * Unpack records in helper threads during full scans and
+	 * re-indexing.
+	 *
+	 * The threads are created at the start of each full scan and
+	 * joined at its end, so this only pays off for databases large
+	 * enough that unpacking dominates that cost. More threads than
+	 * online CPUs gain nothing, so the value is clamped to that.
+	 */
+	{
+		const char *threads = ldb_options_find(
+			ldb, options, "scan_threads");
+		if (threads != NULL) {
+			unsigned long scan_threads = 0;
+			char *end = NULL;
+#ifdef _SC_NPROCESSORS_ONLN
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+			long cpus = 1;
+#endif
+
+			errno = 0;
+			scan_threads = strtoul(threads, &end, 0);
+			if (errno != 0 || end == threads || *end != '\0') {
+				ldb_debug(
+					ldb,
+					LDB_DEBUG_WARNING,
+					"Invalid scan_threads value [%s], "
+					"scanning without helper threads\n",
+					threads);
+				scan_threads = 0;
+			}
+			if (cpus < 1) {
+				cpus = 1;
+			}
+			if (scan_threads > (unsigned long)cpus) {
+				scan_threads = cpus;
+			}
+			ldb_kv->scan_threads = scan_threads;
+		}
+	}
 	/*
 	 * Set batch mode operation.
 	 * This disables the nested sub transactions, and increases the
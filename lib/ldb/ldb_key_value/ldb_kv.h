@@ -146,6 +146,19 @@ struct ldb_kv_private {
 	 * The size to be used for the index transaction cache
 	 */
 	size_t index_transaction_cache_size;
+
+	/*
+	 * Number of helper threads unpacking records during full
+	 * scans and re-indexing, 0 to do it inline.
+	 */
+	unsigned int scan_threads;
+
+	/*
+	 * While a search with LDB_CONTROL_SEARCH_EXPLAIN_OID is
+	 * running, the steps taken are collected here by
+	 * ldb_kv_explain(), otherwise NULL.
+	 */
+	char *explain;
 };
 
 struct ldb_kv_context {
@@ -172,8 +185,20 @@ struct ldb_kv_context {
 	const char * const *attrs;
 	struct tevent_timer *timeout_event;
 
+	/* the compiled tree for the full scan in ldb_kv_search_full() */
+	struct ldb_match_program *match_program;
+
+	/*
+	 * The attributes to unpack from the records: the ones asked
+	 * for and the ones the filter looks at. NULL for all of them.
+	 */
+	const char **unpack_attrs;
+
 	/* error handling */
 	int error;
+
+	/* the plan for LDB_CONTROL_SEARCH_EXPLAIN_OID, or NULL */
+	char *explain;
 };
 
 struct ldb_kv_reindex_context {
@@ -300,12 +325,30 @@ int ldb_kv_search_key(struct ldb_module *module,
 		      struct ldb_kv_private *ldb_kv,
 		      const struct ldb_val ldb_key,
 		      struct ldb_message *msg,
+		      const char * const *unpack_attrs,
 		      unsigned int unpack_flags);
-int ldb_kv_filter_attrs(struct ldb_context *ldb,
-			const struct ldb_message *msg,
+int ldb_kv_filter_attrs(TALLOC_CTX *mem_ctx,
+			struct ldb_message *msg,
 			const char *const *attrs,
-			struct ldb_message *filtered_msg);
+			struct ldb_message **_filtered_msg);
 int ldb_kv_search(struct ldb_kv_context *ctx);
+void ldb_kv_explain(struct ldb_kv_private *ldb_kv,
+		    const char *fmt, ...) PRINTF_ATTRIBUTE(2, 3);
+
+/*
+ * The following definitions come from lib/ldb/ldb_key_value/ldb_kv_scan.c
+ */
+typedef int (*ldb_kv_scan_fn)(struct ldb_kv_private *ldb_kv,
+			      struct ldb_val key,
+			      struct ldb_message *msg,
+			      void *private_data);
+int ldb_kv_scan(struct ldb_kv_private *ldb_kv,
+		const struct ldb_val *start_key,
+		const struct ldb_val *end_key,
+		const char * const *unpack_attrs,
+		unsigned int unpack_flags,
+		ldb_kv_scan_fn fn,
+		void *private_data);
 
 /*
  * The following definitions come from lib/ldb/ldb_key_value/ldb_kv.c  */
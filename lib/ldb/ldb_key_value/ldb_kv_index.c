@@ -261,6 +261,62 @@ static int ldb_val_equal_exact_ordered(const struct ldb_val v1,
 	return memcmp(v1.data, v2->data, v1.length);
 }
 
+/*
+  compare two entries of a sorted dn_list, in the same order as
+  ldb_val_equal_exact_ordered()
+
+  In a GUID index every entry is a LDB_KV_GUID_SIZE byte GUID, the
+  fixed size memcmp() is inlined by the compiler into a few word
+  compares, which matters when intersecting long lists.
+ */
+static inline int ldb_kv_dn_list_cmp(const struct ldb_val *v1,
+				     const struct ldb_val *v2)
+{
+	if (likely(v1->length == LDB_KV_GUID_SIZE &&
+		   v2->length == LDB_KV_GUID_SIZE)) {
+		return memcmp(v1->data, v2->data, LDB_KV_GUID_SIZE);
+	}
+	return ldb_val_equal_exact_ordered(*v1, v2);
+}
+
+/*
+  find the first entry at or after start in a sorted dn_list that
+  is not less than v, returns count if there is none
+
+  The search gallops forward from start before doing a binary
+  search, so walking a long list with the entries of a much shorter
+  one costs O(short * log(long/short)) rather than O(short * log(long))
+  and degrades to a plain merge when both are of similar size.
+ */
+static unsigned int ldb_kv_dn_list_seek(const struct dn_list *list,
+					unsigned int start,
+					const struct ldb_val *v)
+{
+	size_t lo = start;
+	size_t hi = start;
+	size_t step = 1;
+
+	while (hi < list->count && ldb_kv_dn_list_cmp(&list->dn[hi], v) < 0) {
+		lo = hi + 1;
+		hi += step;
+		step *= 2;
+	}
+	if (hi > list->count) {
+		hi = list->count;
+	}
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (ldb_kv_dn_list_cmp(&list->dn[mid], v) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
 
 /*
   find a entry in a dn_list, using a ldb_val. Uses a case sensitive
@@ -647,8 +703,8 @@ int ldb_kv_key_dn_from_idx(struct ldb_module *module,
 				return ret;
 			}
 
-			ret =
-			    ldb_kv_search_key(module, ldb_kv, key, rec, flags);
+			ret = ldb_kv_search_key(
+			    module, ldb_kv, key, rec, NULL, flags);
 			if (key.data != guid_key) {
 				TALLOC_FREE(key.data);
 			}
@@ -1396,11 +1452,11 @@ static int ldb_kv_index_dn_leaf(struct ldb_module *module,
 */
 static bool list_intersect(struct ldb_kv_private *ldb_kv,
 			   struct dn_list *list,
-			   const struct dn_list *list2)
+			   struct dn_list *list2)
 {
 	const struct dn_list *short_list, *long_list;
 	struct dn_list *list3;
-	unsigned int i;
+	unsigned int i, j;
 
 	if (list->count == 0) {
 		/* 0 & X == 0 */
@@ -1460,11 +1516,29 @@ static bool list_intersect(struct ldb_kv_private *ldb_kv,
 	}
 	list3->count = 0;
 
-	for (i=0;i<short_list->count;i++) {
-		/* For the GUID index case, this is a binary search */
-		if (ldb_kv_dn_list_find_val(
-			ldb_kv, long_list, &short_list->dn[i]) != -1) {
-			list3->dn[list3->count] = short_list->dn[i];
+	/*
+	 * Sort the lists (if not in GUID DN mode) so we can walk
+	 * both of them in order
+	 *
+	 * NOTE: This can sort the in-memory index values, as list or
+	 * list2 might not be a copy!
+	 */
+	ldb_kv_dn_list_sort(ldb_kv, list);
+	ldb_kv_dn_list_sort(ldb_kv, list2);
+
+	for (i = 0, j = 0; i < short_list->count; i++) {
+		const struct ldb_val *v = &short_list->dn[i];
+
+		/*
+		 * j only moves forward, a duplicate in short_list
+		 * finds the same entry of long_list again
+		 */
+		j = ldb_kv_dn_list_seek(long_list, j, v);
+		if (j == long_list->count) {
+			break;
+		}
+		if (ldb_kv_dn_list_cmp(&long_list->dn[j], v) == 0) {
+			list3->dn[list3->count] = *v;
 			list3->count++;
 		}
 	}
@@ -1530,8 +1604,7 @@ static bool list_union(struct ldb_context *ldb,
 		} else if (j >= list2->count) {
 			cmp = -1;
 		} else {
-			cmp = ldb_val_equal_exact_ordered(list->dn[i],
-							  &list2->dn[j]);
+			cmp = ldb_kv_dn_list_cmp(&list->dn[i], &list2->dn[j]);
 		}
 
 		if (cmp < 0) {
@@ -1663,6 +1736,235 @@ static bool ldb_kv_index_unique(struct ldb_context *ldb,
 	return false;
 }
 
+/*
+ * The estimated size of an index list that can't be looked at
+ * cheaply. Such terms of an AND are evaluated last, in filter order.
+ */
+#define LDB_KV_ESTIMATE_UNKNOWN UINT64_MAX
+
+/*
+ * Once an AND has narrowed the candidates down to this many entries,
+ * letting ldb_kv_index_filter() check them against the full expression
+ * is cheaper than loading and intersecting the index lists of the
+ * remaining terms, which are all expected to be larger.
+ */
+#define LDB_KV_AND_CANDIDATE_THRESHOLD 16
+
+struct ldb_kv_index_count_ctx {
+	struct ldb_context *ldb;
+	struct ldb_kv_private *ldb_kv;
+	uint64_t count;
+};
+
+static int ldb_kv_index_count_parser(_UNUSED_ struct ldb_val key,
+				     struct ldb_val data,
+				     void *private_data)
+{
+	struct ldb_kv_index_count_ctx *ctx = private_data;
+	struct ldb_message *msg = NULL;
+	struct ldb_message_element *el = NULL;
+	int ret;
+
+	msg = ldb_msg_new(ctx->ldb_kv);
+	if (msg == NULL) {
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	/*
+	 * Nothing is copied out of data, we only need to know the
+	 * number of entries.
+	 */
+	ret = ldb_unpack_data_flags(ctx->ldb, &data, msg,
+				    LDB_UNPACK_DATA_FLAG_NO_DN |
+				    LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC);
+	if (ret != 0) {
+		talloc_free(msg);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	el = ldb_msg_find_element(msg, LDB_KV_IDX);
+	if (el == NULL) {
+		ctx->count = 0;
+	} else if (ctx->ldb_kv->cache->GUID_index_attribute != NULL) {
+		ctx->count = el->num_values > 0 ?
+			el->values[0].length / LDB_KV_GUID_SIZE : 0;
+	} else {
+		ctx->count = el->num_values;
+	}
+
+	talloc_free(msg);
+	return LDB_SUCCESS;
+}
+
+/*
+ * Return the number of entries in the index record for an equality
+ * match, without loading the list itself.
+ *
+ * The index records are the statistics: they are kept up to date by
+ * every index write and the count is stored in the record header, so
+ * all this costs is a lookup in the database (or in the in memory
+ * index cache during a transaction).
+ */
+static uint64_t ldb_kv_index_count(struct ldb_module *module,
+				   struct ldb_kv_private *ldb_kv,
+				   const struct ldb_parse_tree *tree)
+{
+	struct ldb_context *ldb = ldb_module_get_ctx(module);
+	struct ldb_kv_index_count_ctx ctx = {
+		.ldb = ldb,
+		.ldb_kv = ldb_kv,
+		.count = LDB_KV_ESTIMATE_UNKNOWN,
+	};
+	enum key_truncation truncation = KEY_NOT_TRUNCATED;
+	struct ldb_dn *dn = NULL;
+	struct ldb_val key;
+	int ret;
+
+	dn = ldb_kv_index_key(ldb,
+			      ldb_kv,
+			      ldb_kv,
+			      tree->u.equality.attr,
+			      &tree->u.equality.value,
+			      NULL,
+			      &truncation);
+	if (dn == NULL) {
+		return LDB_KV_ESTIMATE_UNKNOWN;
+	}
+
+	if (ldb_kv->idxptr != NULL) {
+		struct dn_list *list = talloc_zero(dn, struct dn_list);
+		if (list == NULL) {
+			talloc_free(dn);
+			return LDB_KV_ESTIMATE_UNKNOWN;
+		}
+		ret = ldb_kv_dn_list_load(module, ldb_kv, dn, list,
+					  DN_LIST_WILL_BE_READ_ONLY);
+		if (ret == LDB_SUCCESS) {
+			ctx.count = list->count;
+		} else if (ret == LDB_ERR_NO_SUCH_OBJECT) {
+			ctx.count = 0;
+		}
+		talloc_free(dn);
+		return ctx.count;
+	}
+
+	key = ldb_kv_key_dn(dn, dn);
+	if (key.data == NULL) {
+		talloc_free(dn);
+		return LDB_KV_ESTIMATE_UNKNOWN;
+	}
+
+	ret = ldb_kv->kv_ops->fetch_and_parse(ldb_kv, key,
+					      ldb_kv_index_count_parser,
+					      &ctx);
+	if (ret == LDB_ERR_NO_SUCH_OBJECT) {
+		ctx.count = 0;
+	} else if (ret != LDB_SUCCESS) {
+		ctx.count = LDB_KV_ESTIMATE_UNKNOWN;
+	}
+
+	talloc_free(dn);
+	return ctx.count;
+}
+
+/*
+ * Estimate the number of entries ldb_kv_index_dn() would return for
+ * tree, LDB_KV_ESTIMATE_UNKNOWN if it can't be told cheaply or the
+ * term can't be answered from the index at all.
+ */
+static uint64_t ldb_kv_index_estimate(struct ldb_module *module,
+				      struct ldb_kv_private *ldb_kv,
+				      const struct ldb_parse_tree *tree)
+{
+	struct ldb_context *ldb = ldb_module_get_ctx(module);
+	uint64_t estimate;
+	unsigned int i;
+
+	switch (tree->operation) {
+	case LDB_OP_AND:
+		estimate = LDB_KV_ESTIMATE_UNKNOWN;
+		for (i = 0; i < tree->u.list.num_elements; i++) {
+			uint64_t e = ldb_kv_index_estimate(
+			    module, ldb_kv, tree->u.list.elements[i]);
+			estimate = MIN(estimate, e);
+		}
+		return estimate;
+
+	case LDB_OP_OR:
+		estimate = 0;
+		for (i = 0; i < tree->u.list.num_elements; i++) {
+			uint64_t e = ldb_kv_index_estimate(
+			    module, ldb_kv, tree->u.list.elements[i]);
+			if (e == LDB_KV_ESTIMATE_UNKNOWN) {
+				return LDB_KV_ESTIMATE_UNKNOWN;
+			}
+			estimate += e;
+		}
+		return estimate;
+
+	case LDB_OP_EQUALITY:
+		if (ldb_kv->disallow_dn_filter &&
+		    ldb_attr_cmp(tree->u.equality.attr, "dn") == 0) {
+			return 0;
+		}
+		if (tree->u.equality.attr[0] == '@') {
+			return 0;
+		}
+		if (ldb_kv_index_unique(ldb, ldb_kv, tree->u.equality.attr)) {
+			return 1;
+		}
+		if (!ldb_kv_is_indexed(module, ldb_kv,
+				       tree->u.equality.attr)) {
+			return LDB_KV_ESTIMATE_UNKNOWN;
+		}
+		return ldb_kv_index_count(module, ldb_kv, tree);
+
+	default:
+		return LDB_KV_ESTIMATE_UNKNOWN;
+	}
+}
+
+struct ldb_kv_and_term {
+	const struct ldb_parse_tree *tree;
+	uint64_t estimate;
+	unsigned int pos;
+};
+
+static int ldb_kv_and_term_cmp(const struct ldb_kv_and_term *t1,
+			       const struct ldb_kv_and_term *t2)
+{
+	if (t1->estimate != t2->estimate) {
+		return t1->estimate < t2->estimate ? -1 : 1;
+	}
+	/* keep the filter order for equal estimates */
+	if (t1->pos != t2->pos) {
+		return t1->pos < t2->pos ? -1 : 1;
+	}
+	return 0;
+}
+
+static void ldb_kv_explain_tree(struct ldb_kv_private *ldb_kv,
+				const char *what,
+				const struct ldb_parse_tree *tree,
+				uint64_t n)
+{
+	char *filter = NULL;
+
+	if (ldb_kv->explain == NULL) {
+		return;
+	}
+
+	filter = ldb_filter_from_tree(ldb_kv, tree);
+	if (n == LDB_KV_ESTIMATE_UNKNOWN) {
+		ldb_kv_explain(ldb_kv, "and: %s %s\n",
+			       filter ? filter : "?", what);
+	} else {
+		ldb_kv_explain(ldb_kv, "and: %s %s %"PRIu64"\n",
+			       filter ? filter : "?", what, n);
+	}
+	TALLOC_FREE(filter);
+}
+
 /*
   process an AND expression (intersection)
  */
@@ -1672,6 +1974,8 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 			       struct dn_list *list)
 {
 	struct ldb_context *ldb;
+	struct ldb_kv_and_term *terms = NULL;
+	unsigned int num_terms = tree->u.list.num_elements;
 	unsigned int i;
 	bool found;
 
@@ -1683,7 +1987,7 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 	/* in the first pass we only look for unique simple
 	   equality tests, in the hope of avoiding having to look
 	   at any others */
-	for (i=0; i<tree->u.list.num_elements; i++) {
+	for (i=0; i<num_terms; i++) {
 		const struct ldb_parse_tree *subtree = tree->u.list.elements[i];
 		int ret;
 
@@ -1696,6 +2000,8 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 		ret = ldb_kv_index_dn(module, ldb_kv, subtree, list);
 		if (ret == LDB_ERR_NO_SUCH_OBJECT) {
 			/* 0 && X == 0 */
+			ldb_kv_explain_tree(ldb_kv, "unique, entries",
+					    subtree, 0);
 			return LDB_ERR_NO_SUCH_OBJECT;
 		}
 		if (ret == LDB_SUCCESS) {
@@ -1703,20 +2009,51 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 			 * stop. Note that we don't care if we return
 			 * a few too many objects, due to later
 			 * filtering */
+			ldb_kv_explain_tree(ldb_kv, "unique, entries",
+					    subtree, list->count);
 			return LDB_SUCCESS;
 		}
 	}
 
+	/*
+	 * Plan the full intersection: look up how big the index list
+	 * of each term is and start with the smallest. The
+	 * intersection can only shrink, so once it is small enough
+	 * there is no point in loading the bigger lists.
+	 */
+	terms = talloc_array(list, struct ldb_kv_and_term, num_terms);
+	if (terms == NULL) {
+		return ldb_module_oom(module);
+	}
+	for (i = 0; i < num_terms; i++) {
+		terms[i] = (struct ldb_kv_and_term) {
+			.tree = tree->u.list.elements[i],
+			.estimate = ldb_kv_index_estimate(
+				module, ldb_kv, tree->u.list.elements[i]),
+			.pos = i,
+		};
+	}
+	TYPESAFE_QSORT(terms, num_terms, ldb_kv_and_term_cmp);
+
+	for (i = 0; i < num_terms; i++) {
+		ldb_kv_explain_tree(ldb_kv,
+				    terms[i].estimate ==
+					    LDB_KV_ESTIMATE_UNKNOWN ?
+					    "estimate unknown" : "estimate",
+				    terms[i].tree, terms[i].estimate);
+	}
+
 	/* now do a full intersection */
 	found = false;
 
-	for (i=0; i<tree->u.list.num_elements; i++) {
-		const struct ldb_parse_tree *subtree = tree->u.list.elements[i];
+	for (i=0; i<num_terms; i++) {
+		const struct ldb_parse_tree *subtree = terms[i].tree;
 		struct dn_list *list2;
 		int ret;
 
 		list2 = talloc_zero(list, struct dn_list);
 		if (list2 == NULL) {
+			TALLOC_FREE(terms);
 			return ldb_module_oom(module);
 		}
 
@@ -1724,18 +2061,24 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 
 		if (ret == LDB_ERR_NO_SUCH_OBJECT) {
 			/* X && 0 == 0 */
+			ldb_kv_explain_tree(ldb_kv, "loaded", subtree, 0);
 			list->dn = NULL;
 			list->count = 0;
 			talloc_free(list2);
+			TALLOC_FREE(terms);
 			return LDB_ERR_NO_SUCH_OBJECT;
 		}
 
 		if (ret != LDB_SUCCESS) {
 			/* this didn't adding anything */
+			ldb_kv_explain_tree(ldb_kv, "not indexed",
+					    subtree, LDB_KV_ESTIMATE_UNKNOWN);
 			talloc_free(list2);
 			continue;
 		}
 
+		ldb_kv_explain_tree(ldb_kv, "loaded", subtree, list2->count);
+
 		if (!found) {
 			talloc_reparent(list2, list, list->dn);
 			list->dn = list2->dn;
@@ -1743,25 +2086,37 @@ static int ldb_kv_index_dn_and(struct ldb_module *module,
 			found = true;
 		} else if (!list_intersect(ldb_kv, list, list2)) {
 			talloc_free(list2);
+			TALLOC_FREE(terms);
 			return LDB_ERR_OPERATIONS_ERROR;
 		}
 
 		if (list->count == 0) {
 			list->dn = NULL;
+			TALLOC_FREE(terms);
 			return LDB_ERR_NO_SUCH_OBJECT;
 		}
 
-		if (list->count < 2) {
+		if (list->count <= LDB_KV_AND_CANDIDATE_THRESHOLD &&
+		    i + 1 < num_terms) {
 			/* it isn't worth loading the next part of the tree */
+			ldb_kv_explain(ldb_kv,
+				       "and: stopped with %u candidates, "
+				       "%u terms left to the filter\n",
+				       list->count,
+				       num_terms - i - 1);
+			TALLOC_FREE(terms);
 			return LDB_SUCCESS;
 		}
 	}
 
+	TALLOC_FREE(terms);
+
 	if (!found) {
 		/* none of the attributes were indexed */
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
 
+	ldb_kv_explain(ldb_kv, "and: %u candidates\n", list->count);
 	return LDB_SUCCESS;
 }
 
@@ -2269,6 +2624,9 @@ static int ldb_kv_index_filter(struct ldb_kv_private *ldb_kv,
 	unsigned int num_keys = 0;
 	uint8_t previous_guid_key[LDB_KV_GUID_KEY_SIZE] = {0};
 	struct ldb_val *keys = NULL;
+	struct ldb_dn *base = ac->base;
+	struct ldb_match_program *program = NULL;
+	int ret;
 
 	/*
 	 * We have to allocate the key list (rather than just walk the
@@ -2311,8 +2669,6 @@ static int ldb_kv_index_filter(struct ldb_kv_private *ldb_kv,
 	}
 
 	for (i = 0; i < dn_list->count; i++) {
-		int ret;
-
 		ret = ldb_kv_idx_to_key(
 		    ac->module, ldb_kv, keys, &dn_list->dn[i], &keys[num_keys]);
 		if (ret != LDB_SUCCESS) {
@@ -2345,12 +2701,30 @@ static int ldb_kv_index_filter(struct ldb_kv_private *ldb_kv,
 		num_keys++;
 	}
 
+	/*
+	 * We trust the index for LDB_SCOPE_ONELEVEL
+	 * unless the index key has been truncated, so the scope only
+	 * needs to be checked in the other cases.
+	 *
+	 * LDB_SCOPE_BASE is not passed in by our only caller.
+	 */
+	if (ac->scope == LDB_SCOPE_ONELEVEL &&
+	    ldb_kv->cache->one_level_indexes &&
+	    scope_one_truncation == KEY_NOT_TRUNCATED) {
+		base = NULL;
+	}
+
+	ret = ldb_match_program_compile(ldb, keys, ac->tree, base,
+					ac->scope, &program);
+	if (ret != LDB_SUCCESS) {
+		talloc_free(keys);
+		return ret;
+	}
 
 	/*
 	 * Now that the list is a safe copy, send the callbacks
 	 */
 	for (i = 0; i < num_keys; i++) {
-		int ret;
 		bool matched;
 
 		/*
@@ -2404,6 +2778,7 @@ static int ldb_kv_index_filter(struct ldb_kv_private *ldb_kv,
 				      ldb_kv,
 				      keys[i],
 				      msg,
+				      ac->unpack_attrs,
 				      LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC |
 				      /*
 				       * The entry point ldb_kv_search_indexed is
@@ -2429,23 +2804,7 @@ static int ldb_kv_index_filter(struct ldb_kv_private *ldb_kv,
 			return LDB_ERR_OPERATIONS_ERROR;
 		}
 
-		/*
-		 * We trust the index for LDB_SCOPE_ONELEVEL
-		 * unless the index key has been truncated.
-		 *
-		 * LDB_SCOPE_BASE is not passed in by our only caller.
-		 */
-		if (ac->scope == LDB_SCOPE_ONELEVEL &&
-		    ldb_kv->cache->one_level_indexes &&
-		    scope_one_truncation == KEY_NOT_TRUNCATED) {
-			ret = ldb_match_message(ldb, msg, ac->tree,
-						ac->scope, &matched);
-		} else {
-			ret = ldb_match_msg_error(ldb, msg,
-						  ac->tree, ac->base,
-						  ac->scope, &matched);
-		}
-
+		ret = ldb_match_program_run(program, msg, &matched);
 		if (ret != LDB_SUCCESS) {
 			talloc_free(keys);
 			talloc_free(msg);
@@ -2456,22 +2815,13 @@ static int ldb_kv_index_filter(struct ldb_kv_private *ldb_kv,
 			continue;
 		}
 
-		filtered_msg = ldb_msg_new(ac);
-		if (filtered_msg == NULL) {
-			TALLOC_FREE(keys);
-			TALLOC_FREE(msg);
-			return LDB_ERR_OPERATIONS_ERROR;
-		}
-
-		filtered_msg->dn = talloc_steal(filtered_msg, msg->dn);
-
 		/* filter the attributes that the user wants */
-		ret = ldb_kv_filter_attrs(ldb, msg, ac->attrs, filtered_msg);
+		ret = ldb_kv_filter_attrs(ac, msg, ac->attrs,
+					  &filtered_msg);
 
 		talloc_free(msg);
 
 		if (ret == -1) {
-			TALLOC_FREE(filtered_msg);
 			talloc_free(keys);
 			return LDB_ERR_OPERATIONS_ERROR;
 		}
@@ -2575,6 +2925,9 @@ int ldb_kv_search_indexed(struct ldb_kv_context *ac, uint32_t *match_count)
 			talloc_free(dn_list);
 			return ret;
 		}
+		ldb_kv_explain(ldb_kv, "one-level: %s has %u children\n",
+			       ldb_dn_get_linearized(ac->base),
+			       dn_list->count);
 
 		/*
 		 * If we have too many children, running ldb_kv_index_filter()
@@ -2677,9 +3030,13 @@ int ldb_kv_search_indexed(struct ldb_kv_context *ac, uint32_t *match_count)
 	 * processing as the truncation here refers only to the
 	 * SCOPE_ONELEVEL index.
 	 */
+	ldb_kv_explain(ldb_kv, "filter: %u candidates\n", dn_list->count);
+
 	ret = ldb_kv_index_filter(
 	    ldb_kv, dn_list, ac, match_count, scope_one_truncation);
 	talloc_free(dn_list);
+
+	ldb_kv_explain(ldb_kv, "filter: %u matched\n", *match_count);
 	return ret;
 }
 
@@ -2807,8 +3164,8 @@ static int ldb_kv_index_add1(struct ldb_module *module,
 				return ret;
 			}
 
-			ret =
-			    ldb_kv_search_key(module, ldb_kv, key, rec, flags);
+			ret = ldb_kv_search_key(
+			    module, ldb_kv, key, rec, NULL, flags);
 			if (key.data != guid_key) {
 				TALLOC_FREE(key.data);
 			}
@@ -3485,7 +3842,12 @@ static int re_key(struct ldb_kv_private *ldb_kv,
 		return -1;
 	}
 
-	ret = ldb_unpack_data(ldb, &val, msg);
+	/*
+	 * The values are only looked at during this callback, no
+	 * need to copy them
+	 */
+	ret = ldb_unpack_data_flags(ldb, &val, msg,
+				    LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC);
 	if (ret != 0) {
 		ldb_debug(ldb, LDB_DEBUG_ERROR, "Invalid data for index %s\n",
 						ldb_dn_get_linearized(msg->dn));
@@ -3535,42 +3897,21 @@ static int re_key(struct ldb_kv_private *ldb_kv,
 }
 
 /*
-  traversal function that adds @INDEX records during a re index
+  scan function that adds @INDEX records during a re index
 */
 static int re_index(struct ldb_kv_private *ldb_kv,
 		    struct ldb_val key,
-		    struct ldb_val val,
+		    struct ldb_message *msg,
 		    void *state)
 {
 	struct ldb_context *ldb;
 	struct ldb_kv_reindex_context *ctx =
 	    (struct ldb_kv_reindex_context *)state;
 	struct ldb_module *module = ldb_kv->module;
-	struct ldb_message *msg;
 	int ret;
-	bool is_record;
 
 	ldb = ldb_module_get_ctx(module);
 
-	is_record = ldb_kv_key_is_normal_record(key);
-	if (is_record == false) {
-		return 0;
-	}
-
-	msg = ldb_msg_new(module);
-	if (msg == NULL) {
-		return -1;
-	}
-
-	ret = ldb_unpack_data(ldb, &val, msg);
-	if (ret != 0) {
-		ldb_debug(ldb, LDB_DEBUG_ERROR, "Invalid data for index %s\n",
-						ldb_dn_get_linearized(msg->dn));
-		ctx->error = ret;
-		talloc_free(msg);
-		return -1;
-	}
-
 	if (msg->dn == NULL) {
 		ldb_debug(ldb, LDB_DEBUG_ERROR,
 			  "Refusing to re-index as GUID "
@@ -3806,9 +4147,13 @@ int ldb_kv_reindex(struct ldb_module *module)
 	ctx.error = 0;
 	ctx.count = 0;
 
-	/* now traverse adding any indexes for normal LDB records */
-	ret = ldb_kv->kv_ops->iterate(ldb_kv, re_index, &ctx);
-	if (ret < 0) {
+	/*
+	 * now traverse adding any indexes for normal LDB records,
+	 * this is where the records get unpacked in helper threads
+	 * if "scan_threads" is set
+	 */
+	ret = ldb_kv_scan(ldb_kv, NULL, NULL, NULL, 0, re_index, &ctx);
+	if (ret < 0 && ctx.error == LDB_SUCCESS) {
 		struct ldb_context *ldb = ldb_module_get_ctx(module);
 		ldb_asprintf_errstring(ldb, "reindexing traverse failed: %s",
 				       ldb_errstring(ldb));
@@ -0,0 +1,590 @@
+/*
+   ldb database library
+
+     ** NOTE! The following LGPL license applies to the ldb
+     ** library. This does NOT imply that all of Samba is released
+     ** under the LGPL
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ *  Name: ldb
+ *
+ *  Component: ldb key value full database scans
+ *
+ *  Description: walk all records of the database, unpacking them in
+ *  helper threads
+ *
+ *  A full scan (an unindexed search or a re-index) spends most of
+ *  its time unpacking records. Everything else it does touches the
+ *  ldb context: the backend traversal, matching the filter (which
+ *  uses the schema and allocates below the ldb context), index
+ *  updates and the request callbacks. None of that is thread safe,
+ *  so it all stays in the calling thread.
+ *
+ *  With the "scan_threads" option set, the records found by the
+ *  traversal are copied into batches which are unpacked by that many
+ *  helper threads while the traversal continues. The batches are
+ *  handed back to the callback in the order of the traversal, so the
+ *  result is the same as for the inline scan.
+ */
+
+#include "ldb_kv.h"
+#include "ldb_private.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+/*
+ * A batch is handed to a helper thread once it holds this many
+ * records or bytes.
+ */
+#define LDB_KV_SCAN_BATCH_RECORDS 64
+#define LDB_KV_SCAN_BATCH_BYTES (256 * 1024)
+
+struct ldb_kv_scan_record {
+	struct ldb_val key;
+	struct ldb_val data;
+	struct ldb_message *msg;
+	int ret;
+};
+
+struct ldb_kv_scan_batch {
+	/*
+	 * A top level talloc context, as it is used by a helper
+	 * thread while the scanning thread allocates elsewhere.
+	 *
+	 * Between being queued and being marked done the batch
+	 * belongs to the helper thread, otherwise to the scanning
+	 * thread.
+	 */
+	TALLOC_CTX *mem_ctx;
+	struct ldb_kv_scan_record *records;
+	unsigned int num_records;
+	/* copies of the records, see ldb_kv_scan_queue() */
+	uint8_t *buf;
+	size_t buf_used;
+	bool done;
+};
+
+struct ldb_kv_scan_state {
+	struct ldb_kv_private *ldb_kv;
+	const char * const *unpack_attrs;
+	unsigned int unpack_flags;
+	ldb_kv_scan_fn fn;
+	void *private_data;
+	/* the unpacking or fn failed and stopped the traversal */
+	bool failed;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;
+	/* signalled when a batch is queued or on shutdown */
+	pthread_cond_t queued_cond;
+	/* signalled when a helper thread has finished a batch */
+	pthread_cond_t done_cond;
+	bool shutdown;
+
+	pthread_t *threads;
+	unsigned int num_threads;
+
+	/*
+	 * Batch number n lives in batches[n % num_batches]. The
+	 * scanning thread fills batch "submitted", the helper threads
+	 * take them in order starting at "started", the scanning
+	 * thread consumes them starting at "consumed".
+	 */
+	struct ldb_kv_scan_batch *batches;
+	unsigned int num_batches;
+	uint64_t submitted;
+	uint64_t started;
+	uint64_t consumed;
+
+	/* the records stay valid for the whole traversal */
+	bool stable;
+#endif
+};
+
+/*
+ * Pass one unpacked record to the callback, which owns msg from now
+ * on.
+ */
+static int ldb_kv_scan_consume(struct ldb_kv_scan_state *state,
+			       struct ldb_val key,
+			       struct ldb_message *msg,
+			       int unpack_ret)
+{
+	struct ldb_context *ldb = ldb_module_get_ctx(state->ldb_kv->module);
+	int ret;
+
+	if (unpack_ret != 0) {
+		ldb_asprintf_errstring(ldb,
+				       "Invalid data in record %*.*s",
+				       (int)key.length, (int)key.length,
+				       (char *)key.data);
+		talloc_free(msg);
+		state->failed = true;
+		return -1;
+	}
+
+	ret = state->fn(state->ldb_kv, key, msg, state->private_data);
+	if (ret != 0) {
+		state->failed = true;
+	}
+	return ret;
+}
+
+static int ldb_kv_scan_inline(struct ldb_kv_private *ldb_kv,
+			      struct ldb_val key,
+			      struct ldb_val data,
+			      void *private_data)
+{
+	struct ldb_kv_scan_state *state =
+		(struct ldb_kv_scan_state *)private_data;
+	struct ldb_context *ldb = ldb_module_get_ctx(ldb_kv->module);
+	struct ldb_message *msg = NULL;
+	int ret;
+
+	if (ldb_kv_key_is_normal_record(key) == false) {
+		return 0;
+	}
+
+	msg = ldb_msg_new(ldb_kv);
+	if (msg == NULL) {
+		ldb_oom(ldb);
+		return -1;
+	}
+
+	ret = ldb_unpack_data_attrs(ldb, &data, msg,
+				    state->unpack_attrs,
+				    state->unpack_flags);
+
+	return ldb_kv_scan_consume(state, key, msg, ret);
+}
+
+#ifdef HAVE_PTHREAD
+
+/*
+ * Runs in a helper thread, nothing in here may touch anything but
+ * the batch. ldb_unpack_data_attrs() only uses the ldb context to
+ * remember it in the DN and to log corrupt records.
+ */
+static void ldb_kv_scan_unpack(struct ldb_kv_scan_state *state,
+			       struct ldb_kv_scan_batch *batch)
+{
+	struct ldb_context *ldb = ldb_module_get_ctx(state->ldb_kv->module);
+	unsigned int i;
+
+	for (i = 0; i < batch->num_records; i++) {
+		struct ldb_kv_scan_record *rec = &batch->records[i];
+
+		rec->msg = ldb_msg_new(batch->mem_ctx);
+		if (rec->msg == NULL) {
+			rec->ret = -1;
+			continue;
+		}
+		rec->ret = ldb_unpack_data_attrs(ldb,
+						 &rec->data,
+						 rec->msg,
+						 state->unpack_attrs,
+						 state->unpack_flags);
+	}
+}
+
+static void *ldb_kv_scan_worker(void *private_data)
+{
+	struct ldb_kv_scan_state *state =
+		(struct ldb_kv_scan_state *)private_data;
+
+	pthread_mutex_lock(&state->mutex);
+
+	while (!state->shutdown) {
+		struct ldb_kv_scan_batch *batch = NULL;
+
+		if (state->started == state->submitted) {
+			pthread_cond_wait(&state->queued_cond,
+					  &state->mutex);
+			continue;
+		}
+
+		batch = &state->batches[state->started % state->num_batches];
+		state->started += 1;
+
+		pthread_mutex_unlock(&state->mutex);
+		ldb_kv_scan_unpack(state, batch);
+		pthread_mutex_lock(&state->mutex);
+
+		batch->done = true;
+		pthread_cond_signal(&state->done_cond);
+	}
+
+	pthread_mutex_unlock(&state->mutex);
+	return NULL;
+}
+
+static void ldb_kv_scan_stop(struct ldb_kv_scan_state *state)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&state->mutex);
+	state->shutdown = true;
+	pthread_cond_broadcast(&state->queued_cond);
+	pthread_mutex_unlock(&state->mutex);
+
+	for (i = 0; i < state->num_threads; i++) {
+		pthread_join(state->threads[i], NULL);
+	}
+
+	for (i = 0; i < state->num_batches; i++) {
+		TALLOC_FREE(state->batches[i].mem_ctx);
+	}
+
+	pthread_cond_destroy(&state->done_cond);
+	pthread_cond_destroy(&state->queued_cond);
+	pthread_mutex_destroy(&state->mutex);
+
+	TALLOC_FREE(state->threads);
+	TALLOC_FREE(state->batches);
+	state->num_threads = 0;
+}
+
+static bool ldb_kv_scan_start(struct ldb_kv_scan_state *state,
+			      unsigned int num_threads)
+{
+	sigset_t mask, omask;
+	unsigned int i;
+	int ret;
+
+	/*
+	 * One batch being filled, one being consumed and some
+	 * queued for every helper.
+	 */
+	state->num_batches = num_threads * 2 + 2;
+	state->batches = talloc_zero_array(state->ldb_kv,
+					   struct ldb_kv_scan_batch,
+					   state->num_batches);
+	state->threads = talloc_zero_array(state->ldb_kv,
+					   pthread_t,
+					   num_threads);
+	if (state->batches == NULL || state->threads == NULL) {
+		TALLOC_FREE(state->batches);
+		TALLOC_FREE(state->threads);
+		return false;
+	}
+
+	ret = pthread_mutex_init(&state->mutex, NULL);
+	if (ret != 0) {
+		TALLOC_FREE(state->batches);
+		TALLOC_FREE(state->threads);
+		return false;
+	}
+	ret = pthread_cond_init(&state->queued_cond, NULL);
+	if (ret != 0) {
+		pthread_mutex_destroy(&state->mutex);
+		TALLOC_FREE(state->batches);
+		TALLOC_FREE(state->threads);
+		return false;
+	}
+	ret = pthread_cond_init(&state->done_cond, NULL);
+	if (ret != 0) {
+		pthread_cond_destroy(&state->queued_cond);
+		pthread_mutex_destroy(&state->mutex);
+		TALLOC_FREE(state->batches);
+		TALLOC_FREE(state->threads);
+		return false;
+	}
+
+	/*
+	 * Signals have to be delivered to the main thread, the
+	 * helpers block all of them.
+	 */
+	sigfillset(&mask);
+	ret = pthread_sigmask(SIG_BLOCK, &mask, &omask);
+	if (ret != 0) {
+		num_threads = 0;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		ret = pthread_create(&state->threads[i], NULL,
+				     ldb_kv_scan_worker, state);
+		if (ret != 0) {
+			break;
+		}
+		state->num_threads += 1;
+	}
+
+	if (num_threads != 0) {
+		pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	}
+
+	if (state->num_threads == 0) {
+		/* Fall back to the inline scan */
+		ldb_kv_scan_stop(state);
+		return false;
+	}
+
+	return true;
+}
+
+static int ldb_kv_scan_consume_batch(struct ldb_kv_scan_state *state,
+				     struct ldb_kv_scan_batch *batch)
+{
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < batch->num_records; i++) {
+		struct ldb_kv_scan_record *rec = &batch->records[i];
+
+		ret = ldb_kv_scan_consume(state, rec->key, rec->msg, rec->ret);
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	TALLOC_FREE(batch->mem_ctx);
+	batch->records = NULL;
+	batch->num_records = 0;
+	batch->buf = NULL;
+	batch->buf_used = 0;
+	batch->done = false;
+	state->consumed += 1;
+
+	return ret;
+}
+
+/*
+ * Hand all finished batches to the callback, in order. Wait for the
+ * oldest batch if there is no free one to fill next, or for all of
+ * them if wait_all is set.
+ */
+static int ldb_kv_scan_collect(struct ldb_kv_scan_state *state,
+			       bool wait_all)
+{
+	while (state->consumed < state->submitted) {
+		struct ldb_kv_scan_batch *batch =
+			&state->batches[state->consumed % state->num_batches];
+		bool must_wait = wait_all ||
+			(state->submitted - state->consumed ==
+			 state->num_batches);
+		bool done;
+		int ret;
+
+		pthread_mutex_lock(&state->mutex);
+		while (must_wait && !batch->done) {
+			pthread_cond_wait(&state->done_cond, &state->mutex);
+		}
+		done = batch->done;
+		pthread_mutex_unlock(&state->mutex);
+
+		if (!done) {
+			break;
+		}
+
+		ret = ldb_kv_scan_consume_batch(state, batch);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static void ldb_kv_scan_submit(struct ldb_kv_scan_state *state)
+{
+	pthread_mutex_lock(&state->mutex);
+	state->submitted += 1;
+	pthread_cond_signal(&state->queued_cond);
+	pthread_mutex_unlock(&state->mutex);
+}
+
+static int ldb_kv_scan_queue(struct ldb_kv_private *ldb_kv,
+			     struct ldb_val key,
+			     struct ldb_val data,
+			     void *private_data)
+{
+	struct ldb_kv_scan_state *state =
+		(struct ldb_kv_scan_state *)private_data;
+	struct ldb_kv_scan_batch *batch =
+		&state->batches[state->submitted % state->num_batches];
+	struct ldb_context *ldb = ldb_module_get_ctx(ldb_kv->module);
+	struct ldb_kv_scan_record *rec = NULL;
+	uint8_t *buf = NULL;
+
+	if (ldb_kv_key_is_normal_record(key) == false) {
+		return 0;
+	}
+
+	if (batch->mem_ctx == NULL) {
+		batch->mem_ctx = talloc_new(NULL);
+		if (batch->mem_ctx == NULL) {
+			goto nomem;
+		}
+		batch->records = talloc_array(batch->mem_ctx,
+					      struct ldb_kv_scan_record,
+					      LDB_KV_SCAN_BATCH_RECORDS);
+		if (batch->records == NULL) {
+			TALLOC_FREE(batch->mem_ctx);
+			goto nomem;
+		}
+	}
+
+	rec = &batch->records[batch->num_records];
+	*rec = (struct ldb_kv_scan_record) {
+		.key = key,
+		.data = data,
+	};
+
+	if (!state->stable) {
+		size_t len = key.length + data.length;
+
+		/*
+		 * Otherwise the backend only guarantees the record to
+		 * be valid during the callback, copy it.
+		 */
+		if (batch->buf == NULL) {
+			batch->buf = talloc_size(batch->mem_ctx,
+						 LDB_KV_SCAN_BATCH_BYTES);
+			if (batch->buf == NULL) {
+				goto nomem;
+			}
+		}
+
+		if (len <= LDB_KV_SCAN_BATCH_BYTES - batch->buf_used) {
+			buf = batch->buf + batch->buf_used;
+			batch->buf_used += len;
+		} else {
+			buf = talloc_size(batch->mem_ctx, len);
+			if (buf == NULL) {
+				goto nomem;
+			}
+			batch->buf_used = LDB_KV_SCAN_BATCH_BYTES;
+		}
+		memcpy(buf, key.data, key.length);
+		memcpy(buf + key.length, data.data, data.length);
+		rec->key.data = buf;
+		rec->data.data = buf + key.length;
+	}
+	batch->num_records += 1;
+
+	if (batch->num_records < LDB_KV_SCAN_BATCH_RECORDS &&
+	    batch->buf_used < LDB_KV_SCAN_BATCH_BYTES) {
+		return 0;
+	}
+
+	ldb_kv_scan_submit(state);
+
+	return ldb_kv_scan_collect(state, false);
+
+nomem:
+	ldb_oom(ldb);
+	state->failed = true;
+	return -1;
+}
+
+/*
+ * Queue the last partially filled batch and consume all of them, any
+ * failure is noted in state->failed.
+ */
+static void ldb_kv_scan_finish(struct ldb_kv_scan_state *state)
+{
+	struct ldb_kv_scan_batch *batch =
+		&state->batches[state->submitted % state->num_batches];
+
+	if (batch->num_records > 0) {
+		ldb_kv_scan_submit(state);
+	}
+
+	ldb_kv_scan_collect(state, true);
+}
+
+#endif /* HAVE_PTHREAD */
+
+/*
+ * Call fn for every normal record of the database, in the order of
+ * the backend traversal. fn gets the record unpacked with
+ * unpack_flags and has to free it. If unpack_attrs is not NULL, only
+ * these attributes are unpacked.
+ *
+ * If start_key and end_key are given and the backend supports it,
+ * only that range of keys is traversed.
+ *
+ * Returns a negative value if the traversal failed, a record could
+ * not be unpacked or fn returned non-zero, which stops the scan.
+ */
+int ldb_kv_scan(struct ldb_kv_private *ldb_kv,
+		const struct ldb_val *start_key,
+		const struct ldb_val *end_key,
+		const char * const *unpack_attrs,
+		unsigned int unpack_flags,
+		ldb_kv_scan_fn fn,
+		void *private_data)
+{
+	struct ldb_kv_scan_state state = {
+		.ldb_kv = ldb_kv,
+		.unpack_attrs = unpack_attrs,
+		.unpack_flags = unpack_flags,
+		.fn = fn,
+		.private_data = private_data,
+	};
+	ldb_kv_traverse_fn traverse_fn = ldb_kv_scan_inline;
+	int ret = LDB_ERR_OPERATIONS_ERROR;
+
+#ifdef HAVE_PTHREAD
+	if (ldb_kv->scan_threads > 0 &&
+	    ldb_kv_scan_start(&state, ldb_kv->scan_threads)) {
+		traverse_fn = ldb_kv_scan_queue;
+
+		/*
+		 * Same as for LDB_UNPACK_DATA_FLAG_READ_LOCKED in
+		 * ldb_kv_parse_data_unpack(), full scans are only
+		 * done with the read lock held
+		 */
+		state.stable =
+			(ldb_kv->kv_ops->options &
+			 LDB_KV_OPTION_STABLE_READ_LOCK) &&
+			!ldb_kv->kv_ops->transaction_active(ldb_kv);
+	}
+#endif
+
+	if (start_key != NULL && end_key != NULL) {
+		ret = ldb_kv->kv_ops->iterate_range(ldb_kv,
+						    *start_key,
+						    *end_key,
+						    traverse_fn,
+						    &state);
+	}
+	if (ret == LDB_ERR_OPERATIONS_ERROR) {
+		/*
+		 * If iterate_range isn't defined, it'll return an error,
+		 * so just iterate over the whole DB.
+		 */
+		ret = ldb_kv->kv_ops->iterate(ldb_kv, traverse_fn, &state);
+	}
+
+#ifdef HAVE_PTHREAD
+	if (state.num_threads > 0) {
+		if (ret >= 0 && !state.failed) {
+			ldb_kv_scan_finish(&state);
+		}
+		ldb_kv_scan_stop(&state);
+	}
+#endif
+
+	if (state.failed) {
+		return -1;
+	}
+	return ret;
+}
@@ -101,6 +101,7 @@ struct ldb_kv_parse_data_unpack_ctx {
 	struct ldb_message *msg;
 	struct ldb_module *module;
 	struct ldb_kv_private *ldb_kv;
+	const char * const *unpack_attrs;
 	unsigned int unpack_flags;
 };
 
@@ -151,8 +152,9 @@ static int ldb_kv_parse_data_unpack(struct ldb_val key,
 		}
 	}
 
-	ret = ldb_unpack_data_flags(ldb, &data_parse,
-				    ctx->msg, ctx->unpack_flags);
+	ret = ldb_unpack_data_attrs(ldb, &data_parse,
+				    ctx->msg, ctx->unpack_attrs,
+				    ctx->unpack_flags);
 	if (ret == -1) {
 		if (data_parse.data != data.data) {
 			talloc_free(data_parse.data);
@@ -176,12 +178,14 @@ int ldb_kv_search_key(struct ldb_module *module,
 		      struct ldb_kv_private *ldb_kv,
 		      const struct ldb_val ldb_key,
 		      struct ldb_message *msg,
+		      const char * const *unpack_attrs,
 		      unsigned int unpack_flags)
 {
 	int ret;
 	struct ldb_kv_parse_data_unpack_ctx ctx = {
 		.msg = msg,
 		.module = module,
+		.unpack_attrs = unpack_attrs,
 		.unpack_flags = unpack_flags,
 		.ldb_kv = ldb_kv
 	};
@@ -212,16 +216,17 @@ int ldb_kv_search_key(struct ldb_module *module,
 }
 
 /*
-  search the database for a single simple dn, returning all attributes
-  in a single message
+  search the database for a single simple dn, returning the attributes
+  in unpack_attrs (or all of them) in a single message
 
   return LDB_ERR_NO_SUCH_OBJECT on record-not-found
   and LDB_SUCCESS on success
 */
-int ldb_kv_search_dn1(struct ldb_module *module,
-		      struct ldb_dn *dn,
-		      struct ldb_message *msg,
-		      unsigned int unpack_flags)
+static int ldb_kv_search_dn_attrs(struct ldb_module *module,
+				  struct ldb_dn *dn,
+				  struct ldb_message *msg,
+				  const char * const *unpack_attrs,
+				  unsigned int unpack_flags)
 {
 	void *data = ldb_module_get_private(module);
 	struct ldb_kv_private *ldb_kv =
@@ -270,7 +275,8 @@ int ldb_kv_search_dn1(struct ldb_module *module,
 		}
 	}
 
-	ret = ldb_kv_search_key(module, ldb_kv, key, msg, unpack_flags);
+	ret = ldb_kv_search_key(module, ldb_kv, key, msg,
+				unpack_attrs, unpack_flags);
 
 	TALLOC_FREE(tdb_key_ctx);
 
@@ -291,16 +297,187 @@ int ldb_kv_search_dn1(struct ldb_module *module,
 }
 
 /*
- * filter the specified list of attributes from msg,
- * adding requested attributes, and perhaps all for *,
- * but not the DN to filtered_msg.
+  search the database for a single simple dn, returning all attributes
+  in a single message
+
+  return LDB_ERR_NO_SUCH_OBJECT on record-not-found
+  and LDB_SUCCESS on success
+*/
+int ldb_kv_search_dn1(struct ldb_module *module,
+		      struct ldb_dn *dn,
+		      struct ldb_message *msg,
+		      unsigned int unpack_flags)
+{
+	return ldb_kv_search_dn_attrs(module, dn, msg, NULL, unpack_flags);
+}
+
+/*
+ * Remove the elements from msg that are not in attrs, adding the
+ * distinguishedName element if it was asked for (or for *). This
+ * only touches the elements array of msg, the values are left
+ * where they are.
  */
-int ldb_kv_filter_attrs(struct ldb_context *ldb,
-			const struct ldb_message *msg,
+static int ldb_kv_filter_attrs_in_place(struct ldb_message *msg,
+					const char *const *attrs)
+{
+	unsigned int i;
+	unsigned int num_elements = 0;
+	bool keep_all = false;
+	bool add_dn = false;
+
+	if (attrs == NULL) {
+		keep_all = true;
+	} else {
+		for (i = 0; attrs[i] != NULL; i++) {
+			if (strcmp(attrs[i], "*") == 0) {
+				keep_all = true;
+				break;
+			}
+			if (ldb_attr_cmp(attrs[i], "distinguishedName") == 0) {
+				add_dn = true;
+			}
+		}
+	}
+
+	if (keep_all) {
+		add_dn = true;
+		num_elements = msg->num_elements;
+	} else {
+		for (i = 0; i < msg->num_elements; i++) {
+			const struct ldb_message_element *el =
+				&msg->elements[i];
+			unsigned int j;
+
+			for (j = 0; attrs[j] != NULL; j++) {
+				if (ldb_attr_cmp(el->name, attrs[j]) == 0) {
+					break;
+				}
+			}
+			if (attrs[j] == NULL) {
+				continue;
+			}
+			if (num_elements != i) {
+				msg->elements[num_elements] = *el;
+			}
+			num_elements++;
+		}
+		msg->num_elements = num_elements;
+	}
+
+	if (add_dn &&
+	    ldb_msg_find_element(msg, "distinguishedName") == NULL) {
+		const char *dn = ldb_dn_get_linearized(msg->dn);
+		int ret;
+
+		if (dn == NULL) {
+			return -1;
+		}
+		ret = ldb_msg_add_string(msg, "distinguishedName", dn);
+		if (ret != LDB_SUCCESS) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * filter the specified list of attributes from msg, adding requested
+ * attributes, and perhaps all for *, into a new *_filtered_msg.
+ *
+ * msg is the message just unpacked by the search, its values usually
+ * point into the database record (LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC
+ * and LDB_UNPACK_DATA_FLAG_READ_LOCKED). Only the elements the caller
+ * asked for are copied out, and all of them into a single pooled
+ * allocation together with the message itself, rather than one
+ * allocation per name, values array and value.
+ *
+ * msg is modified: the elements that were not asked for are removed
+ * and msg->dn is moved to the new message.
+ */
+int ldb_kv_filter_attrs(TALLOC_CTX *mem_ctx,
+			struct ldb_message *msg,
 			const char *const *attrs,
-			struct ldb_message *filtered_msg)
+			struct ldb_message **_filtered_msg)
 {
-	return ldb_filter_attrs(ldb, msg, attrs, filtered_msg);
+	struct ldb_message *filtered_msg = NULL;
+	unsigned int num_subobjects = 1;
+	size_t size = 0;
+	unsigned int i, j;
+	int ret;
+
+	ret = ldb_kv_filter_attrs_in_place(msg, attrs);
+	if (ret != 0) {
+		return -1;
+	}
+
+	size = sizeof(struct ldb_message_element) * msg->num_elements;
+	for (i = 0; i < msg->num_elements; i++) {
+		const struct ldb_message_element *el = &msg->elements[i];
+
+		size += strlen(el->name) + 1;
+		size += sizeof(struct ldb_val) * el->num_values;
+		num_subobjects += 2;
+		for (j = 0; j < el->num_values; j++) {
+			size += el->values[j].length + 1;
+		}
+		num_subobjects += el->num_values;
+	}
+
+	filtered_msg = talloc_pooled_object(mem_ctx, struct ldb_message,
+					    num_subobjects, size);
+	if (filtered_msg == NULL) {
+		return -1;
+	}
+	*filtered_msg = (struct ldb_message) {
+		.dn = talloc_steal(filtered_msg, msg->dn),
+	};
+	msg->dn = NULL;
+
+	if (msg->num_elements == 0) {
+		*_filtered_msg = filtered_msg;
+		return 0;
+	}
+
+	filtered_msg->elements = talloc_array(filtered_msg,
+					      struct ldb_message_element,
+					      msg->num_elements);
+	if (filtered_msg->elements == NULL) {
+		goto failed;
+	}
+
+	for (i = 0; i < msg->num_elements; i++) {
+		const struct ldb_message_element *el = &msg->elements[i];
+		struct ldb_message_element *el2 = &filtered_msg->elements[i];
+
+		*el2 = *el;
+		el2->name = talloc_strdup(filtered_msg->elements, el->name);
+		if (el2->name == NULL) {
+			goto failed;
+		}
+		el2->values = talloc_array(filtered_msg->elements,
+					   struct ldb_val, el->num_values);
+		if (el2->values == NULL) {
+			goto failed;
+		}
+		for (j = 0; j < el->num_values; j++) {
+			el2->values[j] = ldb_val_dup(el2->values,
+						     &el->values[j]);
+			if (el2->values[j].data == NULL &&
+			    el->values[j].length != 0) {
+				goto failed;
+			}
+		}
+	}
+	filtered_msg->num_elements = msg->num_elements;
+
+	*_filtered_msg = filtered_msg;
+	return 0;
+
+failed:
+	msg->dn = talloc_steal(msg, filtered_msg->dn);
+	TALLOC_FREE(filtered_msg);
+	return -1;
 }
 
 /*
@@ -308,12 +485,12 @@ int ldb_kv_filter_attrs(struct ldb_context *ldb,
  */
 static int search_func(_UNUSED_ struct ldb_kv_private *ldb_kv,
 		       struct ldb_val key,
-		       struct ldb_val val,
+		       struct ldb_message *msg,
 		       void *state)
 {
 	struct ldb_context *ldb;
 	struct ldb_kv_context *ac;
-	struct ldb_message *msg, *filtered_msg;
+	struct ldb_message *filtered_msg;
 	struct timeval now;
 	int ret, timeval_cmp;
 	bool matched;
@@ -322,26 +499,12 @@ static int search_func(_UNUSED_ struct ldb_kv_private *ldb_kv,
 	ldb = ldb_module_get_ctx(ac->module);
 
 	/*
-	 * We want to skip @ records early in a search full scan
-	 *
 	 * @ records like @IDXLIST are only available via a base
-	 * search on the specific name but the method by which they
-	 * were excluded was expensive, after the unpack the DN is
-	 * exploded and ldb_match_msg_error() would reject it for
-	 * failing to match the scope.
-	 *
-	 * ldb_kv_key_is_normal_record() uses the fact that @ records
-	 * have the DN=@ prefix on their TDB/LMDB key to quickly
-	 * exclude them from consideration.
-	 *
-	 * (any other non-records are also excluded by the same key
-	 * match)
+	 * search on the specific name. ldb_kv_scan() skips them
+	 * early, using the fact that @ records have the DN=@ prefix
+	 * on their TDB/LMDB key.
 	 */
 
-	if (ldb_kv_key_is_normal_record(key) == false) {
-		return 0;
-	}
-
 	/*
 	 * Check the time every 64 records, to reduce calls to
 	 * gettimeofday().  This is a compromise, not all calls to
@@ -362,31 +525,17 @@ static int search_func(_UNUSED_ struct ldb_kv_private *ldb_kv,
 		 * within this loop.  The tevent based timeout is not
 		 * likely to be hit, sadly.
 		 *
-		 * ldb_match_msg_error() can be quite expensive if a
+		 * ldb_match_program_run() can be quite expensive if a
 		 * LDAP_MATCHING_RULE_IN_CHAIN extended match was
 		 * specified.
 		 */
 		if (timeval_cmp <= 0) {
+			talloc_free(msg);
 			ac->error = LDB_ERR_TIME_LIMIT_EXCEEDED;
 			return -1;
 		}
 	}
 
-	msg = ldb_msg_new(ac);
-	if (!msg) {
-		ac->error = LDB_ERR_OPERATIONS_ERROR;
-		return -1;
-	}
-
-	/* unpack the record */
-	ret = ldb_unpack_data_flags(ldb, &val, msg,
-				    LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC);
-	if (ret == -1) {
-		talloc_free(msg);
-		ac->error = LDB_ERR_OPERATIONS_ERROR;
-		return -1;
-	}
-
 	if (!msg->dn) {
 		msg->dn = ldb_dn_new(msg, ldb,
 				     (char *)key.data + 3);
@@ -398,8 +547,7 @@ static int search_func(_UNUSED_ struct ldb_kv_private *ldb_kv,
 	}
 
 	/* see if it matches the given expression */
-	ret = ldb_match_msg_error(ldb, msg,
-				  ac->tree, ac->base, ac->scope, &matched);
+	ret = ldb_match_program_run(ac->match_program, msg, &matched);
 	if (ret != LDB_SUCCESS) {
 		talloc_free(msg);
 		ac->error = LDB_ERR_OPERATIONS_ERROR;
@@ -410,20 +558,11 @@ static int search_func(_UNUSED_ struct ldb_kv_private *ldb_kv,
 		return 0;
 	}
 
-	filtered_msg = ldb_msg_new(ac);
-	if (filtered_msg == NULL) {
-		TALLOC_FREE(msg);
-		return LDB_ERR_OPERATIONS_ERROR;
-	}
-
-	filtered_msg->dn = talloc_steal(filtered_msg, msg->dn);
-
 	/* filter the attributes that the user wants */
-	ret = ldb_kv_filter_attrs(ldb, msg, ac->attrs, filtered_msg);
+	ret = ldb_kv_filter_attrs(ac, msg, ac->attrs, &filtered_msg);
 	talloc_free(msg);
 
 	if (ret == -1) {
-		TALLOC_FREE(filtered_msg);
 		ac->error = LDB_ERR_OPERATIONS_ERROR;
 		return -1;
 	}
@@ -464,24 +603,33 @@ static int ldb_kv_search_full(struct ldb_kv_context *ctx)
 	int ret;
 
 	/*
-	 * If the backend has an iterate_range op, use it to start the search
-	 * at the first GUID indexed record, skipping the indexes section.
+	 * If the backend has an iterate_range op, ldb_kv_scan() uses
+	 * it to start the search at the first GUID indexed record,
+	 * skipping the indexes section.
 	 */
-	ctx->error = LDB_SUCCESS;
-	ret = ldb_kv->kv_ops->iterate_range(ldb_kv,
-					    start_of_db_key,
-					    end_of_db_key,
-					    search_func,
-					    ctx);
-	if (ret == LDB_ERR_OPERATIONS_ERROR) {
-		/*
-		 * If iterate_range isn't defined, it'll return an error,
-		 * so just iterate over the whole DB.
-		 */
-		ret = ldb_kv->kv_ops->iterate(ldb_kv, search_func, ctx);
+	ret = ldb_match_program_compile(ldb_module_get_ctx(ctx->module),
+					ctx,
+					ctx->tree,
+					ctx->base,
+					ctx->scope,
+					&ctx->match_program);
+	if (ret != LDB_SUCCESS) {
+		return ret;
 	}
 
+	ctx->error = LDB_SUCCESS;
+	ret = ldb_kv_scan(ldb_kv,
+			  &start_of_db_key,
+			  &end_of_db_key,
+			  ctx->unpack_attrs,
+			  LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC,
+			  search_func,
+			  ctx);
+	TALLOC_FREE(ctx->match_program);
 	if (ret < 0) {
+		if (ctx->error != LDB_SUCCESS) {
+			return ctx->error;
+		}
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
 
@@ -502,11 +650,12 @@ static int ldb_kv_search_and_return_base(struct ldb_kv_private *ldb_kv,
 	if (!msg) {
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
-	ret = ldb_kv_search_dn1(ctx->module,
-				ctx->base,
-				msg,
-				LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC |
-				LDB_UNPACK_DATA_FLAG_READ_LOCKED);
+	ret = ldb_kv_search_dn_attrs(ctx->module,
+				     ctx->base,
+				     msg,
+				     ctx->unpack_attrs,
+				     LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC |
+				     LDB_UNPACK_DATA_FLAG_READ_LOCKED);
 
 	if (ret == LDB_ERR_NO_SUCH_OBJECT) {
 		if (ldb_kv->check_base == false) {
@@ -549,12 +698,6 @@ static int ldb_kv_search_and_return_base(struct ldb_kv_private *ldb_kv,
 	dn_linearized = ldb_dn_get_linearized(ctx->base);
 	msg_dn_linearized = ldb_dn_get_linearized(msg->dn);
 
-	filtered_msg = ldb_msg_new(ctx);
-	if (filtered_msg == NULL) {
-		talloc_free(msg);
-		return LDB_ERR_OPERATIONS_ERROR;
-	}
-
 	if (strcmp(dn_linearized, msg_dn_linearized) == 0) {
 		/*
 		 * If the DN is exactly the same string, then
@@ -562,25 +705,23 @@ static int ldb_kv_search_and_return_base(struct ldb_kv_private *ldb_kv,
 		 * returned result, as it has already been
 		 * casefolded
 		 */
-		filtered_msg->dn = ldb_dn_copy(filtered_msg, ctx->base);
-	}
+		struct ldb_dn *dn = ldb_dn_copy(msg, ctx->base);
 
-	/*
-	 * If the ldb_dn_copy() failed, or if we did not choose that
-	 * optimisation (filtered_msg is zeroed at allocation),
-	 * steal the one from the unpack
-	 */
-	if (filtered_msg->dn == NULL) {
-		filtered_msg->dn = talloc_steal(filtered_msg, msg->dn);
+		/*
+		 * If the ldb_dn_copy() failed, just keep the one
+		 * from the unpack
+		 */
+		if (dn != NULL) {
+			msg->dn = dn;
+		}
 	}
 
 	/*
 	 * filter the attributes that the user wants.
 	 */
-	ret = ldb_kv_filter_attrs(ldb, msg, ctx->attrs, filtered_msg);
+	ret = ldb_kv_filter_attrs(ctx, msg, ctx->attrs, &filtered_msg);
 	if (ret == -1) {
 		talloc_free(msg);
-		filtered_msg = NULL;
 		return LDB_ERR_OPERATIONS_ERROR;
 	}
 
@@ -603,11 +744,145 @@ static int ldb_kv_search_and_return_base(struct ldb_kv_private *ldb_kv,
 	return LDB_SUCCESS;
 }
 
+/*
+  add a step to the plan of a search with the explain control
+*/
+void ldb_kv_explain(struct ldb_kv_private *ldb_kv, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (ldb_kv->explain == NULL) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	ldb_kv->explain = talloc_vasprintf_append_buffer(ldb_kv->explain,
+							 fmt, ap);
+	va_end(ap);
+}
+
+/*
+  add an attribute to the list of attributes to unpack
+*/
+static int ldb_kv_unpack_attrs_add(struct ldb_kv_context *ctx,
+				   unsigned int *count,
+				   const char *attr)
+{
+	const char **attrs = NULL;
+
+	if (attr == NULL || ldb_attr_in_list(ctx->unpack_attrs, attr)) {
+		return LDB_SUCCESS;
+	}
+
+	attrs = talloc_realloc(ctx, ctx->unpack_attrs, const char *,
+			       *count + 2);
+	if (attrs == NULL) {
+		return ldb_module_oom(ctx->module);
+	}
+	attrs[(*count)++] = attr;
+	attrs[*count] = NULL;
+	ctx->unpack_attrs = attrs;
+
+	return LDB_SUCCESS;
+}
+
+static int ldb_kv_unpack_attrs_add_tree(struct ldb_kv_context *ctx,
+					unsigned int *count,
+					const struct ldb_parse_tree *tree)
+{
+	unsigned int i;
+	int ret;
+
+	switch (tree->operation) {
+	case LDB_OP_AND:
+	case LDB_OP_OR:
+		for (i = 0; i < tree->u.list.num_elements; i++) {
+			ret = ldb_kv_unpack_attrs_add_tree(
+			    ctx, count, tree->u.list.elements[i]);
+			if (ret != LDB_SUCCESS) {
+				return ret;
+			}
+		}
+		return LDB_SUCCESS;
+	case LDB_OP_NOT:
+		return ldb_kv_unpack_attrs_add_tree(ctx,
+						    count,
+						    tree->u.isnot.child);
+	case LDB_OP_EQUALITY:
+		return ldb_kv_unpack_attrs_add(ctx,
+					       count,
+					       tree->u.equality.attr);
+	case LDB_OP_GREATER:
+	case LDB_OP_LESS:
+	case LDB_OP_APPROX:
+		return ldb_kv_unpack_attrs_add(ctx,
+					       count,
+					       tree->u.comparison.attr);
+	case LDB_OP_SUBSTRING:
+		return ldb_kv_unpack_attrs_add(ctx,
+					       count,
+					       tree->u.substring.attr);
+	case LDB_OP_PRESENT:
+		return ldb_kv_unpack_attrs_add(ctx,
+					       count,
+					       tree->u.present.attr);
+	case LDB_OP_EXTENDED:
+		/*
+		 * Extended match rules only look at the DN and the
+		 * attribute they are given
+		 */
+		return ldb_kv_unpack_attrs_add(ctx,
+					       count,
+					       tree->u.extended.attr);
+	}
+
+	return LDB_SUCCESS;
+}
+
+/*
+  work out which attributes of the records a search needs, so the
+  others don't have to be unpacked: the attributes the caller asked
+  for and the ones the filter looks at. Everything else would be
+  thrown away by ldb_kv_filter_attrs() anyway.
+
+  Modules above us that need further attributes for their own
+  processing (like acl_read for the nTSecurityDescriptor) add them to
+  the attrs of the request, so this is all that has to be kept.
+
+  ctx->unpack_attrs stays NULL (for all attributes) if no attrs or "*"
+  were given.
+*/
+static int ldb_kv_unpack_attrs(struct ldb_kv_context *ctx)
+{
+	unsigned int i, count = 0;
+	int ret;
+
+	ctx->unpack_attrs = NULL;
+
+	if (ctx->attrs == NULL || ldb_attr_in_list(ctx->attrs, "*")) {
+		return LDB_SUCCESS;
+	}
+
+	ctx->unpack_attrs = talloc_zero_array(ctx, const char *, 1);
+	if (ctx->unpack_attrs == NULL) {
+		return ldb_module_oom(ctx->module);
+	}
+
+	for (i = 0; ctx->attrs[i] != NULL; i++) {
+		ret = ldb_kv_unpack_attrs_add(ctx, &count, ctx->attrs[i]);
+		if (ret != LDB_SUCCESS) {
+			return ret;
+		}
+	}
+
+	return ldb_kv_unpack_attrs_add_tree(ctx, &count, ctx->tree);
+}
+
 /*
   search the database with a LDAP-like expression.
   choses a search method
 */
-int ldb_kv_search(struct ldb_kv_context *ctx)
+static int ldb_kv_search_choose(struct ldb_kv_context *ctx)
 {
 	struct ldb_context *ldb;
 	struct ldb_module *module = ctx->module;
@@ -640,6 +915,12 @@ int ldb_kv_search(struct ldb_kv_context *ctx)
 	ctx->base = req->op.search.base;
 	ctx->attrs = req->op.search.attrs;
 
+	ret = ldb_kv_unpack_attrs(ctx);
+	if (ret != LDB_SUCCESS) {
+		ldb_kv->kv_ops->unlock_read(module);
+		return ret;
+	}
+
 	if ((req->op.search.base == NULL) || (ldb_dn_is_null(req->op.search.base) == true)) {
 
 		/* Check what we should do with a NULL dn */
@@ -668,6 +949,9 @@ int ldb_kv_search(struct ldb_kv_context *ctx)
 		 * will try to look up an index record for a special
 		 * record (which doesn't exist).
 		 */
+		ldb_kv_explain(ldb_kv, "base: %s\n",
+			       ldb_dn_get_linearized(ctx->base));
+
 		ret = ldb_kv_search_and_return_base(ldb_kv, ctx);
 
 		ldb_kv->kv_ops->unlock_read(module);
@@ -752,6 +1036,8 @@ int ldb_kv_search(struct ldb_kv_context *ctx)
 				return LDB_ERR_INAPPROPRIATE_MATCHING;
 			}
 
+			ldb_kv_explain(ldb_kv, "full scan\n");
+
 			ret = ldb_kv_search_full(ctx);
 			if (ret != LDB_SUCCESS) {
 				ldb_set_errstring(ldb, "Indexed and full searches both failed!\n");
@@ -763,3 +1049,33 @@ int ldb_kv_search(struct ldb_kv_context *ctx)
 
 	return ret;
 }
+
+int ldb_kv_search(struct ldb_kv_context *ctx)
+{
+	struct ldb_kv_private *ldb_kv = talloc_get_type(
+	    ldb_module_get_private(ctx->module), struct ldb_kv_private);
+	char *explain = NULL;
+	int ret;
+
+	if (ldb_request_get_control(ctx->req,
+				    LDB_CONTROL_SEARCH_EXPLAIN_OID) != NULL) {
+		ctx->explain = talloc_strdup(ctx, "");
+		if (ctx->explain == NULL) {
+			return ldb_module_oom(ctx->module);
+		}
+	}
+
+	/*
+	 * The callbacks might run nested searches on this database,
+	 * they collect their own plan (or none)
+	 */
+	explain = ldb_kv->explain;
+	ldb_kv->explain = ctx->explain;
+
+	ret = ldb_kv_search_choose(ctx);
+
+	ctx->explain = ldb_kv->explain;
+	ldb_kv->explain = explain;
+
+	return ret;
+}
@@ -55,6 +55,7 @@
 #include "ldb_key_value/ldb_kv.c"
 #include "ldb_key_value/ldb_kv_index.c"
 #include "ldb_key_value/ldb_kv_search.c"
+#include "ldb_key_value/ldb_kv_scan.c"
 
 #define DEFAULT_BE  "tdb"
 
@@ -351,6 +352,76 @@ static void test_init_store_set_index_cache_size_range(void **state)
 	TALLOC_FREE(ldb);
 }
 
+/*
+ * Test that ldb_kv_init_store ignores scan_threads values that are not
+ * a number and clamps large ones to the number of online CPUs.
+ */
+static void test_init_store_scan_threads(void **state)
+{
+	struct test_ctx *test_ctx = talloc_get_type_abort(
+		*state,
+		struct test_ctx);
+	const char *invalid[] = { "1x", "fred", "", "-", NULL };
+	const char *options[] = { NULL, NULL };
+	unsigned int i;
+	int ret = LDB_SUCCESS;
+
+	for (i = 0; invalid[i] != NULL; i++) {
+		struct ldb_module *module = NULL;
+		struct ldb_kv_private *ldb_kv = NULL;
+		struct ldb_context *ldb = NULL;
+
+		options[0] = talloc_asprintf(test_ctx,
+					     "scan_threads:%s",
+					     invalid[i]);
+		module = talloc_zero(test_ctx, struct ldb_module);
+		ldb = talloc_zero(test_ctx, struct ldb_context);
+		ldb_kv = talloc_zero(test_ctx, struct ldb_kv_private);
+
+		ret = ldb_kv_init_store(ldb_kv, "test", ldb, options, &module);
+		assert_int_equal(LDB_SUCCESS, ret);
+		assert_int_equal(0, ldb_kv->scan_threads);
+
+		TALLOC_FREE(ldb_kv);
+		TALLOC_FREE(module);
+		TALLOC_FREE(ldb);
+	}
+
+	{
+		struct ldb_module *module = NULL;
+		struct ldb_kv_private *ldb_kv = NULL;
+		struct ldb_context *ldb = NULL;
+
+		options[0] = "scan_threads:0xffffffffffffffffffffffff";
+		module = talloc_zero(test_ctx, struct ldb_module);
+		ldb = talloc_zero(test_ctx, struct ldb_context);
+		ldb_kv = talloc_zero(test_ctx, struct ldb_kv_private);
+
+		ret = ldb_kv_init_store(ldb_kv, "test", ldb, options, &module);
+		assert_int_equal(LDB_SUCCESS, ret);
+		assert_int_equal(0, ldb_kv->scan_threads);
+		TALLOC_FREE(ldb_kv);
+		TALLOC_FREE(module);
+		TALLOC_FREE(ldb);
+
+		options[0] = "scan_threads:100000";
+		module = talloc_zero(test_ctx, struct ldb_module);
+		ldb = talloc_zero(test_ctx, struct ldb_context);
+		ldb_kv = talloc_zero(test_ctx, struct ldb_kv_private);
+
+		ret = ldb_kv_init_store(ldb_kv, "test", ldb, options, &module);
+		assert_int_equal(LDB_SUCCESS, ret);
+		assert_in_range(ldb_kv->scan_threads, 1, 100000);
+#ifdef _SC_NPROCESSORS_ONLN
+		assert_true(ldb_kv->scan_threads <=
+			    sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+		TALLOC_FREE(ldb_kv);
+		TALLOC_FREE(module);
+		TALLOC_FREE(ldb);
+	}
+}
+
 int main(int argc, const char **argv)
 {
 	const struct CMUnitTest tests[] = {
@@ -382,6 +453,10 @@ int main(int argc, const char **argv)
 			test_init_store_set_index_cache_size_range,
 			setup,
 			teardown),
+		cmocka_unit_test_setup_teardown(
+			test_init_store_scan_threads,
+			setup,
+			teardown),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
@@ -286,6 +286,212 @@ static void test_wildcard_match_end_condition(void **state)
 	assert_true(matched);
 }
 
+static struct ldb_message *match_test_msg(TALLOC_CTX *mem_ctx,
+					  struct ldb_context *ldb,
+					  const char *dn,
+					  const char *cn,
+					  const char *num,
+					  const char *member)
+{
+	struct ldb_message *msg = ldb_msg_new(mem_ctx);
+	int ret;
+
+	assert_non_null(msg);
+	msg->dn = ldb_dn_new(msg, ldb, dn);
+	assert_non_null(msg->dn);
+
+	if (cn != NULL) {
+		ret = ldb_msg_add_string(msg, "cn", cn);
+		assert_int_equal(ret, LDB_SUCCESS);
+	}
+	if (num != NULL) {
+		ret = ldb_msg_add_string(msg, "num", num);
+		assert_int_equal(ret, LDB_SUCCESS);
+	}
+	if (member != NULL) {
+		ret = ldb_msg_add_string(msg, "member", member);
+		assert_int_equal(ret, LDB_SUCCESS);
+		ret = ldb_msg_add_string(msg, "member",
+					 "cn=other,dc=example,dc=com");
+		assert_int_equal(ret, LDB_SUCCESS);
+	}
+	return msg;
+}
+
+/*
+ * A compiled program has to give the same answers as matching with
+ * the parse tree directly
+ */
+static void test_match_program(void **state)
+{
+	struct ldbtest_ctx *ctx = *state;
+	const char *filters[] = {
+		"(cn=Test1)",
+		"(cn=test*)",
+		"(cn=*T*2)",
+		"(cn=*)",
+		"(num=*)",
+		"(!(cn=*))",
+		"(&(cn=t*1)(num>=5))",
+		"(|(num<=3)(!(cn=*)))",
+		"(num>=10)",
+		"(member=CN=Foo,DC=example,DC=com)",
+		"(member=not a dn)",
+		"(distinguishedName=CN=test1,dc=example,DC=com)",
+		"(dn=cn=test2,dc=example,dc=com)",
+		"(dn=*)",
+		"(num:1.2.840.113556.1.4.803:=4)",
+		"(num:1.2.840.113556.1.4.804:=3)",
+		"(num:1.2.3.4:=1)",
+		"(num~=5)",
+		"(|(&(cn=test2)(num=7))(&(!(num=7))(cn=*1)))",
+	};
+	struct {
+		const char *base;
+		enum ldb_scope scope;
+	} bases[] = {
+		{ NULL, LDB_SCOPE_SUBTREE },
+		{ "dc=example,dc=com", LDB_SCOPE_SUBTREE },
+		{ "dc=example,dc=com", LDB_SCOPE_ONELEVEL },
+		{ "cn=test1,dc=example,dc=com", LDB_SCOPE_BASE },
+		{ "@ATTRIBUTES", LDB_SCOPE_BASE },
+	};
+	struct ldb_message *msgs[] = {
+		match_test_msg(ctx, ctx->ldb, "cn=test1,dc=example,dc=com",
+			       "test1", "5", "cn=foo,dc=example,dc=com"),
+		match_test_msg(ctx, ctx->ldb, "cn=test2,dc=example,dc=com",
+			       "test2", "7", NULL),
+		match_test_msg(ctx, ctx->ldb, "cn=x,cn=test2,dc=example,dc=com",
+			       NULL, "2", "cn=bar,dc=example,dc=com"),
+		match_test_msg(ctx, ctx->ldb, "@ATTRIBUTES",
+			       "test1", NULL, NULL),
+	};
+	size_t f, b, m;
+	int ret;
+
+	ret = ldb_schema_attribute_add(ctx->ldb, "num", 0,
+				       LDB_SYNTAX_INTEGER);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_schema_attribute_add(ctx->ldb, "member", 0,
+				       LDB_SYNTAX_DN);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	for (f = 0; f < ARRAY_SIZE(filters); f++) {
+		struct ldb_parse_tree *tree = ldb_parse_tree(ctx, filters[f]);
+		assert_non_null(tree);
+
+		for (b = 0; b < ARRAY_SIZE(bases); b++) {
+			struct ldb_match_program *program = NULL;
+			struct ldb_dn *base = NULL;
+
+			if (bases[b].base != NULL) {
+				base = ldb_dn_new(ctx, ctx->ldb, bases[b].base);
+				assert_non_null(base);
+			}
+
+			ret = ldb_match_program_compile(ctx->ldb, ctx, tree,
+							base, bases[b].scope,
+							&program);
+			assert_int_equal(ret, LDB_SUCCESS);
+
+			for (m = 0; m < ARRAY_SIZE(msgs); m++) {
+				bool expected = false;
+				bool matched = false;
+				int expected_ret;
+
+				expected_ret = ldb_match_msg_error(
+					ctx->ldb, msgs[m], tree, base,
+					bases[b].scope, &expected);
+				ret = ldb_match_program_run(program, msgs[m],
+							    &matched);
+				if (ret != expected_ret ||
+				    (ret == LDB_SUCCESS &&
+				     matched != expected)) {
+					fail_msg("%s base %s msg %s: "
+						 "%d/%d, expected %d/%d\n",
+						 filters[f],
+						 bases[b].base,
+						 ldb_dn_get_linearized(msgs[m]->dn),
+						 ret, matched,
+						 expected_ret, expected);
+				}
+			}
+			TALLOC_FREE(program);
+			TALLOC_FREE(base);
+		}
+	}
+}
+
+static unsigned int match_test_rule_calls;
+
+static int match_test_rule(struct ldb_context *ldb,
+			   const char *oid,
+			   const struct ldb_message *msg,
+			   const char *attribute_to_match,
+			   const struct ldb_val *value_to_match,
+			   bool *matched)
+{
+	match_test_rule_calls++;
+	*matched = true;
+	return LDB_SUCCESS;
+}
+
+/*
+ * Extended matches may be expensive, the cheaper terms of an AND or
+ * OR are tried first
+ */
+static void test_match_program_order(void **state)
+{
+	struct ldbtest_ctx *ctx = *state;
+	struct ldb_extended_match_rule rule = {
+		.oid = "1.3.6.1.4.1.7165.4.5.99",
+		.callback = match_test_rule,
+	};
+	struct ldb_message *msg = match_test_msg(
+		ctx, ctx->ldb, "cn=test1,dc=example,dc=com", "test1", "5", NULL);
+	struct ldb_match_program *program = NULL;
+	struct ldb_parse_tree *tree = NULL;
+	bool matched = true;
+	int ret;
+
+	ret = ldb_register_extended_match_rule(ctx->ldb, &rule);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	tree = ldb_parse_tree(ctx,
+			      "(&(num:1.3.6.1.4.1.7165.4.5.99:=1)(cn=test2))");
+	assert_non_null(tree);
+	ret = ldb_match_program_compile(ctx->ldb, ctx, tree, NULL,
+					LDB_SCOPE_SUBTREE, &program);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_match_program_run(program, msg, &matched);
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_false(matched);
+	assert_int_equal(match_test_rule_calls, 0);
+	TALLOC_FREE(program);
+
+	tree = ldb_parse_tree(ctx,
+			      "(|(num:1.3.6.1.4.1.7165.4.5.99:=1)(cn=test1))");
+	assert_non_null(tree);
+	ret = ldb_match_program_compile(ctx->ldb, ctx, tree, NULL,
+					LDB_SCOPE_SUBTREE, &program);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_match_program_run(program, msg, &matched);
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_true(matched);
+	assert_int_equal(match_test_rule_calls, 0);
+
+	tree = ldb_parse_tree(ctx,
+			      "(&(num:1.3.6.1.4.1.7165.4.5.99:=1)(cn=test1))");
+	assert_non_null(tree);
+	ret = ldb_match_program_compile(ctx->ldb, ctx, tree, NULL,
+					LDB_SCOPE_SUBTREE, &program);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_match_program_run(program, msg, &matched);
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_true(matched);
+	assert_int_equal(match_test_rule_calls, 1);
+}
+
 /*
  * Note: to run under valgrind use:
  *       valgrind \
@@ -307,6 +513,14 @@ int main(int argc, const char **argv)
 			test_wildcard_match_end_condition,
 			setup,
 			teardown),
+		cmocka_unit_test_setup_teardown(
+			test_match_program,
+			setup,
+			teardown),
+		cmocka_unit_test_setup_teardown(
+			test_match_program_order,
+			setup,
+			teardown),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
@@ -1333,6 +1333,71 @@ static void test_search_match_filter(void **state)
 	assert_has_no_attr(result->msgs[0], "uid");
 }
 
+static void test_search_match_filter_dn(void **state)
+{
+	struct search_test_ctx *search_test_ctx = talloc_get_type_abort(*state,
+			struct search_test_ctx);
+	int ret;
+	struct ldb_dn *basedn;
+	struct ldb_result *result = NULL;
+	struct ldb_message *msg = NULL;
+	struct ldb_message_element *el = NULL;
+	const char *uid_vals[] = { "test_search_uid",
+				   "test_search_uid2" };
+	const char *attrs[] = { "uid", "distinguishedName", NULL };
+	char *full_dn;
+	const char *full_dn_vals[1];
+	uint8_t *data = NULL;
+
+	full_dn = get_full_dn(search_test_ctx,
+			      search_test_ctx,
+			      "cn=test_search_cn");
+	assert_non_null(full_dn);
+	full_dn_vals[0] = full_dn;
+
+	basedn = ldb_dn_new_fmt(search_test_ctx,
+				search_test_ctx->ldb_test_ctx->ldb,
+				"%s",
+				search_test_ctx->base_dn);
+	assert_non_null(basedn);
+
+	ret = ldb_search(search_test_ctx->ldb_test_ctx->ldb,
+			 search_test_ctx,
+			 &result,
+			 basedn,
+			 LDB_SCOPE_SUBTREE,
+			 attrs,
+			 "cn=test_search_cn");
+	assert_int_equal(ret, 0);
+	assert_non_null(result);
+	assert_int_equal(result->count, 1);
+
+	msg = result->msgs[0];
+	assert_int_equal(msg->num_elements, 2);
+	assert_attr_has_vals(msg, "uid", uid_vals, 2);
+	assert_attr_has_vals(msg, "distinguishedName",
+			     full_dn_vals, 1);
+	assert_has_no_attr(msg, "cn");
+
+	/*
+	 * The result must behave like any other talloc'ed message,
+	 * it can be extended and parts of it can be moved away.
+	 */
+	ret = ldb_msg_add_string(msg, "cn", "test_search_cn");
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_msg_add_string(msg, "uid", "test_search_uid3");
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(msg->num_elements, 3);
+
+	el = ldb_msg_find_element(msg, "uid");
+	assert_non_null(el);
+	assert_int_equal(el->num_values, 3);
+	data = talloc_steal(search_test_ctx, el->values[1].data);
+	TALLOC_FREE(result);
+	assert_string_equal(data, "test_search_uid2");
+	TALLOC_FREE(data);
+}
+
 static void assert_expected(struct search_test_ctx *search_test_ctx,
 			    struct ldb_message *msg)
 {
@@ -3245,6 +3310,339 @@ static void test_ldb_rename_dn_case_change(void **state)
 	/* FIXME - test the values didn't change */
 }
 
+static int ldb_index_intersect_test_setup(void **state)
+{
+	struct ldbtest_ctx *test_ctx;
+	struct ldb_ldif *ldif;
+	const char *index_ldif =		\
+		"dn: @INDEXLIST\n"
+		"@IDXATTR: parity\n"
+		"@IDXATTR: third\n"
+		"@IDXATTR: uid\n"
+#ifdef GUID_IDX
+		"@IDXGUID: objectUUID\n"
+		"@IDX_DN_GUID: GUID\n"
+#endif
+		"\n";
+	unsigned int i;
+	int ret;
+
+	ldbtest_noconn_setup((void **) &test_ctx);
+
+	ret = ldb_connect(test_ctx->ldb, test_ctx->dbpath, 0, NULL);
+	assert_int_equal(ret, 0);
+
+	while ((ldif = ldb_ldif_read_string(test_ctx->ldb, &index_ldif))) {
+		ret = ldb_add(test_ctx->ldb, ldif->msg);
+		assert_int_equal(ret, LDB_SUCCESS);
+	}
+
+	for (i = 0; i < 200; i++) {
+		struct ldb_message *msg = ldb_msg_new(test_ctx);
+		assert_non_null(msg);
+
+		msg->dn = ldb_dn_new_fmt(msg, test_ctx->ldb,
+					 "cn=intersect%u,dc=test", i);
+		assert_non_null(msg->dn);
+
+		ret = ldb_msg_add_fmt(msg, "objectUUID", "%016u", i);
+		assert_int_equal(ret, LDB_SUCCESS);
+		ret = ldb_msg_add_string(msg, "parity",
+					 (i % 2) == 0 ? "even" : "odd");
+		assert_int_equal(ret, LDB_SUCCESS);
+		ret = ldb_msg_add_fmt(msg, "third", "%u", i % 3);
+		assert_int_equal(ret, LDB_SUCCESS);
+		ret = ldb_msg_add_fmt(msg, "uid", "uid%u", i);
+		assert_int_equal(ret, LDB_SUCCESS);
+
+		ret = ldb_add(test_ctx->ldb, msg);
+		assert_int_equal(ret, LDB_SUCCESS);
+		TALLOC_FREE(msg);
+	}
+
+	*state = test_ctx;
+	return 0;
+}
+
+static int ldb_index_intersect_test_teardown(void **state)
+{
+	struct ldbtest_ctx *test_ctx = talloc_get_type_abort(*state,
+							struct ldbtest_ctx);
+	ldbtest_teardown((void **) &test_ctx);
+	return 0;
+}
+
+static unsigned int index_intersect_count(struct ldbtest_ctx *test_ctx,
+					  const char *expr)
+{
+	struct ldb_result *res = NULL;
+	const char *attrs[] = { "uid", NULL };
+	unsigned int count;
+	int ret;
+
+	ret = ldb_search(test_ctx->ldb, test_ctx, &res, NULL,
+			 LDB_SCOPE_SUBTREE, attrs, "%s", expr);
+	assert_int_equal(ret, LDB_SUCCESS);
+	count = res->count;
+	TALLOC_FREE(res);
+
+	return count;
+}
+
+/*
+ * Index lists of different sizes are intersected and merged, the
+ * results must be the same whichever of them is the shorter one.
+ */
+static void test_ldb_index_intersect(void **state)
+{
+	struct ldbtest_ctx *test_ctx = talloc_get_type_abort(*state,
+							struct ldbtest_ctx);
+
+	assert_int_equal(index_intersect_count(test_ctx,
+			"(&(parity=even)(third=0))"), 34);
+	assert_int_equal(index_intersect_count(test_ctx,
+			"(&(third=0)(parity=even))"), 34);
+	assert_int_equal(index_intersect_count(test_ctx,
+			"(&(parity=odd)(third=2)(parity=odd))"), 33);
+	assert_int_equal(index_intersect_count(test_ctx,
+			"(&(parity=odd)(|(uid=uid7)(uid=uid8)(uid=uid9)))"), 2);
+	assert_int_equal(index_intersect_count(test_ctx,
+			"(&(parity=odd)(parity=even))"), 0);
+	assert_int_equal(index_intersect_count(test_ctx,
+			"(|(parity=even)(third=0))"), 133);
+	assert_int_equal(index_intersect_count(test_ctx,
+			"(&(|(third=1)(third=2))(|(parity=even)(uid=uid3)))"),
+			 66);
+}
+
+/*
+ * The AND planner starts with the smallest index list and stops
+ * loading lists once few enough candidates are left, the explain
+ * control shows the plan.
+ */
+static void test_ldb_index_and_explain(void **state)
+{
+	struct ldbtest_ctx *test_ctx = talloc_get_type_abort(*state,
+							struct ldbtest_ctx);
+	TALLOC_CTX *tmp_ctx = talloc_new(test_ctx);
+	const char *control_strings[] = { "explain:1", NULL };
+	const char *attrs[] = { "uid", NULL };
+	struct ldb_control **ctrls = NULL;
+	struct ldb_request *req = NULL;
+	struct ldb_result *res = NULL;
+	struct ldb_search_explain_control *explain = NULL;
+	unsigned int i;
+	int ret;
+
+	assert_non_null(tmp_ctx);
+
+	ctrls = ldb_parse_control_strings(test_ctx->ldb, tmp_ctx,
+					  control_strings);
+	assert_non_null(ctrls);
+
+	res = talloc_zero(tmp_ctx, struct ldb_result);
+	assert_non_null(res);
+
+	ret = ldb_build_search_req(&req, test_ctx->ldb, tmp_ctx,
+				   NULL, LDB_SCOPE_SUBTREE,
+				   "(&(parity=even)(third=0)(uid=uid12))",
+				   attrs, ctrls,
+				   res, ldb_search_default_callback,
+				   NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	ret = ldb_request(test_ctx->ldb, req);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_wait(req->handle, LDB_WAIT_ALL);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	assert_int_equal(res->count, 1);
+	assert_non_null(res->controls);
+
+	for (i = 0; res->controls[i] != NULL; i++) {
+		if (strcmp(res->controls[i]->oid,
+			   LDB_CONTROL_SEARCH_EXPLAIN_OID) == 0) {
+			explain = talloc_get_type(
+				res->controls[i]->data,
+				struct ldb_search_explain_control);
+		}
+	}
+	assert_non_null(explain);
+
+	assert_non_null(strstr(explain->plan,
+			       "and: (uid=uid12) estimate 1\n"
+			       "and: (third=0) estimate 67\n"
+			       "and: (parity=even) estimate 100\n"
+			       "and: (uid=uid12) loaded 1\n"
+			       "and: stopped with 1 candidates, "
+			       "2 terms left to the filter\n"));
+
+	TALLOC_FREE(tmp_ctx);
+}
+
+/*
+ * Unindexed searches and re-indexing with the records unpacked in
+ * helper threads give the same result as the inline scan
+ */
+static void test_ldb_scan_threads(void **state)
+{
+	struct ldbtest_ctx *test_ctx = talloc_get_type_abort(*state,
+							struct ldbtest_ctx);
+	TALLOC_CTX *tmp_ctx = talloc_new(test_ctx);
+	const char *thread_options[] = { "scan_threads:3", NULL };
+	const char *no_scan_options[] = {
+		"disable_full_db_scan_for_self_test:1", NULL
+	};
+	const char *attrs[] = { "uid", NULL };
+	struct ldb_context *ldb = NULL;
+	struct ldb_context *no_scan_ldb = NULL;
+	struct ldb_result *res = NULL;
+	struct ldb_result *res_threads = NULL;
+	struct ldb_message *msg = NULL;
+	unsigned int i;
+	int ret;
+
+	assert_non_null(tmp_ctx);
+
+	ldb = ldb_init(tmp_ctx, test_ctx->ev);
+	assert_non_null(ldb);
+	ret = ldb_connect(ldb, test_ctx->dbpath, 0, thread_options);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	/* substring matches are not indexed */
+	ret = ldb_search(test_ctx->ldb, tmp_ctx, &res, NULL,
+			 LDB_SCOPE_SUBTREE, attrs, "(uid=uid1*)");
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(res->count, 111);
+
+	ret = ldb_search(ldb, tmp_ctx, &res_threads, NULL,
+			 LDB_SCOPE_SUBTREE, attrs, "(uid=uid1*)");
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(res_threads->count, res->count);
+
+	for (i = 0; i < res->count; i++) {
+		assert_int_equal(ldb_dn_compare(res->msgs[i]->dn,
+						res_threads->msgs[i]->dn),
+				 0);
+		assert_string_equal(
+			ldb_msg_find_attr_as_string(res->msgs[i],
+						    "uid", NULL),
+			ldb_msg_find_attr_as_string(res_threads->msgs[i],
+						    "uid", NULL));
+		assert_int_equal(res_threads->msgs[i]->num_elements, 1);
+	}
+
+	/*
+	 * Changing the index list re-indexes the database, the
+	 * existing indexes have to be rebuilt as well
+	 */
+	msg = ldb_msg_new(tmp_ctx);
+	assert_non_null(msg);
+	msg->dn = ldb_dn_new(msg, ldb, "@INDEXLIST");
+	assert_non_null(msg->dn);
+	ret = ldb_msg_add_empty(msg, "@IDXATTR", LDB_FLAG_MOD_ADD, NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_msg_add_string(msg, "@IDXATTR", "cn");
+	assert_int_equal(ret, LDB_SUCCESS);
+	ret = ldb_modify(ldb, msg);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	no_scan_ldb = ldb_init(tmp_ctx, test_ctx->ev);
+	assert_non_null(no_scan_ldb);
+	ret = ldb_connect(no_scan_ldb, test_ctx->dbpath, 0, no_scan_options);
+	assert_int_equal(ret, LDB_SUCCESS);
+
+	TALLOC_FREE(res);
+	ret = ldb_search(no_scan_ldb, tmp_ctx, &res, NULL,
+			 LDB_SCOPE_SUBTREE, attrs, "(uid=uid150)");
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(res->count, 1);
+	assert_string_equal(ldb_msg_find_attr_as_string(res->msgs[0],
+							"uid", NULL),
+			    "uid150");
+
+	TALLOC_FREE(res);
+	ret = ldb_search(no_scan_ldb, tmp_ctx, &res, NULL,
+			 LDB_SCOPE_SUBTREE, attrs, "(&(parity=odd)(third=2))");
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(res->count, 33);
+
+	TALLOC_FREE(tmp_ctx);
+}
+
+/*
+ * Only the attributes asked for and the ones in the filter are
+ * unpacked from the records, make sure the filter still sees the
+ * attributes that are not returned.
+ */
+static void test_ldb_search_unpack_attrs(void **state)
+{
+	struct ldbtest_ctx *test_ctx = talloc_get_type_abort(*state,
+							struct ldbtest_ctx);
+	TALLOC_CTX *tmp_ctx = talloc_new(test_ctx);
+	const char *uid_attrs[] = { "uid", NULL };
+	const char *third_attrs[] = { "third", NULL };
+	const char *dn_attrs[] = { "distinguishedName", NULL };
+	const char *all_attrs[] = { "*", NULL };
+	struct ldb_dn *base = NULL;
+	struct ldb_result *res = NULL;
+	unsigned int i;
+	int ret;
+
+	assert_non_null(tmp_ctx);
+
+	/* indexed */
+	ret = ldb_search(test_ctx->ldb, tmp_ctx, &res, NULL,
+			 LDB_SCOPE_SUBTREE, uid_attrs,
+			 "(&(parity=odd)(third=2))");
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(res->count, 33);
+	for (i = 0; i < res->count; i++) {
+		assert_int_equal(res->msgs[i]->num_elements, 1);
+		assert_string_equal(res->msgs[i]->elements[0].name, "uid");
+	}
+	TALLOC_FREE(res);
+
+	/* a full scan, as substring matches are not indexed */
+	ret = ldb_search(test_ctx->ldb, tmp_ctx, &res, NULL,
+			 LDB_SCOPE_SUBTREE, third_attrs,
+			 "(&(uid=uid1*)(!(parity=even)))");
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(res->count, 56);
+	for (i = 0; i < res->count; i++) {
+		assert_int_equal(res->msgs[i]->num_elements, 1);
+		assert_string_equal(res->msgs[i]->elements[0].name, "third");
+	}
+	TALLOC_FREE(res);
+
+	base = ldb_dn_new(tmp_ctx, test_ctx->ldb, "cn=intersect7,dc=test");
+	assert_non_null(base);
+
+	ret = ldb_search(test_ctx->ldb, tmp_ctx, &res, base,
+			 LDB_SCOPE_BASE, dn_attrs, "(parity=odd)");
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(res->count, 1);
+	assert_int_equal(res->msgs[0]->num_elements, 1);
+	assert_string_equal(res->msgs[0]->elements[0].name,
+			    "distinguishedName");
+	TALLOC_FREE(res);
+
+	ret = ldb_search(test_ctx->ldb, tmp_ctx, &res, base,
+			 LDB_SCOPE_BASE, dn_attrs, "(parity=even)");
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(res->count, 0);
+	TALLOC_FREE(res);
+
+	ret = ldb_search(test_ctx->ldb, tmp_ctx, &res, base,
+			 LDB_SCOPE_BASE, all_attrs, "(uid=uid7)");
+	assert_int_equal(ret, LDB_SUCCESS);
+	assert_int_equal(res->count, 1);
+	/* objectUUID, parity, third, uid and distinguishedName */
+	assert_int_equal(res->msgs[0]->num_elements, 5);
+
+	TALLOC_FREE(tmp_ctx);
+}
+
 static int ldb_read_only_setup(void **state)
 {
 	struct ldbtest_ctx *test_ctx;
@@ -4589,6 +4987,9 @@ int main(int argc, const char **argv)
 		cmocka_unit_test_setup_teardown(test_search_match_filter,
 						ldb_search_test_setup,
 						ldb_search_test_teardown),
+		cmocka_unit_test_setup_teardown(test_search_match_filter_dn,
+						ldb_search_test_setup,
+						ldb_search_test_teardown),
 		cmocka_unit_test_setup_teardown(test_search_match_both,
 						ldb_search_test_setup,
 						ldb_search_test_teardown),
@@ -4652,6 +5053,18 @@ int main(int argc, const char **argv)
 		cmocka_unit_test_setup_teardown(test_ldb_rename_dn_case_change,
 						ldb_rename_test_setup,
 						ldb_rename_test_teardown),
+		cmocka_unit_test_setup_teardown(test_ldb_index_intersect,
+						ldb_index_intersect_test_setup,
+						ldb_index_intersect_test_teardown),
+		cmocka_unit_test_setup_teardown(test_ldb_index_and_explain,
+						ldb_index_intersect_test_setup,
+						ldb_index_intersect_test_teardown),
+		cmocka_unit_test_setup_teardown(test_ldb_scan_threads,
+						ldb_index_intersect_test_setup,
+						ldb_index_intersect_test_teardown),
+		cmocka_unit_test_setup_teardown(test_ldb_search_unpack_attrs,
+						ldb_index_intersect_test_setup,
+						ldb_index_intersect_test_teardown),
 		cmocka_unit_test_setup_teardown(test_read_only,
 						ldb_read_only_setup,
 						ldb_read_only_teardown),
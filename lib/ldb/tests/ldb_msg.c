@@ -363,6 +363,124 @@ static void test_ldb_msg_find_common_values(void **state)
 }
 
 
+/*
+ * ldb_unpack_data_attrs() has to skip the attributes not asked for in
+ * both packing formats, keeping the others as ldb_unpack_data_flags()
+ * would return them.
+ */
+static void test_ldb_unpack_data_attrs(void **state)
+{
+	struct test_ctx *test_ctx = talloc_get_type_abort(*state,
+							  struct test_ctx);
+	struct ldb_context *ldb = ldb_init(test_ctx, NULL);
+	struct ldb_message *msg = test_ctx->msg;
+	const char *cn_member[] = { "member", "CN", NULL };
+	const char *none[] = { NULL };
+	const char *missing[] = { "missing", NULL };
+	uint32_t formats[] = { LDB_PACKING_FORMAT, LDB_PACKING_FORMAT_V2 };
+	struct ldb_val photo;
+	unsigned int f, i;
+	int ret;
+
+	assert_non_null(ldb);
+
+	msg->dn = ldb_dn_new(msg, ldb, "cn=test,dc=samba,dc=org");
+	assert_non_null(msg->dn);
+	add_uint_value(test_ctx, msg, "description", 1);
+	add_uint_value(test_ctx, msg, "cn", 2);
+	for (i = 0; i < 300; i++) {
+		add_uint_value(test_ctx, msg, "description", 0x100 + i);
+	}
+	/* needs 32 bit value lengths in the v2 format */
+	photo.length = 70000;
+	photo.data = talloc_zero_size(test_ctx, photo.length);
+	assert_non_null(photo.data);
+	ret = ldb_msg_add_value(msg, "jpegPhoto", &photo, NULL);
+	assert_int_equal(ret, LDB_SUCCESS);
+	for (i = 0; i < 3; i++) {
+		add_uint_value(test_ctx, msg, "member", 0x10 + i);
+	}
+	add_uint_value(test_ctx, msg, "objectClass", 3);
+
+	for (f = 0; f < ARRAY_SIZE(formats); f++) {
+		struct ldb_message *msg2 = NULL;
+		struct ldb_val data;
+		uint8_t *num_values = NULL;
+		uint8_t saved[4];
+
+		ret = ldb_pack_data(ldb, msg, &data, formats[f]);
+		assert_int_equal(ret, 0);
+
+		msg2 = ldb_msg_new(test_ctx);
+		ret = ldb_unpack_data_attrs(ldb, &data, msg2, cn_member,
+					    LDB_UNPACK_DATA_FLAG_NO_VALUES_ALLOC);
+		assert_int_equal(ret, 0);
+		assert_int_equal(ldb_dn_compare(msg->dn, msg2->dn), 0);
+		assert_int_equal(msg2->num_elements, 2);
+		assert_string_equal(msg2->elements[0].name, "cn");
+		assert_true(ldb_msg_element_equal_ordered(
+				    &msg2->elements[0],
+				    ldb_msg_find_element(msg, "cn")));
+		assert_string_equal(msg2->elements[1].name, "member");
+		assert_true(ldb_msg_element_equal_ordered(
+				    &msg2->elements[1],
+				    ldb_msg_find_element(msg, "member")));
+		TALLOC_FREE(msg2);
+
+		msg2 = ldb_msg_new(test_ctx);
+		ret = ldb_unpack_data_attrs(ldb, &data, msg2, none, 0);
+		assert_int_equal(ret, 0);
+		assert_non_null(msg2->dn);
+		assert_int_equal(msg2->num_elements, 0);
+		TALLOC_FREE(msg2);
+
+		msg2 = ldb_msg_new(test_ctx);
+		ret = ldb_unpack_data_attrs(ldb, &data, msg2, missing, 0);
+		assert_int_equal(ret, 0);
+		assert_int_equal(msg2->num_elements, 0);
+		TALLOC_FREE(msg2);
+
+		msg2 = ldb_msg_new(test_ctx);
+		ret = ldb_unpack_data_attrs(ldb, &data, msg2, NULL, 0);
+		assert_int_equal(ret, 0);
+		assert_int_equal(msg2->num_elements, msg->num_elements);
+		for (i = 0; i < msg->num_elements; i++) {
+			assert_true(ldb_msg_element_equal_ordered(
+					    &msg2->elements[i],
+					    &msg->elements[i]));
+		}
+		TALLOC_FREE(msg2);
+
+		/*
+		 * A value count far beyond the record has to fail in
+		 * both the skipped and the unpacked case
+		 */
+		num_values = memmem(data.data, data.length,
+				    "description", sizeof("description"));
+		assert_non_null(num_values);
+		num_values += sizeof("description");
+		memcpy(saved, num_values, sizeof(saved));
+		memset(num_values, 0xff, sizeof(saved));
+		msg2 = ldb_msg_new(test_ctx);
+		ret = ldb_unpack_data_attrs(ldb, &data, msg2, none, 0);
+		assert_int_not_equal(ret, 0);
+		TALLOC_FREE(msg2);
+		msg2 = ldb_msg_new(test_ctx);
+		ret = ldb_unpack_data_attrs(ldb, &data, msg2, NULL, 0);
+		assert_int_not_equal(ret, 0);
+		TALLOC_FREE(msg2);
+		memcpy(num_values, saved, sizeof(saved));
+
+		/* a truncated record has to fail, even in skipped values */
+		data.length -= 3;
+		msg2 = ldb_msg_new(test_ctx);
+		ret = ldb_unpack_data_attrs(ldb, &data, msg2, none, 0);
+		assert_int_not_equal(ret, 0);
+		TALLOC_FREE(msg2);
+
+		talloc_free(data.data);
+	}
+}
 
 int main(int argc, const char **argv)
 {
@@ -374,6 +492,10 @@ int main(int argc, const char **argv)
 			test_ldb_msg_find_common_values,
 			ldb_msg_setup,
 			ldb_msg_teardown),
+		cmocka_unit_test_setup_teardown(
+			test_ldb_unpack_data_attrs,
+			ldb_msg_setup,
+			ldb_msg_teardown),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
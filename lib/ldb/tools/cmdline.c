@@ -679,6 +679,22 @@ int handle_controls_reply(struct ldb_control **reply, struct ldb_control **reque
 			continue;
 		}
 
+		if (strcmp(LDB_CONTROL_SEARCH_EXPLAIN_OID, reply[i]->oid) == 0) {
+			struct ldb_search_explain_control *rep_control;
+
+			rep_control = talloc_get_type(reply[i]->data, struct ldb_search_explain_control);
+			if (rep_control == NULL) {
+				fprintf(stderr,
+					"Warning EXPLAIN reply OID "
+					"received with no data\n");
+				continue;
+			}
+
+			fprintf(stderr, "Search plan:\n%s", rep_control->plan);
+
+			continue;
+		}
+
 		if (strcmp(LDB_CONTROL_DIRSYNC_OID, reply[i]->oid) == 0) {
 			struct ldb_dirsync_control *rep_control, *req_control;
 			char *cookie;
@@ -31,10 +31,28 @@
 
 #include <assert.h>
 
+#if defined(HAVE_PTHREAD_ATTR_SETAFFINITY_NP) && \
+	defined(HAVE_SCHED_GETCPU) && defined(HAVE_SCHED_GETAFFINITY)
+#define PTHREADPOOL_WITH_AFFINITY 1
+#include <sched.h>
+#endif
+
+/*
+ * With PTHREADPOOL_AFFINITY_NODE a worker looks that far into the
+ * queue for a job from its own node. The job at the head of the
+ * queue is passed over at most that many times.
+ */
+#define PTHREADPOOL_NODE_SCAN 16
+
 struct pthreadpool_job {
 	int id;
 	void (*fn)(void *private_data);
 	void *private_data;
+
+	/*
+	 * NUMA node of the submitter, -1 if unknown
+	 */
+	int node;
 };
 
 struct pthreadpool {
@@ -62,6 +80,23 @@ struct pthreadpool {
 	size_t head;
 	size_t num_jobs;
 
+	/*
+	 * How often the job at head was passed over for a job
+	 * from the worker's own node
+	 */
+	unsigned head_skips;
+
+	/*
+	 * Placement of new worker threads,
+	 * see pthreadpool_set_affinity()
+	 */
+	enum pthreadpool_affinity affinity;
+#ifdef PTHREADPOOL_WITH_AFFINITY
+	cpu_set_t affinity_cpus;
+	cpu_set_t *node_cpus;
+	unsigned num_nodes;
+#endif
+
 	/*
 	 * Indicate job completion
 	 */
@@ -152,6 +187,14 @@ int pthreadpool_init(unsigned max_threads, struct pthreadpool **presult,
 	}
 
 	pool->head = pool->num_jobs = 0;
+	pool->head_skips = 0;
+
+	pool->affinity = PTHREADPOOL_AFFINITY_NONE;
+#ifdef PTHREADPOOL_WITH_AFFINITY
+	CPU_ZERO(&pool->affinity_cpus);
+	pool->node_cpus = NULL;
+	pool->num_nodes = 0;
+#endif
 
 	ret = pthread_mutex_init(&pool->mutex, NULL);
 	if (ret != 0) {
@@ -242,6 +285,290 @@ size_t pthreadpool_queued_jobs(struct pthreadpool *pool)
 	return ret;
 }
 
+#ifdef PTHREADPOOL_WITH_AFFINITY
+
+/*
+ * Parse a list like "0-7,16-23", the format of
+ * /sys/devices/system/node/node<N>/cpulist
+ */
+static int pthreadpool_parse_cpulist(const char *str, cpu_set_t *set)
+{
+	const char *p = str;
+
+	CPU_ZERO(set);
+
+	while ((*p != '\0') && (*p != '\n')) {
+		unsigned long first, last;
+		char *end = NULL;
+
+		if ((*p < '0') || (*p > '9')) {
+			return EINVAL;
+		}
+
+		errno = 0;
+		first = strtoul(p, &end, 10);
+		if ((end == p) || (errno != 0)) {
+			return EINVAL;
+		}
+		p = end;
+		last = first;
+
+		if (*p == '-') {
+			p += 1;
+			last = strtoul(p, &end, 10);
+			if ((end == p) || (errno != 0)) {
+				return EINVAL;
+			}
+			p = end;
+		}
+
+		if ((last < first) || (last >= CPU_SETSIZE)) {
+			return EINVAL;
+		}
+		for (; first <= last; first++) {
+			CPU_SET(first, set);
+		}
+
+		if (*p == ',') {
+			p += 1;
+			if ((*p == '\0') || (*p == '\n')) {
+				return EINVAL;
+			}
+		} else if ((*p != '\0') && (*p != '\n')) {
+			return EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+#define PTHREADPOOL_MAX_NODES 64
+
+static int pthreadpool_read_nodes(cpu_set_t **pnode_cpus,
+				  unsigned *pnum_nodes)
+{
+	cpu_set_t *node_cpus = NULL;
+	unsigned num_nodes = 0;
+	unsigned node;
+
+	for (node = 0; node < PTHREADPOOL_MAX_NODES; node++) {
+		char path[64];
+		char buf[4096];
+		cpu_set_t *tmp = NULL;
+		FILE *f = NULL;
+		int ret;
+
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%u/cpulist", node);
+
+		f = fopen(path, "r");
+		if (f == NULL) {
+			/*
+			 * Node numbers don't have to be contiguous
+			 */
+			continue;
+		}
+		if (fgets(buf, sizeof(buf), f) == NULL) {
+			buf[0] = '\0';
+		}
+		fclose(f);
+
+		tmp = realloc(node_cpus, sizeof(cpu_set_t) * (node + 1));
+		if (tmp == NULL) {
+			free(node_cpus);
+			return ENOMEM;
+		}
+		node_cpus = tmp;
+
+		for (; num_nodes <= node; num_nodes++) {
+			CPU_ZERO(&node_cpus[num_nodes]);
+		}
+
+		ret = pthreadpool_parse_cpulist(buf, &node_cpus[node]);
+		if (ret != 0) {
+			CPU_ZERO(&node_cpus[node]);
+		}
+	}
+
+	if (num_nodes == 0) {
+		return ENOSYS;
+	}
+
+	*pnode_cpus = node_cpus;
+	*pnum_nodes = num_nodes;
+	return 0;
+}
+
+/*
+ * The NUMA node we're running on right now, -1 if we don't care.
+ * Called with pool->mutex held.
+ */
+static int pthreadpool_current_node(struct pthreadpool *pool)
+{
+	unsigned node;
+	int cpu;
+
+	if (pool->affinity != PTHREADPOOL_AFFINITY_NODE) {
+		return -1;
+	}
+
+	cpu = sched_getcpu();
+	if ((cpu < 0) || (cpu >= CPU_SETSIZE)) {
+		return -1;
+	}
+
+	for (node = 0; node < pool->num_nodes; node++) {
+		if (CPU_ISSET(cpu, &pool->node_cpus[node])) {
+			return node;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Called with pool->mutex held, from the thread that submits the
+ * job that needs a new worker. Returns true if attr now carries a
+ * CPU set.
+ */
+static bool pthreadpool_attr_set_affinity(struct pthreadpool *pool,
+					  pthread_attr_t *attr)
+{
+	cpu_set_t *cpus = NULL;
+	int node;
+	int ret;
+
+	switch (pool->affinity) {
+	case PTHREADPOOL_AFFINITY_NONE:
+		return false;
+	case PTHREADPOOL_AFFINITY_NODE:
+		node = pthreadpool_current_node(pool);
+		if (node == -1) {
+			return false;
+		}
+		cpus = &pool->node_cpus[node];
+		break;
+	case PTHREADPOOL_AFFINITY_CPUS:
+		cpus = &pool->affinity_cpus;
+		break;
+	}
+
+	if ((cpus == NULL) || (CPU_COUNT(cpus) == 0)) {
+		return false;
+	}
+
+	/*
+	 * This only fails for an invalid set size, the CPUs in the
+	 * set are checked by pthread_create().
+	 */
+	ret = pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), cpus);
+	return (ret == 0);
+}
+
+/*
+ * The CPUs this process may run on, applied to the configured sets so
+ * that pthread_create() does not fail with EINVAL for a set the
+ * process can't use.
+ */
+static int pthreadpool_allowed_cpus(cpu_set_t *allowed)
+{
+	int ret;
+
+	ret = sched_getaffinity(0, sizeof(cpu_set_t), allowed);
+	if (ret == -1) {
+		return errno;
+	}
+	return 0;
+}
+
+#else
+
+static int pthreadpool_current_node(struct pthreadpool *pool)
+{
+	return -1;
+}
+
+#endif
+
+int pthreadpool_set_affinity(struct pthreadpool *pool,
+			     enum pthreadpool_affinity affinity,
+			     const char *cpus)
+{
+#ifdef PTHREADPOOL_WITH_AFFINITY
+	cpu_set_t affinity_cpus;
+	cpu_set_t allowed;
+	cpu_set_t *node_cpus = NULL;
+	unsigned num_nodes = 0;
+	unsigned node;
+	int ret;
+
+	CPU_ZERO(&affinity_cpus);
+
+	switch (affinity) {
+	case PTHREADPOOL_AFFINITY_NONE:
+		break;
+	case PTHREADPOOL_AFFINITY_NODE:
+		ret = pthreadpool_allowed_cpus(&allowed);
+		if (ret != 0) {
+			return ret;
+		}
+		ret = pthreadpool_read_nodes(&node_cpus, &num_nodes);
+		if (ret != 0) {
+			return ret;
+		}
+		/*
+		 * Nodes left without a usable CPU are treated as
+		 * unknown, workers created from there are not bound.
+		 */
+		for (node = 0; node < num_nodes; node++) {
+			CPU_AND(&node_cpus[node], &node_cpus[node], &allowed);
+		}
+		break;
+	case PTHREADPOOL_AFFINITY_CPUS:
+		if (cpus == NULL) {
+			return EINVAL;
+		}
+		ret = pthreadpool_parse_cpulist(cpus, &affinity_cpus);
+		if (ret != 0) {
+			return ret;
+		}
+		ret = pthreadpool_allowed_cpus(&allowed);
+		if (ret != 0) {
+			return ret;
+		}
+		CPU_AND(&affinity_cpus, &affinity_cpus, &allowed);
+		if (CPU_COUNT(&affinity_cpus) == 0) {
+			return EINVAL;
+		}
+		break;
+	default:
+		return EINVAL;
+	}
+
+	ret = pthread_mutex_lock(&pool->mutex);
+	if (ret != 0) {
+		free(node_cpus);
+		return ret;
+	}
+
+	pool->affinity = affinity;
+	pool->affinity_cpus = affinity_cpus;
+	free(pool->node_cpus);
+	pool->node_cpus = node_cpus;
+	pool->num_nodes = num_nodes;
+
+	ret = pthread_mutex_unlock(&pool->mutex);
+	assert(ret == 0);
+
+	return 0;
+#else
+	if (affinity == PTHREADPOOL_AFFINITY_NONE) {
+		return 0;
+	}
+	return ENOSYS;
+#endif
+}
+
 static void pthreadpool_prepare_pool(struct pthreadpool *pool)
 {
 	int ret;
@@ -395,6 +722,9 @@ static int pthreadpool_free(struct pthreadpool *pool)
 		return ret2;
 	}
 
+#ifdef PTHREADPOOL_WITH_AFFINITY
+	free(pool->node_cpus);
+#endif
 	free(pool->jobs);
 	free(pool);
 
@@ -504,7 +834,8 @@ static void pthreadpool_server_exit(struct pthreadpool *pool)
 }
 
 static bool pthreadpool_get_job(struct pthreadpool *p,
-				struct pthreadpool_job *job)
+				struct pthreadpool_job *job,
+				int node)
 {
 	if (p->stopped) {
 		return false;
@@ -513,9 +844,42 @@ static bool pthreadpool_get_job(struct pthreadpool *p,
 	if (p->num_jobs == 0) {
 		return false;
 	}
+
+	if ((node != -1) &&
+	    (p->jobs[p->head].node != node) &&
+	    (p->head_skips < PTHREADPOOL_NODE_SCAN)) {
+		size_t num = MIN(p->num_jobs, PTHREADPOOL_NODE_SCAN);
+		size_t i;
+
+		for (i = 1; i < num; i++) {
+			size_t idx = (p->head + i) % p->jobs_array_len;
+
+			if (p->jobs[idx].node != node) {
+				continue;
+			}
+
+			/*
+			 * Take the job out of the middle, move the
+			 * ones in front of it up by one.
+			 */
+			*job = p->jobs[idx];
+			for (; i > 0; i--) {
+				size_t dst = (p->head + i) % p->jobs_array_len;
+				size_t src = (p->head + i - 1) %
+					p->jobs_array_len;
+				p->jobs[dst] = p->jobs[src];
+			}
+			p->head = (p->head+1) % p->jobs_array_len;
+			p->num_jobs -= 1;
+			p->head_skips += 1;
+			return true;
+		}
+	}
+
 	*job = p->jobs[p->head];
 	p->head = (p->head+1) % p->jobs_array_len;
 	p->num_jobs -= 1;
+	p->head_skips = 0;
 	return true;
 }
 
@@ -556,6 +920,7 @@ static bool pthreadpool_put_job(struct pthreadpool *p,
 	job->id = id;
 	job->fn = fn;
 	job->private_data = private_data;
+	job->node = pthreadpool_current_node(p);
 
 	p->num_jobs += 1;
 
@@ -570,6 +935,7 @@ static void pthreadpool_undo_put_job(struct pthreadpool *p)
 static void *pthreadpool_server(void *arg)
 {
 	struct pthreadpool *pool = (struct pthreadpool *)arg;
+	int node;
 	int res;
 
 	res = pthread_mutex_lock(&pool->mutex);
@@ -577,6 +943,12 @@ static void *pthreadpool_server(void *arg)
 		return NULL;
 	}
 
+	/*
+	 * With PTHREADPOOL_AFFINITY_NODE we're bound to the node of
+	 * the submitter that created us.
+	 */
+	node = pthreadpool_current_node(pool);
+
 	while (1) {
 		struct timespec ts;
 		struct pthreadpool_job job;
@@ -642,7 +1014,7 @@ static void *pthreadpool_server(void *arg)
 			assert(res == 0);
 		}
 
-		if (pthreadpool_get_job(pool, &job)) {
+		if (pthreadpool_get_job(pool, &job, node)) {
 			int ret;
 
 			/*
@@ -677,10 +1049,31 @@ static void *pthreadpool_server(void *arg)
 	}
 }
 
+static int pthreadpool_thread_attr_init(pthread_attr_t *attr)
+{
+	int res;
+
+	res = pthread_attr_init(attr);
+	if (res != 0) {
+		return res;
+	}
+
+	res = pthread_attr_setdetachstate(attr, PTHREAD_CREATE_DETACHED);
+	if (res != 0) {
+		pthread_attr_destroy(attr);
+		return res;
+	}
+
+	return 0;
+}
+
 static int pthreadpool_create_thread(struct pthreadpool *pool)
 {
 	pthread_attr_t thread_attr;
 	pthread_t thread_id;
+#ifdef PTHREADPOOL_WITH_AFFINITY
+	bool bound = false;
+#endif
 	int res;
 	sigset_t mask, omask;
 
@@ -690,17 +1083,14 @@ static int pthreadpool_create_thread(struct pthreadpool *pool)
 
 	sigfillset(&mask);
 
-	res = pthread_attr_init(&thread_attr);
+	res = pthreadpool_thread_attr_init(&thread_attr);
 	if (res != 0) {
 		return res;
 	}
 
-	res = pthread_attr_setdetachstate(
-		&thread_attr, PTHREAD_CREATE_DETACHED);
-	if (res != 0) {
-		pthread_attr_destroy(&thread_attr);
-		return res;
-	}
+#ifdef PTHREADPOOL_WITH_AFFINITY
+	bound = pthreadpool_attr_set_affinity(pool, &thread_attr);
+#endif
 
 	res = pthread_sigmask(SIG_BLOCK, &mask, &omask);
 	if (res != 0) {
@@ -711,9 +1101,30 @@ static int pthreadpool_create_thread(struct pthreadpool *pool)
 	res = pthread_create(&thread_id, &thread_attr, pthreadpool_server,
 			     (void *)pool);
 
-	assert(pthread_sigmask(SIG_SETMASK, &omask, NULL) == 0);
-
+#ifdef PTHREADPOOL_WITH_AFFINITY
+	if ((res == EINVAL) && bound) {
+		/*
+		 * None of the CPUs is usable anymore, for example
+		 * because the process was moved to another cpuset
+		 * after pthreadpool_set_affinity(). An unbound worker
+		 * is better than no worker at all.
+		 */
+		pthread_attr_destroy(&thread_attr);
+		res = pthreadpool_thread_attr_init(&thread_attr);
+		if (res == 0) {
+			res = pthread_create(&thread_id, &thread_attr,
+					     pthreadpool_server,
+					     (void *)pool);
+			pthread_attr_destroy(&thread_attr);
+		}
+	} else {
+		pthread_attr_destroy(&thread_attr);
+	}
+#else
 	pthread_attr_destroy(&thread_attr);
+#endif
+
+	assert(pthread_sigmask(SIG_SETMASK, &omask, NULL) == 0);
 
 	if (res == 0) {
 		pool->num_threads += 1;
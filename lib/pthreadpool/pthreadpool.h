@@ -71,6 +71,50 @@ size_t pthreadpool_max_threads(struct pthreadpool *pool);
  */
 size_t pthreadpool_queued_jobs(struct pthreadpool *pool);
 
+/**
+ * @brief Placement policies for worker threads
+ */
+enum pthreadpool_affinity {
+	/*
+	 * Workers inherit the CPU set of the thread creating them
+	 */
+	PTHREADPOOL_AFFINITY_NONE = 0,
+
+	/*
+	 * Workers are bound to the NUMA node the submitting thread
+	 * runs on when the worker is created, and prefer jobs that
+	 * were submitted from their own node. As memory is placed
+	 * on the node that touches it first, buffers filled by a job
+	 * end up local to the submitter.
+	 */
+	PTHREADPOOL_AFFINITY_NODE,
+
+	/*
+	 * Workers are bound to a fixed set of CPUs
+	 */
+	PTHREADPOOL_AFFINITY_CPUS,
+};
+
+/**
+ * @brief Set the CPU affinity policy of a pthreadpool
+ *
+ * The policy is applied to threads created after this call. CPUs
+ * the process is not allowed to run on are dropped from the list.
+ * If none of them can be used anymore when a thread is created,
+ * the thread is started without binding it.
+ *
+ * @param[in]	pool		The pool
+ * @param[in]	affinity	The placement policy
+ * @param[in]	cpus		CPU list like "0-7,16-23", only used
+ *				with PTHREADPOOL_AFFINITY_CPUS
+ * @return			success: 0, failure: errno, ENOSYS if
+ *				the platform can't bind threads, EINVAL
+ *				if no CPU of the list can be used
+ */
+int pthreadpool_set_affinity(struct pthreadpool *pool,
+			     enum pthreadpool_affinity affinity,
+			     const char *cpus);
+
 /**
  * @brief Stop a pthreadpool
  *
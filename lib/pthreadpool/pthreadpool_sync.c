@@ -65,6 +65,16 @@ size_t pthreadpool_queued_jobs(struct pthreadpool *pool)
 	return 0;
 }
 
+int pthreadpool_set_affinity(struct pthreadpool *pool,
+			     enum pthreadpool_affinity affinity,
+			     const char *cpus)
+{
+	if (affinity == PTHREADPOOL_AFFINITY_NONE) {
+		return 0;
+	}
+	return ENOSYS;
+}
+
 int pthreadpool_add_job(struct pthreadpool *pool, int job_id,
 			void (*fn)(void *private_data), void *private_data)
 {
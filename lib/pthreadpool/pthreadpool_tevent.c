@@ -121,6 +121,17 @@ size_t pthreadpool_tevent_queued_jobs(struct pthreadpool_tevent *pool)
 	return pthreadpool_queued_jobs(pool->pool);
 }
 
+int pthreadpool_tevent_set_affinity(struct pthreadpool_tevent *pool,
+				    enum pthreadpool_affinity affinity,
+				    const char *cpus)
+{
+	if (pool->pool == NULL) {
+		return EINVAL;
+	}
+
+	return pthreadpool_set_affinity(pool->pool, affinity, cpus);
+}
+
 static int pthreadpool_tevent_destructor(struct pthreadpool_tevent *pool)
 {
 	struct pthreadpool_tevent_job_state *state, *next;
@@ -21,6 +21,7 @@
 #define __PTHREADPOOL_TEVENT_H__
 
 #include <tevent.h>
+#include "pthreadpool.h"
 
 struct pthreadpool_tevent;
 
@@ -29,6 +30,9 @@ int pthreadpool_tevent_init(TALLOC_CTX *mem_ctx, unsigned max_threads,
 
 size_t pthreadpool_tevent_max_threads(struct pthreadpool_tevent *pool);
 size_t pthreadpool_tevent_queued_jobs(struct pthreadpool_tevent *pool);
+int pthreadpool_tevent_set_affinity(struct pthreadpool_tevent *pool,
+				    enum pthreadpool_affinity affinity,
+				    const char *cpus);
 
 struct tevent_req *pthreadpool_tevent_job_send(
 	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
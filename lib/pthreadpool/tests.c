@@ -9,8 +9,10 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <sched.h>
 #include "pthreadpool_pipe.h"
 #include "pthreadpool_tevent.h"
+#include "tevent_executor.h"
 
 static int test_init(void)
 {
@@ -465,8 +467,429 @@ static int test_tevent_1(void)
 	return 0;
 }
 
-int main(void)
+
+static void test_tevent_bench_fn(void *private_data)
+{
+	return;
+}
+
+/*
+ * Not a correctness test: Report how many trivial jobs per second
+ * pthreadpool_tevent gets through with a deep queue.
+ */
+static int test_tevent_bench(unsigned num_threads, unsigned num_jobs)
+{
+	struct tevent_context *ev;
+	struct pthreadpool_tevent *pool;
+	struct tevent_req **reqs;
+	struct timeval start, end;
+	double secs;
+	unsigned i;
+	int ret;
+	bool ok;
+
+	ev = tevent_context_init(NULL);
+	if (ev == NULL) {
+		fprintf(stderr, "tevent_context_init failed\n");
+		return ENOMEM;
+	}
+	reqs = talloc_zero_array(ev, struct tevent_req *, num_jobs);
+	if (reqs == NULL) {
+		TALLOC_FREE(ev);
+		return ENOMEM;
+	}
+	ret = pthreadpool_tevent_init(ev, num_threads, &pool);
+	if (ret != 0) {
+		fprintf(stderr, "pthreadpool_tevent_init failed: %s\n",
+			strerror(ret));
+		TALLOC_FREE(ev);
+		return ret;
+	}
+
+	start = tevent_timeval_current();
+
+	for (i=0; i<num_jobs; i++) {
+		reqs[i] = pthreadpool_tevent_job_send(
+			reqs, ev, pool, test_tevent_bench_fn, NULL);
+		if (reqs[i] == NULL) {
+			fprintf(stderr, "pthreadpool_tevent_job_send failed\n");
+			TALLOC_FREE(ev);
+			return ENOMEM;
+		}
+	}
+
+	for (i=0; i<num_jobs; i++) {
+		ok = tevent_req_poll(reqs[i], ev);
+		if (!ok) {
+			ret = errno;
+			fprintf(stderr, "tevent_req_poll failed: %s\n",
+				strerror(ret));
+			TALLOC_FREE(ev);
+			return ret;
+		}
+		ret = pthreadpool_tevent_job_recv(reqs[i]);
+		TALLOC_FREE(reqs[i]);
+		if (ret != 0) {
+			fprintf(stderr, "job %u failed: %s\n",
+				i, strerror(ret));
+			TALLOC_FREE(ev);
+			return ret;
+		}
+	}
+
+	end = tevent_timeval_current();
+	secs = (end.tv_sec - start.tv_sec) +
+	       (end.tv_usec - start.tv_usec) / 1000000.0;
+
+	printf("pthreadpool_tevent: %u threads: %.0f jobs/sec\n",
+	       num_threads, num_jobs / secs);
+	fflush(stdout);
+
+	TALLOC_FREE(pool);
+	TALLOC_FREE(ev);
+	return 0;
+}
+
+static void test_affinity_fn(void *private_data)
+{
+	int *ran = private_data;
+	*ran = 1;
+}
+
+static int test_affinity(void)
+{
+	char usable[16];
+	char usable_range[48];
+	char unusable[16];
+	struct {
+		enum pthreadpool_affinity affinity;
+		const char *cpus;
+		int ret;
+	} tests[] = {
+		{ PTHREADPOOL_AFFINITY_CPUS, usable, 0 },
+		{ PTHREADPOOL_AFFINITY_CPUS, usable_range, 0 },
+		{ PTHREADPOOL_AFFINITY_NODE, NULL, 0 },
+		{ PTHREADPOOL_AFFINITY_NONE, NULL, 0 },
+		{ PTHREADPOOL_AFFINITY_CPUS, unusable, EINVAL },
+		{ PTHREADPOOL_AFFINITY_CPUS, NULL, EINVAL },
+		{ PTHREADPOOL_AFFINITY_CPUS, "", EINVAL },
+		{ PTHREADPOOL_AFFINITY_CPUS, "x", EINVAL },
+		{ PTHREADPOOL_AFFINITY_CPUS, "3-1", EINVAL },
+		{ PTHREADPOOL_AFFINITY_CPUS, "0,", EINVAL },
+		{ PTHREADPOOL_AFFINITY_CPUS, "1000000", EINVAL },
+	};
+	struct tevent_context *ev;
+	struct pthreadpool_tevent *pool;
+#ifdef CPU_SETSIZE
+	cpu_set_t allowed;
+	int cpu;
+#endif
+	int first = -1;
+	int outside = -1;
+	size_t i;
+	int ret;
+
+#ifdef CPU_SETSIZE
+	/*
+	 * Only CPUs the test may run on can be bound to, pick them
+	 * from our own affinity mask.
+	 */
+	ret = sched_getaffinity(0, sizeof(allowed), &allowed);
+	if (ret == 0) {
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &allowed)) {
+				if (first == -1) {
+					first = cpu;
+				}
+			} else if (outside == -1) {
+				outside = cpu;
+			}
+		}
+	}
+#endif
+	if (first == -1) {
+		printf("no usable CPU found, skipping\n");
+		return 0;
+	}
+
+	snprintf(usable, sizeof(usable), "%d", first);
+	snprintf(usable_range, sizeof(usable_range), "%d-%d,%d",
+		 first, first, first);
+	if (outside != -1) {
+		snprintf(unusable, sizeof(unusable), "%d", outside);
+	} else {
+		/* all CPUs are usable, take one beyond CPU_SETSIZE */
+		snprintf(unusable, sizeof(unusable), "1000000");
+	}
+
+	ev = tevent_context_init(NULL);
+	if (ev == NULL) {
+		fprintf(stderr, "tevent_context_init failed\n");
+		return ENOMEM;
+	}
+	ret = pthreadpool_tevent_init(ev, 2, &pool);
+	if (ret != 0) {
+		fprintf(stderr, "pthreadpool_tevent_init failed: %s\n",
+			strerror(ret));
+		TALLOC_FREE(ev);
+		return ret;
+	}
+
+	ret = pthreadpool_tevent_set_affinity(
+		pool, PTHREADPOOL_AFFINITY_CPUS, usable);
+	if (ret == ENOSYS) {
+		printf("thread affinity not supported, skipping\n");
+		TALLOC_FREE(ev);
+		return 0;
+	}
+
+	for (i=0; i<sizeof(tests)/sizeof(tests[0]); i++) {
+		struct tevent_req *req;
+		int ran = 0;
+
+		ret = pthreadpool_tevent_set_affinity(
+			pool, tests[i].affinity, tests[i].cpus);
+		if ((ret == ENOSYS) &&
+		    (tests[i].affinity == PTHREADPOOL_AFFINITY_NODE)) {
+			/* no NUMA information in /sys */
+			continue;
+		}
+		if (ret != tests[i].ret) {
+			fprintf(stderr, "test %zu: got %d, expected %d\n",
+				i, ret, tests[i].ret);
+			TALLOC_FREE(ev);
+			return EINVAL;
+		}
+		if (ret != 0) {
+			continue;
+		}
+
+		req = pthreadpool_tevent_job_send(
+			ev, ev, pool, test_affinity_fn, &ran);
+		if (req == NULL) {
+			TALLOC_FREE(ev);
+			return ENOMEM;
+		}
+		if (!tevent_req_poll(req, ev)) {
+			ret = errno;
+			TALLOC_FREE(ev);
+			return ret;
+		}
+		ret = pthreadpool_tevent_job_recv(req);
+		TALLOC_FREE(req);
+		if ((ret != 0) || (ran != 1)) {
+			fprintf(stderr, "test %zu: job failed\n", i);
+			TALLOC_FREE(ev);
+			return EINVAL;
+		}
+	}
+
+	TALLOC_FREE(pool);
+	TALLOC_FREE(ev);
+	return 0;
+}
+
+struct test_executor_job {
+	unsigned busy_msecs;
+	unsigned msecs;
+	pthread_t thread;
+	bool done;
+};
+
+struct test_executor_sleep_state {
+	struct test_executor_job *job;
+};
+
+static void test_executor_sleep_done(struct tevent_context *ev,
+				     struct tevent_timer *te,
+				     struct timeval current_time,
+				     void *private_data)
+{
+	struct tevent_req *req = talloc_get_type_abort(
+		private_data, struct tevent_req);
+	tevent_req_done(req);
+}
+
+static struct tevent_req *test_executor_sleep_send(TALLOC_CTX *mem_ctx,
+						   struct tevent_context *ev,
+						   void *private_data)
+{
+	struct tevent_req *req;
+	struct test_executor_sleep_state *state;
+	struct tevent_timer *te;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct test_executor_sleep_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->job = private_data;
+	state->job->thread = pthread_self();
+
+	/*
+	 * Keep the worker busy, so that the others get a chance
+	 */
+	poll(NULL, 0, state->job->busy_msecs);
+
+	te = tevent_add_timer(ev, state,
+			      tevent_timeval_current_ofs(
+				      0, state->job->msecs * 1000),
+			      test_executor_sleep_done, req);
+	if (tevent_req_nomem(te, req)) {
+		return tevent_req_post(req, ev);
+	}
+	return req;
+}
+
+static int test_executor_sleep_recv(struct tevent_req *req,
+				    void *private_data)
+{
+	struct test_executor_job *job = private_data;
+
+	if (tevent_req_is_in_progress(req)) {
+		return EINVAL;
+	}
+	job->done = true;
+	return 0;
+}
+
+static int test_executor(unsigned num_threads, unsigned num_jobs)
+{
+	struct tevent_context *ev;
+	struct tevent_executor *executor;
+	struct test_executor_job *jobs;
+	struct tevent_req **reqs;
+	struct tevent_req *req;
+	unsigned i, j, num_threads_seen = 0;
+	int ret;
+	bool ok;
+
+	ev = tevent_context_init(NULL);
+	if (ev == NULL) {
+		fprintf(stderr, "tevent_context_init failed\n");
+		return ENOMEM;
+	}
+	jobs = talloc_zero_array(ev, struct test_executor_job, num_jobs);
+	reqs = talloc_zero_array(ev, struct tevent_req *, num_jobs);
+	if ((jobs == NULL) || (reqs == NULL)) {
+		TALLOC_FREE(ev);
+		return ENOMEM;
+	}
+
+	ret = tevent_executor_init(ev, num_threads, &executor);
+	if (ret != 0) {
+		fprintf(stderr, "tevent_executor_init failed: %s\n",
+			strerror(ret));
+		TALLOC_FREE(ev);
+		return ret;
+	}
+
+	for (i=0; i<num_jobs; i++) {
+		jobs[i].busy_msecs = 1;
+		jobs[i].msecs = 10;
+		reqs[i] = tevent_executor_job_send(
+			reqs, ev, executor, test_executor_sleep_send,
+			test_executor_sleep_recv, &jobs[i]);
+		if (reqs[i] == NULL) {
+			fprintf(stderr, "tevent_executor_job_send failed\n");
+			TALLOC_FREE(ev);
+			return ENOMEM;
+		}
+	}
+
+	for (i=0; i<num_jobs; i++) {
+		ok = tevent_req_poll(reqs[i], ev);
+		if (!ok) {
+			ret = errno;
+			fprintf(stderr, "tevent_req_poll failed: %s\n",
+				strerror(ret));
+			TALLOC_FREE(ev);
+			return ret;
+		}
+		ret = tevent_executor_job_recv(reqs[i]);
+		TALLOC_FREE(reqs[i]);
+		if (ret != 0) {
+			fprintf(stderr, "job %u failed: %s\n",
+				i, strerror(ret));
+			TALLOC_FREE(ev);
+			return ret;
+		}
+		if (!jobs[i].done) {
+			fprintf(stderr, "job %u not done\n", i);
+			TALLOC_FREE(ev);
+			return EINVAL;
+		}
+	}
+
+	for (i=0; i<num_jobs; i++) {
+		for (j=0; j<i; j++) {
+			if (pthread_equal(jobs[i].thread, jobs[j].thread)) {
+				break;
+			}
+		}
+		if (j == i) {
+			num_threads_seen += 1;
+		}
+	}
+	if ((num_threads > 1) && (num_jobs > 1) && (num_threads_seen < 2)) {
+		fprintf(stderr, "jobs ran on %u threads only\n",
+			num_threads_seen);
+		TALLOC_FREE(ev);
+		return EINVAL;
+	}
+
+	/*
+	 * Free requests while their jobs are queued or running, then
+	 * the executor with jobs still running.
+	 */
+	for (i=0; i<num_jobs; i++) {
+		jobs[i].busy_msecs = 0;
+		jobs[i].msecs = 1000;
+		reqs[i] = tevent_executor_job_send(
+			reqs, ev, executor, test_executor_sleep_send,
+			test_executor_sleep_recv, &jobs[i]);
+		if (reqs[i] == NULL) {
+			fprintf(stderr, "tevent_executor_job_send failed\n");
+			TALLOC_FREE(ev);
+			return ENOMEM;
+		}
+	}
+	for (i=0; i<num_jobs; i+=2) {
+		TALLOC_FREE(reqs[i]);
+	}
+	poll(NULL, 0, 10);
+	for (i=1; i<num_jobs; i+=2) {
+		TALLOC_FREE(reqs[i]);
+	}
+	TALLOC_FREE(executor);
+
+	/*
+	 * The canceled jobs are cleaned up by immediates from the
+	 * workers, those are not waited for by tevent_loop_wait().
+	 */
+	req = tevent_wakeup_send(ev, ev, tevent_timeval_current_ofs(0, 10000));
+	if (req == NULL) {
+		fprintf(stderr, "tevent_wakeup_send failed\n");
+		TALLOC_FREE(ev);
+		return ENOMEM;
+	}
+	ok = tevent_req_poll(req, ev);
+	if (!ok) {
+		ret = errno;
+		fprintf(stderr, "tevent_req_poll failed: %s\n",
+			strerror(ret));
+		TALLOC_FREE(ev);
+		return ret;
+	}
+	TALLOC_FREE(req);
+
+	TALLOC_FREE(ev);
+	return 0;
+}
+
+int main(int argc, const char *argv[])
 {
+	unsigned i;
 	int ret;
 
 	ret = test_tevent_1();
@@ -476,6 +899,43 @@ int main(void)
 		return 1;
 	}
 
+	ret = test_affinity();
+	if (ret != 0) {
+		fprintf(stderr, "test_affinity failed: %s\n",
+			strerror(ret));
+		return 1;
+	}
+
+	if ((argc > 1) && (strcmp(argv[1], "bench") == 0)) {
+		/*
+		 * Benchmarks only run with "pthreadpooltest bench",
+		 * not as part of the normal test run.
+		 */
+		for (i=1; i<=8; i*=2) {
+			ret = test_tevent_bench(i, 50000);
+			if (ret != 0) {
+				fprintf(stderr,
+					"test_tevent_bench failed: %s\n",
+					strerror(ret));
+				return 1;
+			}
+		}
+	}
+
+	ret = test_executor(0, 10);
+	if (ret != 0) {
+		fprintf(stderr, "test_executor failed: %s\n",
+			strerror(ret));
+		return 1;
+	}
+
+	ret = test_executor(4, 100);
+	if (ret != 0) {
+		fprintf(stderr, "test_executor failed: %s\n",
+			strerror(ret));
+		return 1;
+	}
+
 	ret = test_init();
 	if (ret != 0) {
 		fprintf(stderr, "test_init failed\n");
@@ -0,0 +1,739 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Run tevent requests on a set of threads with their own event loops
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replace.h"
+#ifdef HAVE_PTHREAD
+#include "system/threads.h"
+#endif
+#include "tevent_executor.h"
+#include "lib/util/tevent_unix.h"
+#include "lib/util/dlinklist.h"
+
+struct tevent_executor_job_state;
+
+/*
+ * A job is either on the queue of a worker or on the running list
+ * of the worker that started it. The job state itself is linked
+ * into executor->jobs, so we need a second set of list pointers.
+ */
+struct tevent_executor_qlink {
+	struct tevent_executor_qlink *prev, *next;
+	struct tevent_executor_job_state *state;
+};
+
+struct tevent_executor_worker {
+	struct tevent_executor *executor;
+
+	/*
+	 * Protected by executor->mutex
+	 */
+	struct tevent_executor_qlink *queue;
+	bool ready;
+	int init_ret;
+	bool wakeup_pending;
+	bool idle;
+	bool stop;
+
+	/*
+	 * Allocated by the worker thread. tctx and wakeup_im are
+	 * used by the main thread to wake up the worker, everything
+	 * else is only touched by the worker itself.
+	 */
+	struct tevent_context *ev;
+	struct tevent_threaded_context *tctx;
+	struct tevent_immediate *wakeup_im;
+	struct tevent_immediate *dispatch_im;
+	struct tevent_executor_qlink *running;
+	bool wakeup_seen;
+	bool exit_loop;
+
+#ifdef HAVE_PTHREAD
+	pthread_t tid;
+#endif
+};
+
+struct tevent_executor {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;
+	pthread_cond_t ready_cond;
+#endif
+	struct tevent_executor_worker *workers;
+	size_t num_workers;
+	size_t num_started;
+	size_t next_worker;
+
+	/*
+	 * All jobs whose completion was not yet delivered, only used
+	 * by the main thread.
+	 */
+	struct tevent_executor_job_state *jobs;
+};
+
+struct tevent_executor_job_state {
+	struct tevent_executor_job_state *prev, *next;
+	struct tevent_executor_qlink qlink;
+	struct tevent_executor *executor;
+	struct tevent_req *req;
+	bool in_flight;
+
+	tevent_executor_send_fn_t send_fn;
+	tevent_executor_recv_fn_t recv_fn;
+	void *private_data;
+
+	struct tevent_threaded_context *tctx;
+	struct tevent_immediate *im;
+
+	/*
+	 * Protected by executor->mutex
+	 */
+	struct tevent_executor_worker *queued_on;
+
+	/*
+	 * Only used by the worker running the job
+	 */
+	struct tevent_executor_worker *running_on;
+	struct tevent_req *subreq;
+	int ret;
+};
+
+#ifdef HAVE_PTHREAD
+
+static void tevent_executor_lock(struct tevent_executor *executor)
+{
+	int ret = pthread_mutex_lock(&executor->mutex);
+	if (ret != 0) {
+		abort();
+	}
+}
+
+static void tevent_executor_unlock(struct tevent_executor *executor)
+{
+	int ret = pthread_mutex_unlock(&executor->mutex);
+	if (ret != 0) {
+		abort();
+	}
+}
+
+static void tevent_executor_job_done(struct tevent_context *ev,
+				     struct tevent_immediate *im,
+				     void *private_data);
+
+/*
+ * Hand the job back to the thread that submitted it. After this
+ * the caller must not touch state anymore.
+ */
+static void tevent_executor_job_finish(struct tevent_executor_job_state *state)
+{
+	tevent_threaded_schedule_immediate(state->tctx, state->im,
+					   tevent_executor_job_done, state);
+}
+
+static void tevent_executor_worker_wakeup(struct tevent_context *ev,
+					  struct tevent_immediate *im,
+					  void *private_data);
+
+/*
+ * Called with executor->mutex held
+ */
+static void tevent_executor_wakeup(struct tevent_executor_worker *w)
+{
+	if (w->wakeup_pending) {
+		return;
+	}
+	w->wakeup_pending = true;
+	tevent_threaded_schedule_immediate(w->tctx, w->wakeup_im,
+					   tevent_executor_worker_wakeup, w);
+}
+
+/*
+ * Called with executor->mutex held. Take the oldest job from our own
+ * queue. If that's empty, steal the newest one from another worker,
+ * that one is the least likely to be picked up there soon.
+ */
+static struct tevent_executor_job_state *tevent_executor_pop_job(
+	struct tevent_executor_worker *w)
+{
+	struct tevent_executor *executor = w->executor;
+	struct tevent_executor_qlink *link = w->queue;
+	struct tevent_executor_job_state *state = NULL;
+	size_t idx = w - executor->workers;
+	size_t i;
+
+	for (i = 1; (link == NULL) && (i < executor->num_workers); i++) {
+		struct tevent_executor_worker *victim =
+			&executor->workers[(idx + i) % executor->num_workers];
+		link = DLIST_TAIL(victim->queue);
+	}
+
+	if (link == NULL) {
+		return NULL;
+	}
+
+	state = link->state;
+	DLIST_REMOVE(state->queued_on->queue, link);
+	state->queued_on = NULL;
+
+	return state;
+}
+
+static void tevent_executor_job_fn_done(struct tevent_req *subreq);
+
+static void tevent_executor_job_start(struct tevent_executor_worker *w,
+				      struct tevent_executor_job_state *state)
+{
+	state->subreq = state->send_fn(w->ev, w->ev, state->private_data);
+	if (state->subreq == NULL) {
+		state->ret = ENOMEM;
+		tevent_executor_job_finish(state);
+		return;
+	}
+	state->running_on = w;
+	DLIST_ADD(w->running, &state->qlink);
+
+	/*
+	 * Don't use tevent_req_callback_data() on state, the main
+	 * thread owns its talloc header.
+	 */
+	tevent_req_set_callback(state->subreq, tevent_executor_job_fn_done,
+				state);
+}
+
+static void tevent_executor_job_fn_done(struct tevent_req *subreq)
+{
+	struct tevent_executor_job_state *state =
+		(struct tevent_executor_job_state *)
+		tevent_req_callback_data_void(subreq);
+	struct tevent_executor_worker *w = state->running_on;
+
+	state->ret = state->recv_fn(subreq, state->private_data);
+	TALLOC_FREE(subreq);
+	state->subreq = NULL;
+
+	DLIST_REMOVE(w->running, &state->qlink);
+	state->running_on = NULL;
+
+	tevent_executor_job_finish(state);
+}
+
+static void tevent_executor_worker_dispatch(struct tevent_context *ev,
+					    struct tevent_immediate *im,
+					    void *private_data)
+{
+	struct tevent_executor_worker *w =
+		(struct tevent_executor_worker *)private_data;
+	struct tevent_executor *executor = w->executor;
+	struct tevent_executor_job_state *state = NULL;
+
+	tevent_executor_lock(executor);
+
+	if (w->wakeup_seen) {
+		w->wakeup_pending = false;
+		w->wakeup_seen = false;
+	}
+
+	if (w->stop) {
+		tevent_executor_unlock(executor);
+		w->exit_loop = true;
+		return;
+	}
+
+	state = tevent_executor_pop_job(w);
+	w->idle = (state == NULL);
+
+	tevent_executor_unlock(executor);
+
+	if (state == NULL) {
+		return;
+	}
+
+	tevent_executor_job_start(w, state);
+
+	/*
+	 * Look for more work in the next round. This gives the
+	 * other events on this loop a chance to run in between, and
+	 * marks us idle once there is nothing left to do.
+	 */
+	tevent_schedule_immediate(w->dispatch_im, w->ev,
+				  tevent_executor_worker_dispatch, w);
+}
+
+static void tevent_executor_worker_wakeup(struct tevent_context *ev,
+					  struct tevent_immediate *im,
+					  void *private_data)
+{
+	struct tevent_executor_worker *w =
+		(struct tevent_executor_worker *)private_data;
+
+	/*
+	 * tevent_threaded_schedule_immediate() aborts if wakeup_im
+	 * is scheduled again while we're in its handler. So
+	 * wakeup_pending is only cleared in the dispatch handler,
+	 * and only after we have been here.
+	 */
+	w->wakeup_seen = true;
+	tevent_schedule_immediate(w->dispatch_im, w->ev,
+				  tevent_executor_worker_dispatch, w);
+}
+
+static int tevent_executor_worker_setup(struct tevent_executor_worker *w)
+{
+	w->ev = tevent_context_init(NULL);
+	if (w->ev == NULL) {
+		return ENOMEM;
+	}
+	w->tctx = tevent_threaded_context_create(w->ev, w->ev);
+	if (w->tctx == NULL) {
+		return errno;
+	}
+	w->wakeup_im = tevent_create_immediate(w->ev);
+	if (w->wakeup_im == NULL) {
+		return ENOMEM;
+	}
+	w->dispatch_im = tevent_create_immediate(w->ev);
+	if (w->dispatch_im == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static void *tevent_executor_worker_main(void *private_data)
+{
+	struct tevent_executor_worker *w =
+		(struct tevent_executor_worker *)private_data;
+	struct tevent_executor *executor = w->executor;
+	int ret;
+
+	/*
+	 * The worker allocates from its own talloc hierarchy, the
+	 * one of the main thread is off limits.
+	 */
+	ret = tevent_executor_worker_setup(w);
+
+	tevent_executor_lock(executor);
+	w->init_ret = ret;
+	w->ready = true;
+	ret = pthread_cond_signal(&executor->ready_cond);
+	if (ret != 0) {
+		abort();
+	}
+	tevent_executor_unlock(executor);
+
+	if (w->init_ret != 0) {
+		TALLOC_FREE(w->ev);
+		return NULL;
+	}
+
+	while (!w->exit_loop) {
+		ret = tevent_loop_once(w->ev);
+		if (ret != 0) {
+			abort();
+		}
+	}
+
+	while (w->running != NULL) {
+		struct tevent_executor_job_state *state = w->running->state;
+
+		DLIST_REMOVE(w->running, &state->qlink);
+		state->running_on = NULL;
+		TALLOC_FREE(state->subreq);
+		state->ret = ECANCELED;
+		tevent_executor_job_finish(state);
+	}
+
+	TALLOC_FREE(w->tctx);
+	TALLOC_FREE(w->ev);
+	return NULL;
+}
+
+static int tevent_executor_create_thread(struct tevent_executor_worker *w)
+{
+	sigset_t mask, omask;
+	int ret;
+
+	/*
+	 * Like the pthreadpool workers, ours should not receive any
+	 * signals.
+	 */
+	sigfillset(&mask);
+
+	ret = pthread_sigmask(SIG_BLOCK, &mask, &omask);
+	if (ret != 0) {
+		return ret;
+	}
+
+	ret = pthread_create(&w->tid, NULL, tevent_executor_worker_main, w);
+
+	if (pthread_sigmask(SIG_SETMASK, &omask, NULL) != 0) {
+		abort();
+	}
+
+	return ret;
+}
+
+static int tevent_executor_destructor(struct tevent_executor *executor)
+{
+	struct tevent_executor_job_state *state = NULL;
+	struct tevent_executor_job_state *next = NULL;
+	size_t i;
+	int ret;
+
+	tevent_executor_lock(executor);
+	for (i = 0; i < executor->num_started; i++) {
+		struct tevent_executor_worker *w = &executor->workers[i];
+
+		w->stop = true;
+		if (w->init_ret == 0) {
+			tevent_executor_wakeup(w);
+		}
+	}
+	tevent_executor_unlock(executor);
+
+	/*
+	 * The workers cancel the jobs they are running on their way
+	 * out.
+	 */
+	for (i = 0; i < executor->num_started; i++) {
+		ret = pthread_join(executor->workers[i].tid, NULL);
+		if (ret != 0) {
+			abort();
+		}
+	}
+
+	for (i = 0; i < executor->num_started; i++) {
+		struct tevent_executor_worker *w = &executor->workers[i];
+
+		while (w->queue != NULL) {
+			state = w->queue->state;
+			DLIST_REMOVE(w->queue, &state->qlink);
+			state->queued_on = NULL;
+			state->ret = ECANCELED;
+			tevent_executor_job_finish(state);
+		}
+	}
+
+	/*
+	 * The completions are still pending, tell the jobs not to
+	 * look at us anymore.
+	 */
+	for (state = executor->jobs; state != NULL; state = next) {
+		next = state->next;
+		DLIST_REMOVE(executor->jobs, state);
+		state->executor = NULL;
+	}
+
+	ret = pthread_cond_destroy(&executor->ready_cond);
+	if (ret != 0) {
+		abort();
+	}
+	ret = pthread_mutex_destroy(&executor->mutex);
+	if (ret != 0) {
+		abort();
+	}
+
+	return 0;
+}
+
+static int tevent_executor_start(struct tevent_executor *executor,
+				 unsigned num_threads)
+{
+	size_t i;
+	int ret;
+
+	executor->workers = talloc_zero_array(
+		executor, struct tevent_executor_worker, num_threads);
+	if (executor->workers == NULL) {
+		return ENOMEM;
+	}
+	executor->num_workers = num_threads;
+
+	ret = pthread_mutex_init(&executor->mutex, NULL);
+	if (ret != 0) {
+		return ret;
+	}
+	ret = pthread_cond_init(&executor->ready_cond, NULL);
+	if (ret != 0) {
+		pthread_mutex_destroy(&executor->mutex);
+		return ret;
+	}
+	talloc_set_destructor(executor, tevent_executor_destructor);
+
+	for (i = 0; i < num_threads; i++) {
+		struct tevent_executor_worker *w = &executor->workers[i];
+
+		w->executor = executor;
+		w->idle = true;
+
+		ret = tevent_executor_create_thread(w);
+		if (ret != 0) {
+			break;
+		}
+		executor->num_started += 1;
+	}
+
+	/*
+	 * Wait for the workers to have their event contexts ready,
+	 * the destructor needs that as well.
+	 */
+	tevent_executor_lock(executor);
+	for (i = 0; i < executor->num_started; i++) {
+		struct tevent_executor_worker *w = &executor->workers[i];
+
+		while (!w->ready) {
+			int err = pthread_cond_wait(&executor->ready_cond,
+						    &executor->mutex);
+			if (err != 0) {
+				abort();
+			}
+		}
+		if ((ret == 0) && (w->init_ret != 0)) {
+			ret = w->init_ret;
+		}
+	}
+	tevent_executor_unlock(executor);
+
+	return ret;
+}
+
+static int tevent_executor_job_state_destructor(
+	struct tevent_executor_job_state *state)
+{
+	struct tevent_executor *executor = state->executor;
+	bool dequeued = false;
+
+	if (!state->in_flight) {
+		return 0;
+	}
+
+	/*
+	 * We should never be called with state->req == NULL,
+	 * state->in_flight must be cleared before the 2nd talloc_free().
+	 */
+	if (state->req == NULL) {
+		abort();
+	}
+
+	if (executor != NULL) {
+		tevent_executor_lock(executor);
+		if (state->queued_on != NULL) {
+			DLIST_REMOVE(state->queued_on->queue, &state->qlink);
+			state->queued_on = NULL;
+			dequeued = true;
+		}
+		tevent_executor_unlock(executor);
+	}
+
+	if (dequeued) {
+		DLIST_REMOVE(executor->jobs, state);
+		state->executor = NULL;
+		state->in_flight = false;
+		return 0;
+	}
+
+	/*
+	 * A worker still has the job, or the completion is already
+	 * on its way. We need to reparent to a long term context,
+	 * tevent_executor_job_done() will free us.
+	 */
+	(void)talloc_reparent(state->req, NULL, state);
+	state->req = NULL;
+	return -1;
+}
+
+static void tevent_executor_job_done(struct tevent_context *ev,
+				     struct tevent_immediate *im,
+				     void *private_data)
+{
+	struct tevent_executor_job_state *state = talloc_get_type_abort(
+		private_data, struct tevent_executor_job_state);
+
+	state->in_flight = false;
+
+	if (state->executor != NULL) {
+		DLIST_REMOVE(state->executor->jobs, state);
+		state->executor = NULL;
+	}
+
+	if (state->req == NULL) {
+		/*
+		 * There was a talloc_free() of state->req while the
+		 * job was pending, we're on a longterm talloc
+		 * context. Just cleanup.
+		 */
+		talloc_free(state);
+		return;
+	}
+
+	if (tevent_req_error(state->req, state->ret)) {
+		return;
+	}
+	tevent_req_done(state->req);
+}
+
+#endif /* HAVE_PTHREAD */
+
+int tevent_executor_init(TALLOC_CTX *mem_ctx, unsigned num_threads,
+			 struct tevent_executor **presult)
+{
+	struct tevent_executor *executor = NULL;
+
+	executor = talloc_zero(mem_ctx, struct tevent_executor);
+	if (executor == NULL) {
+		return ENOMEM;
+	}
+
+#ifdef HAVE_PTHREAD
+	if (num_threads != 0) {
+		int ret = tevent_executor_start(executor, num_threads);
+		if (ret != 0) {
+			TALLOC_FREE(executor);
+			return ret;
+		}
+	}
+#endif
+
+	*presult = executor;
+	return 0;
+}
+
+size_t tevent_executor_num_threads(struct tevent_executor *executor)
+{
+	return executor->num_workers;
+}
+
+static void tevent_executor_job_inline_done(struct tevent_req *subreq);
+
+struct tevent_req *tevent_executor_job_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct tevent_executor *executor,
+	tevent_executor_send_fn_t send_fn,
+	tevent_executor_recv_fn_t recv_fn,
+	void *private_data)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct tevent_executor_job_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct tevent_executor_job_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->req = req;
+	state->send_fn = send_fn;
+	state->recv_fn = recv_fn;
+	state->private_data = private_data;
+	state->qlink.state = state;
+
+	if (executor == NULL) {
+		tevent_req_error(req, EINVAL);
+		return tevent_req_post(req, ev);
+	}
+
+	if (executor->num_workers == 0) {
+		subreq = send_fn(state, ev, private_data);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq,
+					tevent_executor_job_inline_done,
+					req);
+		return req;
+	}
+
+#ifdef HAVE_PTHREAD
+	{
+		struct tevent_executor_worker *w = NULL;
+		size_t i;
+
+		state->im = tevent_create_immediate(state);
+		if (tevent_req_nomem(state->im, req)) {
+			return tevent_req_post(req, ev);
+		}
+
+		state->tctx = tevent_threaded_context_create(state, ev);
+		if (state->tctx == NULL) {
+			tevent_req_error(req, errno);
+			return tevent_req_post(req, ev);
+		}
+
+		state->executor = executor;
+		state->in_flight = true;
+		DLIST_ADD_END(executor->jobs, state);
+
+		/*
+		 * Once the job is queued, we need to protect our
+		 * memory.
+		 */
+		talloc_set_destructor(state,
+				      tevent_executor_job_state_destructor);
+
+		tevent_executor_lock(executor);
+
+		w = &executor->workers[executor->next_worker];
+		executor->next_worker =
+			(executor->next_worker + 1) % executor->num_workers;
+
+		DLIST_ADD_END(w->queue, &state->qlink);
+		state->queued_on = w;
+		tevent_executor_wakeup(w);
+
+		if (!w->idle) {
+			/*
+			 * The worker might be busy with a long running
+			 * handler, give an idle one the chance to steal
+			 * the job.
+			 */
+			for (i = 0; i < executor->num_workers; i++) {
+				struct tevent_executor_worker *o =
+					&executor->workers[i];
+				if (o->idle) {
+					o->idle = false;
+					tevent_executor_wakeup(o);
+					break;
+				}
+			}
+		}
+
+		tevent_executor_unlock(executor);
+	}
+#endif
+
+	return req;
+}
+
+static void tevent_executor_job_inline_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct tevent_executor_job_state *state = tevent_req_data(
+		req, struct tevent_executor_job_state);
+	int ret;
+
+	ret = state->recv_fn(subreq, state->private_data);
+	TALLOC_FREE(subreq);
+	if (tevent_req_error(req, ret)) {
+		return;
+	}
+	tevent_req_done(req);
+}
+
+int tevent_executor_job_recv(struct tevent_req *req)
+{
+	return tevent_req_simple_recv_unix(req);
+}
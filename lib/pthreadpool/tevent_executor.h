@@ -0,0 +1,128 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Run tevent requests on a set of threads with their own event loops
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TEVENT_EXECUTOR_H__
+#define __TEVENT_EXECUTOR_H__
+
+#include <tevent.h>
+
+/**
+ * @defgroup tevent_executor The tevent executor API
+ *
+ * A tevent executor runs a fixed number of threads, each of them
+ * with its own tevent context. Jobs are tevent requests: they are
+ * started on one of the worker loops and their completion is
+ * reported back as a tevent request on the event context of the
+ * submitting thread.
+ *
+ * Every worker has its own queue. New jobs are distributed round
+ * robin, a worker that runs out of work steals queued jobs from the
+ * other workers.
+ *
+ * The executor itself is not thread safe. It has to be created,
+ * used and freed by a single thread. The job functions run in the
+ * worker threads, they must only use the event context and the
+ * talloc hierarchy they got passed and whatever they can safely
+ * reach through private_data.
+ */
+
+struct tevent_executor;
+
+/**
+ * @brief Start the job on a worker event context
+ *
+ * Called in a worker thread. The returned request is allocated from
+ * mem_ctx, which belongs to the worker thread.
+ */
+typedef struct tevent_req *(*tevent_executor_send_fn_t)(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	void *private_data);
+
+/**
+ * @brief Collect the result of a job
+ *
+ * Called in the worker thread once the request returned by the send
+ * function has finished. The request is freed afterwards. Results
+ * that need to go back to the submitter have to be stored in
+ * memory reachable via private_data, not allocated from talloc
+ * contexts of the worker.
+ *
+ * @return 0 on success, an errno value on failure
+ */
+typedef int (*tevent_executor_recv_fn_t)(struct tevent_req *req,
+					 void *private_data);
+
+/**
+ * @brief Create a tevent executor
+ *
+ * @param[in]	mem_ctx		The talloc memory context to use
+ * @param[in]	num_threads	Number of worker threads
+ * @param[out]	presult		The executor
+ * @return			success: 0, failure: errno
+ *
+ * num_threads=0 runs all jobs directly on the event context of the
+ * caller. This is also what happens on platforms without pthreads.
+ */
+int tevent_executor_init(TALLOC_CTX *mem_ctx, unsigned num_threads,
+			 struct tevent_executor **presult);
+
+/**
+ * @brief Get the number of worker threads
+ *
+ * @param[in]	executor	The executor
+ * @return			number of threads, 0 for inline processing
+ */
+size_t tevent_executor_num_threads(struct tevent_executor *executor);
+
+/**
+ * @brief Run a job on one of the workers
+ *
+ * @param[in]	mem_ctx		The talloc memory context to use
+ * @param[in]	ev		The event context to report completion to
+ * @param[in]	executor	The executor
+ * @param[in]	send_fn		Starts the job in the worker
+ * @param[in]	recv_fn		Collects the job result in the worker
+ * @param[in]	private_data	Passed to send_fn and recv_fn
+ * @return			a tevent request, NULL on out of memory
+ *
+ * private_data must stay valid until the request has finished. If
+ * the request is freed before, the job is dequeued if it has not
+ * been started yet. A job that is already running can't be
+ * stopped, it keeps using private_data until it is done or the
+ * executor is freed.
+ */
+struct tevent_req *tevent_executor_job_send(
+	TALLOC_CTX *mem_ctx,
+	struct tevent_context *ev,
+	struct tevent_executor *executor,
+	tevent_executor_send_fn_t send_fn,
+	tevent_executor_recv_fn_t recv_fn,
+	void *private_data);
+
+/**
+ * @brief Get the result of a job
+ *
+ * @param[in]	req		The request from tevent_executor_job_send()
+ * @return			0 or the errno from recv_fn, ECANCELED
+ *				if the executor was freed before the
+ *				job finished
+ */
+int tevent_executor_job_recv(struct tevent_req *req);
+
+#endif
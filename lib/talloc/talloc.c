@@ -259,6 +259,7 @@ static struct talloc_chunk *_vasprintf_tc(const void *t,
 typedef int (*talloc_destructor_t)(void *);
 
 struct talloc_pool_hdr;
+struct talloc_slab_cache;
 
 struct talloc_chunk {
 	/*
@@ -310,6 +311,13 @@ struct talloc_chunk {
 	 * from.
 	 */
 	struct talloc_pool_hdr *pool;
+
+	/*
+	 * Chunks handed out by talloc_slab_alloc() point to the slab
+	 * cache they go back to on talloc_free(). NULL for all other
+	 * chunks, this is also reset if such a chunk is realloced.
+	 */
+	struct talloc_slab_cache *slab;
 };
 
 union talloc_chunk_cast_u {
@@ -733,6 +741,348 @@ static inline struct talloc_chunk *tc_alloc_pool(struct talloc_chunk *parent,
 	return result;
 }
 
+/*
+  Allocation profiling.
+
+  With a sample interval set, __talloc() counts down the allocated
+  bytes and picks an allocation about every "interval" bytes. The
+  chunk is remembered in talloc_profile_thread.pending, the caller
+  sets the name right after the allocation, which is when
+  _tc_set_name_const() hands it over to tc_profile_record().
+  Allocations smaller than the interval stand for interval/size
+  allocations, larger ones are always sampled and counted as they
+  are.
+
+  The countdown is kept per thread, so threads allocating at the same
+  time don't share any state until an allocation is sampled.
+
+  The statistics are kept in a fixed size hash table keyed by the
+  name, which for most chunks is a __location__ or type name string
+  constant. The table keeps its own copy of every name, names set
+  with talloc_set_name() go away with their chunk. Names that don't
+  fit go into an overflow entry. The table is protected by a spin
+  lock, it is only taken for sampled allocations and by the
+  functions below.
+*/
+
+#define TALLOC_PROFILE_TABLE_SIZE 8192
+#define TALLOC_PROFILE_MAX_NAMES (TALLOC_PROFILE_TABLE_SIZE/2)
+
+#ifdef HAVE___THREAD
+#define TALLOC_PROFILE_THREAD __thread
+#else
+#define TALLOC_PROFILE_THREAD
+#endif
+
+struct talloc_profile_slot {
+	char *name;
+	uint32_t hash;
+	struct talloc_profile_entry entry;
+};
+
+static struct {
+	size_t interval;
+	bool locked;
+	size_t num_names;
+	struct talloc_profile_slot *slots;
+	struct talloc_profile_entry other;
+} talloc_profile;
+
+static TALLOC_PROFILE_THREAD struct {
+	/* the interval bytes_left was drawn for */
+	size_t interval;
+	size_t bytes_left;
+	uint32_t rand_state;
+	struct talloc_chunk *pending;
+	size_t pending_size;
+} talloc_profile_thread;
+
+static void tc_profile_lock(void)
+{
+#ifdef HAVE___ATOMIC_ADD_FETCH
+	while (__atomic_test_and_set(&talloc_profile.locked,
+				     __ATOMIC_ACQUIRE)) {
+		/* spin, the lock is only held for a few instructions */
+	}
+#endif
+}
+
+static void tc_profile_unlock(void)
+{
+#ifdef HAVE___ATOMIC_ADD_FETCH
+	__atomic_clear(&talloc_profile.locked, __ATOMIC_RELEASE);
+#endif
+}
+
+static size_t tc_profile_get_interval(void)
+{
+#ifdef HAVE___ATOMIC_ADD_FETCH
+	return __atomic_load_n(&talloc_profile.interval, __ATOMIC_RELAXED);
+#else
+	return talloc_profile.interval;
+#endif
+}
+
+static size_t tc_profile_next_interval(void)
+{
+	uint32_t x = talloc_profile_thread.rand_state;
+	unsigned bits = 0;
+	double log2x, neglog;
+
+	if (x == 0) {
+		/*
+		 * Seed every thread differently, the address of the
+		 * thread local state is good enough for that.
+		 */
+		x = talloc_magic ^ (uint32_t)(uintptr_t)&talloc_profile_thread;
+		x |= 1;
+	}
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	talloc_profile_thread.rand_state = x;
+
+	/*
+	 * Exponentially distributed distances between samples make
+	 * the chance to sample an allocation independent of the
+	 * allocations before it. -ln(x/2^32) is approximated from
+	 * the highest bit set in x and a linear interpolation of the
+	 * bits below, which is good enough here.
+	 */
+	while ((x >> bits) > 1) {
+		bits += 1;
+	}
+	log2x = bits + (double)(x - ((uint32_t)1 << bits)) /
+		((uint32_t)1 << bits);
+	neglog = (32.0 - log2x) * 0.6931471805599453;
+
+	return (size_t)(neglog * talloc_profile_thread.interval) + 1;
+}
+
+static inline void tc_profile_sample(struct talloc_chunk *tc, size_t size)
+{
+	size_t interval;
+
+	talloc_profile_thread.pending = NULL;
+
+	if (likely(size < talloc_profile_thread.bytes_left)) {
+		talloc_profile_thread.bytes_left -= size;
+		return;
+	}
+
+	interval = tc_profile_get_interval();
+	if (interval == 0) {
+		return;
+	}
+
+	if (talloc_profile_thread.interval != interval) {
+		/*
+		 * First allocation of this thread since sampling was
+		 * enabled or the interval changed, start counting.
+		 */
+		talloc_profile_thread.interval = interval;
+		talloc_profile_thread.bytes_left = tc_profile_next_interval();
+		return;
+	}
+
+	talloc_profile_thread.bytes_left = tc_profile_next_interval();
+	talloc_profile_thread.pending = tc;
+	talloc_profile_thread.pending_size = size;
+}
+
+static uint32_t tc_profile_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name != '\0') {
+		h ^= (uint8_t)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/*
+  Called with the lock held
+*/
+static struct talloc_profile_entry *tc_profile_entry(const char *name)
+{
+	size_t mask = TALLOC_PROFILE_TABLE_SIZE - 1;
+	uint32_t hash = tc_profile_hash(name);
+	size_t i = hash & mask;
+
+	while (true) {
+		struct talloc_profile_slot *slot = &talloc_profile.slots[i];
+
+		if (slot->name == NULL) {
+			if (talloc_profile.num_names >=
+			    TALLOC_PROFILE_MAX_NAMES) {
+				return &talloc_profile.other;
+			}
+			slot->name = strdup(name);
+			if (slot->name == NULL) {
+				return &talloc_profile.other;
+			}
+			slot->hash = hash;
+			talloc_profile.num_names++;
+			return &slot->entry;
+		}
+		if ((slot->hash == hash) && (strcmp(slot->name, name) == 0)) {
+			return &slot->entry;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+static void tc_profile_record(struct talloc_chunk *tc, const char *name)
+{
+	size_t size = talloc_profile_thread.pending_size;
+	size_t interval = talloc_profile_thread.interval;
+	struct talloc_profile_entry *e = NULL;
+
+	talloc_profile_thread.pending = NULL;
+
+	if (name == TC_PTR_FROM_CHUNK(tc)) {
+		/*
+		 * talloc_strdup() and friends use the string as name
+		 */
+		name = "char";
+	}
+	if (name == NULL) {
+		name = "UNNAMED";
+	}
+
+	tc_profile_lock();
+
+	if (talloc_profile.slots == NULL) {
+		tc_profile_unlock();
+		return;
+	}
+
+	e = tc_profile_entry(name);
+	e->samples += 1;
+
+	if (size >= interval) {
+		e->alloc_count += 1;
+		e->alloc_bytes += size;
+	} else {
+		e->alloc_count += interval / size;
+		e->alloc_bytes += interval;
+	}
+
+	tc_profile_unlock();
+}
+
+_PUBLIC_ int talloc_profile_set_interval(size_t interval)
+{
+	talloc_profile_thread.pending = NULL;
+
+	tc_profile_lock();
+
+	if ((interval != 0) && (talloc_profile.slots == NULL)) {
+		talloc_profile.slots = calloc(TALLOC_PROFILE_TABLE_SIZE,
+					      sizeof(struct talloc_profile_slot));
+		if (talloc_profile.slots == NULL) {
+			tc_profile_unlock();
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+#ifdef HAVE___ATOMIC_ADD_FETCH
+	__atomic_store_n(&talloc_profile.interval, interval, __ATOMIC_RELAXED);
+#else
+	talloc_profile.interval = interval;
+#endif
+
+	tc_profile_unlock();
+
+	if (interval != 0) {
+		talloc_profile_thread.interval = interval;
+		talloc_profile_thread.bytes_left = tc_profile_next_interval();
+	}
+
+	return 0;
+}
+
+_PUBLIC_ size_t talloc_profile_get_interval(void)
+{
+	return tc_profile_get_interval();
+}
+
+_PUBLIC_ void talloc_profile_reset(void)
+{
+	size_t i;
+
+	talloc_profile_thread.pending = NULL;
+
+	tc_profile_lock();
+
+	if (talloc_profile.slots != NULL) {
+		for (i=0; i<TALLOC_PROFILE_TABLE_SIZE; i++) {
+			free(talloc_profile.slots[i].name);
+		}
+		memset(talloc_profile.slots, 0,
+		       TALLOC_PROFILE_TABLE_SIZE *
+		       sizeof(struct talloc_profile_slot));
+	}
+	talloc_profile.num_names = 0;
+	talloc_profile.other = (struct talloc_profile_entry) { .samples = 0 };
+
+	tc_profile_unlock();
+}
+
+_PUBLIC_ void talloc_profile_walk(talloc_profile_fn_t fn, void *private_data)
+{
+	struct talloc_profile_slot *copy = NULL;
+	struct talloc_profile_entry other;
+	size_t i, num = 0;
+
+	/*
+	 * fn() may allocate and so sample, which needs the lock.
+	 * Call it on a copy of the table taken with the lock held.
+	 */
+	tc_profile_lock();
+
+	if (talloc_profile.slots == NULL) {
+		tc_profile_unlock();
+		return;
+	}
+
+	copy = calloc(talloc_profile.num_names + 1, sizeof(*copy));
+	if (copy == NULL) {
+		tc_profile_unlock();
+		return;
+	}
+
+	for (i=0; i<TALLOC_PROFILE_TABLE_SIZE; i++) {
+		struct talloc_profile_slot *slot = &talloc_profile.slots[i];
+
+		if (slot->name == NULL) {
+			continue;
+		}
+		copy[num].name = strdup(slot->name);
+		if (copy[num].name == NULL) {
+			continue;
+		}
+		copy[num].entry = slot->entry;
+		num += 1;
+	}
+	other = talloc_profile.other;
+
+	tc_profile_unlock();
+
+	for (i=0; i<num; i++) {
+		fn(copy[i].name, &copy[i].entry, private_data);
+		free(copy[i].name);
+	}
+	free(copy);
+
+	if (other.samples != 0) {
+		fn("[other]", &other, private_data);
+	}
+}
+
 /*
    Allocate a bit of memory as a child of an existing pointer
 */
@@ -798,6 +1148,7 @@ static inline void *__talloc_with_prefix(const void *context,
 	tc->child = NULL;
 	tc->name = NULL;
 	tc->refs = NULL;
+	tc->slab = NULL;
 
 	if (likely(context != NULL)) {
 		if (parent->child) {
@@ -822,7 +1173,13 @@ static inline void *__talloc(const void *context,
 			size_t size,
 			struct talloc_chunk **tc)
 {
-	return __talloc_with_prefix(context, size, 0, tc);
+	void *ptr = __talloc_with_prefix(context, size, 0, tc);
+
+	if (unlikely(tc_profile_get_interval() != 0) && likely(ptr != NULL)) {
+		tc_profile_sample(*tc, size);
+	}
+
+	return ptr;
 }
 
 /*
@@ -926,6 +1283,218 @@ overflow:
 	return NULL;
 }
 
+/*
+  A slab keeps freed chunks of one fixed size in a cache, so that hot
+  objects which are allocated and freed over and over again don't go
+  through malloc(3) and free(3) every time.
+
+  The cache is not a talloc chunk itself, as the chunks handed out can
+  outlive the talloc_slab handle. Once the handle is gone, chunks coming
+  back are freed and the cache goes away together with the last one.
+*/
+
+struct talloc_slab_cache {
+	struct talloc_slab *handle;
+	const char *name;
+	size_t size;
+	size_t max_cached;
+	size_t num_cached;
+	size_t num_used;
+	size_t hits;
+	size_t misses;
+	size_t released;
+	struct talloc_chunk *cached[];
+};
+
+struct talloc_slab {
+	struct talloc_slab_cache *cache;
+};
+
+static inline void tc_slab_cache_unref(struct talloc_slab_cache *cache)
+{
+	cache->num_used--;
+
+	if (unlikely(cache->handle == NULL && cache->num_used == 0)) {
+		free(cache);
+	}
+}
+
+static int talloc_slab_destructor(struct talloc_slab *slab)
+{
+	struct talloc_slab_cache *cache = slab->cache;
+	size_t i;
+
+	for (i=0; i<cache->num_cached; i++) {
+		free(cache->cached[i]);
+	}
+	cache->num_cached = 0;
+	cache->max_cached = 0;
+	cache->handle = NULL;
+
+	if (cache->num_used == 0) {
+		free(cache);
+	}
+	return 0;
+}
+
+_PUBLIC_ struct talloc_slab *_talloc_slab_create(const void *ctx,
+						 size_t size,
+						 const char *name,
+						 size_t max_cached)
+{
+	struct talloc_slab *slab;
+	struct talloc_slab_cache *cache;
+	size_t cache_size;
+
+	if (unlikely(size >= MAX_TALLOC_SIZE)) {
+		return NULL;
+	}
+
+	if (max_cached > (SIZE_MAX - sizeof(struct talloc_slab_cache)) /
+	    sizeof(struct talloc_chunk *)) {
+		return NULL;
+	}
+	cache_size = sizeof(struct talloc_slab_cache) +
+		max_cached * sizeof(struct talloc_chunk *);
+
+	slab = (struct talloc_slab *)talloc_named_const(
+		ctx, sizeof(struct talloc_slab), "struct talloc_slab");
+	if (unlikely(slab == NULL)) {
+		return NULL;
+	}
+
+	cache = malloc(cache_size);
+	if (unlikely(cache == NULL)) {
+		talloc_free(slab);
+		return NULL;
+	}
+	*cache = (struct talloc_slab_cache) {
+		.handle = slab,
+		.name = name,
+		.size = size,
+		.max_cached = max_cached,
+	};
+	slab->cache = cache;
+
+	talloc_set_destructor(slab, talloc_slab_destructor);
+
+	return slab;
+}
+
+_PUBLIC_ void *_talloc_slab_alloc(const void *ctx,
+				  struct talloc_slab *slab,
+				  size_t size)
+{
+	struct talloc_slab_cache *cache;
+	struct talloc_chunk *tc;
+	struct talloc_chunk *parent = NULL;
+	struct talloc_memlimit *limit = NULL;
+	size_t total_len;
+
+	if (unlikely(slab == NULL)) {
+		return NULL;
+	}
+	cache = slab->cache;
+
+	if (unlikely(size != cache->size)) {
+		talloc_abort("talloc_slab_alloc: object size does not "
+			     "match the slab");
+		return NULL;
+	}
+	total_len = TC_HDR_SIZE + size;
+
+	if (unlikely(ctx == NULL)) {
+		ctx = null_context;
+	}
+	if (likely(ctx != NULL)) {
+		parent = talloc_chunk_from_ptr(ctx);
+		limit = parent->limit;
+	}
+
+	if (!talloc_memlimit_check(limit, total_len)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (likely(cache->num_cached > 0)) {
+		cache->num_cached--;
+		tc = cache->cached[cache->num_cached];
+#if defined(DEVELOPER) && defined(VALGRIND_MAKE_MEM_UNDEFINED)
+		VALGRIND_MAKE_MEM_UNDEFINED(tc, total_len);
+#endif
+		cache->hits++;
+	} else {
+		tc = (struct talloc_chunk *)malloc(total_len);
+		if (unlikely(tc == NULL)) {
+			return NULL;
+		}
+		cache->misses++;
+	}
+	cache->num_used++;
+
+	talloc_memlimit_grow(limit, total_len);
+
+	tc->flags = talloc_magic;
+	tc->pool = NULL;
+	tc->slab = cache;
+	tc->limit = limit;
+	tc->size = size;
+	tc->destructor = NULL;
+	tc->child = NULL;
+	tc->refs = NULL;
+
+	if (unlikely(tc_profile_get_interval() != 0)) {
+		tc_profile_sample(tc, size);
+	}
+	_tc_set_name_const(tc, cache->name);
+
+	if (likely(parent != NULL)) {
+		if (parent->child) {
+			parent->child->parent = NULL;
+			tc->next = parent->child;
+			tc->next->prev = tc;
+		} else {
+			tc->next = NULL;
+		}
+		tc->parent = parent;
+		tc->prev = NULL;
+		parent->child = tc;
+	} else {
+		tc->next = tc->prev = tc->parent = NULL;
+	}
+
+	return TC_PTR_FROM_CHUNK(tc);
+}
+
+_PUBLIC_ void *_talloc_slab_zero(const void *ctx,
+				 struct talloc_slab *slab,
+				 size_t size)
+{
+	void *p = _talloc_slab_alloc(ctx, slab, size);
+
+	if (likely(p != NULL)) {
+		memset(p, '\0', size);
+	}
+
+	return p;
+}
+
+_PUBLIC_ void talloc_slab_get_stats(const struct talloc_slab *slab,
+				    struct talloc_slab_stats *stats)
+{
+	const struct talloc_slab_cache *cache = slab->cache;
+
+	*stats = (struct talloc_slab_stats) {
+		.object_size = cache->size,
+		.max_cached = cache->max_cached,
+		.num_cached = cache->num_cached,
+		.num_used = cache->num_used,
+		.hits = cache->hits,
+		.misses = cache->misses,
+		.released = cache->released,
+	};
+}
+
 /*
   setup a destructor to be called on free of a pointer
   the destructor should return 0 on success, or -1 on failure.
@@ -969,6 +1538,11 @@ static inline void _tc_set_name_const(struct talloc_chunk *tc,
 					const char *name)
 {
 	tc->name = name;
+
+	if (unlikely(tc_profile_get_interval() != 0) &&
+	    unlikely(tc == talloc_profile_thread.pending)) {
+		tc_profile_record(tc, name);
+	}
 }
 
 /*
@@ -1098,6 +1672,30 @@ static inline void _tc_free_poolmem(struct talloc_chunk *tc,
 	 */
 }
 
+static inline void _tc_free_slabmem(struct talloc_chunk *tc)
+{
+	struct talloc_slab_cache *cache = tc->slab;
+
+	tc_memlimit_update_on_free(tc);
+
+	TC_INVALIDATE_FULL_CHUNK(tc);
+
+	if (likely(cache->num_cached < cache->max_cached)) {
+		/*
+		 * Keep the chunk, it is still marked as free, so a
+		 * double free is detected as usual.
+		 */
+		cache->cached[cache->num_cached] = tc;
+		cache->num_cached++;
+		cache->num_used--;
+		return;
+	}
+
+	cache->released++;
+	free(tc);
+	tc_slab_cache_unref(cache);
+}
+
 static inline void _tc_free_children_internal(struct talloc_chunk *tc,
 						  void *ptr,
 						  const char *location);
@@ -1216,6 +1814,11 @@ static inline int _tc_free_internal(struct talloc_chunk *tc,
 		return 0;
 	}
 
+	if (unlikely(tc->slab != NULL)) {
+		_tc_free_slabmem(tc);
+		return 0;
+	}
+
 	tc_memlimit_update_on_free(tc);
 
 	TC_INVALIDATE_FULL_CHUNK(tc);
@@ -1839,6 +2442,12 @@ _PUBLIC_ void *_talloc_realloc(const void *context, void *ptr, size_t size, cons
 		pool_hdr = tc->pool;
 	}
 
+	/* a slab chunk of a different size can't go back to the slab */
+	if (unlikely(tc->slab != NULL) && tc->size != size) {
+		tc_slab_cache_unref(tc->slab);
+		tc->slab = NULL;
+	}
+
 	/* don't shrink if we have less than 1k to gain */
 	if (size < tc->size && tc->limit == NULL) {
 		if (pool_hdr) {
@@ -56,7 +56,7 @@ extern "C" {
  */
 
 #define TALLOC_VERSION_MAJOR 2
-#define TALLOC_VERSION_MINOR 3
+#define TALLOC_VERSION_MINOR 4
 
 _PUBLIC_ int talloc_version_major(void);
 _PUBLIC_ int talloc_version_minor(void);
@@ -912,6 +912,126 @@ _PUBLIC_ void *_talloc_pooled_object(const void *ctx,
 			    size_t total_subobjects_size);
 #endif
 
+/**
+ * @brief Statistics of a talloc slab.
+ *
+ * @see talloc_slab_get_stats()
+ */
+struct talloc_slab_stats {
+	size_t object_size;	/* size of the objects in the slab */
+	size_t max_cached;	/* maximum number of cached free objects */
+	size_t num_cached;	/* currently cached free objects */
+	size_t num_used;	/* objects allocated and not yet freed */
+	size_t hits;		/* allocations served from the cache */
+	size_t misses;		/* allocations that had to call malloc(3) */
+	size_t released;	/* frees that called free(3), cache was full */
+};
+
+struct talloc_slab;
+
+#ifdef DOXYGEN
+/**
+ * @brief Create a slab for talloc objects of one type.
+ *
+ * A slab is a cache for objects of a single type that are allocated and
+ * freed very often, for example the per-request structures of a server.
+ * Objects allocated with talloc_slab_alloc() are normal talloc chunks,
+ * they can have children, destructors and can be moved around. But when
+ * they are freed with talloc_free(), their memory is not given back with
+ * free(3). It is kept in the slab and handed out again by the next
+ * talloc_slab_alloc(). Only if the slab already caches max_cached free
+ * objects, free(3) is called.
+ *
+ * Unlike a talloc_pool() an object from a slab can be freed in any order
+ * and its memory is reused immediately, and a long living object does not
+ * pin the memory of other objects.
+ *
+ * talloc is not thread safe, so neither is a slab. Threads that want to
+ * use slabs have to create their own.
+ *
+ * Freeing the slab releases all cached memory. Objects still in use stay
+ * valid, they are just freed normally later on.
+ *
+ * @param[in]  ctx        The talloc context to hang the slab off.
+ *
+ * @param[in]  type       The type of the objects in the slab.
+ *
+ * @param[in]  max_cached The maximum number of free objects to keep.
+ *
+ * @return              The slab, NULL on error.
+ *
+ * @code
+ *      struct talloc_slab *slab;
+ *      struct foo *f;
+ *
+ *      slab = talloc_slab_create(mem_ctx, struct foo, 64);
+ *      f = talloc_slab_zero(mem_ctx, slab, struct foo);
+ *      ...
+ *      TALLOC_FREE(f);  <-- goes back to slab
+ * @endcode
+ */
+_PUBLIC_ struct talloc_slab *talloc_slab_create(const void *ctx, #type,
+						size_t max_cached);
+
+/**
+ * @brief Allocate an object from a slab.
+ *
+ * The object is not initialized. Its name is the type name of the slab.
+ *
+ * @param[in]  ctx      The talloc context to hang the result off.
+ *
+ * @param[in]  slab     The slab created for the type.
+ *
+ * @param[in]  type     The type to allocate, it has to be the type the slab
+ *                      was created for.
+ *
+ * @return              The allocated object, NULL on error.
+ *
+ * @see talloc_slab_zero()
+ */
+_PUBLIC_ void *talloc_slab_alloc(const void *ctx, struct talloc_slab *slab,
+				 #type);
+
+/**
+ * @brief Allocate a zeroed object from a slab.
+ *
+ * @see talloc_slab_alloc()
+ */
+_PUBLIC_ void *talloc_slab_zero(const void *ctx, struct talloc_slab *slab,
+				#type);
+#else
+#define talloc_slab_create(_ctx, _type, _max_cached) \
+	_talloc_slab_create((_ctx), sizeof(_type), #_type, (_max_cached))
+#define talloc_slab_alloc(_ctx, _slab, _type) \
+	(_type *)_talloc_slab_alloc((_ctx), (_slab), sizeof(_type))
+#define talloc_slab_zero(_ctx, _slab, _type) \
+	(_type *)_talloc_slab_zero((_ctx), (_slab), sizeof(_type))
+_PUBLIC_ struct talloc_slab *_talloc_slab_create(const void *ctx,
+						 size_t size,
+						 const char *name,
+						 size_t max_cached);
+_PUBLIC_ void *_talloc_slab_alloc(const void *ctx,
+				  struct talloc_slab *slab,
+				  size_t size);
+_PUBLIC_ void *_talloc_slab_zero(const void *ctx,
+				 struct talloc_slab *slab,
+				 size_t size);
+#endif
+
+/**
+ * @brief Get the statistics of a slab.
+ *
+ * The hit rate shows how many allocations could be served without calling
+ * malloc(3). A high number of released objects means that max_cached is too
+ * small for the number of objects that are in use at the same time.
+ *
+ * @param[in]  slab     The slab to get the statistics for.
+ *
+ * @param[out] stats    The statistics.
+ */
+_PUBLIC_ void talloc_slab_get_stats(const struct talloc_slab *slab,
+				    struct talloc_slab_stats *stats);
+
 /**
  * @brief Free a talloc chunk and NULL out the pointer.
  *
@@ -1936,6 +2056,68 @@ _PUBLIC_ void talloc_set_log_stderr(void);
  */
 _PUBLIC_ int talloc_set_memlimit(const void *ctx, size_t max_size) _DEPRECATED_;
 
+/**
+ * @brief Allocation statistics of one name, see talloc_profile_walk().
+ */
+struct talloc_profile_entry {
+	size_t samples;		/* number of sampled allocations */
+	size_t alloc_count;	/* estimated number of allocations */
+	size_t alloc_bytes;	/* estimated number of bytes allocated */
+};
+
+/**
+ * @brief Enable or disable sampling of allocations.
+ *
+ * With sampling enabled talloc picks about one allocation out of every
+ * interval bytes allocated and accounts it to the name of the new chunk.
+ * For most chunks this is the __location__ of the allocation or the type
+ * name, so the statistics show where memory is allocated. The estimated
+ * counts scale the samples up to all allocations.
+ *
+ * Sampling is cheap enough to be enabled in production, a typical interval
+ * is 512k. Allocations of all threads are sampled, every thread counts
+ * down its own interval.
+ *
+ * Disabling sampling keeps the statistics collected so far.
+ *
+ * @param[in]  interval  The average number of bytes between two samples,
+ *                       0 disables sampling.
+ *
+ * @return              0 on success, -1 on error with errno set.
+ *
+ * @see talloc_profile_walk()
+ */
+_PUBLIC_ int talloc_profile_set_interval(size_t interval);
+
+/**
+ * @brief Get the current sample interval, 0 if sampling is disabled.
+ */
+_PUBLIC_ size_t talloc_profile_get_interval(void);
+
+/**
+ * @brief Throw away the statistics collected by sampling.
+ */
+_PUBLIC_ void talloc_profile_reset(void);
+
+typedef void (*talloc_profile_fn_t)(const char *name,
+				    const struct talloc_profile_entry *entry,
+				    void *private_data);
+
+/**
+ * @brief Walk the statistics collected by sampling.
+ *
+ * The callback is called once per name, on a copy of the statistics.
+ * Chunks named by their content, like the ones from talloc_strdup(), are
+ * reported as "char". If too many different names were sampled, the rest
+ * is reported as "[other]". The name passed to fn is only valid during
+ * the call.
+ *
+ * @param[in]  fn           The function to call for every name.
+ *
+ * @param[in]  private_data Passed to fn.
+ */
+_PUBLIC_ void talloc_profile_walk(talloc_profile_fn_t fn, void *private_data);
+
 /* @} ******************************************************************/
 
 #if TALLOC_DEPRECATED
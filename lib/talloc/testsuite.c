@@ -1499,6 +1499,223 @@ static bool test_pooled_object(void)
 	return true;
 }
 
+struct slabbed {
+	int value;
+	char *str;
+};
+
+struct slabbed_big {
+	char buf[512];
+};
+
+static int slab_destructor_calls;
+
+static int test_slab_destructor(struct slabbed *s)
+{
+	slab_destructor_calls++;
+	return 0;
+}
+
+static bool test_slab(void)
+{
+	void *root;
+	struct talloc_slab *slab;
+	struct talloc_slab_stats stats;
+	struct slabbed *s1, *s2, *s3, *s4;
+	void *old;
+
+	printf("test: slab\n# TALLOC SLAB\n");
+
+	root = talloc_new(NULL);
+	slab = talloc_slab_create(root, struct slabbed, 2);
+	torture_assert("slab", slab != NULL, "failed: slab create");
+
+	s1 = talloc_slab_zero(root, slab, struct slabbed);
+	torture_assert("slab", s1 != NULL, "failed: slab alloc");
+	torture_assert("slab", s1->value == 0 && s1->str == NULL,
+		"failed: not zeroed\n");
+	torture_assert("slab", talloc_get_type(s1, struct slabbed) == s1,
+		"failed: wrong type\n");
+	torture_assert("slab", talloc_parent(s1) == root,
+		"failed: wrong parent\n");
+
+	s1->str = talloc_strdup(s1, "child");
+	talloc_set_destructor(s1, test_slab_destructor);
+	old = s1;
+	talloc_free(s1);
+	torture_assert("slab", slab_destructor_calls == 1,
+		"failed: destructor not called\n");
+
+	s1 = talloc_slab_alloc(root, slab, struct slabbed);
+	torture_assert("slab", s1 == old, "failed: memory not reused\n");
+	torture_assert("slab", talloc_total_blocks(s1) == 1,
+		"failed: stale children\n");
+	s1->value = 1;
+
+	talloc_slab_get_stats(slab, &stats);
+	torture_assert("slab", stats.hits == 1 && stats.misses == 1,
+		"failed: wrong hit/miss count\n");
+	torture_assert("slab", stats.num_used == 1 && stats.num_cached == 0,
+		"failed: wrong object count\n");
+	torture_assert("slab", stats.object_size == sizeof(struct slabbed),
+		"failed: wrong object size\n");
+
+	s2 = talloc_slab_zero(s1, slab, struct slabbed);
+	s3 = talloc_slab_zero(root, slab, struct slabbed);
+	s4 = talloc_slab_zero(root, slab, struct slabbed);
+	torture_assert("slab", s2 != NULL && s3 != NULL && s4 != NULL,
+		"failed: slab alloc\n");
+
+	/* s2 goes away with its parent */
+	talloc_free(s1);
+	talloc_free(s3);
+	talloc_free(s4);
+
+	talloc_slab_get_stats(slab, &stats);
+	torture_assert("slab", stats.num_cached == 2 && stats.num_used == 0,
+		"failed: wrong object count\n");
+	torture_assert("slab", stats.released == 2,
+		"failed: full cache not released\n");
+
+	/* a realloced object leaves the slab */
+	s1 = talloc_slab_alloc(root, slab, struct slabbed);
+	s1 = talloc_realloc_size(root, s1, 2 * sizeof(struct slabbed));
+	torture_assert("slab", s1 != NULL, "failed: realloc\n");
+	talloc_slab_get_stats(slab, &stats);
+	torture_assert("slab", stats.num_used == 0,
+		"failed: realloced object still in slab\n");
+	talloc_free(s1);
+	talloc_slab_get_stats(slab, &stats);
+	torture_assert("slab", stats.num_cached == 1,
+		"failed: realloced object went back to slab\n");
+
+	/* objects survive the slab */
+	s1 = talloc_slab_alloc(NULL, slab, struct slabbed);
+	s2 = talloc_slab_alloc(NULL, slab, struct slabbed);
+	talloc_free(slab);
+	s1->value = 2;
+	talloc_free(s1);
+	talloc_free(s2);
+
+	/* memory limits apply to slab objects */
+	torture_assert("slab", talloc_set_memlimit(root, 1024) == 0,
+		"failed: set memlimit\n");
+	slab = talloc_slab_create(NULL, struct slabbed_big, 1);
+	old = talloc_slab_alloc(root, slab, struct slabbed_big);
+	torture_assert("slab", old != NULL, "failed: slab alloc\n");
+	torture_assert("slab", talloc_slab_alloc(root, slab, struct slabbed_big) == NULL,
+		"failed: memlimit ignored\n");
+	talloc_free(old);
+	old = talloc_slab_alloc(root, slab, struct slabbed_big);
+	torture_assert("slab", old != NULL,
+		"failed: memlimit not updated on free\n");
+
+	talloc_free(slab);
+	talloc_free(root);
+
+	printf("success: slab\n");
+	return true;
+}
+
+struct profile_count {
+	const char *name;
+	struct talloc_profile_entry entry;
+	size_t num_names;
+};
+
+static void test_profile_fn(const char *name,
+			    const struct talloc_profile_entry *entry,
+			    void *private_data)
+{
+	struct profile_count *c = private_data;
+
+	c->num_names += 1;
+	if (strcmp(name, c->name) == 0) {
+		c->entry = *entry;
+	}
+}
+
+static bool test_profile(void)
+{
+	void *root;
+	struct profile_count c = { .name = "char" };
+	int i;
+
+	printf("test: profile\n# TALLOC PROFILE\n");
+
+	root = talloc_new(NULL);
+
+	torture_assert("profile", talloc_profile_set_interval(1024) == 0,
+		"failed: enable profiling\n");
+	torture_assert("profile", talloc_profile_get_interval() == 1024,
+		"failed: wrong interval\n");
+
+	for (i=0; i<10000; i++) {
+		char *s = talloc_strdup(root, "0123456789abcdef");
+		void *p = talloc_size(root, 4096);
+		torture_assert("profile", s != NULL && p != NULL,
+			"failed: allocation\n");
+		talloc_free(p);
+		talloc_free(s);
+	}
+
+	torture_assert("profile", talloc_profile_set_interval(0) == 0,
+		"failed: disable profiling\n");
+	(void)talloc_size(root, 4096);
+
+	talloc_profile_walk(test_profile_fn, &c);
+
+	/* "char" and the location of the talloc_size() above */
+	torture_assert("profile", c.num_names == 2,
+		"failed: wrong number of names\n");
+	torture_assert("profile", c.entry.samples > 0,
+		"failed: strings not sampled\n");
+	torture_assert("profile",
+		c.entry.alloc_count > 5000 && c.entry.alloc_count < 20000,
+		"failed: bad estimate of string count\n");
+
+	c = (struct profile_count) { .name = "char" };
+	talloc_profile_reset();
+	talloc_profile_walk(test_profile_fn, &c);
+	torture_assert("profile", c.num_names == 0,
+		"failed: reset\n");
+
+	/*
+	 * The statistics keep a copy of the names, they may go away
+	 * together with their chunks.
+	 */
+	torture_assert("profile", talloc_profile_set_interval(1) == 0,
+		"failed: enable profiling\n");
+	for (i=0; i<10; i++) {
+		char *name = strdup("dynamic name");
+		void *p = NULL;
+
+		torture_assert("profile", name != NULL,
+			"failed: strdup\n");
+		p = talloc_named_const(root, 4096, name);
+		torture_assert("profile", p != NULL,
+			"failed: allocation\n");
+		talloc_free(p);
+		memset(name, 'x', strlen(name));
+		free(name);
+	}
+	torture_assert("profile", talloc_profile_set_interval(0) == 0,
+		"failed: disable profiling\n");
+
+	c = (struct profile_count) { .name = "dynamic name" };
+	talloc_profile_walk(test_profile_fn, &c);
+	torture_assert("profile", c.num_names == 1,
+		"failed: wrong number of names\n");
+	torture_assert("profile", c.entry.samples == 10,
+		"failed: dynamic names not sampled\n");
+	talloc_profile_reset();
+
+	talloc_free(root);
+
+	printf("success: profile\n");
+	return true;
+}
+
 static bool test_free_ref_null_context(void)
 {
 	void *p1, *p2, *p3;
@@ -2053,6 +2270,74 @@ static bool test_pthread_talloc_passing(void)
 	printf("success: pthread_talloc_passing\n");
 	return true;
 }
+
+#define NUM_PROFILE_THREADS 8
+
+static void *profile_thread_fn(void *arg)
+{
+	void *top_ctx = talloc_named_const(NULL, 0, "top");
+	int i;
+
+	if (top_ctx == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < 10000; i++) {
+		char *s = talloc_strdup(top_ctx, "0123456789abcdef");
+		if (s == NULL) {
+			break;
+		}
+		talloc_free(s);
+	}
+	talloc_free(top_ctx);
+	return NULL;
+}
+
+/* Sampling from several threads at the same time. */
+static bool test_pthread_profile(void)
+{
+	struct profile_count c = { .name = "char" };
+	pthread_t thread_ids[NUM_PROFILE_THREADS];
+	int i;
+	int ret;
+
+	talloc_disable_null_tracking();
+
+	printf("test: pthread_profile\n# PTHREAD PROFILE\n");
+
+	torture_assert("pthread_profile",
+		talloc_profile_set_interval(1024) == 0,
+		"failed: enable profiling\n");
+
+	for (i = 0; i < NUM_PROFILE_THREADS; i++) {
+		ret = pthread_create(&thread_ids[i],
+				     NULL,
+				     profile_thread_fn,
+				     NULL);
+		torture_assert("pthread_profile", ret == 0,
+			"failed: pthread_create\n");
+	}
+	for (i = 0; i < NUM_PROFILE_THREADS; i++) {
+		ret = pthread_join(thread_ids[i], NULL);
+		torture_assert("pthread_profile", ret == 0,
+			"failed: pthread_join\n");
+	}
+
+	torture_assert("pthread_profile",
+		talloc_profile_set_interval(0) == 0,
+		"failed: disable profiling\n");
+
+	talloc_profile_walk(test_profile_fn, &c);
+	torture_assert("pthread_profile", c.entry.samples > 0,
+		"failed: strings not sampled\n");
+	torture_assert("pthread_profile",
+		c.entry.alloc_count > NUM_PROFILE_THREADS * 5000 &&
+		c.entry.alloc_count < NUM_PROFILE_THREADS * 20000,
+		"failed: bad estimate of string count\n");
+	talloc_profile_reset();
+
+	printf("success: pthread_profile\n");
+	return true;
+}
 #endif
 
 static void test_magic_protection_abort(const char *reason)
@@ -2210,6 +2495,10 @@ bool torture_local_talloc(struct torture_context *tctx)
 	test_reset();
 	ret &= test_pooled_object();
 	test_reset();
+	ret &= test_slab();
+	test_reset();
+	ret &= test_profile();
+	test_reset();
 	ret &= test_pool_nest();
 	test_reset();
 	ret &= test_ref1();
@@ -2268,6 +2557,8 @@ bool torture_local_talloc(struct torture_context *tctx)
 #ifdef HAVE_PTHREAD
 	test_reset();
 	ret &= test_pthread_talloc_passing();
+	test_reset();
+	ret &= test_pthread_profile();
 #endif
 
 
@@ -398,6 +398,14 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 			record_offset(hashes[h], off);
 	}
 
+	/* The other freelist bins are in the header. */
+	for (h = 1; h < tdb_freelist_num_bins(tdb); h++) {
+		if (tdb_ofs_read(tdb, TDB_FREELIST_BIN_TOP(h), &off) == -1)
+			goto free;
+		if (off)
+			record_offset(hashes[0], off);
+	}
+
 	/* For each record, read it in and check it's ok. */
 	for (off = TDB_DATA_START(tdb->hash_size);
 	     off < tdb->map_size;
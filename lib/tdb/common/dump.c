@@ -62,31 +62,38 @@ static int tdb_dump_chain(struct tdb_context *tdb, int i)
 {
 	struct tdb_chainwalk_ctx chainwalk;
 	tdb_off_t rec_ptr, top;
+	unsigned bin, num_bins = 1;
 
 	if (i == -1) {
-		top = FREELIST_TOP;
-	} else {
-		top = TDB_HASH_TOP(i);
+		num_bins = tdb_freelist_num_bins(tdb);
 	}
 
 	if (tdb_lock(tdb, i, F_WRLCK) != 0)
 		return -1;
 
-	if (tdb_ofs_read(tdb, top, &rec_ptr) == -1)
-		return tdb_unlock(tdb, i, F_WRLCK);
+	for (bin = 0; bin < num_bins; bin++) {
+		if (i == -1) {
+			top = TDB_FREELIST_BIN_TOP(bin);
+		} else {
+			top = TDB_HASH_TOP(i);
+		}
 
-	tdb_chainwalk_init(&chainwalk, rec_ptr);
+		if (tdb_ofs_read(tdb, top, &rec_ptr) == -1)
+			break;
 
-	if (rec_ptr)
-		printf("hash=%d\n", i);
+		tdb_chainwalk_init(&chainwalk, rec_ptr);
 
-	while (rec_ptr) {
-		bool ok;
-		rec_ptr = tdb_dump_record(tdb, i, rec_ptr);
-		ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
-		if (!ok) {
-			printf("circular hash chain %d\n", i);
-			break;
+		if (rec_ptr)
+			printf("hash=%d\n", i);
+
+		while (rec_ptr) {
+			bool ok;
+			rec_ptr = tdb_dump_record(tdb, i, rec_ptr);
+			ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
+			if (!ok) {
+				printf("circular hash chain %d\n", i);
+				break;
+			}
 		}
 	}
 
@@ -109,38 +116,45 @@ _PUBLIC_ int tdb_printfreelist(struct tdb_context *tdb)
 	long total_free = 0;
 	tdb_off_t offset, rec_ptr;
 	struct tdb_record rec;
+	unsigned bin;
 
 	if ((ret = tdb_lock(tdb, -1, F_WRLCK)) != 0)
 		return ret;
 
-	offset = FREELIST_TOP;
+	for (bin = 0; bin < tdb_freelist_num_bins(tdb); bin++) {
+		offset = TDB_FREELIST_BIN_TOP(bin);
 
-	/* read in the freelist top */
-	if (tdb_ofs_read(tdb, offset, &rec_ptr) == -1) {
-		tdb_unlock(tdb, -1, F_WRLCK);
-		return 0;
-	}
-
-	printf("freelist top=[0x%08x]\n", rec_ptr );
-	while (rec_ptr) {
-		if (tdb->methods->tdb_read(tdb, rec_ptr, (char *)&rec,
-					   sizeof(rec), DOCONV()) == -1) {
+		/* read in the freelist top */
+		if (tdb_ofs_read(tdb, offset, &rec_ptr) == -1) {
 			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+			return 0;
 		}
 
-		if (rec.magic != TDB_FREE_MAGIC) {
-			printf("bad magic 0x%08x in free list\n", rec.magic);
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+		if (bin == 0) {
+			printf("freelist top=[0x%08x]\n", rec_ptr );
+		} else {
+			printf("freelist bin %u top=[0x%08x]\n", bin, rec_ptr);
+		}
+		while (rec_ptr) {
+			if (tdb->methods->tdb_read(tdb, rec_ptr, (char *)&rec,
+						   sizeof(rec), DOCONV()) == -1) {
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return -1;
+			}
+
+			if (rec.magic != TDB_FREE_MAGIC) {
+				printf("bad magic 0x%08x in free list\n", rec.magic);
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return -1;
+			}
+
+			printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%u)] (end = 0x%08x)\n",
+			       rec_ptr, rec.rec_len, rec.rec_len, rec_ptr + rec.rec_len);
+			total_free += rec.rec_len;
+
+			/* move to the next record */
+			rec_ptr = rec.next;
 		}
-
-		printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%u)] (end = 0x%08x)\n",
-		       rec_ptr, rec.rec_len, rec.rec_len, rec_ptr + rec.rec_len);
-		total_free += rec.rec_len;
-
-		/* move to the next record */
-		rec_ptr = rec.next;
 	}
 	printf("total rec_len = [0x%08lx (%lu)]\n", total_free, total_free);
 
@@ -27,6 +27,30 @@
 
 #include "tdb_private.h"
 
+unsigned tdb_freelist_num_bins(struct tdb_context *tdb)
+{
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_FREELIST_BINS) {
+		return TDB_FREELIST_BINS;
+	}
+	return 1;
+}
+
+/* the freelist bin a free record of the given size belongs to */
+static unsigned tdb_freelist_bin(struct tdb_context *tdb, tdb_len_t len)
+{
+	unsigned num_bins = tdb_freelist_num_bins(tdb);
+	unsigned bin = 0;
+
+	len >>= TDB_FREELIST_BIN_SHIFT;
+
+	while ((len > 0) && (bin < num_bins - 1)) {
+		bin += 1;
+		len >>= 1;
+	}
+
+	return bin;
+}
+
 /* read a freelist record and check for simple errors */
 int tdb_rec_free_read(struct tdb_context *tdb, tdb_off_t off, struct tdb_record *rec)
 {
@@ -276,6 +300,7 @@ static int check_merge_ptr_with_left_record(struct tdb_context *tdb,
  */
 int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec)
 {
+	tdb_off_t top;
 	int ret;
 
 	/* Allocation and tailer lock */
@@ -300,10 +325,11 @@ int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec)
 	/* Nothing to merge, prepend to free list */
 
 	rec->magic = TDB_FREE_MAGIC;
+	top = TDB_FREELIST_BIN_TOP(tdb_freelist_bin(tdb, rec->rec_len));
 
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &rec->next) == -1 ||
+	if (tdb_ofs_read(tdb, top, &rec->next) == -1 ||
 	    tdb_rec_write(tdb, offset, rec) == -1 ||
-	    tdb_ofs_write(tdb, FREELIST_TOP, &offset) == -1) {
+	    tdb_ofs_write(tdb, top, &offset) == -1) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_free record write failed at offset=%u\n", offset));
 		goto fail;
 	}
@@ -330,8 +356,11 @@ done:
  */
 static tdb_off_t tdb_allocate_ofs(struct tdb_context *tdb,
 				  tdb_len_t length, tdb_off_t rec_ptr,
-				  struct tdb_record *rec, tdb_off_t last_ptr)
+				  struct tdb_record *rec, tdb_off_t last_ptr,
+				  unsigned bin)
 {
+	unsigned new_bin;
+
 #define MIN_REC_SIZE (sizeof(struct tdb_record) + sizeof(tdb_off_t) + 8)
 
 	if (rec->rec_len < length + MIN_REC_SIZE) {
@@ -352,6 +381,26 @@ static tdb_off_t tdb_allocate_ofs(struct tdb_context *tdb,
 
 	/* we're going to just shorten the existing record */
 	rec->rec_len -= (length + sizeof(*rec));
+
+	new_bin = tdb_freelist_bin(tdb, rec->rec_len);
+	if (new_bin < bin) {
+		/*
+		 * It's too small for its bin now, move it
+		 * to the head of the right one.
+		 */
+		tdb_off_t top = TDB_FREELIST_BIN_TOP(new_bin);
+
+		if (tdb_ofs_write(tdb, last_ptr, &rec->next) == -1) {
+			return 0;
+		}
+		if (tdb_ofs_read(tdb, top, &rec->next) == -1) {
+			return 0;
+		}
+		if (tdb_ofs_write(tdb, top, &rec_ptr) == -1) {
+			return 0;
+		}
+	}
+
 	if (tdb_rec_write(tdb, rec_ptr, rec) == -1) {
 		return 0;
 	}
@@ -377,46 +426,42 @@ static tdb_off_t tdb_allocate_ofs(struct tdb_context *tdb,
 	return rec_ptr;
 }
 
-/* allocate some space from the free list. The offset returned points
-   to a unconnected tdb_record within the database with room for at
-   least length bytes of total data
+struct tdb_freelist_fit {
+	tdb_off_t rec_ptr, last_ptr;
+	tdb_len_t rec_len;
+};
 
-   0 is returned if the space could not be allocated
+/*
+   walk one freelist bin looking for a record with room for length
+   bytes. With first_fit the first such record is taken, that's used
+   for bins holding only records larger than length anyway.
+
+   returns -1 on error, the result is in fit, fit->rec_ptr is 0 if
+   nothing was found
  */
-static tdb_off_t tdb_allocate_from_freelist(
-	struct tdb_context *tdb, tdb_len_t length, struct tdb_record *rec)
+static int tdb_freelist_bin_fit(struct tdb_context *tdb, unsigned bin,
+				tdb_len_t length, bool first_fit,
+				struct tdb_record *rec,
+				struct tdb_freelist_fit *bestfit,
+				bool *merge_created_candidate)
 {
-	tdb_off_t rec_ptr, last_ptr, newrec_ptr;
+	tdb_off_t rec_ptr, last_ptr;
 	struct tdb_chainwalk_ctx chainwalk;
 	bool modified;
-	struct {
-		tdb_off_t rec_ptr, last_ptr;
-		tdb_len_t rec_len;
-	} bestfit;
 	float multiplier = 1.0;
-	bool merge_created_candidate;
-
-	/* over-allocate to reduce fragmentation */
-	length *= 1.25;
-
-	/* Extra bytes required for tailer */
-	length += sizeof(tdb_off_t);
-	length = TDB_ALIGN(length, TDB_ALIGNMENT);
 
- again:
-	merge_created_candidate = false;
-	last_ptr = FREELIST_TOP;
+	last_ptr = TDB_FREELIST_BIN_TOP(bin);
 
 	/* read in the freelist top */
-	if (tdb_ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1)
-		return 0;
+	if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1)
+		return -1;
 
 	modified = false;
 	tdb_chainwalk_init(&chainwalk, rec_ptr);
 
-	bestfit.rec_ptr = 0;
-	bestfit.last_ptr = 0;
-	bestfit.rec_len = 0;
+	bestfit->rec_ptr = 0;
+	bestfit->last_ptr = 0;
+	bestfit->rec_len = 0;
 
 	/*
 	   this is a best fit allocation strategy. Originally we used
@@ -429,20 +474,20 @@ static tdb_off_t tdb_allocate_from_freelist(
 		struct tdb_record left_rec;
 
 		if (tdb_rec_free_read(tdb, rec_ptr, rec) == -1) {
-			return 0;
+			return -1;
 		}
 
 		ret = check_merge_with_left_record(tdb, rec_ptr, rec,
 						   &left_ptr, &left_rec);
 		if (ret == -1) {
-			return 0;
+			return -1;
 		}
 		if (ret == 1) {
 			/* merged */
 			rec_ptr = rec->next;
 			ret = tdb_ofs_write(tdb, last_ptr, &rec->next);
 			if (ret == -1) {
-				return 0;
+				return -1;
 			}
 
 			/*
@@ -466,12 +511,12 @@ static tdb_off_t tdb_allocate_from_freelist(
 			 * This way we can avoid expanding the database.
 			 */
 
-			if (bestfit.rec_ptr == left_ptr) {
-				bestfit.rec_len = left_rec.rec_len;
+			if (bestfit->rec_ptr == left_ptr) {
+				bestfit->rec_len = left_rec.rec_len;
 			}
 
 			if (left_rec.rec_len > length) {
-				merge_created_candidate = true;
+				*merge_created_candidate = true;
 			}
 
 			modified = true;
@@ -480,11 +525,14 @@ static tdb_off_t tdb_allocate_from_freelist(
 		}
 
 		if (rec->rec_len >= length) {
-			if (bestfit.rec_ptr == 0 ||
-			    rec->rec_len < bestfit.rec_len) {
-				bestfit.rec_len = rec->rec_len;
-				bestfit.rec_ptr = rec_ptr;
-				bestfit.last_ptr = last_ptr;
+			if (bestfit->rec_ptr == 0 ||
+			    rec->rec_len < bestfit->rec_len) {
+				bestfit->rec_len = rec->rec_len;
+				bestfit->rec_ptr = rec_ptr;
+				bestfit->last_ptr = last_ptr;
+			}
+			if (first_fit) {
+				break;
 			}
 		}
 
@@ -496,7 +544,7 @@ static tdb_off_t tdb_allocate_from_freelist(
 			bool ok;
 			ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
 			if (!ok) {
-				return 0;
+				return -1;
 			}
 		}
 
@@ -504,8 +552,8 @@ static tdb_off_t tdb_allocate_from_freelist(
 		   stop searching if its also not too big. The
 		   definition of 'too big' changes as we scan
 		   through */
-		if (bestfit.rec_len > 0 &&
-		    bestfit.rec_len < length * multiplier) {
+		if (bestfit->rec_len > 0 &&
+		    bestfit->rec_len < length * multiplier) {
 			break;
 		}
 
@@ -516,14 +564,59 @@ static tdb_off_t tdb_allocate_from_freelist(
 		multiplier *= 1.05;
 	}
 
-	if (bestfit.rec_ptr != 0) {
+	return 0;
+}
+
+/* allocate some space from the free list. The offset returned points
+   to a unconnected tdb_record within the database with room for at
+   least length bytes of total data
+
+   0 is returned if the space could not be allocated
+ */
+static tdb_off_t tdb_allocate_from_freelist(
+	struct tdb_context *tdb, tdb_len_t length, struct tdb_record *rec)
+{
+	struct tdb_freelist_fit bestfit;
+	unsigned bin, start_bin, num_bins;
+	bool merge_created_candidate;
+
+	/* over-allocate to reduce fragmentation */
+	length *= 1.25;
+
+	/* Extra bytes required for tailer */
+	length += sizeof(tdb_off_t);
+	length = TDB_ALIGN(length, TDB_ALIGNMENT);
+
+ again:
+	merge_created_candidate = false;
+
+	/*
+	   with binned freelists we start in the size class of length,
+	   all records in the bins above it are big enough, so the
+	   first one there will do
+	 */
+	start_bin = tdb_freelist_bin(tdb, length);
+	num_bins = tdb_freelist_num_bins(tdb);
+
+	for (bin = start_bin; bin < num_bins; bin++) {
+		int ret;
+
+		ret = tdb_freelist_bin_fit(tdb, bin, length, bin > start_bin,
+					   rec, &bestfit,
+					   &merge_created_candidate);
+		if (ret == -1) {
+			return 0;
+		}
+		if (bestfit.rec_ptr == 0) {
+			continue;
+		}
+
 		if (tdb_rec_free_read(tdb, bestfit.rec_ptr, rec) == -1) {
 			return 0;
 		}
 
-		newrec_ptr = tdb_allocate_ofs(tdb, length, bestfit.rec_ptr,
-					      rec, bestfit.last_ptr);
-		return newrec_ptr;
+		return tdb_allocate_ofs(tdb, length, bestfit.rec_ptr,
+					rec, bestfit.last_ptr, bin);
 	}
 
 	if (merge_created_candidate) {
@@ -648,6 +741,7 @@ static int tdb_freelist_merge_adjacent(struct tdb_context *tdb,
 				       int *count_records, int *count_merged)
 {
 	tdb_off_t cur, next;
+	unsigned bin, num_bins;
 	int count = 0;
 	int merged = 0;
 	int ret;
@@ -657,32 +751,43 @@ static int tdb_freelist_merge_adjacent(struct tdb_context *tdb,
 		return -1;
 	}
 
-	cur = FREELIST_TOP;
-	while (tdb_ofs_read(tdb, cur, &next) == 0 && next != 0) {
-		tdb_off_t next2;
+	num_bins = tdb_freelist_num_bins(tdb);
 
-		count++;
+	for (bin = 0; bin < num_bins; bin++) {
+		cur = TDB_FREELIST_BIN_TOP(bin);
+		while (tdb_ofs_read(tdb, cur, &next) == 0 && next != 0) {
+			tdb_off_t next2;
 
-		ret = check_merge_ptr_with_left_record(tdb, next, &next2);
-		if (ret == -1) {
-			goto done;
-		}
-		if (ret == 1) {
-			/*
-			 * merged:
-			 * now let cur->next point to next2 instead of next
-			 */
+			count++;
 
-			ret = tdb_ofs_write(tdb, cur, &next2);
-			if (ret != 0) {
+			ret = check_merge_ptr_with_left_record(tdb, next,
+							       &next2);
+			if (ret == -1) {
 				goto done;
 			}
+			if (ret == 1) {
+				/*
+				 * merged:
+				 * now let cur->next point to next2 instead
+				 * of next
+				 */
+
+				ret = tdb_ofs_write(tdb, cur, &next2);
+				if (ret != 0) {
+					goto done;
+				}
+
+				next = next2;
+				merged++;
+
+				if (next == 0) {
+					/* we merged the last one */
+					break;
+				}
+			}
 
-			next = next2;
-			merged++;
+			cur = next;
 		}
-
-		cur = next;
 	}
 
 	if (count_records != NULL) {
@@ -706,15 +811,20 @@ done:
 static int tdb_freelist_size_no_merge(struct tdb_context *tdb)
 {
 	tdb_off_t ptr;
+	unsigned bin, num_bins;
 	int count=0;
 
 	if (tdb_lock(tdb, -1, F_RDLCK) == -1) {
 		return -1;
 	}
 
-	ptr = FREELIST_TOP;
-	while (tdb_ofs_read(tdb, ptr, &ptr) == 0 && ptr != 0) {
-		count++;
+	num_bins = tdb_freelist_num_bins(tdb);
+
+	for (bin = 0; bin < num_bins; bin++) {
+		ptr = TDB_FREELIST_BIN_TOP(bin);
+		while (tdb_ofs_read(tdb, ptr, &ptr) == 0 && ptr != 0) {
+			count++;
+		}
 	}
 
 	tdb_unlock(tdb, -1, F_RDLCK);
@@ -50,6 +50,79 @@ void tdb_header_hash(struct tdb_context *tdb,
 		*magic1_hash = 1;
 }
 
+/*
+ * With TDB_GROW_HASH_SIZE the hash table of a TDB_CLEAR_IF_FIRST
+ * database is sized from the previous use of the file: we never go
+ * below the previous hash size, and we double it as long as the
+ * space the records took at their peak would give long hash chains.
+ *
+ * The hash size can't be changed while other processes have the
+ * database open, so wiping it is the only point where we can do
+ * this.
+ */
+#define TDB_GROW_HASH_BYTES_PER_CHAIN 1024
+#define TDB_GROW_HASH_SIZE_MAX (1U<<24)
+
+static int tdb_grown_hash_size(struct tdb_context *tdb, int hash_size)
+{
+	struct tdb_header old;
+	struct stat st;
+	uint64_t data_start;
+	uint64_t data_size;
+	uint32_t new_hash_size;
+	ssize_t nread;
+
+	nread = pread(tdb->fd, &old, sizeof(old), 0);
+	if (nread != sizeof(old)) {
+		return hash_size;
+	}
+	if (strcmp(old.magic_food, TDB_MAGIC_FOOD) != 0) {
+		return hash_size;
+	}
+	if (old.version == TDB_BYTEREV(TDB_VERSION)) {
+		tdb_convert(&old, sizeof(old));
+	} else if (old.version != TDB_VERSION) {
+		return hash_size;
+	}
+	if ((old.hash_size == 0) || (old.hash_size > TDB_GROW_HASH_SIZE_MAX)) {
+		return hash_size;
+	}
+
+	if (fstat(tdb->fd, &st) == -1) {
+		return hash_size;
+	}
+
+	data_start = sizeof(struct tdb_header) +
+		((uint64_t)old.hash_size + 1) * sizeof(tdb_off_t);
+	if ((old.rwlocks == TDB_FEATURE_FLAG_MAGIC) &&
+	    (old.feature_flags & TDB_FEATURE_FLAG_MUTEX)) {
+		data_start += old.mutex_size;
+	}
+
+	data_size = 0;
+	if ((uint64_t)st.st_size > data_start) {
+		data_size = st.st_size - data_start;
+	}
+
+	new_hash_size = MAX((uint32_t)hash_size, old.hash_size);
+
+	while ((data_size / new_hash_size > TDB_GROW_HASH_BYTES_PER_CHAIN) &&
+	       (new_hash_size < TDB_GROW_HASH_SIZE_MAX / 2)) {
+		/* keep it odd */
+		new_hash_size = new_hash_size * 2 + 1;
+	}
+
+	if (new_hash_size != (uint32_t)hash_size) {
+		TDB_LOG((tdb, TDB_DEBUG_TRACE, "tdb_grown_hash_size: "
+			 "using hash size %"PRIu32" instead of %d, "
+			 "previous hash size %"PRIu32" with %"PRIu64" "
+			 "bytes of data\n",
+			 new_hash_size, hash_size, old.hash_size, data_size));
+	}
+
+	return new_hash_size;
+}
+
 /* initialise a new database with a specified hash size */
 static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 			    int hash_size)
@@ -85,6 +158,10 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 		newdb->feature_flags |= TDB_FEATURE_FLAG_MUTEX;
 	}
 
+	if (tdb->flags & TDB_BINNED_FREELIST) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_FREELIST_BINS;
+	}
+
 	/*
 	 * If we have any features we add the FEATURE_FLAG_MAGIC, overwriting the
 	 * TDB_HASH_RWLOCK_MAGIC above.
@@ -486,6 +563,9 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 					 name, strerror(errno)));
 				goto fail;
 			}
+			if (tdb_flags & TDB_GROW_HASH_SIZE) {
+				hash_size = tdb_grown_hash_size(tdb, hash_size);
+			}
 			ret = tdb_new_database(tdb, &header, hash_size);
 			if (ret == -1) {
 				TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_open_ex: "
@@ -24,6 +24,7 @@
 	"Incompatible hash: %s\n" \
 	"Active/supported feature flags: 0x%08x/0x%08x\n" \
 	"Robust mutexes locking: %s\n" \
+	"Freelist bins: %s\n" \
 	"Smallest/average/largest keys: %zu/%zu/%zu\n" \
 	"Smallest/average/largest data: %zu/%zu/%zu\n" \
 	"Smallest/average/largest padding: %zu/%zu/%zu\n" \
@@ -96,11 +97,43 @@ static size_t get_hash_length(struct tdb_context *tdb, unsigned int i)
 	return count;
 }
 
+/*
+ * Walk one freelist bin. We hold the allrecord lock (or are best-effort
+ * on a read-only database), which covers the freelist lock. Never walk
+ * more records than the file scan found free, so a looping list can't
+ * hang us.
+ */
+static bool get_freelist_bin(struct tdb_context *tdb, unsigned int bin,
+			     size_t max_records, struct tally *tally)
+{
+	tdb_off_t rec_ptr;
+
+	if (tdb_ofs_read(tdb, TDB_FREELIST_BIN_TOP(bin), &rec_ptr) == -1)
+		return false;
+
+	while (rec_ptr) {
+		struct tdb_record r;
+
+		if (tally->num == max_records)
+			return false;
+		if (tdb->methods->tdb_read(tdb, rec_ptr, &r, sizeof(r),
+					   DOCONV()) == -1)
+			return false;
+		if (r.magic != TDB_FREE_MAGIC)
+			return false;
+		tally_add(tally, r.rec_len);
+		rec_ptr = r.next;
+	}
+	return true;
+}
+
 _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 {
 	off_t file_size;
 	tdb_off_t off, rec_off;
 	struct tally freet, keys, data, dead, extra, hashval, uncoal;
+	struct tally bins[TDB_FREELIST_BINS];
+	unsigned int bin, num_bins;
 	struct tdb_record rec;
 	char *ret = NULL;
 	bool locked;
@@ -177,6 +210,16 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 	for (off = 0; off < tdb->hash_size; off++)
 		tally_add(&hashval, get_hash_length(tdb, off));
 
+	num_bins = tdb_freelist_num_bins(tdb);
+	for (bin = 0; bin < num_bins; bin++) {
+		tally_init(&bins[bin]);
+		if (!get_freelist_bin(tdb, bin, freet.num, &bins[bin])) {
+			TDB_LOG((tdb, TDB_DEBUG_ERROR,
+				 "Corrupt freelist bin %u\n", bin));
+			goto unlock;
+		}
+	}
+
 	file_size = tdb->hdr_ofs + tdb->map_size;
 
 	len = asprintf(&ret, SUMMARY_FORMAT,
@@ -186,6 +229,7 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		 (tdb->hash_fn == tdb_jenkins_hash)?"yes":"no",
 		 (unsigned)tdb->feature_flags, TDB_SUPPORTED_FEATURE_FLAGS,
 		 (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX)?"yes":"no",
+		 (tdb->feature_flags & TDB_FEATURE_FLAG_FREELIST_BINS)?"yes":"no",
 		 keys.min, tally_mean(&keys), keys.max,
 		 data.min, tally_mean(&data), data.max,
 		 extra.min, tally_mean(&extra), extra.max,
@@ -211,6 +255,20 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		goto unlock;
 	}
 
+	for (bin = 0; bin < num_bins; bin++) {
+		char *bin_ret = NULL;
+
+		len = asprintf(&bin_ret,
+			       "%sFreelist bin %u records/bytes: %zu/%zu\n",
+			       ret, bin, bins[bin].num, bins[bin].total);
+		free(ret);
+		if (len == -1) {
+			ret = NULL;
+			goto unlock;
+		}
+		ret = bin_ret;
+	}
+
 unlock:
 	if (locked) {
 		tdb_unlockall_read(tdb);
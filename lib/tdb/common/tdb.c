@@ -1012,9 +1012,11 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 	}
 
 	/* wipe the freelist */
-	if (tdb_ofs_write(tdb, FREELIST_TOP, &offset) == -1) {
-		TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write freelist\n"));
-		goto failed;
+	for (i=0;i<tdb_freelist_num_bins(tdb);i++) {
+		if (tdb_ofs_write(tdb, TDB_FREELIST_BIN_TOP(i), &offset) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write freelist\n"));
+			goto failed;
+		}
 	}
 
 	/* add all the rest of the file to the freelist, possibly leaving a gap
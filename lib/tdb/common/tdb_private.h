@@ -70,11 +70,26 @@ typedef uint32_t tdb_off_t;
 #define TDB_PAD_U32  0x42424242
 
 #define TDB_FEATURE_FLAG_MUTEX 0x00000001
+#define TDB_FEATURE_FLAG_FREELIST_BINS 0x00000002
 
 #define TDB_SUPPORTED_FEATURE_FLAGS ( \
 	TDB_FEATURE_FLAG_MUTEX | \
+	TDB_FEATURE_FLAG_FREELIST_BINS | \
 	0)
 
+/*
+ * With TDB_FEATURE_FLAG_FREELIST_BINS free records are kept in
+ * TDB_FREELIST_BINS lists by size class. Bin 0 is the classic
+ * freelist at FREELIST_TOP, the other heads are in the header.
+ * Bin n > 0 holds records of at least 2^(n+TDB_FREELIST_BIN_SHIFT-1)
+ * bytes.
+ */
+#define TDB_FREELIST_BINS 16
+#define TDB_FREELIST_BIN_SHIFT 6
+#define TDB_FREELIST_BIN_TOP(bin) ((bin) == 0 ? FREELIST_TOP : \
+	offsetof(struct tdb_header, freelist_bins) + \
+	((bin)-1)*sizeof(tdb_off_t))
+
 /* NB assumes there is a local variable called "tdb" that is the
  * current context, also takes doubly-parenthesized print-style
  * argument. */
@@ -182,7 +197,9 @@ struct tdb_header {
 	uint32_t magic2_hash; /* hash of TDB_MAGIC. */
 	uint32_t feature_flags;
 	tdb_len_t mutex_size; /* set if TDB_FEATURE_FLAG_MUTEX is set */
-	tdb_off_t reserved[25];
+	/* set if TDB_FEATURE_FLAG_FREELIST_BINS is set */
+	tdb_off_t freelist_bins[15];
+	tdb_off_t reserved[10];
 };
 
 struct tdb_lock_type {
@@ -302,6 +319,7 @@ int tdb_ofs_read(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 int tdb_ofs_write(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 void *tdb_convert(void *buf, uint32_t size);
 int tdb_free(struct tdb_context *tdb, tdb_off_t offset, struct tdb_record *rec);
+unsigned tdb_freelist_num_bins(struct tdb_context *tdb);
 tdb_off_t tdb_allocate(struct tdb_context *tdb, int hash, tdb_len_t length,
 		       struct tdb_record *rec);
 
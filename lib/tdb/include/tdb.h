@@ -97,6 +97,12 @@ extern "C" {
 #define TDB_MUTEX_LOCKING 4096 /** optimized locking using robust mutexes if supported,
                                    only with tdb >= 1.3.0 and TDB_CLEAR_IF_FIRST
                                    after checking tdb_runtime_check_for_robust_mutexes() */
+#define TDB_GROW_HASH_SIZE 8192 /** with TDB_CLEAR_IF_FIRST: size the hash table of the
+                                    wiped db from the previous use of the file,
+                                    only with tdb >= 1.4.8 */
+#define TDB_BINNED_FREELIST 16384 /** keep free records in lists by size class when
+                                      creating a new db, it can't be opened by
+                                      tdb < 1.4.8 */
 
 /** The tdb error codes */
 enum TDB_ERROR {TDB_SUCCESS=0, TDB_ERR_CORRUPT, TDB_ERR_IO, TDB_ERR_LOCK, 
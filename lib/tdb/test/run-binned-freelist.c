@@ -0,0 +1,133 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "../common/summary.c"
+#include "../common/freelistcheck.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+static unsigned int used_bins(struct tdb_context *tdb)
+{
+	unsigned int bin, used = 0;
+	tdb_off_t ptr;
+
+	for (bin = 0; bin < tdb_freelist_num_bins(tdb); bin++) {
+		if (tdb_ofs_read(tdb, TDB_FREELIST_BIN_TOP(bin), &ptr) == -1) {
+			return 0;
+		}
+		if (ptr != 0) {
+			used += 1;
+		}
+	}
+	return used;
+}
+
+static bool store_records(struct tdb_context *tdb, unsigned int num)
+{
+	static uint8_t buf[20000];
+	unsigned int j;
+
+	for (j = 0; j < num; j++) {
+		TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+		TDB_DATA data = { buf, (j * 97) % sizeof(buf) };
+
+		if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool delete_odd_records(struct tdb_context *tdb, unsigned int num)
+{
+	unsigned int j;
+
+	for (j = 1; j < num; j += 2) {
+		TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+
+		if (tdb_delete(tdb, key) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	struct tdb_context *tdb;
+	int flags[] = { TDB_DEFAULT, TDB_NOMMAP, TDB_CONVERT,
+			TDB_NOMMAP|TDB_CONVERT };
+	int num_entries;
+	char *summary;
+
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 19 + 7);
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		tdb = tdb_open_ex("run-binned-freelist.tdb", 131,
+				  flags[i]|TDB_BINNED_FREELIST,
+				  O_CREAT|O_TRUNC|O_RDWR, 0600,
+				  &taplogctx, NULL);
+		ok1(tdb);
+		ok1(tdb_freelist_num_bins(tdb) == TDB_FREELIST_BINS);
+
+		ok1(store_records(tdb, 1000));
+		ok1(delete_odd_records(tdb, 1000));
+
+		/* The holes are spread over the size classes */
+		ok1(used_bins(tdb) > 1);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		ok1(tdb_validate_freelist(tdb, &num_entries) == 0);
+		/* That merges adjacent records */
+		ok1(tdb_freelist_size(tdb) <= num_entries);
+
+		/* Fill the holes again, with different sizes */
+		ok1(store_records(tdb, 1500));
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+		summary = tdb_summary(tdb);
+		ok1(summary);
+		ok1(strstr(summary, "Freelist bins: yes\n"));
+		ok1(strstr(summary, "Freelist bin 15 records/bytes: "));
+		free(summary);
+
+		/* A transaction may repack, that wipes all bins */
+		ok1(delete_odd_records(tdb, 1500));
+		ok1(tdb_transaction_start(tdb) == 0);
+		ok1(store_records(tdb, 200));
+		ok1(tdb_transaction_commit(tdb) == 0);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		tdb_close(tdb);
+
+		/* The layout is in the header, the flag isn't needed */
+		tdb = tdb_open_ex("run-binned-freelist.tdb", 131, flags[i],
+				  O_RDWR, 0600, &taplogctx, NULL);
+		ok1(tdb_freelist_num_bins(tdb) == TDB_FREELIST_BINS);
+		tdb_close(tdb);
+	}
+
+	/* Without the flag we still have the classic freelist */
+	tdb = tdb_open_ex("run-binned-freelist.tdb", 131, TDB_DEFAULT,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb_freelist_num_bins(tdb) == 1);
+	ok1(store_records(tdb, 100));
+	ok1(delete_odd_records(tdb, 100));
+	ok1(used_bins(tdb) == 1);
+	summary = tdb_summary(tdb);
+	ok1(strstr(summary, "Freelist bins: no\n"));
+	ok1(strstr(summary, "Freelist bin 0 records/bytes: "));
+	ok1(!strstr(summary, "Freelist bin 1 "));
+	free(summary);
+	tdb_close(tdb);
+
+	return exit_status();
+}
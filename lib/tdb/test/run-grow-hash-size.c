@@ -0,0 +1,82 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+static int count_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		    void *private_data)
+{
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i, j;
+	struct tdb_context *tdb;
+	int flags[] = { TDB_DEFAULT, TDB_NOMMAP, TDB_CONVERT };
+	uint8_t buf[256] = { 0, };
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+	TDB_DATA data = { buf, sizeof(buf) };
+	uint32_t grown;
+
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 12);
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		int tdb_flags = flags[i]|TDB_CLEAR_IF_FIRST;
+
+		tdb = tdb_open_ex("run-grow-hash-size.tdb", 7,
+				  tdb_flags|TDB_GROW_HASH_SIZE,
+				  O_CREAT|O_TRUNC|O_RDWR, 0600,
+				  &taplogctx, NULL);
+		ok1(tdb);
+		ok1(tdb_hash_size(tdb) == 7);
+
+		for (j = 0; j < 2000; j++) {
+			if (tdb_store(tdb, key, data, TDB_INSERT) != 0) {
+				fail("Storing in tdb");
+			}
+		}
+		tdb_close(tdb);
+
+		/* The records needed ~500kB, that's more than 7 chains */
+		tdb = tdb_open_ex("run-grow-hash-size.tdb", 7,
+				  tdb_flags|TDB_GROW_HASH_SIZE,
+				  O_RDWR, 0600, &taplogctx, NULL);
+		ok1(tdb);
+		grown = tdb_hash_size(tdb);
+		ok1(grown > 7);
+		ok1((grown % 2) == 1);
+		ok1(tdb_traverse(tdb, count_fn, NULL) == 0);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		tdb_close(tdb);
+
+		/* An empty file doesn't shrink the hash table again */
+		tdb = tdb_open_ex("run-grow-hash-size.tdb", 7,
+				  tdb_flags|TDB_GROW_HASH_SIZE,
+				  O_RDWR, 0600, &taplogctx, NULL);
+		ok1(tdb);
+		ok1(tdb_hash_size(tdb) == grown);
+		tdb_close(tdb);
+
+		/* Without TDB_GROW_HASH_SIZE we use the given size */
+		tdb = tdb_open_ex("run-grow-hash-size.tdb", 7,
+				  tdb_flags,
+				  O_RDWR, 0600, &taplogctx, NULL);
+		ok1(tdb);
+		ok1(tdb_hash_size(tdb) == 7);
+		ok1(tdb_check(tdb, NULL, NULL) == 0);
+		tdb_close(tdb);
+	}
+
+	return exit_status();
+}
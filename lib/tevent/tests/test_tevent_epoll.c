@@ -0,0 +1,194 @@
+/*
+ * Unix SMB/CIFS implementation.
+ *
+ * testing of the deferred epoll_ctl() updates of the epoll backend
+ *
+ *   ** NOTE! The following LGPL license applies to the tevent
+ *   ** library. This does NOT imply that all of Samba is released
+ *   ** under the LGPL
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replace.h"
+#include "system/filesys.h"
+#include "system/select.h"
+#include "system/network.h"
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+/*
+ * Count the epoll_ctl() calls of the backend included below
+ */
+static unsigned num_epoll_ctl;
+
+static int test_epoll_ctl(int epfd, int op, int fd,
+			  struct epoll_event *event)
+{
+	num_epoll_ctl += 1;
+	return epoll_ctl(epfd, op, fd, event);
+}
+
+#define epoll_ctl(_epfd, _op, _fd, _event) \
+	test_epoll_ctl(_epfd, _op, _fd, _event)
+
+#include "tevent_epoll.c"
+
+struct test_ctx {
+	struct tevent_context *ev;
+	struct tevent_fd *fde;
+	int sock[2];
+	unsigned num_read;
+	unsigned num_write;
+};
+
+static void test_fd_handler(struct tevent_context *ev,
+			    struct tevent_fd *fde,
+			    uint16_t flags,
+			    void *private_data)
+{
+	struct test_ctx *tctx = (struct test_ctx *)private_data;
+	uint8_t c;
+	ssize_t nread;
+
+	if (!(flags & TEVENT_FD_READ)) {
+		tctx->num_write += 1;
+		TEVENT_FD_NOT_WRITEABLE(fde);
+		return;
+	}
+
+	nread = read(tctx->sock[0], &c, 1);
+	assert_int_equal(nread, 1);
+	tctx->num_read += 1;
+
+	/*
+	 * Like a stream that is done with one request
+	 * and directly waits for the next one.
+	 */
+	TEVENT_FD_NOT_READABLE(fde);
+	TEVENT_FD_READABLE(fde);
+}
+
+static int test_setup(void **state)
+{
+	struct test_ctx *tctx = NULL;
+	int ret;
+
+	tctx = talloc_zero(NULL, struct test_ctx);
+	assert_non_null(tctx);
+
+	tctx->ev = tevent_context_init_ops(tctx, &epoll_event_ops, NULL);
+	assert_non_null(tctx->ev);
+
+	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, tctx->sock);
+	assert_int_equal(ret, 0);
+
+	tctx->fde = tevent_add_fd(tctx->ev, tctx, tctx->sock[0],
+				  TEVENT_FD_READ, test_fd_handler, tctx);
+	assert_non_null(tctx->fde);
+
+	*state = tctx;
+	return 0;
+}
+
+static int test_teardown(void **state)
+{
+	struct test_ctx *tctx = (struct test_ctx *)(*state);
+
+	TALLOC_FREE(tctx->fde);
+	close(tctx->sock[0]);
+	close(tctx->sock[1]);
+	TALLOC_FREE(tctx);
+	return 0;
+}
+
+static void test_write_byte(struct test_ctx *tctx)
+{
+	uint8_t c = 0;
+	ssize_t nwritten;
+
+	nwritten = write(tctx->sock[1], &c, 1);
+	assert_int_equal(nwritten, 1);
+}
+
+/*
+ * Switching TEVENT_FD_READ off and on again in the handler doesn't
+ * touch the kernel
+ */
+static void test_toggle_in_handler(void **state)
+{
+	struct test_ctx *tctx = (struct test_ctx *)(*state);
+	unsigned i;
+	int ret;
+
+	for (i = 0; i < 100; i++) {
+		test_write_byte(tctx);
+		num_epoll_ctl = 0;
+		ret = tevent_loop_once(tctx->ev);
+		assert_int_equal(ret, 0);
+		assert_int_equal(tctx->num_read, i + 1);
+		assert_int_equal(num_epoll_ctl, 0);
+	}
+}
+
+/*
+ * Only the final state of the flags is applied
+ */
+static void test_toggle_coalesced(void **state)
+{
+	struct test_ctx *tctx = (struct test_ctx *)(*state);
+	int ret;
+
+	test_write_byte(tctx);
+
+	/* back to the registered flags, nothing to do */
+	num_epoll_ctl = 0;
+	TEVENT_FD_NOT_READABLE(tctx->fde);
+	TEVENT_FD_READABLE(tctx->fde);
+	TEVENT_FD_NOT_READABLE(tctx->fde);
+	TEVENT_FD_READABLE(tctx->fde);
+	ret = tevent_loop_once(tctx->ev);
+	assert_int_equal(ret, 0);
+	assert_int_equal(tctx->num_read, 1);
+	assert_int_equal(num_epoll_ctl, 0);
+
+	/* a real change costs a single call */
+	num_epoll_ctl = 0;
+	TEVENT_FD_WRITEABLE(tctx->fde);
+	TEVENT_FD_NOT_WRITEABLE(tctx->fde);
+	TEVENT_FD_NOT_READABLE(tctx->fde);
+	TEVENT_FD_WRITEABLE(tctx->fde);
+	ret = tevent_loop_once(tctx->ev);
+	assert_int_equal(ret, 0);
+	assert_int_equal(num_epoll_ctl, 1);
+	assert_int_equal(tctx->num_write, 1);
+	assert_int_equal(tctx->num_read, 1);
+}
+
+int main(int argc, char **argv)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_toggle_in_handler,
+						test_setup,
+						test_teardown),
+		cmocka_unit_test_setup_teardown(test_toggle_coalesced,
+						test_setup,
+						test_teardown),
+	};
+
+	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -697,6 +697,125 @@ static bool test_event_fd2(struct torture_context *tctx,
 	return true;
 }
 
+struct test_event_fd_toggle_state {
+	int fd;
+	unsigned num_read;
+	bool timed_out;
+};
+
+static void test_event_fd_toggle_handler(struct tevent_context *ev,
+					 struct tevent_fd *fde,
+					 uint16_t flags,
+					 void *private_data)
+{
+	struct test_event_fd_toggle_state *state =
+		(struct test_event_fd_toggle_state *)private_data;
+	uint8_t c;
+
+	do_read(state->fd, &c, 1);
+	state->num_read += 1;
+
+	/*
+	 * Like a stream that is done with one request
+	 * and directly waits for the next one.
+	 */
+	TEVENT_FD_NOT_READABLE(fde);
+	TEVENT_FD_READABLE(fde);
+}
+
+static void test_event_fd_toggle_timeout(struct tevent_context *ev,
+					 struct tevent_timer *te,
+					 struct timeval tval,
+					 void *private_data)
+{
+	struct test_event_fd_toggle_state *state =
+		(struct test_event_fd_toggle_state *)private_data;
+
+	state->timed_out = true;
+}
+
+static bool test_event_fd_toggle(struct torture_context *tctx,
+				 const void *test_data)
+{
+	const char *backend = (const char *)test_data;
+	struct test_event_fd_toggle_state state = { .fd = -1, };
+	struct tevent_context *ev = NULL;
+	struct tevent_fd *fde = NULL;
+	int sock[2] = { -1, -1 };
+	uint8_t c = 0;
+	int ret;
+	bool ok = false;
+
+	ev = tevent_context_init_byname(tctx, backend);
+	if (ev == NULL) {
+		torture_skip(tctx, talloc_asprintf(tctx,
+			     "event backend '%s' not supported\n",
+			     backend));
+		return true;
+	}
+
+	torture_comment(tctx, "backend '%s' - %s\n",
+			backend, __FUNCTION__);
+
+	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sock);
+	torture_assert_goto(tctx, ret == 0, ok, done, "socketpair failed\n");
+	state.fd = sock[0];
+
+	fde = tevent_add_fd(ev, ev, sock[0], TEVENT_FD_READ,
+			    test_event_fd_toggle_handler, &state);
+	torture_assert_goto(tctx, fde != NULL, ok, done,
+			    "tevent_add_fd failed\n");
+	tevent_fd_set_auto_close(fde);
+	sock[0] = -1;
+
+	do_write(sock[1], &c, 1);
+
+	/* switched off in the end, nothing should happen */
+	TEVENT_FD_NOT_READABLE(fde);
+	TEVENT_FD_READABLE(fde);
+	TEVENT_FD_NOT_READABLE(fde);
+
+	tevent_add_timer(ev, ev, timeval_current_ofs(0, 10000),
+			 test_event_fd_toggle_timeout, &state);
+	while (!state.timed_out) {
+		ret = tevent_loop_once(ev);
+		torture_assert_goto(tctx, ret == 0, ok, done,
+				    "tevent_loop_once failed\n");
+	}
+	torture_assert_int_equal_goto(tctx, state.num_read, 0, ok, done,
+				      "handler called for disabled fde\n");
+
+	/* switched on in the end, the pending byte arrives */
+	TEVENT_FD_READABLE(fde);
+	TEVENT_FD_NOT_READABLE(fde);
+	TEVENT_FD_READABLE(fde);
+
+	while (state.num_read < 1) {
+		ret = tevent_loop_once(ev);
+		torture_assert_goto(tctx, ret == 0, ok, done,
+				    "tevent_loop_once failed\n");
+	}
+
+	/* the handler toggled it, the next byte still arrives */
+	do_write(sock[1], &c, 1);
+	while (state.num_read < 2) {
+		ret = tevent_loop_once(ev);
+		torture_assert_goto(tctx, ret == 0, ok, done,
+				    "tevent_loop_once failed\n");
+	}
+
+	ok = true;
+done:
+	TALLOC_FREE(ev);
+	if (sock[0] != -1) {
+		close(sock[0]);
+	}
+	if (sock[1] != -1) {
+		close(sock[1]);
+	}
+	return ok;
+}
+
 struct test_wrapper_state {
 	struct torture_context *tctx;
 	int num_events;
@@ -1202,6 +1321,192 @@ done:
 	return ok;
 }
 
+struct test_timer_order_state {
+	unsigned order[8];
+	unsigned num;
+};
+
+static void test_timer_order_handler(struct tevent_context *ev,
+				     struct tevent_timer *te,
+				     struct timeval current_time,
+				     void *private_data)
+{
+	struct test_timer_order_state *state =
+		talloc_get_type_abort(talloc_parent(te),
+		struct test_timer_order_state);
+	unsigned id = (unsigned)(uintptr_t)private_data;
+
+	if (state->num < ARRAY_SIZE(state->order)) {
+		state->order[state->num] = id;
+	}
+	state->num += 1;
+}
+
+static bool test_timer_order(struct torture_context *tctx,
+			     const void *test_data)
+{
+	struct test_timer_order_state *state = NULL;
+	struct tevent_context *ev = NULL;
+	struct tevent_timer *te[8] = { NULL, };
+	struct timeval tv[8] = {
+		tevent_timeval_set(2, 0),
+		tevent_timeval_set(1, 0),
+		tevent_timeval_zero(),
+		tevent_timeval_set(2, 0),
+		tevent_timeval_set(1, 0),
+		tevent_timeval_zero(),
+		tevent_timeval_set(3, 0),
+		tevent_timeval_set(1, 500),
+	};
+	/*
+	 * Zero timers first, equal times in the order they were
+	 * added, 4 moved behind 1, 6 freed
+	 */
+	unsigned expected[] = { 2, 5, 1, 4, 7, 0, 3 };
+	unsigned i;
+	bool ok = false;
+
+	ev = tevent_context_init(tctx);
+	torture_assert(tctx, ev != NULL, "tevent_context_init failed");
+
+	state = talloc_zero(ev, struct test_timer_order_state);
+	torture_assert_goto(tctx, state != NULL, ok, done,
+			    "talloc_zero failed\n");
+
+	for (i = 0; i < ARRAY_SIZE(te); i++) {
+		te[i] = tevent_add_timer(ev, state, tv[i],
+					 test_timer_order_handler,
+					 (void *)(uintptr_t)i);
+		torture_assert_goto(tctx, te[i] != NULL, ok, done,
+				    "tevent_add_timer failed\n");
+	}
+
+	tevent_update_timer(te[4], tevent_timeval_set(1, 0));
+	TALLOC_FREE(te[6]);
+
+	while (state->num < ARRAY_SIZE(expected)) {
+		int ret = tevent_loop_once(ev);
+		torture_assert_goto(tctx, ret == 0, ok, done,
+				    "tevent_loop_once failed\n");
+	}
+
+	torture_assert_int_equal_goto(tctx, state->num, ARRAY_SIZE(expected),
+				      ok, done, "wrong number of timers");
+	for (i = 0; i < ARRAY_SIZE(expected); i++) {
+		torture_assert_int_equal_goto(tctx, state->order[i],
+					      expected[i], ok, done,
+					      "wrong timer order");
+	}
+
+	ok = true;
+done:
+	TALLOC_FREE(ev);
+	return ok;
+}
+
+struct test_timer_speed_state {
+	uint64_t last;
+	unsigned num;
+	bool sorted;
+};
+
+static void test_timer_speed_handler(struct tevent_context *ev,
+				     struct tevent_timer *te,
+				     struct timeval current_time,
+				     void *private_data)
+{
+	struct test_timer_speed_state *state =
+		(struct test_timer_speed_state *)private_data;
+	uint64_t tag = tevent_timer_get_tag(te);
+
+	if (tag < state->last) {
+		state->sorted = false;
+	}
+	state->last = tag;
+	state->num += 1;
+}
+
+static bool test_timer_speed(struct torture_context *tctx,
+			     const void *test_data)
+{
+	const unsigned num = 100000;
+	struct tevent_context *ev = NULL;
+	struct tevent_timer **te = NULL;
+	struct test_timer_speed_state state = { .sorted = true, };
+	struct timeval start;
+	unsigned i;
+	bool ok = false;
+
+	if (!torture_setting_bool(tctx, "bench", false)) {
+		torture_skip(tctx, "benchmark - enable with "
+			     "--option=torture:bench=yes\n");
+	}
+
+	ev = tevent_context_init(tctx);
+	torture_assert(tctx, ev != NULL, "tevent_context_init failed");
+
+	te = talloc_zero_array(ev, struct tevent_timer *, num);
+	torture_assert_goto(tctx, te != NULL, ok, done,
+			    "talloc_zero_array failed\n");
+
+	/*
+	 * Timers 1-2 minutes in the future in pseudo random order,
+	 * like per open timeouts.
+	 */
+	start = timeval_current();
+	for (i = 0; i < num; i++) {
+		uint32_t usecs = (i * 7919) % num * 600;
+
+		te[i] = tevent_add_timer(ev, te,
+					 timeval_current_ofs(60, usecs),
+					 test_timer_speed_handler,
+					 &state);
+		torture_assert_goto(tctx, te[i] != NULL, ok, done,
+				    "tevent_add_timer failed\n");
+	}
+	torture_comment(tctx, "Added %u timers: %.0f timers/sec\n",
+			num, num / timeval_elapsed(&start));
+
+	start = timeval_current();
+	for (i = 0; i < num; i++) {
+		TALLOC_FREE(te[(i * 7919) % num]);
+	}
+	torture_comment(tctx, "Cancelled %u timers: %.0f timers/sec\n",
+			num, num / timeval_elapsed(&start));
+
+	/*
+	 * Now expired timers, they have to run in order
+	 */
+	for (i = 0; i < num; i++) {
+		uint32_t usecs = (i * 7919) % num;
+
+		te[i] = tevent_add_timer(ev, te,
+					 tevent_timeval_set(1, usecs),
+					 test_timer_speed_handler,
+					 &state);
+		torture_assert_goto(tctx, te[i] != NULL, ok, done,
+				    "tevent_add_timer failed\n");
+		tevent_timer_set_tag(te[i], usecs);
+	}
+
+	start = timeval_current();
+	while (state.num < num) {
+		int ret = tevent_loop_once(ev);
+		torture_assert_goto(tctx, ret == 0, ok, done,
+				    "tevent_loop_once failed\n");
+	}
+	torture_comment(tctx, "Ran %u timers: %.0f timers/sec\n",
+			num, num / timeval_elapsed(&start));
+
+	torture_assert_goto(tctx, state.sorted, ok, done,
+			    "timers ran out of order\n");
+
+	ok = true;
+done:
+	TALLOC_FREE(ev);
+	return ok;
+}
+
 #ifdef HAVE_PTHREAD
 
 static pthread_mutex_t threaded_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -1786,6 +2091,10 @@ struct torture_suite *torture_local_event(TALLOC_CTX *mem_ctx)
 					       "fd2",
 					       test_event_fd2,
 					       (const void *)list[i]);
+		torture_suite_add_simple_tcase_const(backend_suite,
+					       "fd_toggle",
+					       test_event_fd_toggle,
+					       (const void *)list[i]);
 		torture_suite_add_simple_tcase_const(backend_suite,
 					       "wrapper",
 					       test_wrapper,
@@ -1798,6 +2107,14 @@ struct torture_suite *torture_local_event(TALLOC_CTX *mem_ctx)
 		torture_suite_add_suite(suite, backend_suite);
 	}
 
+	torture_suite_add_simple_tcase_const(suite, "timer_order",
+					     test_timer_order,
+					     NULL);
+
+	torture_suite_add_simple_tcase_const(suite, "timer_speed",
+					     test_timer_speed,
+					     NULL);
+
 #ifdef HAVE_PTHREAD
 	torture_suite_add_simple_tcase_const(suite, "threaded_poll_mt",
 					     test_event_context_threaded,
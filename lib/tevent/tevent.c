@@ -309,10 +309,11 @@ static void tevent_prep_atfork(void)
 int tevent_common_context_destructor(struct tevent_context *ev)
 {
 	struct tevent_fd *fd, *fn;
-	struct tevent_timer *te, *tn;
+	struct tevent_timer *te;
 	struct tevent_immediate *ie, *in;
 	struct tevent_signal *se, *sn;
 	struct tevent_wrapper_glue *gl, *gn;
+	size_t i;
 #ifdef HAVE_PTHREAD
 	int ret;
 #endif
@@ -383,14 +384,14 @@ int tevent_common_context_destructor(struct tevent_context *ev)
 		DLIST_REMOVE(ev->fd_events, fd);
 	}
 
-	ev->last_zero_timer = NULL;
-	for (te = ev->timer_events; te; te = tn) {
-		tn = te->next;
+	for (i = 0; i < ev->timers.num; i++) {
+		te = ev->timers.heap[i];
 		tevent_trace_timer_callback(te->event_ctx, te, TEVENT_EVENT_TRACE_DETACH);
 		te->wrapper = NULL;
 		te->event_ctx = NULL;
-		DLIST_REMOVE(ev->timer_events, te);
 	}
+	ev->timers.num = 0;
+	TALLOC_FREE(ev->timers.heap);
 
 	for (ie = ev->immediate_events; ie; ie = in) {
 		in = ie->next;
@@ -894,7 +895,7 @@ bool tevent_common_have_events(struct tevent_context *ev)
 		 */
 	}
 
-	return ((ev->timer_events != NULL) ||
+	return ((ev->timers.num != 0) ||
 		(ev->immediate_events != NULL) ||
 		(ev->signal_events != NULL));
 }
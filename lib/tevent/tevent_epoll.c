@@ -32,6 +32,12 @@
 #include "tevent_internal.h"
 #include "tevent_util.h"
 
+struct epoll_pending_update {
+	struct tevent_fd *fde;
+	/* the flags the fd is registered with */
+	uint16_t registered_flags;
+};
+
 struct epoll_event_context {
 	/* a pointer back to the generic event_context */
 	struct tevent_context *ev;
@@ -41,6 +47,13 @@ struct epoll_event_context {
 
 	pid_t pid;
 
+	/*
+	 * fdes with a deferred EPOLL_CTL_MOD/DEL,
+	 * see epoll_event_set_fd_flags()
+	 */
+	struct epoll_pending_update *pending;
+	size_t num_pending;
+
 	bool panic_force_replay;
 	bool *panic_state;
 	bool (*panic_fallback)(struct tevent_context *ev, bool replay);
@@ -50,6 +63,7 @@ struct epoll_event_context {
 #define EPOLL_ADDITIONAL_FD_FLAG_REPORT_ERROR	(1<<1)
 #define EPOLL_ADDITIONAL_FD_FLAG_GOT_ERROR	(1<<2)
 #define EPOLL_ADDITIONAL_FD_FLAG_HAS_MPX	(1<<3)
+#define EPOLL_ADDITIONAL_FD_FLAG_UPDATE_PENDING	(1<<4)
 
 #ifdef TEST_PANIC_FALLBACK
 
@@ -179,6 +193,41 @@ static uint32_t epoll_map_flags(uint16_t flags)
 	return ret;
 }
 
+/*
+  forget a deferred update of the fde
+*/
+static void epoll_unpend_fde(struct epoll_event_context *epoll_ev,
+			     struct tevent_fd *fde)
+{
+	size_t i;
+
+	if (!(fde->additional_flags & EPOLL_ADDITIONAL_FD_FLAG_UPDATE_PENDING)) {
+		return;
+	}
+	fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_UPDATE_PENDING;
+
+	for (i = 0; i < epoll_ev->num_pending; i++) {
+		if (epoll_ev->pending[i].fde != fde) {
+			continue;
+		}
+		epoll_ev->num_pending -= 1;
+		epoll_ev->pending[i] = epoll_ev->pending[epoll_ev->num_pending];
+		return;
+	}
+}
+
+/*
+  remove an fde with a bad fd from the event context
+*/
+static void epoll_disable_fde(struct epoll_event_context *epoll_ev,
+			      struct tevent_fd *fde)
+{
+	epoll_unpend_fde(epoll_ev, fde);
+	DLIST_REMOVE(epoll_ev->ev->fd_events, fde);
+	fde->wrapper = NULL;
+	fde->event_ctx = NULL;
+}
+
 /*
  free the epoll fd
 */
@@ -243,6 +292,10 @@ static void epoll_check_reopen(struct epoll_event_context *epoll_ev)
 
 	epoll_ev->pid = getpid();
 	epoll_ev->panic_state = &panic_triggered;
+	/* all fdes get registered again below */
+	while (epoll_ev->num_pending > 0) {
+		epoll_unpend_fde(epoll_ev, epoll_ev->pending[0].fde);
+	}
 	for (fde=epoll_ev->ev->fd_events;fde;fde=fde->next) {
 		fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_HAS_EVENT;
 		epoll_update_event(epoll_ev, fde);
@@ -322,12 +375,8 @@ static int epoll_add_multiplex_fd(struct epoll_event_context *epoll_ev,
 			     "EPOLL_CTL_MOD EBADF for "
 			     "add_fde[%p] mpx_fde[%p] fd[%d] - disabling\n",
 			     add_fde, mpx_fde, add_fde->fd);
-		DLIST_REMOVE(epoll_ev->ev->fd_events, mpx_fde);
-		mpx_fde->wrapper = NULL;
-		mpx_fde->event_ctx = NULL;
-		DLIST_REMOVE(epoll_ev->ev->fd_events, add_fde);
-		add_fde->wrapper = NULL;
-		add_fde->event_ctx = NULL;
+		epoll_disable_fde(epoll_ev, mpx_fde);
+		epoll_disable_fde(epoll_ev, add_fde);
 		return 0;
 	} else if (ret != 0) {
 		return ret;
@@ -388,13 +437,9 @@ static void epoll_add_event(struct epoll_event_context *epoll_ev, struct tevent_
 			     "EPOLL_CTL_ADD EBADF for "
 			     "fde[%p] mpx_fde[%p] fd[%d] - disabling\n",
 			     fde, mpx_fde, fde->fd);
-		DLIST_REMOVE(epoll_ev->ev->fd_events, fde);
-		fde->wrapper = NULL;
-		fde->event_ctx = NULL;
+		epoll_disable_fde(epoll_ev, fde);
 		if (mpx_fde != NULL) {
-			DLIST_REMOVE(epoll_ev->ev->fd_events, mpx_fde);
-			mpx_fde->wrapper = NULL;
-			mpx_fde->event_ctx = NULL;
+			epoll_disable_fde(epoll_ev, mpx_fde);
 		}
 		return;
 	} else if (ret != 0 && errno == EEXIST && mpx_fde == NULL) {
@@ -465,13 +510,9 @@ static void epoll_del_event(struct epoll_event_context *epoll_ev, struct tevent_
 			     "EPOLL_CTL_DEL EBADF for "
 			     "fde[%p] mpx_fde[%p] fd[%d] - disabling\n",
 			     fde, mpx_fde, fde->fd);
-		DLIST_REMOVE(epoll_ev->ev->fd_events, fde);
-		fde->wrapper = NULL;
-		fde->event_ctx = NULL;
+		epoll_disable_fde(epoll_ev, fde);
 		if (mpx_fde != NULL) {
-			DLIST_REMOVE(epoll_ev->ev->fd_events, mpx_fde);
-			mpx_fde->wrapper = NULL;
-			mpx_fde->event_ctx = NULL;
+			epoll_disable_fde(epoll_ev, mpx_fde);
 		}
 		return;
 	} else if (ret != 0) {
@@ -511,18 +552,19 @@ static void epoll_mod_event(struct epoll_event_context *epoll_ev, struct tevent_
 	}
 	event.data.ptr = fde;
 	ret = epoll_ctl(epoll_ev->epoll_fd, EPOLL_CTL_MOD, fde->fd, &event);
-	if (ret != 0 && errno == EBADF) {
+	if (ret != 0 && (errno == EBADF || errno == ENOENT)) {
+		/*
+		 * ENOENT means the fd was closed behind our back
+		 * before a deferred update was applied.
+		 */
 		tevent_debug(epoll_ev->ev, TEVENT_DEBUG_ERROR,
-			     "EPOLL_CTL_MOD EBADF for "
+			     "EPOLL_CTL_MOD %s for "
 			     "fde[%p] mpx_fde[%p] fd[%d] - disabling\n",
+			     (errno == EBADF) ? "EBADF" : "ENOENT",
 			     fde, mpx_fde, fde->fd);
-		DLIST_REMOVE(epoll_ev->ev->fd_events, fde);
-		fde->wrapper = NULL;
-		fde->event_ctx = NULL;
+		epoll_disable_fde(epoll_ev, fde);
 		if (mpx_fde != NULL) {
-			DLIST_REMOVE(epoll_ev->ev->fd_events, mpx_fde);
-			mpx_fde->wrapper = NULL;
-			mpx_fde->event_ctx = NULL;
+			epoll_disable_fde(epoll_ev, mpx_fde);
 		}
 		return;
 	} else if (ret != 0) {
@@ -593,6 +635,43 @@ static void epoll_update_event(struct epoll_event_context *epoll_ev, struct teve
 	}
 }
 
+/*
+  apply the deferred updates before we wait for events
+  or add a new fde, which could use the same fd number
+*/
+static void epoll_flush_pending(struct epoll_event_context *epoll_ev)
+{
+	bool *caller_panic_state = epoll_ev->panic_state;
+	bool panic_triggered = false;
+
+	epoll_ev->panic_state = &panic_triggered;
+
+	while (epoll_ev->num_pending > 0) {
+		struct epoll_pending_update *p = NULL;
+		struct tevent_fd *fde = NULL;
+
+		epoll_ev->num_pending -= 1;
+		p = &epoll_ev->pending[epoll_ev->num_pending];
+		fde = p->fde;
+
+		fde->additional_flags &= ~EPOLL_ADDITIONAL_FD_FLAG_UPDATE_PENDING;
+		if (fde->flags == p->registered_flags) {
+			/* changed back in the meantime */
+			continue;
+		}
+		epoll_update_event(epoll_ev, fde);
+
+		if (panic_triggered) {
+			if (caller_panic_state != NULL) {
+				*caller_panic_state = true;
+			}
+			return;
+		}
+	}
+
+	epoll_ev->panic_state = caller_panic_state;
+}
+
 /*
   Cope with epoll returning EPOLLHUP|EPOLLERR on an event.
   Return true if there's nothing else to do, false if
@@ -793,6 +872,7 @@ static int epoll_event_fd_destructor(struct tevent_fd *fde)
 	 * reuse invalid memory
 	 */
 	DLIST_REMOVE(ev->fd_events, fde);
+	epoll_unpend_fde(epoll_ev, fde);
 
 	if (fde->additional_flags & EPOLL_ADDITIONAL_FD_FLAG_HAS_MPX) {
 		mpx_fde = talloc_get_type_abort(fde->additional_data,
@@ -860,6 +940,10 @@ static struct tevent_fd *epoll_event_add_fd(struct tevent_context *ev, TALLOC_CT
 	if (panic_triggered) {
 		return fde;
 	}
+	epoll_flush_pending(epoll_ev);
+	if (panic_triggered) {
+		return fde;
+	}
 	epoll_ev->panic_state = NULL;
 
 	epoll_update_event(epoll_ev, fde);
@@ -875,6 +959,7 @@ static void epoll_event_set_fd_flags(struct tevent_fd *fde, uint16_t flags)
 	struct tevent_context *ev;
 	struct epoll_event_context *epoll_ev;
 	bool panic_triggered = false;
+	uint16_t old_flags;
 
 	if (fde->flags == flags) return;
 
@@ -882,6 +967,7 @@ static void epoll_event_set_fd_flags(struct tevent_fd *fde, uint16_t flags)
 	epoll_ev = talloc_get_type_abort(ev->additional_data,
 					 struct epoll_event_context);
 
+	old_flags = fde->flags;
 	fde->flags = flags;
 
 	epoll_ev->panic_state = &panic_triggered;
@@ -891,6 +977,54 @@ static void epoll_event_set_fd_flags(struct tevent_fd *fde, uint16_t flags)
 	}
 	epoll_ev->panic_state = NULL;
 
+	if (fde->additional_flags & EPOLL_ADDITIONAL_FD_FLAG_UPDATE_PENDING) {
+		return;
+	}
+
+	if (fde->additional_flags & EPOLL_ADDITIONAL_FD_FLAG_HAS_EVENT) {
+		size_t size = talloc_array_length(epoll_ev->pending);
+
+		/*
+		 * The fd is already registered, so we can defer the
+		 * EPOLL_CTL_MOD/DEL until we wait for events again.
+		 *
+		 * Callers like tstream_bsd toggle TEVENT_FD_READ or
+		 * TEVENT_FD_WRITE for every single request, often
+		 * back to the old value before the next epoll_wait().
+		 * That way the changes cost at most one epoll_ctl()
+		 * per loop iteration, often none.
+		 */
+		if (epoll_ev->num_pending == size) {
+			struct epoll_pending_update *pending = NULL;
+
+			pending = talloc_realloc(epoll_ev,
+						 epoll_ev->pending,
+						 struct epoll_pending_update,
+						 MAX(size * 2, 16));
+			if (pending == NULL) {
+				epoll_update_event(epoll_ev, fde);
+				return;
+			}
+			epoll_ev->pending = pending;
+		}
+
+		epoll_ev->pending[epoll_ev->num_pending] =
+			(struct epoll_pending_update) {
+				.fde = fde,
+				.registered_flags = old_flags,
+			};
+		epoll_ev->num_pending += 1;
+		fde->additional_flags |= EPOLL_ADDITIONAL_FD_FLAG_UPDATE_PENDING;
+		return;
+	}
+
+	epoll_ev->panic_state = &panic_triggered;
+	epoll_flush_pending(epoll_ev);
+	if (panic_triggered) {
+		return;
+	}
+	epoll_ev->panic_state = NULL;
+
 	epoll_update_event(epoll_ev, fde);
 }
 
@@ -931,6 +1065,11 @@ static int epoll_event_loop_once(struct tevent_context *ev, const char *location
 		errno = EINVAL;
 		return -1;
 	}
+	epoll_flush_pending(epoll_ev);
+	if (panic_triggered) {
+		errno = EINVAL;
+		return -1;
+	}
 	epoll_ev->panic_force_replay = false;
 	epoll_ev->panic_state = NULL;
 
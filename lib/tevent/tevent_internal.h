@@ -209,7 +209,10 @@ struct tevent_fd {
 };
 
 struct tevent_timer {
-	struct tevent_timer *prev, *next;
+	/* position in event_ctx->timers.heap */
+	size_t heap_idx;
+	/* orders timers with the same next_event */
+	uint64_t seq;
 	struct tevent_context *event_ctx;
 	struct tevent_wrapper_glue *wrapper;
 	bool busy;
@@ -313,8 +316,12 @@ struct tevent_context {
 	/* list of fd events - used by common code */
 	struct tevent_fd *fd_events;
 
-	/* list of timed events - used by common code */
-	struct tevent_timer *timer_events;
+	/* timed events - used by common code, see tevent_timed.c */
+	struct {
+		struct tevent_timer **heap;
+		size_t num;
+		uint64_t seq;
+	} timers;
 
 	/* List of scheduled immediates */
 	pthread_mutex_t scheduled_mutex;
@@ -385,13 +392,6 @@ struct tevent_context {
 		struct tevent_wrapper_glue *glue;
 	} wrapper;
 
-	/*
-	 * an optimization pointer into timer_events
-	 * used by used by common code via
-	 * tevent_common_add_timer_v2()
-	 */
-	struct tevent_timer *last_zero_timer;
-
 #ifdef HAVE_PTHREAD
 	struct tevent_context *prev, *next;
 #endif
@@ -437,6 +437,8 @@ struct timeval tevent_common_loop_timer_delay(struct tevent_context *);
 int tevent_common_invoke_timer_handler(struct tevent_timer *te,
 				       struct timeval current_time,
 				       bool *removed);
+void tevent_common_detach_wrapper_timers(struct tevent_context *main_ev,
+					 struct tevent_wrapper_glue *glue);
 
 void tevent_common_schedule_immediate(struct tevent_immediate *im,
 				      struct tevent_context *ev,
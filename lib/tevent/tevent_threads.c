@@ -474,6 +474,7 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 	const char *create_location = im->create_location;
 	struct tevent_context *main_ev = NULL;
 	struct tevent_wrapper_glue *glue = NULL;
+	bool wakeup;
 	int ret, wakeup_fd;
 
 	ret = pthread_mutex_lock(&tctx->event_ctx_mutex);
@@ -529,6 +530,13 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 		abort();
 	}
 
+	/*
+	 * tevent_common_threaded_activate_immediate() moves the
+	 * whole list in one go. If the list is not empty, whoever
+	 * added the first entry has done or will do the wakeup, so
+	 * a burst of completions costs just one write.
+	 */
+	wakeup = (main_ev->scheduled_immediates == NULL);
 	DLIST_ADD_END(main_ev->scheduled_immediates, im);
 	wakeup_fd = main_ev->wakeup_fd;
 
@@ -552,7 +560,9 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 	 * than a noncontended one. So I'd opt for the lower footprint
 	 * initially. Maybe we have to change that later.
 	 */
-	tevent_common_wakeup_fd(wakeup_fd);
+	if (wakeup) {
+		tevent_common_wakeup_fd(wakeup_fd);
+	}
 #else
 	/*
 	 * tevent_threaded_context_create() returned NULL with ENOSYS...
@@ -129,6 +129,128 @@ struct timeval tevent_timeval_current_ofs(uint32_t secs, uint32_t usecs)
 	return tevent_timeval_add(&tv, secs, usecs);
 }
 
+/*
+  The timers of a context are kept in a 4-ary min heap, ordered by
+  next_event. Timers with the same next_event are ordered by te->seq,
+  so they run in the order they were added or updated, just as they
+  did when we kept a sorted list. Adding and removing a timer is
+  O(log n) instead of walking the list.
+*/
+#define TEVENT_TIMER_HEAP_ARITY 4
+
+static bool tevent_timer_before(const struct tevent_timer *te1,
+				const struct tevent_timer *te2)
+{
+	int ret;
+
+	ret = tevent_timeval_compare(&te1->next_event, &te2->next_event);
+	if (ret != 0) {
+		return (ret < 0);
+	}
+
+	return (te1->seq < te2->seq);
+}
+
+static void tevent_timer_heap_sift_up(struct tevent_context *ev, size_t idx)
+{
+	struct tevent_timer **heap = ev->timers.heap;
+	struct tevent_timer *te = heap[idx];
+
+	while (idx > 0) {
+		size_t parent = (idx - 1) / TEVENT_TIMER_HEAP_ARITY;
+
+		if (!tevent_timer_before(te, heap[parent])) {
+			break;
+		}
+
+		heap[idx] = heap[parent];
+		heap[idx]->heap_idx = idx;
+		idx = parent;
+	}
+
+	heap[idx] = te;
+	te->heap_idx = idx;
+}
+
+static void tevent_timer_heap_sift_down(struct tevent_context *ev, size_t idx)
+{
+	struct tevent_timer **heap = ev->timers.heap;
+	size_t num = ev->timers.num;
+	struct tevent_timer *te = heap[idx];
+
+	while (true) {
+		size_t first = idx * TEVENT_TIMER_HEAP_ARITY + 1;
+		size_t last = MIN(first + TEVENT_TIMER_HEAP_ARITY, num);
+		size_t min_idx = idx;
+		struct tevent_timer *min_te = te;
+		size_t i;
+
+		for (i = first; i < last; i++) {
+			if (tevent_timer_before(heap[i], min_te)) {
+				min_idx = i;
+				min_te = heap[i];
+			}
+		}
+
+		if (min_idx == idx) {
+			break;
+		}
+
+		heap[idx] = min_te;
+		min_te->heap_idx = idx;
+		idx = min_idx;
+	}
+
+	heap[idx] = te;
+	te->heap_idx = idx;
+}
+
+static void tevent_common_remove_timer(struct tevent_context *ev,
+				       struct tevent_timer *te)
+{
+	size_t idx = te->heap_idx;
+	size_t size = talloc_array_length(ev->timers.heap);
+	struct tevent_timer *last = NULL;
+
+	if ((idx >= ev->timers.num) || (ev->timers.heap[idx] != te)) {
+		/* not queued, e.g. while the handler runs */
+		return;
+	}
+
+	ev->timers.num -= 1;
+	last = ev->timers.heap[ev->timers.num];
+	ev->timers.heap[ev->timers.num] = NULL;
+
+	if (last != te) {
+		ev->timers.heap[idx] = last;
+		last->heap_idx = idx;
+
+		if ((idx > 0) &&
+		    tevent_timer_before(
+			    last,
+			    ev->timers.heap[(idx - 1) / TEVENT_TIMER_HEAP_ARITY]))
+		{
+			tevent_timer_heap_sift_up(ev, idx);
+		} else {
+			tevent_timer_heap_sift_down(ev, idx);
+		}
+	}
+
+	if ((size > 64) && (ev->timers.num < size / 4)) {
+		struct tevent_timer **heap = NULL;
+
+		/*
+		 * Give back the memory after a burst of timers,
+		 * it's no problem if that fails.
+		 */
+		heap = talloc_realloc(ev, ev->timers.heap,
+				      struct tevent_timer *, size / 2);
+		if (heap != NULL) {
+			ev->timers.heap = heap;
+		}
+	}
+}
+
 /*
   destroy a timed event
 */
@@ -148,12 +270,8 @@ static int tevent_common_timed_destructor(struct tevent_timer *te)
 		     "Destroying timer event %p \"%s\"\n",
 		     te, te->handler_name);
 
-	if (te->event_ctx->last_zero_timer == te) {
-		te->event_ctx->last_zero_timer = DLIST_PREV(te);
-	}
-
 	tevent_trace_timer_callback(te->event_ctx, te, TEVENT_EVENT_TRACE_DETACH);
-	DLIST_REMOVE(te->event_ctx->timer_events, te);
+	tevent_common_remove_timer(te->event_ctx, te);
 
 	te->event_ctx = NULL;
 done:
@@ -165,61 +283,73 @@ done:
 	return 0;
 }
 
-static void tevent_common_insert_timer(struct tevent_context *ev,
-				       struct tevent_timer *te,
-				       bool optimize_zero)
+static bool tevent_common_insert_timer(struct tevent_context *ev,
+				       struct tevent_timer *te)
 {
-	struct tevent_timer *prev_te = NULL;
+	size_t num = ev->timers.num;
+	size_t size = talloc_array_length(ev->timers.heap);
 
 	if (te->destroyed) {
 		tevent_abort(ev, "tevent_timer use after free");
-		return;
+		return false;
 	}
 
-	/* keep the list ordered */
-	if (optimize_zero && tevent_timeval_is_zero(&te->next_event)) {
-		/*
-		 * Some callers use zero tevent_timer
-		 * instead of tevent_immediate events.
-		 *
-		 * As these can happen very often,
-		 * we remember the last zero timer
-		 * in the list.
-		 */
-		prev_te = ev->last_zero_timer;
-		ev->last_zero_timer = te;
-	} else {
-		struct tevent_timer *cur_te;
+	if (num == size) {
+		struct tevent_timer **heap = NULL;
 
-		/*
-		 * we traverse the list from the tail
-		 * because it's much more likely that
-		 * timers are added at the end of the list
-		 */
-		for (cur_te = DLIST_TAIL(ev->timer_events);
-		     cur_te != NULL;
-		     cur_te = DLIST_PREV(cur_te))
-		{
-			int ret;
-
-			/*
-			 * if the new event comes before the current
-			 * we continue searching
-			 */
-			ret = tevent_timeval_compare(&te->next_event,
-						     &cur_te->next_event);
-			if (ret < 0) {
-				continue;
-			}
+		heap = talloc_realloc(ev, ev->timers.heap,
+				      struct tevent_timer *,
+				      MAX(size * 2, 64));
+		if (heap == NULL) {
+			return false;
+		}
+		ev->timers.heap = heap;
+	}
 
-			break;
+	te->seq = ev->timers.seq++;
+
+	ev->timers.heap[num] = te;
+	ev->timers.num = num + 1;
+	tevent_timer_heap_sift_up(ev, num);
+
+	tevent_trace_timer_callback(te->event_ctx, te, TEVENT_EVENT_TRACE_ATTACH);
+	return true;
+}
+
+void tevent_common_detach_wrapper_timers(struct tevent_context *main_ev,
+					 struct tevent_wrapper_glue *glue)
+{
+	size_t i, num = 0;
+
+	for (i = 0; i < main_ev->timers.num; i++) {
+		struct tevent_timer *te = main_ev->timers.heap[i];
+
+		if (te->wrapper != glue) {
+			main_ev->timers.heap[num] = te;
+			te->heap_idx = num;
+			num += 1;
+			continue;
 		}
 
-		prev_te = cur_te;
+		te->wrapper = NULL;
+		te->event_ctx = NULL;
 	}
 
-	tevent_trace_timer_callback(te->event_ctx, te, TEVENT_EVENT_TRACE_ATTACH);
-	DLIST_ADD_AFTER(ev->timer_events, te, prev_te);
+	for (i = num; i < main_ev->timers.num; i++) {
+		main_ev->timers.heap[i] = NULL;
+	}
+	main_ev->timers.num = num;
+
+	if (num < 2) {
+		return;
+	}
+
+	/* restore the heap order, bottom up from the last parent */
+	i = (num - 2) / TEVENT_TIMER_HEAP_ARITY + 1;
+	while (i > 0) {
+		i -= 1;
+		tevent_timer_heap_sift_down(main_ev, i);
+	}
 }
 
 /*
@@ -233,10 +363,10 @@ static struct tevent_timer *tevent_common_add_timer_internal(
 					tevent_timer_handler_t handler,
 					void *private_data,
 					const char *handler_name,
-					const char *location,
-					bool optimize_zero)
+					const char *location)
 {
 	struct tevent_timer *te;
+	bool ok;
 
 	te = talloc(mem_ctx?mem_ctx:ev, struct tevent_timer);
 	if (te == NULL) return NULL;
@@ -250,12 +380,12 @@ static struct tevent_timer *tevent_common_add_timer_internal(
 		.location	= location,
 	};
 
-	if (ev->timer_events == NULL) {
-		ev->last_zero_timer = NULL;
+	ok = tevent_common_insert_timer(ev, te);
+	if (!ok) {
+		talloc_free(te);
+		return NULL;
 	}
 
-	tevent_common_insert_timer(ev, te, optimize_zero);
-
 	talloc_set_destructor(te, tevent_common_timed_destructor);
 
 
@@ -273,17 +403,9 @@ struct tevent_timer *tevent_common_add_timer(struct tevent_context *ev,
 					     const char *handler_name,
 					     const char *location)
 {
-	/*
-	 * do not use optimization, there are broken Samba
-	 * versions which use tevent_common_add_timer()
-	 * without using tevent_common_loop_timer_delay(),
-	 * it just uses DLIST_REMOVE(ev->timer_events, te)
-	 * and would leave ev->last_zero_timer behind.
-	 */
 	return tevent_common_add_timer_internal(ev, mem_ctx, next_event,
 						handler, private_data,
-						handler_name, location,
-						false);
+						handler_name, location);
 }
 
 struct tevent_timer *tevent_common_add_timer_v2(struct tevent_context *ev,
@@ -295,31 +417,32 @@ struct tevent_timer *tevent_common_add_timer_v2(struct tevent_context *ev,
 					        const char *location)
 {
 	/*
-	 * Here we turn on last_zero_timer optimization
+	 * This used to turn on an optimization for zero timers
+	 * in the sorted list, the heap doesn't need it.
 	 */
 	return tevent_common_add_timer_internal(ev, mem_ctx, next_event,
 						handler, private_data,
-						handler_name, location,
-						true);
+						handler_name, location);
 }
 
 void tevent_update_timer(struct tevent_timer *te, struct timeval next_event)
 {
 	struct tevent_context *ev = te->event_ctx;
+	bool ok;
 
-	if (ev->last_zero_timer == te) {
-		te->event_ctx->last_zero_timer = DLIST_PREV(te);
-	}
 	tevent_trace_timer_callback(te->event_ctx, te, TEVENT_EVENT_TRACE_DETACH);
-	DLIST_REMOVE(ev->timer_events, te);
+	tevent_common_remove_timer(ev, te);
 
 	te->next_event = next_event;
 
 	/*
-	 * Not doing the zero_timer optimization. This is for new code
-	 * that should know about immediates.
+	 * We just gave back a slot in the heap, so this only fails
+	 * if the timer wasn't queued.
 	 */
-	tevent_common_insert_timer(ev, te, false);
+	ok = tevent_common_insert_timer(ev, te);
+	if (!ok) {
+		tevent_abort(ev, "tevent_update_timer: no memory");
+	}
 }
 
 int tevent_common_invoke_timer_handler(struct tevent_timer *te,
@@ -341,10 +464,7 @@ int tevent_common_invoke_timer_handler(struct tevent_timer *te,
 	 * handler because in a semi-async inner event loop called from the
 	 * handler we don't want to come across this event again -- vl
 	 */
-	if (te->event_ctx->last_zero_timer == te) {
-		te->event_ctx->last_zero_timer = DLIST_PREV(te);
-	}
-	DLIST_REMOVE(te->event_ctx->timer_events, te);
+	tevent_common_remove_timer(te->event_ctx, te);
 
 	tevent_debug(te->event_ctx, TEVENT_DEBUG_TRACE,
 		     "Running timer event %p \"%s\"\n",
@@ -417,16 +537,18 @@ int tevent_common_invoke_timer_handler(struct tevent_timer *te,
 struct timeval tevent_common_loop_timer_delay(struct tevent_context *ev)
 {
 	struct timeval current_time = tevent_timeval_zero();
-	struct tevent_timer *te = ev->timer_events;
+	struct tevent_timer *te = NULL;
 	int ret;
 
-	if (!te) {
+	if (ev->timers.num == 0) {
 		/* have a default tick time of 30 seconds. This guarantees
 		   that code that uses its own timeout checking will be
 		   able to proceed eventually */
 		return tevent_timeval_set(30, 0);
 	}
 
+	te = ev->timers.heap[0];
+
 	/*
 	 * work out the right timeout for the next timed event
 	 *
@@ -198,7 +198,6 @@ static int tevent_wrapper_context_destructor(struct tevent_context *wrap_ev)
 	struct tevent_wrapper_glue *glue = wrap_ev->wrapper.glue;
 	struct tevent_context *main_ev = NULL;
 	struct tevent_fd *fd = NULL, *fn = NULL;
-	struct tevent_timer *te = NULL, *tn = NULL;
 	struct tevent_immediate *ie = NULL, *in = NULL;
 	struct tevent_signal *se = NULL, *sn = NULL;
 #ifdef HAVE_PTHREAD
@@ -281,21 +280,7 @@ static int tevent_wrapper_context_destructor(struct tevent_context *wrap_ev)
 		DLIST_REMOVE(main_ev->fd_events, fd);
 	}
 
-	for (te = main_ev->timer_events; te; te = tn) {
-		tn = te->next;
-
-		if (te->wrapper != glue) {
-			continue;
-		}
-
-		te->wrapper = NULL;
-		te->event_ctx = NULL;
-
-		if (main_ev->last_zero_timer == te) {
-			main_ev->last_zero_timer = DLIST_PREV(te);
-		}
-		DLIST_REMOVE(main_ev->timer_events, te);
-	}
+	tevent_common_detach_wrapper_timers(main_ev, glue);
 
 	for (ie = main_ev->immediate_events; ie; ie = in) {
 		in = ie->next;
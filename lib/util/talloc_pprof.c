@@ -0,0 +1,466 @@
+/*
+ * talloc memory profile in pprof format
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replace.h"
+#include "system/time.h"
+#include "lib/util/memory.h"
+#include "talloc_pprof.h"
+
+/*
+ * Names are collected in a hash table keyed by the name, as for
+ * talloc_profile_walk(). Names built with talloc_set_name() are
+ * different for every chunk, so the table is limited. The table is
+ * malloced, the talloc tree must not change while we walk it.
+ * Names passed by talloc_profile_walk() are only valid during the
+ * callback, they are copied into the table.
+ */
+#define PPROF_MAX_NAMES 65536
+
+struct pprof_entry {
+	const char *name;
+	uint32_t hash;
+	uint64_t alloc_objects;
+	uint64_t alloc_space;
+	uint64_t inuse_objects;
+	uint64_t inuse_space;
+};
+
+struct pprof_table {
+	struct pprof_entry *entries;
+	size_t num_entries;
+	size_t num_used;
+	struct pprof_entry other;
+	TALLOC_CTX *names;
+	bool ok;
+};
+
+static uint32_t pprof_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name != '\0') {
+		h ^= (uint8_t)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static void pprof_insert(struct pprof_entry *entries,
+			 size_t num_entries,
+			 const struct pprof_entry *e)
+{
+	size_t i = e->hash & (num_entries - 1);
+
+	while (entries[i].name != NULL) {
+		i = (i + 1) & (num_entries - 1);
+	}
+	entries[i] = *e;
+}
+
+static struct pprof_entry *pprof_get(struct pprof_table *t,
+				     const char *name,
+				     bool copy)
+{
+	uint32_t hash = pprof_hash(name);
+	size_t i;
+
+	i = hash & (t->num_entries - 1);
+
+	while (t->entries[i].name != NULL) {
+		if ((t->entries[i].hash == hash) &&
+		    (strcmp(t->entries[i].name, name) == 0)) {
+			return &t->entries[i];
+		}
+		i = (i + 1) & (t->num_entries - 1);
+	}
+
+	/*
+	 * A new name, only names we already know are
+	 * counted once the table is full.
+	 */
+	if (t->num_used * 2 >= t->num_entries) {
+		size_t num_entries = t->num_entries * 2;
+		struct pprof_entry *entries = NULL;
+
+		if (t->num_used >= PPROF_MAX_NAMES) {
+			return &t->other;
+		}
+
+		entries = calloc(num_entries, sizeof(struct pprof_entry));
+		if (entries == NULL) {
+			t->ok = false;
+			return &t->other;
+		}
+		for (i=0; i<t->num_entries; i++) {
+			if (t->entries[i].name != NULL) {
+				pprof_insert(entries, num_entries,
+					     &t->entries[i]);
+			}
+		}
+		SAFE_FREE(t->entries);
+		t->entries = entries;
+		t->num_entries = num_entries;
+
+		i = hash & (t->num_entries - 1);
+		while (t->entries[i].name != NULL) {
+			i = (i + 1) & (t->num_entries - 1);
+		}
+	}
+
+	if (copy) {
+		name = talloc_strdup(t->names, name);
+		if (name == NULL) {
+			t->ok = false;
+			return &t->other;
+		}
+	}
+
+	t->entries[i].name = name;
+	t->entries[i].hash = hash;
+	t->num_used += 1;
+	return &t->entries[i];
+}
+
+static void pprof_inuse_cb(const void *ptr,
+			   int depth,
+			   int max_depth,
+			   int is_ref,
+			   void *private_data)
+{
+	struct pprof_table *t = private_data;
+	const char *name = NULL;
+	struct pprof_entry *e = NULL;
+
+	if (is_ref) {
+		return;
+	}
+
+	name = talloc_get_name(ptr);
+	if (name == (const char *)ptr) {
+		/*
+		 * talloc_strdup() and friends use the string as name,
+		 * this is what talloc_profile_walk() reports as well.
+		 */
+		name = "char";
+	}
+
+	e = pprof_get(t, name, false);
+	e->inuse_objects += 1;
+	e->inuse_space += talloc_get_size(ptr);
+}
+
+static void pprof_alloc_cb(const char *name,
+			   const struct talloc_profile_entry *entry,
+			   void *private_data)
+{
+	struct pprof_table *t = private_data;
+	struct pprof_entry *e = NULL;
+
+	if (strcmp(name, "[other]") == 0) {
+		e = &t->other;
+	} else {
+		e = pprof_get(t, name, true);
+	}
+	e->alloc_objects += entry->alloc_count;
+	e->alloc_space += entry->alloc_bytes;
+}
+
+/*
+ * Minimal protobuf encoder, see
+ * https://github.com/google/pprof/blob/main/proto/profile.proto
+ * for the message definitions.
+ */
+
+struct pb {
+	uint8_t *buf;
+	size_t len;
+	bool ok;
+};
+
+static void pb_append(struct pb *pb, const void *data, size_t len)
+{
+	size_t space;
+
+	if (!pb->ok) {
+		return;
+	}
+
+	space = talloc_get_size(pb->buf) - pb->len;
+	if (space < len) {
+		size_t needed = pb->len + len;
+		size_t new_size = MAX(needed, talloc_get_size(pb->buf) * 2);
+		uint8_t *buf = NULL;
+
+		if (needed < pb->len) {
+			pb->ok = false;
+			return;
+		}
+		buf = talloc_realloc(NULL, pb->buf, uint8_t, new_size);
+		if (buf == NULL) {
+			pb->ok = false;
+			return;
+		}
+		pb->buf = buf;
+	}
+
+	memcpy(pb->buf + pb->len, data, len);
+	pb->len += len;
+}
+
+static void pb_varint(struct pb *pb, uint64_t v)
+{
+	uint8_t tmp[10];
+	size_t n = 0;
+
+	do {
+		tmp[n] = v & 0x7f;
+		v >>= 7;
+		if (v != 0) {
+			tmp[n] |= 0x80;
+		}
+		n += 1;
+	} while (v != 0);
+
+	pb_append(pb, tmp, n);
+}
+
+#define PB_WIRE_VARINT 0
+#define PB_WIRE_LEN 2
+
+static void pb_tag(struct pb *pb, unsigned field, unsigned wire_type)
+{
+	pb_varint(pb, ((uint64_t)field << 3) | wire_type);
+}
+
+static void pb_uint(struct pb *pb, unsigned field, uint64_t v)
+{
+	if (v == 0) {
+		/* the default, no need to encode it */
+		return;
+	}
+	pb_tag(pb, field, PB_WIRE_VARINT);
+	pb_varint(pb, v);
+}
+
+static void pb_bytes(struct pb *pb,
+		     unsigned field,
+		     const void *data,
+		     size_t len)
+{
+	pb_tag(pb, field, PB_WIRE_LEN);
+	pb_varint(pb, len);
+	pb_append(pb, data, len);
+}
+
+/* Append sub as embedded message and reset it for the next one */
+static void pb_message(struct pb *pb, unsigned field, struct pb *sub)
+{
+	if (!sub->ok) {
+		pb->ok = false;
+	}
+	pb_bytes(pb, field, sub->buf, sub->len);
+	sub->len = 0;
+}
+
+struct pprof_strings {
+	struct pb pb;
+	int64_t num;
+};
+
+static int64_t pprof_string(struct pprof_strings *s,
+			    const char *str,
+			    size_t len)
+{
+	pb_bytes(&s->pb, 6, str, len);
+	return s->num++;
+}
+
+/*
+ * Split "file.c:123" as produced by __location__
+ */
+static bool pprof_split_location(const char *name,
+				 size_t *pfile_len,
+				 int64_t *pline)
+{
+	const char *colon = strrchr(name, ':');
+	const char *p = NULL;
+	int64_t line = 0;
+
+	if (colon == NULL || colon == name || colon[1] == '\0') {
+		return false;
+	}
+
+	for (p = colon + 1; *p != '\0'; p++) {
+		if (*p < '0' || *p > '9' || line > INT32_MAX) {
+			return false;
+		}
+		line = line * 10 + (*p - '0');
+	}
+
+	*pfile_len = colon - name;
+	*pline = line;
+	return true;
+}
+
+static void pprof_encode_entry(struct pb *profile,
+			       struct pb *msg,
+			       struct pb *sub,
+			       struct pprof_strings *strings,
+			       uint64_t id,
+			       const char *name,
+			       const struct pprof_entry *e)
+{
+	int64_t name_idx, file_idx = 0, line = 0;
+	size_t file_len;
+	uint64_t values[] = {
+		e->alloc_objects,
+		e->alloc_space,
+		e->inuse_objects,
+		e->inuse_space,
+	};
+	size_t i;
+
+	name_idx = pprof_string(strings, name, strlen(name));
+	if (pprof_split_location(name, &file_len, &line)) {
+		file_idx = pprof_string(strings, name, file_len);
+	}
+
+	/* Function */
+	pb_uint(msg, 1, id);
+	pb_uint(msg, 2, name_idx);
+	pb_uint(msg, 3, name_idx);
+	pb_uint(msg, 4, file_idx);
+	pb_uint(msg, 5, line);
+	pb_message(profile, 5, msg);
+
+	/* Location with a single Line */
+	pb_uint(sub, 1, id);
+	pb_uint(sub, 2, line);
+	pb_uint(msg, 1, id);
+	pb_message(msg, 4, sub);
+	pb_message(profile, 4, msg);
+
+	/* Sample, location_id and value are packed */
+	pb_varint(sub, id);
+	pb_message(msg, 1, sub);
+	for (i=0; i<ARRAY_SIZE(values); i++) {
+		pb_varint(sub, values[i]);
+	}
+	pb_message(msg, 2, sub);
+	pb_message(profile, 2, msg);
+}
+
+uint8_t *talloc_pprof(TALLOC_CTX *mem_ctx, TALLOC_CTX *root, size_t *plen)
+{
+	struct pprof_table t = { .num_entries = 1024, .ok = true };
+	struct pprof_strings strings = { .pb.ok = true };
+	struct pb profile = { .ok = true };
+	struct pb msg = { .ok = true };
+	struct pb sub = { .ok = true };
+	static const char *types[] = {
+		"alloc_objects", "count",
+		"alloc_space", "bytes",
+		"inuse_objects", "count",
+		"inuse_space", "bytes",
+	};
+	int64_t type_idx[ARRAY_SIZE(types)];
+	TALLOC_CTX *frame = NULL;
+	struct timespec ts;
+	uint8_t *result = NULL;
+	uint64_t id = 0;
+	size_t i;
+
+	t.entries = calloc(t.num_entries, sizeof(struct pprof_entry));
+	if (t.entries == NULL) {
+		return NULL;
+	}
+
+	talloc_report_depth_cb(root, 0, -1, pprof_inuse_cb, &t);
+
+	frame = talloc_new(NULL);
+	if (frame == NULL) {
+		goto fail;
+	}
+
+	t.names = frame;
+	talloc_profile_walk(pprof_alloc_cb, &t);
+	if (!t.ok) {
+		goto fail;
+	}
+	strings.pb.buf = talloc_size(frame, 4096);
+	profile.buf = talloc_size(frame, 4096);
+	msg.buf = talloc_size(frame, 256);
+	sub.buf = talloc_size(frame, 256);
+	if (strings.pb.buf == NULL || profile.buf == NULL ||
+	    msg.buf == NULL || sub.buf == NULL) {
+		goto fail;
+	}
+
+	/* string_table[0] has to be "" */
+	pprof_string(&strings, "", 0);
+	for (i=0; i<ARRAY_SIZE(types); i++) {
+		type_idx[i] = pprof_string(&strings, types[i],
+					   strlen(types[i]));
+	}
+
+	for (i=0; i<ARRAY_SIZE(types); i+=2) {
+		pb_uint(&msg, 1, type_idx[i]);
+		pb_uint(&msg, 2, type_idx[i+1]);
+		pb_message(&profile, 1, &msg);
+	}
+
+	for (i=0; i<t.num_entries; i++) {
+		const struct pprof_entry *e = &t.entries[i];
+
+		if (e->name == NULL) {
+			continue;
+		}
+		id += 1;
+		pprof_encode_entry(&profile, &msg, &sub, &strings,
+				   id, e->name, e);
+	}
+	if (t.other.alloc_objects != 0 || t.other.inuse_objects != 0) {
+		id += 1;
+		pprof_encode_entry(&profile, &msg, &sub, &strings,
+				   id, "[other]", &t.other);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	pb_uint(&profile, 9,
+		(uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+
+	/* period_type is space/bytes, the sample interval */
+	pb_uint(&msg, 1, type_idx[6]);
+	pb_uint(&msg, 2, type_idx[7]);
+	pb_message(&profile, 11, &msg);
+	pb_uint(&profile, 12, talloc_profile_get_interval());
+
+	/* default_sample_type: inuse_space */
+	pb_uint(&profile, 14, type_idx[6]);
+
+	pb_append(&strings.pb, profile.buf, profile.len);
+	if (!strings.pb.ok || !profile.ok) {
+		goto fail;
+	}
+
+	result = talloc_steal(mem_ctx, strings.pb.buf);
+	*plen = strings.pb.len;
+fail:
+	TALLOC_FREE(frame);
+	SAFE_FREE(t.entries);
+	return result;
+}
@@ -0,0 +1,35 @@
+/*
+ * talloc memory profile in pprof format
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TALLOC_PPROF_H_
+#define _TALLOC_PPROF_H_
+
+#include <talloc.h>
+
+/*
+ * Create a memory profile in the (uncompressed) protobuf format read by
+ * "go tool pprof" and friends.
+ *
+ * Every talloc name is a pprof function, with file and line filled in
+ * for __location__ names. The "inuse" values count all chunks below
+ * root, root==NULL needs talloc_enable_null_tracking(). The "alloc"
+ * values are the estimates from talloc_profile_set_interval() sampling,
+ * they are 0 if sampling was never enabled.
+ */
+uint8_t *talloc_pprof(TALLOC_CTX *mem_ctx, TALLOC_CTX *root, size_t *plen);
+
+#endif
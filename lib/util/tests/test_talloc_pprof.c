@@ -0,0 +1,518 @@
+/*
+ * Unix SMB/CIFS implementation.
+ *
+ * Tests for talloc_pprof()
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "lib/replace/replace.h"
+#include "lib/util/talloc_pprof.h"
+
+/* Mirrors the limit in talloc_pprof.c */
+#define PPROF_MAX_NAMES 65536
+
+/*
+ * Just enough of a protobuf decoder to check the messages of
+ * https://github.com/google/pprof/blob/main/proto/profile.proto
+ * we create.
+ */
+
+struct pb_field {
+	unsigned field;
+	unsigned wire_type;
+	uint64_t v;
+	const uint8_t *data;
+	size_t len;
+};
+
+static uint64_t pb_get_varint(const uint8_t **pp, const uint8_t *end)
+{
+	const uint8_t *p = *pp;
+	uint64_t v = 0;
+	unsigned shift = 0;
+
+	do {
+		assert_true(p < end);
+		assert_true(shift < 64);
+		v |= (uint64_t)(*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+
+	*pp = p;
+	return v;
+}
+
+static bool pb_next(const uint8_t **pp,
+		    const uint8_t *end,
+		    struct pb_field *f)
+{
+	uint64_t tag;
+
+	if (*pp == end) {
+		return false;
+	}
+
+	tag = pb_get_varint(pp, end);
+	*f = (struct pb_field) {
+		.field = tag >> 3,
+		.wire_type = tag & 7,
+	};
+
+	switch (f->wire_type) {
+	case 0:
+		f->v = pb_get_varint(pp, end);
+		break;
+	case 2:
+		f->len = pb_get_varint(pp, end);
+		assert_true(f->len <= (size_t)(end - *pp));
+		f->data = *pp;
+		*pp += f->len;
+		break;
+	default:
+		fail_msg("unexpected wire type %u", f->wire_type);
+	}
+
+	return true;
+}
+
+/* Decode a packed repeated uint64 field */
+static size_t pb_packed(const struct pb_field *f,
+			uint64_t *values,
+			size_t max_values)
+{
+	const uint8_t *p = f->data;
+	const uint8_t *end = f->data + f->len;
+	size_t n = 0;
+
+	assert_int_equal(f->wire_type, 2);
+
+	while (p < end) {
+		assert_true(n < max_values);
+		values[n++] = pb_get_varint(&p, end);
+	}
+	return n;
+}
+
+struct pprof_function {
+	uint64_t id;
+	uint64_t name;
+	uint64_t system_name;
+	uint64_t filename;
+	uint64_t start_line;
+};
+
+struct pprof_location {
+	uint64_t id;
+	uint64_t function_id;
+	uint64_t line;
+};
+
+struct pprof_sample {
+	uint64_t location_id[4];
+	size_t num_location_ids;
+	uint64_t value[8];
+	size_t num_values;
+};
+
+struct pprof_value_type {
+	uint64_t type;
+	uint64_t unit;
+};
+
+struct pprof_profile {
+	char **strings;
+	size_t num_strings;
+	struct pprof_value_type sample_type[4];
+	size_t num_sample_types;
+	struct pprof_sample *samples;
+	size_t num_samples;
+	struct pprof_location *locations;
+	size_t num_locations;
+	struct pprof_function *functions;
+	size_t num_functions;
+	struct pprof_value_type period_type;
+	uint64_t period;
+	uint64_t default_sample_type;
+};
+
+static void decode_value_type(const struct pb_field *m,
+			      struct pprof_value_type *vt)
+{
+	const uint8_t *p = m->data;
+	struct pb_field f;
+
+	*vt = (struct pprof_value_type) { .type = 0, };
+
+	while (pb_next(&p, m->data + m->len, &f)) {
+		if (f.field == 1) {
+			vt->type = f.v;
+		} else if (f.field == 2) {
+			vt->unit = f.v;
+		}
+	}
+}
+
+static void decode_sample(const struct pb_field *m, struct pprof_sample *s)
+{
+	const uint8_t *p = m->data;
+	struct pb_field f;
+
+	while (pb_next(&p, m->data + m->len, &f)) {
+		if (f.field == 1) {
+			s->num_location_ids = pb_packed(
+				&f,
+				s->location_id,
+				ARRAY_SIZE(s->location_id));
+		} else if (f.field == 2) {
+			s->num_values = pb_packed(&f,
+						  s->value,
+						  ARRAY_SIZE(s->value));
+		}
+	}
+}
+
+static void decode_location(const struct pb_field *m,
+			    struct pprof_location *l)
+{
+	const uint8_t *p = m->data;
+	struct pb_field f;
+	size_t num_lines = 0;
+
+	while (pb_next(&p, m->data + m->len, &f)) {
+		if (f.field == 1) {
+			l->id = f.v;
+		} else if (f.field == 4) {
+			const uint8_t *q = f.data;
+			struct pb_field g;
+
+			while (pb_next(&q, f.data + f.len, &g)) {
+				if (g.field == 1) {
+					l->function_id = g.v;
+				} else if (g.field == 2) {
+					l->line = g.v;
+				}
+			}
+			num_lines += 1;
+		}
+	}
+	assert_int_equal(num_lines, 1);
+}
+
+static void decode_function(const struct pb_field *m,
+			    struct pprof_function *fn)
+{
+	const uint8_t *p = m->data;
+	struct pb_field f;
+
+	while (pb_next(&p, m->data + m->len, &f)) {
+		switch (f.field) {
+		case 1:
+			fn->id = f.v;
+			break;
+		case 2:
+			fn->name = f.v;
+			break;
+		case 3:
+			fn->system_name = f.v;
+			break;
+		case 4:
+			fn->filename = f.v;
+			break;
+		case 5:
+			fn->start_line = f.v;
+			break;
+		}
+	}
+}
+
+static void decode_profile(TALLOC_CTX *mem_ctx,
+			   const uint8_t *buf,
+			   size_t len,
+			   struct pprof_profile *pr)
+{
+	const uint8_t *p = buf;
+	struct pb_field f;
+
+	*pr = (struct pprof_profile) { .num_strings = 0, };
+
+	while (pb_next(&p, buf + len, &f)) {
+		switch (f.field) {
+		case 1:
+			assert_true(pr->num_sample_types <
+				    ARRAY_SIZE(pr->sample_type));
+			decode_value_type(
+				&f, &pr->sample_type[pr->num_sample_types++]);
+			break;
+		case 2:
+			pr->samples = talloc_realloc(mem_ctx,
+						     pr->samples,
+						     struct pprof_sample,
+						     pr->num_samples + 1);
+			assert_non_null(pr->samples);
+			pr->samples[pr->num_samples] =
+				(struct pprof_sample) { .num_values = 0, };
+			decode_sample(&f, &pr->samples[pr->num_samples++]);
+			break;
+		case 4:
+			pr->locations = talloc_realloc(mem_ctx,
+						       pr->locations,
+						       struct pprof_location,
+						       pr->num_locations + 1);
+			assert_non_null(pr->locations);
+			pr->locations[pr->num_locations] =
+				(struct pprof_location) { .id = 0, };
+			decode_location(&f, &pr->locations[pr->num_locations++]);
+			break;
+		case 5:
+			pr->functions = talloc_realloc(mem_ctx,
+						       pr->functions,
+						       struct pprof_function,
+						       pr->num_functions + 1);
+			assert_non_null(pr->functions);
+			pr->functions[pr->num_functions] =
+				(struct pprof_function) { .id = 0, };
+			decode_function(&f, &pr->functions[pr->num_functions++]);
+			break;
+		case 6:
+			assert_int_equal(f.wire_type, 2);
+			pr->strings = talloc_realloc(mem_ctx,
+						     pr->strings,
+						     char *,
+						     pr->num_strings + 1);
+			assert_non_null(pr->strings);
+			pr->strings[pr->num_strings] = talloc_strndup(
+				pr->strings, (const char *)f.data, f.len);
+			assert_non_null(pr->strings[pr->num_strings]);
+			pr->num_strings += 1;
+			break;
+		case 11:
+			decode_value_type(&f, &pr->period_type);
+			break;
+		case 12:
+			pr->period = f.v;
+			break;
+		case 14:
+			pr->default_sample_type = f.v;
+			break;
+		}
+	}
+}
+
+static const char *pprof_str(const struct pprof_profile *pr, uint64_t idx)
+{
+	assert_true(idx < pr->num_strings);
+	return pr->strings[idx];
+}
+
+static const struct pprof_function *pprof_find_function(
+	const struct pprof_profile *pr,
+	const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < pr->num_functions; i++) {
+		const struct pprof_function *fn = &pr->functions[i];
+
+		if (strcmp(pprof_str(pr, fn->name), name) == 0) {
+			return fn;
+		}
+	}
+
+	fail_msg("function %s not found", name);
+	return NULL;
+}
+
+/*
+ * Checks the Location and Sample of fn and returns the
+ * sample values.
+ */
+static const uint64_t *pprof_function_values(const struct pprof_profile *pr,
+					     const struct pprof_function *fn)
+{
+	const struct pprof_location *loc = NULL;
+	size_t i;
+
+	for (i = 0; i < pr->num_locations; i++) {
+		if (pr->locations[i].id == fn->id) {
+			loc = &pr->locations[i];
+			break;
+		}
+	}
+	assert_non_null(loc);
+	assert_int_equal(loc->function_id, fn->id);
+	assert_int_equal(loc->line, fn->start_line);
+
+	for (i = 0; i < pr->num_samples; i++) {
+		const struct pprof_sample *s = &pr->samples[i];
+
+		assert_int_equal(s->num_location_ids, 1);
+		if (s->location_id[0] != loc->id) {
+			continue;
+		}
+		assert_int_equal(s->num_values, 4);
+		return s->value;
+	}
+
+	fail_msg("no sample for location %"PRIu64, loc->id);
+	return NULL;
+}
+
+static void test_pprof_tree(void **state)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	TALLOC_CTX *root = NULL;
+	struct pprof_profile pr;
+	const struct pprof_function *fn = NULL;
+	const uint64_t *values = NULL;
+	static const char *types[] = {
+		"alloc_objects", "count",
+		"alloc_space", "bytes",
+		"inuse_objects", "count",
+		"inuse_space", "bytes",
+	};
+	uint8_t *buf = NULL;
+	size_t len = 0;
+	size_t i;
+
+	talloc_profile_set_interval(0);
+	talloc_profile_reset();
+
+	root = talloc_named_const(frame, 0, "pprof_root");
+	assert_non_null(root);
+	assert_non_null(talloc_named_const(root, 100, "tests/foo.c:42"));
+	assert_non_null(talloc_named_const(root, 100, "tests/foo.c:42"));
+	assert_non_null(talloc_named_const(root, 10, "plain:name"));
+
+	buf = talloc_pprof(frame, root, &len);
+	assert_non_null(buf);
+
+	decode_profile(frame, buf, len, &pr);
+
+	assert_true(pr.num_strings > 0);
+	assert_string_equal(pr.strings[0], "");
+
+	assert_int_equal(pr.num_sample_types, 4);
+	for (i = 0; i < pr.num_sample_types; i++) {
+		assert_string_equal(pprof_str(&pr, pr.sample_type[i].type),
+				    types[i*2]);
+		assert_string_equal(pprof_str(&pr, pr.sample_type[i].unit),
+				    types[i*2+1]);
+	}
+	assert_string_equal(pprof_str(&pr, pr.period_type.type),
+			    "inuse_space");
+	assert_string_equal(pprof_str(&pr, pr.period_type.unit), "bytes");
+	assert_int_equal(pr.period, 0);
+	assert_string_equal(pprof_str(&pr, pr.default_sample_type),
+			    "inuse_space");
+
+	assert_int_equal(pr.num_functions, 3);
+	assert_int_equal(pr.num_locations, 3);
+	assert_int_equal(pr.num_samples, 3);
+
+	fn = pprof_find_function(&pr, "tests/foo.c:42");
+	assert_int_equal(fn->system_name, fn->name);
+	assert_string_equal(pprof_str(&pr, fn->filename), "tests/foo.c");
+	assert_int_equal(fn->start_line, 42);
+	values = pprof_function_values(&pr, fn);
+	assert_int_equal(values[0], 0);
+	assert_int_equal(values[1], 0);
+	assert_int_equal(values[2], 2);
+	assert_int_equal(values[3], 200);
+
+	/* Not a line number, so no file either */
+	fn = pprof_find_function(&pr, "plain:name");
+	assert_string_equal(pprof_str(&pr, fn->filename), "");
+	assert_int_equal(fn->start_line, 0);
+	values = pprof_function_values(&pr, fn);
+	assert_int_equal(values[2], 1);
+	assert_int_equal(values[3], 10);
+
+	fn = pprof_find_function(&pr, "pprof_root");
+	values = pprof_function_values(&pr, fn);
+	assert_int_equal(values[2], 1);
+	assert_int_equal(values[3], 0);
+
+	TALLOC_FREE(frame);
+}
+
+static void test_pprof_other(void **state)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	TALLOC_CTX *root = NULL;
+	struct pprof_profile pr;
+	const struct pprof_function *fn = NULL;
+	const uint64_t *values = NULL;
+	const size_t num_children = PPROF_MAX_NAMES + 10;
+	uint8_t *buf = NULL;
+	size_t len = 0;
+	size_t i;
+
+	talloc_profile_set_interval(0);
+	talloc_profile_reset();
+
+	root = talloc_named_const(frame, 0, "pprof_root");
+	assert_non_null(root);
+
+	for (i = 0; i < num_children; i++) {
+		void *c = talloc_size(root, 1);
+
+		assert_non_null(c);
+		assert_non_null(talloc_set_name(c, "child_%zu", i));
+	}
+
+	buf = talloc_pprof(frame, root, &len);
+	assert_non_null(buf);
+
+	decode_profile(frame, buf, len, &pr);
+
+	/*
+	 * The names are "pprof_root", ".name" (of the chunks
+	 * holding the names) and one per child. Whatever doesn't
+	 * fit into the table ends up in "[other]", the names in
+	 * the table keep being counted.
+	 */
+	assert_int_equal(pr.num_functions, PPROF_MAX_NAMES + 1);
+
+	fn = pprof_find_function(&pr, ".name");
+	values = pprof_function_values(&pr, fn);
+	assert_int_equal(values[2], num_children);
+
+	fn = pprof_find_function(&pr, "[other]");
+	values = pprof_function_values(&pr, fn);
+	assert_int_equal(values[2], num_children + 2 - PPROF_MAX_NAMES);
+
+	TALLOC_FREE(frame);
+}
+
+int main(int argc, char **argv)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_pprof_tree),
+		cmocka_unit_test(test_pprof_other),
+	};
+
+	if (argc == 2) {
+		cmocka_set_test_filter(argv[1]);
+	}
+	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,563 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB2 compression transform
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "includes.h"
+#include "../libcli/smb/smb_common.h"
+#include "../libcli/smb/smb2_compression.h"
+#include "../lib/compression/lzxpress.h"
+
+bool smb2_compression_algo_negotiated(
+			const struct smb3_compression_capabilities *c,
+			uint16_t algo)
+{
+	size_t i;
+
+	for (i = 0; i < c->num_algos; i++) {
+		if (c->algos[i] == algo) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool smb2_compression_algo_is_compressor(uint16_t algo)
+{
+	switch (algo) {
+	case SMB2_COMPRESSION_LZ77:
+		return true;
+	}
+
+	return false;
+}
+
+static ssize_t smb2_compression_algo_decompress(uint16_t algo,
+						const uint8_t *in,
+						size_t in_len,
+						uint8_t *out,
+						size_t out_len)
+{
+	switch (algo) {
+	case SMB2_COMPRESSION_LZ77:
+		return lzxpress_decompress(in, in_len, out, out_len);
+	}
+
+	return -1;
+}
+
+static ssize_t smb2_compression_algo_compress(uint16_t algo,
+					      const uint8_t *in,
+					      size_t in_len,
+					      uint8_t *out,
+					      size_t out_len)
+{
+	switch (algo) {
+	case SMB2_COMPRESSION_LZ77:
+		return lzxpress_compress(in, in_len, out, out_len);
+	}
+
+	return -1;
+}
+
+static NTSTATUS smb2_compression_decompress_unchained(
+			const struct smb3_compression_capabilities *c,
+			const uint8_t *buf,
+			size_t buflen,
+			size_t max_size,
+			uint8_t **pout,
+			size_t *pout_len,
+			TALLOC_CTX *mem_ctx)
+{
+	uint32_t orig_size = IVAL(buf, SMB2_COMP_TF_ORIG_SIZE);
+	uint16_t algo = SVAL(buf, SMB2_COMP_TF_ALGO);
+	uint32_t offset = IVAL(buf, SMB2_COMP_TF_OFFSET);
+	const uint8_t *payload = buf + SMB2_COMP_TF_HDR_SIZE;
+	size_t payload_len = buflen - SMB2_COMP_TF_HDR_SIZE;
+	uint8_t *out = NULL;
+	size_t out_len;
+	ssize_t ret;
+
+	if (!smb2_compression_algo_is_compressor(algo) ||
+	    !smb2_compression_algo_negotiated(c, algo))
+	{
+		DBG_INFO("Invalid compression algorithm[0x%04x]\n", algo);
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (offset > payload_len) {
+		DBG_INFO("Invalid offset[%"PRIu32"] for %zu bytes\n",
+			 offset, payload_len);
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	out_len = (size_t)offset + (size_t)orig_size;
+	if (out_len > max_size) {
+		DBG_INFO("Decompressed size[%zu] exceeds limit[%zu]\n",
+			 out_len, max_size);
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	out = talloc_array(mem_ctx, uint8_t, out_len);
+	if (out == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	memcpy(out, payload, offset);
+
+	ret = smb2_compression_algo_decompress(algo,
+					       payload + offset,
+					       payload_len - offset,
+					       out + offset,
+					       orig_size);
+	if (ret != orig_size) {
+		DBG_INFO("Decompression with algorithm[0x%04x] returned "
+			 "%zd, expected %"PRIu32"\n",
+			 algo, ret, orig_size);
+		TALLOC_FREE(out);
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	*pout = out;
+	*pout_len = out_len;
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smb2_compression_decompress_chained(
+			const struct smb3_compression_capabilities *c,
+			const uint8_t *buf,
+			size_t buflen,
+			size_t max_size,
+			uint8_t **pout,
+			size_t *pout_len,
+			TALLOC_CTX *mem_ctx)
+{
+	uint32_t out_len = IVAL(buf, SMB2_COMP_TF_ORIG_SIZE);
+	uint8_t *out = NULL;
+	size_t produced = 0;
+	size_t ofs;
+
+	if (!(c->flags & SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED)) {
+		DBG_INFO("Chained compression not negotiated\n");
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (out_len > max_size) {
+		DBG_INFO("Decompressed size[%"PRIu32"] exceeds limit[%zu]\n",
+			 out_len, max_size);
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	out = talloc_array(mem_ctx, uint8_t, out_len);
+	if (out == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	/*
+	 * The first chained payload header overlays the
+	 * algorithm, flags and offset fields of the
+	 * SMB2_COMPRESSION_TRANSFORM header.
+	 */
+	ofs = SMB2_COMP_TF_ALGO;
+
+	while (ofs < buflen) {
+		const uint8_t *hdr = buf + ofs;
+		const uint8_t *payload = NULL;
+		size_t available = out_len - produced;
+		uint16_t algo;
+		uint32_t length;
+
+		if (buflen - ofs < SMB2_COMP_CHAINED_HDR_SIZE) {
+			goto inval;
+		}
+		algo = SVAL(hdr, SMB2_COMP_CHAINED_ALGO);
+		length = IVAL(hdr, SMB2_COMP_CHAINED_LENGTH);
+		ofs += SMB2_COMP_CHAINED_HDR_SIZE;
+
+		if (length > buflen - ofs) {
+			goto inval;
+		}
+		payload = buf + ofs;
+		ofs += length;
+
+		switch (algo) {
+		case SMB2_COMPRESSION_NONE:
+			if (length > available) {
+				goto inval;
+			}
+			memcpy(out + produced, payload, length);
+			produced += length;
+			break;
+
+		case SMB2_COMPRESSION_PATTERN_V1: {
+			uint8_t pattern;
+			uint32_t reps;
+
+			if (!smb2_compression_algo_negotiated(c, algo)) {
+				goto inval;
+			}
+			if (length != SMB2_COMP_PATTERN_V1_SIZE) {
+				goto inval;
+			}
+			pattern = CVAL(payload, SMB2_COMP_PATTERN_V1_PATTERN);
+			reps = IVAL(payload, SMB2_COMP_PATTERN_V1_REPS);
+			if (reps > available) {
+				goto inval;
+			}
+			memset(out + produced, pattern, reps);
+			produced += reps;
+			break;
+		}
+
+		default: {
+			uint32_t orig_size;
+			ssize_t ret;
+
+			if (!smb2_compression_algo_is_compressor(algo) ||
+			    !smb2_compression_algo_negotiated(c, algo))
+			{
+				goto inval;
+			}
+			if (length < sizeof(uint32_t)) {
+				goto inval;
+			}
+			orig_size = IVAL(payload, 0);
+			if (orig_size > available) {
+				goto inval;
+			}
+			ret = smb2_compression_algo_decompress(
+					algo,
+					payload + sizeof(uint32_t),
+					length - sizeof(uint32_t),
+					out + produced,
+					orig_size);
+			if (ret != orig_size) {
+				goto inval;
+			}
+			produced += orig_size;
+			break;
+		}
+		}
+	}
+
+	if (produced != out_len) {
+		goto inval;
+	}
+
+	*pout = out;
+	*pout_len = out_len;
+	return NT_STATUS_OK;
+
+inval:
+	DBG_INFO("Invalid chained compression payload at offset %zu\n", ofs);
+	TALLOC_FREE(out);
+	return NT_STATUS_INVALID_PARAMETER;
+}
+
+NTSTATUS smb2_compression_decompress(TALLOC_CTX *mem_ctx,
+				     const struct smb3_compression_capabilities *c,
+				     const uint8_t *buf,
+				     size_t buflen,
+				     size_t max_size,
+				     DATA_BLOB *out)
+{
+	uint8_t *data = NULL;
+	size_t len = 0;
+	uint16_t flags;
+	NTSTATUS status;
+
+	if (c->num_algos == 0) {
+		DBG_INFO("Compression not negotiated\n");
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (buflen < SMB2_COMP_TF_HDR_SIZE) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (IVAL(buf, SMB2_COMP_TF_PROTOCOL_ID) != SMB2_COMP_TF_MAGIC) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	flags = SVAL(buf, SMB2_COMP_TF_FLAGS);
+	if (flags & SMB2_COMPRESSION_FLAG_CHAINED) {
+		status = smb2_compression_decompress_chained(c,
+							     buf,
+							     buflen,
+							     max_size,
+							     &data,
+							     &len,
+							     mem_ctx);
+	} else {
+		status = smb2_compression_decompress_unchained(c,
+							       buf,
+							       buflen,
+							       max_size,
+							       &data,
+							       &len,
+							       mem_ctx);
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	*out = data_blob_const(data, len);
+	return NT_STATUS_OK;
+}
+
+static size_t smb2_compression_pattern_fwd(const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for (i = 1; i < len; i++) {
+		if (data[i] != data[0]) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+static size_t smb2_compression_pattern_bwd(const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for (i = 1; i < len; i++) {
+		if (data[len - 1 - i] != data[len - 1]) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+static uint8_t *smb2_compression_push_chained_hdr(uint8_t *p,
+						  uint16_t algo,
+						  uint32_t length)
+{
+	SSVAL(p, SMB2_COMP_CHAINED_ALGO, algo);
+	SSVAL(p, SMB2_COMP_CHAINED_FLAGS, SMB2_COMPRESSION_FLAG_CHAINED);
+	SIVAL(p, SMB2_COMP_CHAINED_LENGTH, length);
+	return p + SMB2_COMP_CHAINED_HDR_SIZE;
+}
+
+static uint8_t *smb2_compression_push_pattern(uint8_t *p,
+					      uint8_t pattern,
+					      uint32_t reps)
+{
+	p = smb2_compression_push_chained_hdr(p,
+					      SMB2_COMPRESSION_PATTERN_V1,
+					      SMB2_COMP_PATTERN_V1_SIZE);
+	SCVAL(p, SMB2_COMP_PATTERN_V1_PATTERN, pattern);
+	SCVAL(p, 1, 0);
+	SSVAL(p, 2, 0);
+	SIVAL(p, SMB2_COMP_PATTERN_V1_REPS, reps);
+	return p + SMB2_COMP_PATTERN_V1_SIZE;
+}
+
+NTSTATUS smb2_compression_compress(TALLOC_CTX *mem_ctx,
+				   const struct smb3_compression_capabilities *c,
+				   const uint8_t *prefix,
+				   size_t prefix_len,
+				   const uint8_t *data,
+				   size_t data_len,
+				   DATA_BLOB *out)
+{
+	size_t total_len = prefix_len + data_len;
+	uint16_t algo = SMB2_COMPRESSION_NONE;
+	bool chained;
+	bool pattern;
+	uint8_t *buf = NULL;
+	uint8_t *p = NULL;
+	size_t i;
+	ssize_t ret;
+
+	for (i = 0; i < c->num_algos; i++) {
+		if (smb2_compression_algo_is_compressor(c->algos[i])) {
+			algo = c->algos[i];
+			break;
+		}
+	}
+
+	chained = (c->flags & SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED);
+	pattern = chained &&
+		smb2_compression_algo_negotiated(c, SMB2_COMPRESSION_PATTERN_V1);
+
+	if (algo == SMB2_COMPRESSION_NONE && !pattern) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	if (total_len > UINT32_MAX) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (data_len < SMB2_COMPRESSION_MIN_SIZE) {
+		return NT_STATUS_BUFFER_TOO_SMALL;
+	}
+
+	/*
+	 * The result is only useful if it's smaller than
+	 * the uncompressed message, so that's all the space
+	 * the compressors get.
+	 */
+	buf = talloc_array(mem_ctx, uint8_t, total_len);
+	if (buf == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	SIVAL(buf, SMB2_COMP_TF_PROTOCOL_ID, SMB2_COMP_TF_MAGIC);
+
+	if (!chained) {
+		size_t hdr_len = SMB2_COMP_TF_HDR_SIZE + prefix_len;
+
+		if (hdr_len >= total_len) {
+			goto too_small;
+		}
+
+		SIVAL(buf, SMB2_COMP_TF_ORIG_SIZE, data_len);
+		SSVAL(buf, SMB2_COMP_TF_ALGO, algo);
+		SSVAL(buf, SMB2_COMP_TF_FLAGS, SMB2_COMPRESSION_FLAG_NONE);
+		SIVAL(buf, SMB2_COMP_TF_OFFSET, prefix_len);
+		memcpy(buf + SMB2_COMP_TF_HDR_SIZE, prefix, prefix_len);
+
+		ret = smb2_compression_algo_compress(algo,
+						     data,
+						     data_len,
+						     buf + hdr_len,
+						     total_len - hdr_len);
+		if (ret <= 0 || hdr_len + ret >= total_len) {
+			goto too_small;
+		}
+
+		*out = data_blob_const(buf, hdr_len + ret);
+		return NT_STATUS_OK;
+	}
+
+	/*
+	 * Chained: the prefix goes as SMB2_COMPRESSION_NONE payload,
+	 * leading and trailing runs of a single byte as
+	 * SMB2_COMPRESSION_PATTERN_V1 and whatever is in the
+	 * middle with the real compression algorithm.
+	 */
+	SIVAL(buf, SMB2_COMP_TF_ORIG_SIZE, total_len);
+	p = buf + SMB2_COMP_TF_ALGO;
+
+	if (prefix_len > 0) {
+		size_t needed = SMB2_COMP_CHAINED_HDR_SIZE + prefix_len;
+
+		if (needed >= total_len - PTR_DIFF(p, buf)) {
+			goto too_small;
+		}
+		p = smb2_compression_push_chained_hdr(p,
+						      SMB2_COMPRESSION_NONE,
+						      prefix_len);
+		memcpy(p, prefix, prefix_len);
+		p += prefix_len;
+	}
+
+	while (data_len > 0) {
+		size_t remaining = total_len - PTR_DIFF(p, buf);
+		size_t fwd = 0;
+		size_t bwd = 0;
+		size_t needed;
+		size_t len;
+
+		if (pattern) {
+			fwd = smb2_compression_pattern_fwd(data, data_len);
+			if (fwd < SMB2_COMPRESSION_PATTERN_V1_MIN_SIZE) {
+				fwd = 0;
+			}
+		}
+
+		if (fwd > 0) {
+			needed = SMB2_COMP_CHAINED_HDR_SIZE +
+				 SMB2_COMP_PATTERN_V1_SIZE;
+			if (needed >= remaining) {
+				goto too_small;
+			}
+			p = smb2_compression_push_pattern(p, data[0], fwd);
+			data += fwd;
+			data_len -= fwd;
+			continue;
+		}
+
+		if (pattern) {
+			bwd = smb2_compression_pattern_bwd(data, data_len);
+			if (bwd < SMB2_COMPRESSION_PATTERN_V1_MIN_SIZE) {
+				bwd = 0;
+			}
+		}
+
+		len = data_len - bwd;
+		needed = SMB2_COMP_CHAINED_HDR_SIZE + sizeof(uint32_t);
+		ret = -1;
+
+		if (algo != SMB2_COMPRESSION_NONE && needed < remaining) {
+			ret = smb2_compression_algo_compress(
+					algo,
+					data,
+					len,
+					p + needed,
+					MIN(remaining - needed, len));
+		}
+
+		if (ret > 0 && sizeof(uint32_t) + ret < len) {
+			p = smb2_compression_push_chained_hdr(
+					p, algo, sizeof(uint32_t) + ret);
+			SIVAL(p, 0, len);
+			p += sizeof(uint32_t) + ret;
+		} else {
+			/*
+			 * Not compressible, but the patterns
+			 * may still give us something.
+			 */
+			needed = SMB2_COMP_CHAINED_HDR_SIZE + len;
+			if (needed >= remaining) {
+				goto too_small;
+			}
+			p = smb2_compression_push_chained_hdr(
+					p, SMB2_COMPRESSION_NONE, len);
+			memcpy(p, data, len);
+			p += len;
+		}
+
+		if (bwd > 0) {
+			remaining = total_len - PTR_DIFF(p, buf);
+			needed = SMB2_COMP_CHAINED_HDR_SIZE +
+				 SMB2_COMP_PATTERN_V1_SIZE;
+			if (needed >= remaining) {
+				goto too_small;
+			}
+			p = smb2_compression_push_pattern(p,
+							  data[data_len - 1],
+							  bwd);
+		}
+
+		break;
+	}
+
+	if (PTR_DIFF(p, buf) >= total_len) {
+		goto too_small;
+	}
+
+	*out = data_blob_const(buf, PTR_DIFF(p, buf));
+	return NT_STATUS_OK;
+
+too_small:
+	TALLOC_FREE(buf);
+	return NT_STATUS_BUFFER_TOO_SMALL;
+}
@@ -0,0 +1,90 @@
+/*
+   Unix SMB/CIFS implementation.
+   SMB2 compression transform
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LIBCLI_SMB_SMB2_COMPRESSION_H_
+#define _LIBCLI_SMB_SMB2_COMPRESSION_H_
+
+struct smb3_compression_capabilities {
+#define SMB3_COMPRESSION_CAPABILITIES_MAX_ALGOS 4
+	uint32_t flags;
+	uint16_t num_algos;
+	uint16_t algos[SMB3_COMPRESSION_CAPABILITIES_MAX_ALGOS];
+};
+
+const char *smb3_compression_algorithm_name(uint16_t algo);
+
+struct smb3_compression_capabilities smb3_compression_capabilities_parse(
+				const char *role,
+				const char * const *compression_algos);
+
+/*
+ * Don't bother to compress anything smaller than this,
+ * the transform headers eat most of the possible gain.
+ */
+#define SMB2_COMPRESSION_MIN_SIZE 4096
+
+/*
+ * Room for the SMB2 headers and fixed bodies of a
+ * (compound) request on top of the largest payload
+ * allowed by the negotiated max_write/max_trans.
+ */
+#define SMB2_COMPRESSION_MAX_OVERHEAD 0x10000
+
+/*
+ * Runs of a single byte shorter than this are left
+ * to the real compression algorithm.
+ */
+#define SMB2_COMPRESSION_PATTERN_V1_MIN_SIZE 32
+
+bool smb2_compression_algo_negotiated(
+			const struct smb3_compression_capabilities *c,
+			uint16_t algo);
+
+/*
+ * Decompress a message starting with a SMB2_COMPRESSION_TRANSFORM
+ * header (chained or unchained) into a new buffer of at most
+ * max_size bytes.
+ *
+ * Only algorithms listed in 'c' are accepted.
+ */
+NTSTATUS smb2_compression_decompress(TALLOC_CTX *mem_ctx,
+				     const struct smb3_compression_capabilities *c,
+				     const uint8_t *buf,
+				     size_t buflen,
+				     size_t max_size,
+				     DATA_BLOB *out);
+
+/*
+ * Compress a message, the first 'prefix_len' bytes (typically
+ * the SMB2 header and the fixed response body) are transferred
+ * uncompressed, the 'data' part gets compressed with the
+ * preferred algorithm in 'c'.
+ *
+ * NT_STATUS_BUFFER_TOO_SMALL is returned if the compressed
+ * message would not be smaller than the uncompressed one,
+ * in that case the message should be sent uncompressed.
+ */
+NTSTATUS smb2_compression_compress(TALLOC_CTX *mem_ctx,
+				   const struct smb3_compression_capabilities *c,
+				   const uint8_t *prefix,
+				   size_t prefix_len,
+				   const uint8_t *data,
+				   size_t data_len,
+				   DATA_BLOB *out);
+
+#endif /* _LIBCLI_SMB_SMB2_COMPRESSION_H_ */
@@ -317,10 +317,19 @@ bool smb2_signing_key_valid(const struct smb2_signing_key *key)
 	return true;
 }
 
-static NTSTATUS smb2_signing_gmac(gnutls_aead_cipher_hd_t cipher_hnd,
-				  const uint8_t *iv, size_t iv_size,
-				  const giovec_t *auth_iov, uint8_t auth_iovcnt,
-				  uint8_t *tag, size_t _tag_size)
+/*
+ * The GMAC calculation only avoids talloc if gnutls can
+ * take the authenticated data as iovec.
+ */
+#if defined(ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_GCM) || \
+    defined(HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV)
+#define SMB2_SIGNING_GMAC_NO_TALLOC 1
+#endif
+
+static int smb2_signing_gmac(gnutls_aead_cipher_hd_t cipher_hnd,
+			     const uint8_t *iv, size_t iv_size,
+			     const giovec_t *auth_iov, uint8_t auth_iovcnt,
+			     uint8_t *tag, size_t _tag_size)
 {
 	size_t tag_size = _tag_size;
 	int rc;
@@ -332,10 +341,27 @@ static NTSTATUS smb2_signing_gmac(gnutls_aead_cipher_hd_t cipher_hnd,
 					  NULL, 0,
 					  tag, &tag_size);
 	if (rc < 0) {
-		return gnutls_error_to_ntstatus(rc, NT_STATUS_HMAC_NOT_SUPPORTED);
+		return rc;
 	}
 
-	return NT_STATUS_OK;
+	return 0;
+#elif defined(HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV)
+	/*
+	 * gnutls_aead_cipher_encryptv() takes the authenticated data
+	 * as iovec, so we don't need to gather it into a temporary
+	 * buffer first.
+	 */
+	rc = gnutls_aead_cipher_encryptv(cipher_hnd,
+					 iv, iv_size,
+					 auth_iov, auth_iovcnt,
+					 tag_size,
+					 NULL, 0,
+					 tag, &tag_size);
+	if (rc < 0) {
+		return rc;
+	}
+
+	return 0;
 #else /* ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_GCM */
 	TALLOC_CTX *tmp_ctx = NULL;
 	size_t atext_size = 0;
@@ -359,7 +385,7 @@ static NTSTATUS smb2_signing_gmac(gnutls_aead_cipher_hd_t cipher_hnd,
 
 	atext = talloc_size(tmp_ctx, atext_size);
 	if (atext == NULL) {
-		return NT_STATUS_NO_MEMORY;
+		return GNUTLS_E_MEMORY_ERROR;
 	}
 
 	for (i = 0; i < auth_iovcnt; i++) {
@@ -370,7 +396,7 @@ static NTSTATUS smb2_signing_gmac(gnutls_aead_cipher_hd_t cipher_hnd,
 		len += auth_iov[i].iov_len;
 		if (len > atext_size) {
 			TALLOC_FREE(atext);
-			return NT_STATUS_INTERNAL_ERROR;
+			return GNUTLS_E_INTERNAL_ERROR;
 		}
 	}
 
@@ -383,37 +409,19 @@ static NTSTATUS smb2_signing_gmac(gnutls_aead_cipher_hd_t cipher_hnd,
 					tag, &tag_size);
 	TALLOC_FREE(atext);
 	if (rc < 0) {
-		return gnutls_error_to_ntstatus(rc, NT_STATUS_HMAC_NOT_SUPPORTED);
+		return rc;
 	}
 
-	return NT_STATUS_OK;
+	return 0;
 #endif /* ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_GCM */
 }
 
-static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key,
-					    uint16_t sign_algo_id,
-					    const struct iovec *vector,
-					    int count,
-					    uint8_t signature[16])
+static NTSTATUS smb2_signing_check_hdr(const uint8_t *hdr,
+				       uint16_t sign_algo_id)
 {
-	const uint8_t *hdr = (uint8_t *)vector[0].iov_base;
 	uint16_t opcode;
 	uint32_t flags;
 	uint64_t msg_id;
-	static const uint8_t zero_sig[16] = { 0, };
-	gnutls_mac_algorithm_t hmac_algo = GNUTLS_MAC_UNKNOWN;
-	int i;
-
-	/*
-	 * We expect
-	 * - SMB2 HDR
-	 * - SMB2 BODY FIXED
-	 * - (optional) SMB2 BODY DYN
-	 * - (optional) PADDING
-	 */
-	SMB_ASSERT(count >= 2);
-	SMB_ASSERT(vector[0].iov_len == SMB2_HDR_BODY);
-	SMB_ASSERT(count <= 4);
 
 	opcode = SVAL(hdr, SMB2_HDR_OPCODE);
 	flags = IVAL(hdr, SMB2_HDR_FLAGS);
@@ -446,29 +454,23 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 		return NT_STATUS_INTERNAL_ERROR;
 	}
 
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smb2_signing_key_sign_setup(struct smb2_signing_key *signing_key,
+					    uint16_t sign_algo_id)
+{
+	gnutls_mac_algorithm_t hmac_algo = GNUTLS_MAC_UNKNOWN;
+	int rc;
+
 	switch (sign_algo_id) {
 	case SMB2_SIGNING_AES128_GMAC: {
 		gnutls_cipher_algorithm_t algo = GNUTLS_CIPHER_AES_128_GCM;
 		uint32_t key_size = gnutls_cipher_get_key_size(algo);
-		uint32_t iv_size = gnutls_cipher_get_iv_size(algo);
-		size_t tag_size = gnutls_cipher_get_tag_size(algo);
 		gnutls_datum_t key = {
 			.data = signing_key->blob.data,
 			.size = MIN(signing_key->blob.length, key_size),
 		};
-		uint64_t high_bits = 0;
-		uint8_t iv[AES_BLOCK_SIZE] = {0};
-		giovec_t auth_iov[count+1];
-		size_t auth_iovcnt = 0;
-		NTSTATUS status;
-		int rc;
-
-		high_bits = flags & SMB2_HDR_FLAG_REDIRECT;
-		if (opcode == SMB2_OP_CANCEL) {
-			high_bits |= SMB2_HDR_FLAG_ASYNC;
-		}
-		SBVAL(iv, 0, msg_id);
-		SBVAL(iv, 8, high_bits);
 
 		if (signing_key->cipher_hnd == NULL) {
 			rc = gnutls_aead_cipher_init(&signing_key->cipher_hnd,
@@ -481,8 +483,78 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 		}
 
 		SMB_ASSERT(key_size == 16);
-		SMB_ASSERT(iv_size == 12);
-		SMB_ASSERT(tag_size == 16);
+		SMB_ASSERT(gnutls_cipher_get_iv_size(algo) == 12);
+		SMB_ASSERT(gnutls_cipher_get_tag_size(algo) == 16);
+
+		return NT_STATUS_OK;
+	}	break;
+
+	case SMB2_SIGNING_AES128_CMAC:
+#ifdef HAVE_GNUTLS_AES_CMAC
+		hmac_algo = GNUTLS_MAC_AES_CMAC_128;
+		break;
+#else /* NOT HAVE_GNUTLS_AES_CMAC */
+		return NT_STATUS_OK;
+#endif
+	case SMB2_SIGNING_HMAC_SHA256:
+		hmac_algo = GNUTLS_MAC_SHA256;
+		break;
+
+	default:
+		return NT_STATUS_HMAC_NOT_SUPPORTED;
+	}
+
+	if (signing_key->hmac_hnd == NULL) {
+		gnutls_datum_t key = {
+			.data = signing_key->blob.data,
+			.size = MIN(signing_key->blob.length, 16),
+		};
+
+		rc = gnutls_hmac_init(&signing_key->hmac_hnd,
+				      hmac_algo,
+				      key.data,
+				      key.size);
+		if (rc < 0) {
+			return gnutls_error_to_ntstatus(rc,
+					NT_STATUS_HMAC_NOT_SUPPORTED);
+		}
+	}
+
+	return NT_STATUS_OK;
+}
+
+/*
+ * This expects smb2_signing_key_sign_setup() to be called before,
+ * it neither uses talloc (except for the GMAC fallback without
+ * SMB2_SIGNING_GMAC_NO_TALLOC) nor the debug system.
+ */
+static int smb2_signing_calc_signature_hnd(struct smb2_signing_key *signing_key,
+					   uint16_t sign_algo_id,
+					   const struct iovec *vector,
+					   int count,
+					   uint8_t signature[16])
+{
+	const uint8_t *hdr = (uint8_t *)vector[0].iov_base;
+	static const uint8_t zero_sig[16] = { 0, };
+	gnutls_mac_algorithm_t hmac_algo = GNUTLS_MAC_UNKNOWN;
+	int i;
+
+	switch (sign_algo_id) {
+	case SMB2_SIGNING_AES128_GMAC: {
+		uint16_t opcode = SVAL(hdr, SMB2_HDR_OPCODE);
+		uint32_t flags = IVAL(hdr, SMB2_HDR_FLAGS);
+		uint64_t msg_id = BVAL(hdr, SMB2_HDR_MESSAGE_ID);
+		uint64_t high_bits = 0;
+		uint8_t iv[AES_BLOCK_SIZE] = {0};
+		giovec_t auth_iov[count+1];
+		size_t auth_iovcnt = 0;
+
+		high_bits = flags & SMB2_HDR_FLAG_REDIRECT;
+		if (opcode == SMB2_OP_CANCEL) {
+			high_bits |= SMB2_HDR_FLAG_ASYNC;
+		}
+		SBVAL(iv, 0, msg_id);
+		SBVAL(iv, 8, high_bits);
 
 		auth_iov[auth_iovcnt++] = (giovec_t) {
 			.iov_base = discard_const_p(uint8_t, hdr),
@@ -499,18 +571,13 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 			};
 		}
 
-		status = smb2_signing_gmac(signing_key->cipher_hnd,
-					   iv,
-					   iv_size,
-					   auth_iov,
-					   auth_iovcnt,
-					   signature,
-					   tag_size);
-		if (!NT_STATUS_IS_OK(status)) {
-			return status;
-		}
-
-		return NT_STATUS_OK;
+		return smb2_signing_gmac(signing_key->cipher_hnd,
+					 iv,
+					 12,
+					 auth_iov,
+					 auth_iovcnt,
+					 signature,
+					 16);
 	}	break;
 
 	case SMB2_SIGNING_AES128_CMAC:
@@ -538,7 +605,7 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 
 		ZERO_ARRAY(key);
 
-		return NT_STATUS_OK;
+		return 0;
 	}	break;
 #endif
 	case SMB2_SIGNING_HMAC_SHA256:
@@ -546,37 +613,20 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 		break;
 
 	default:
-		return NT_STATUS_HMAC_NOT_SUPPORTED;
+		return GNUTLS_E_INVALID_REQUEST;
 	}
 
 	if (hmac_algo != GNUTLS_MAC_UNKNOWN) {
 		uint8_t digest[gnutls_hash_get_len(hmac_algo)];
-		gnutls_datum_t key = {
-			.data = signing_key->blob.data,
-			.size = MIN(signing_key->blob.length, 16),
-		};
 		int rc;
 
-		if (signing_key->hmac_hnd == NULL) {
-			rc = gnutls_hmac_init(&signing_key->hmac_hnd,
-					      hmac_algo,
-					      key.data,
-					      key.size);
-			if (rc < 0) {
-				return gnutls_error_to_ntstatus(rc,
-						NT_STATUS_HMAC_NOT_SUPPORTED);
-			}
-		}
-
 		rc = gnutls_hmac(signing_key->hmac_hnd, hdr, SMB2_HDR_SIGNATURE);
 		if (rc < 0) {
-			return gnutls_error_to_ntstatus(rc,
-						NT_STATUS_HMAC_NOT_SUPPORTED);
+			return rc;
 		}
 		rc = gnutls_hmac(signing_key->hmac_hnd, zero_sig, 16);
 		if (rc < 0) {
-			return gnutls_error_to_ntstatus(rc,
-						NT_STATUS_HMAC_NOT_SUPPORTED);
+			return rc;
 		}
 
 		for (i = 1; i < count; i++) {
@@ -584,17 +634,60 @@ static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key
 					 vector[i].iov_base,
 					 vector[i].iov_len);
 			if (rc < 0) {
-				return gnutls_error_to_ntstatus(rc,
-						NT_STATUS_HMAC_NOT_SUPPORTED);
+				return rc;
 			}
 		}
 		gnutls_hmac_output(signing_key->hmac_hnd, digest);
 		memcpy(signature, digest, 16);
 		ZERO_ARRAY(digest);
-		return NT_STATUS_OK;
+		return 0;
 	}
 
-	return NT_STATUS_HMAC_NOT_SUPPORTED;
+	return GNUTLS_E_INVALID_REQUEST;
+}
+
+static NTSTATUS smb2_signing_calc_signature(struct smb2_signing_key *signing_key,
+					    uint16_t sign_algo_id,
+					    const struct iovec *vector,
+					    int count,
+					    uint8_t signature[16])
+{
+	const uint8_t *hdr = (uint8_t *)vector[0].iov_base;
+	NTSTATUS status;
+	int rc;
+
+	/*
+	 * We expect
+	 * - SMB2 HDR
+	 * - SMB2 BODY FIXED
+	 * - (optional) SMB2 BODY DYN
+	 * - (optional) PADDING
+	 */
+	SMB_ASSERT(count >= 2);
+	SMB_ASSERT(vector[0].iov_len == SMB2_HDR_BODY);
+	SMB_ASSERT(count <= 4);
+
+	status = smb2_signing_check_hdr(hdr, sign_algo_id);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	status = smb2_signing_key_sign_setup(signing_key, sign_algo_id);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	rc = smb2_signing_calc_signature_hnd(signing_key,
+					     sign_algo_id,
+					     vector,
+					     count,
+					     signature);
+	if (rc < 0) {
+		return gnutls_error_to_ntstatus(rc,
+				NT_STATUS_HMAC_NOT_SUPPORTED);
+	}
+
+	return NT_STATUS_OK;
 }
 
 NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
@@ -662,6 +755,74 @@ NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
 	return NT_STATUS_OK;
 }
 
+NTSTATUS smb2_signing_sign_pdu_prepare(struct smb2_signing_key *signing_key,
+				       struct iovec *vector,
+				       int count)
+{
+	uint8_t *hdr;
+	uint64_t session_id;
+	NTSTATUS status;
+
+	SMB_ASSERT(count >= 2);
+	SMB_ASSERT(vector[0].iov_len == SMB2_HDR_BODY);
+	SMB_ASSERT(count <= 4);
+
+	hdr = (uint8_t *)vector[0].iov_base;
+
+	session_id = BVAL(hdr, SMB2_HDR_SESSION_ID);
+	if (session_id == 0) {
+		/*
+		 * smb2_signing_sign_pdu() doesn't
+		 * sign these, see there.
+		 */
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	if (!smb2_signing_key_valid(signing_key)) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+#ifndef SMB2_SIGNING_GMAC_NO_TALLOC
+	if (signing_key->sign_algo_id == SMB2_SIGNING_AES128_GMAC) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+#endif
+
+	memset(hdr + SMB2_HDR_SIGNATURE, 0, 16);
+
+	SIVAL(hdr, SMB2_HDR_FLAGS, IVAL(hdr, SMB2_HDR_FLAGS) | SMB2_HDR_FLAG_SIGNED);
+
+	status = smb2_signing_check_hdr(hdr, signing_key->sign_algo_id);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	return smb2_signing_key_sign_setup(signing_key,
+					   signing_key->sign_algo_id);
+}
+
+int smb2_signing_sign_pdu_inplace(struct smb2_signing_key *signing_key,
+				  struct iovec *vector,
+				  int count)
+{
+	uint8_t *hdr = (uint8_t *)vector[0].iov_base;
+	uint8_t res[16];
+	int rc;
+
+	rc = smb2_signing_calc_signature_hnd(signing_key,
+					     signing_key->sign_algo_id,
+					     vector,
+					     count,
+					     res);
+	if (rc < 0) {
+		return rc;
+	}
+
+	memcpy(hdr + SMB2_HDR_SIGNATURE, res, 16);
+
+	return 0;
+}
+
 NTSTATUS smb2_signing_check_pdu(struct smb2_signing_key *signing_key,
 				const struct iovec *vector,
 				int count)
@@ -812,23 +973,69 @@ NTSTATUS smb2_key_derivation(const uint8_t *KI, size_t KI_len,
 	return NT_STATUS_OK;
 }
 
-NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
-				  struct iovec *vector,
-				  int count)
+static NTSTATUS smb2_signing_cipher_params(uint16_t cipher_id,
+					   gnutls_cipher_algorithm_t *_algo,
+					   uint32_t *_iv_size,
+					   bool *_use_encryptv2)
 {
-#ifdef HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV2
+	gnutls_cipher_algorithm_t algo = 0;
+	uint32_t iv_size = 0;
 	bool use_encryptv2 = false;
+
+	switch (cipher_id) {
+	case SMB2_ENCRYPTION_AES128_CCM:
+		algo = GNUTLS_CIPHER_AES_128_CCM;
+		iv_size = SMB2_AES_128_CCM_NONCE_SIZE;
+#ifdef ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_CCM
+		use_encryptv2 = true;
 #endif
-	uint16_t cipher_id;
+		break;
+	case SMB2_ENCRYPTION_AES128_GCM:
+		algo = GNUTLS_CIPHER_AES_128_GCM;
+		iv_size = gnutls_cipher_get_iv_size(algo);
+#ifdef ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_GCM
+		use_encryptv2 = true;
+#endif
+		break;
+	case SMB2_ENCRYPTION_AES256_CCM:
+		algo = GNUTLS_CIPHER_AES_256_CCM;
+		iv_size = SMB2_AES_128_CCM_NONCE_SIZE;
+#ifdef ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_CCM
+		use_encryptv2 = true;
+#endif
+		break;
+	case SMB2_ENCRYPTION_AES256_GCM:
+		algo = GNUTLS_CIPHER_AES_256_GCM;
+		iv_size = gnutls_cipher_get_iv_size(algo);
+#ifdef ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_GCM
+		use_encryptv2 = true;
+#endif
+		break;
+	default:
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	*_algo = algo;
+	*_iv_size = iv_size;
+	*_use_encryptv2 = use_encryptv2;
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smb2_signing_encrypt_setup(struct smb2_signing_key *encryption_key,
+					   struct iovec *vector,
+					   int count,
+					   uint32_t *_iv_size,
+					   size_t *_tag_size,
+					   bool *_use_encryptv2)
+{
 	uint8_t *tf;
-	size_t a_total;
 	ssize_t m_total;
 	uint32_t iv_size = 0;
 	uint32_t key_size = 0;
 	size_t tag_size = 0;
+	bool use_encryptv2 = false;
 	gnutls_cipher_algorithm_t algo = 0;
 	gnutls_datum_t key;
-	gnutls_datum_t iv;
 	NTSTATUS status;
 	int rc;
 
@@ -846,9 +1053,6 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 		DBG_WARNING("No encryption key for SMB2 signing\n");
 		return NT_STATUS_ACCESS_DENIED;
 	}
-	cipher_id = encryption_key->cipher_algo_id;
-
-	a_total = SMB2_TF_HDR_SIZE - SMB2_TF_NONCE;
 
 	m_total = iov_buflen(&vector[1], count-1);
 	if (m_total == -1) {
@@ -858,37 +1062,12 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 	SSVAL(tf, SMB2_TF_FLAGS, SMB2_TF_FLAGS_ENCRYPTED);
 	SIVAL(tf, SMB2_TF_MSG_SIZE, m_total);
 
-	switch (cipher_id) {
-	case SMB2_ENCRYPTION_AES128_CCM:
-		algo = GNUTLS_CIPHER_AES_128_CCM;
-		iv_size = SMB2_AES_128_CCM_NONCE_SIZE;
-#ifdef ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_CCM
-		use_encryptv2 = true;
-#endif
-		break;
-	case SMB2_ENCRYPTION_AES128_GCM:
-		algo = GNUTLS_CIPHER_AES_128_GCM;
-		iv_size = gnutls_cipher_get_iv_size(algo);
-#ifdef ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_GCM
-		use_encryptv2 = true;
-#endif
-		break;
-	case SMB2_ENCRYPTION_AES256_CCM:
-		algo = GNUTLS_CIPHER_AES_256_CCM;
-		iv_size = SMB2_AES_128_CCM_NONCE_SIZE;
-#ifdef ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_CCM
-		use_encryptv2 = true;
-#endif
-		break;
-	case SMB2_ENCRYPTION_AES256_GCM:
-		algo = GNUTLS_CIPHER_AES_256_GCM;
-		iv_size = gnutls_cipher_get_iv_size(algo);
-#ifdef ALLOW_GNUTLS_AEAD_CIPHER_ENCRYPTV2_AES_GCM
-		use_encryptv2 = true;
-#endif
-		break;
-	default:
-		return NT_STATUS_INVALID_PARAMETER;
+	status = smb2_signing_cipher_params(encryption_key->cipher_algo_id,
+					    &algo,
+					    &iv_size,
+					    &use_encryptv2);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
 	}
 
 	key_size = gnutls_cipher_get_key_size(algo);
@@ -907,18 +1086,12 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 		.size = key_size,
 	};
 
-	iv = (gnutls_datum_t) {
-		.data = tf + SMB2_TF_NONCE,
-		.size = iv_size,
-	};
-
 	if (encryption_key->cipher_hnd == NULL) {
 		rc = gnutls_aead_cipher_init(&encryption_key->cipher_hnd,
 					algo,
 					&key);
 		if (rc < 0) {
-			status = gnutls_error_to_ntstatus(rc, NT_STATUS_INTERNAL_ERROR);
-			goto out;
+			return gnutls_error_to_ntstatus(rc, NT_STATUS_INTERNAL_ERROR);
 		}
 	}
 
@@ -926,35 +1099,98 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 	       0,
 	       16 - iv_size);
 
+	*_iv_size = iv_size;
+	*_tag_size = tag_size;
+	*_use_encryptv2 = use_encryptv2;
+	return NT_STATUS_OK;
+}
+
 #ifdef HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV2
-	if (use_encryptv2) {
-		uint8_t tag[tag_size];
-		giovec_t auth_iov[1];
+static int smb2_signing_encryptv2(struct smb2_signing_key *encryption_key,
+				  struct iovec *vector,
+				  int count,
+				  uint32_t iv_size,
+				  size_t _tag_size)
+{
+	uint8_t *tf = (uint8_t *)vector[0].iov_base;
+	size_t tag_size = _tag_size;
+	uint8_t tag[tag_size];
+	giovec_t auth_iov[1];
+	int rc;
 
-		auth_iov[0] = (giovec_t) {
-			.iov_base = tf + SMB2_TF_NONCE,
-			.iov_len  = a_total,
-		};
+	auth_iov[0] = (giovec_t) {
+		.iov_base = tf + SMB2_TF_NONCE,
+		.iov_len  = SMB2_TF_HDR_SIZE - SMB2_TF_NONCE,
+	};
 
-		rc = gnutls_aead_cipher_encryptv2(encryption_key->cipher_hnd,
-						  iv.data,
-						  iv.size,
-						  auth_iov,
-						  1,
-						  &vector[1],
-						  count - 1,
-						  tag,
-						  &tag_size);
+	rc = gnutls_aead_cipher_encryptv2(encryption_key->cipher_hnd,
+					  tf + SMB2_TF_NONCE,
+					  iv_size,
+					  auth_iov,
+					  1,
+					  &vector[1],
+					  count - 1,
+					  tag,
+					  &tag_size);
+	if (rc < 0) {
+		return rc;
+	}
+
+	memcpy(tf + SMB2_TF_SIGNATURE, tag, tag_size);
+	return 0;
+}
+#endif /* HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV2 */
+
+NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
+				  struct iovec *vector,
+				  int count)
+{
+	bool use_encryptv2 = false;
+	uint8_t *tf;
+	size_t a_total;
+	ssize_t m_total;
+	uint32_t iv_size = 0;
+	size_t tag_size = 0;
+	gnutls_datum_t iv;
+	NTSTATUS status;
+	int rc;
+
+	status = smb2_signing_encrypt_setup(encryption_key,
+					    vector,
+					    count,
+					    &iv_size,
+					    &tag_size,
+					    &use_encryptv2);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	tf = (uint8_t *)vector[0].iov_base;
+	a_total = SMB2_TF_HDR_SIZE - SMB2_TF_NONCE;
+	m_total = IVAL(tf, SMB2_TF_MSG_SIZE);
+
+	iv = (gnutls_datum_t) {
+		.data = tf + SMB2_TF_NONCE,
+		.size = iv_size,
+	};
+
+#ifdef HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV2
+	if (use_encryptv2) {
+		rc = smb2_signing_encryptv2(encryption_key,
+					    vector,
+					    count,
+					    iv_size,
+					    tag_size);
 		if (rc < 0) {
 			status = gnutls_error_to_ntstatus(rc, NT_STATUS_INTERNAL_ERROR);
 			goto out;
 		}
-
-		memcpy(tf + SMB2_TF_SIGNATURE, tag, tag_size);
 	} else
 #endif /* HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV2 */
 	{
+#ifndef HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV
 		size_t ptext_size = m_total;
+#endif
 		uint8_t *ptext = NULL;
 		size_t ctext_size = m_total + tag_size;
 		uint8_t *ctext = NULL;
@@ -972,15 +1208,43 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 			tmp_ctx = talloc_tos();
 		}
 
-		ptext = talloc_size(tmp_ctx, ptext_size);
-		if (ptext == NULL) {
+		ctext = talloc_size(tmp_ctx, ctext_size);
+		if (ctext == NULL) {
 			status = NT_STATUS_NO_MEMORY;
 			goto out;
 		}
 
-		ctext = talloc_size(tmp_ctx, ctext_size);
-		if (ctext == NULL) {
-			TALLOC_FREE(ptext);
+#ifdef HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV
+		{
+			giovec_t auth_iov[1];
+
+			auth_iov[0] = (giovec_t) {
+				.iov_base = tf + SMB2_TF_NONCE,
+				.iov_len  = a_total,
+			};
+
+			/*
+			 * Without encryptv2 we can't encrypt in place,
+			 * but gnutls_aead_cipher_encryptv() at least
+			 * reads the plaintext directly from the
+			 * vectors. This avoids gathering large READ
+			 * responses into a temporary buffer.
+			 */
+			rc = gnutls_aead_cipher_encryptv(encryption_key->cipher_hnd,
+							 iv.data,
+							 iv.size,
+							 auth_iov,
+							 1,
+							 tag_size,
+							 &vector[1],
+							 count - 1,
+							 ctext,
+							 &ctext_size);
+		}
+#else /* HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV */
+		ptext = talloc_size(tmp_ctx, ptext_size);
+		if (ptext == NULL) {
+			TALLOC_FREE(ctext);
 			status = NT_STATUS_NO_MEMORY;
 			goto out;
 		}
@@ -1011,6 +1275,7 @@ NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 						ptext_size,
 						ctext,
 						&ctext_size);
+#endif /* HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV */
 		if (rc < 0 || ctext_size != m_total + tag_size) {
 			TALLOC_FREE(ptext);
 			TALLOC_FREE(ctext);
@@ -1042,6 +1307,60 @@ out:
 	return status;
 }
 
+NTSTATUS smb2_signing_encrypt_pdu_prepare(struct smb2_signing_key *encryption_key,
+					  struct iovec *vector,
+					  int count)
+{
+	bool use_encryptv2 = false;
+	uint32_t iv_size = 0;
+	size_t tag_size = 0;
+	NTSTATUS status;
+
+	status = smb2_signing_encrypt_setup(encryption_key,
+					    vector,
+					    count,
+					    &iv_size,
+					    &tag_size,
+					    &use_encryptv2);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	if (!use_encryptv2) {
+		return NT_STATUS_NOT_SUPPORTED;
+	}
+
+	return NT_STATUS_OK;
+}
+
+int smb2_signing_encrypt_pdu_inplace(struct smb2_signing_key *encryption_key,
+				     struct iovec *vector,
+				     int count)
+{
+#ifdef HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV2
+	gnutls_cipher_algorithm_t algo = 0;
+	uint32_t iv_size = 0;
+	bool use_encryptv2 = false;
+	NTSTATUS status;
+
+	status = smb2_signing_cipher_params(encryption_key->cipher_algo_id,
+					    &algo,
+					    &iv_size,
+					    &use_encryptv2);
+	if (!NT_STATUS_IS_OK(status) || !use_encryptv2) {
+		return GNUTLS_E_INVALID_REQUEST;
+	}
+
+	return smb2_signing_encryptv2(encryption_key,
+				      vector,
+				      count,
+				      iv_size,
+				      gnutls_cipher_get_tag_size(algo));
+#else /* HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV2 */
+	return GNUTLS_E_INVALID_REQUEST;
+#endif /* HAVE_GNUTLS_AEAD_CIPHER_ENCRYPTV2 */
+}
+
 NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
 				  struct iovec *vector,
 				  int count)
@@ -81,6 +81,18 @@ NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
 			       struct iovec *vector,
 			       int count);
 
+/*
+ * smb2_signing_sign_pdu() split into two steps, the same way as
+ * smb2_signing_encrypt_pdu_prepare() and
+ * smb2_signing_encrypt_pdu_inplace() below.
+ */
+NTSTATUS smb2_signing_sign_pdu_prepare(struct smb2_signing_key *signing_key,
+				       struct iovec *vector,
+				       int count);
+int smb2_signing_sign_pdu_inplace(struct smb2_signing_key *signing_key,
+				  struct iovec *vector,
+				  int count);
+
 NTSTATUS smb2_signing_check_pdu(struct smb2_signing_key *signing_key,
 				const struct iovec *vector,
 				int count);
@@ -93,6 +105,26 @@ NTSTATUS smb2_key_derivation(const uint8_t *KI, size_t KI_len,
 NTSTATUS smb2_signing_encrypt_pdu(struct smb2_signing_key *encryption_key,
 				  struct iovec *vector,
 				  int count);
+/*
+ * smb2_signing_encrypt_pdu() split into two steps.
+ *
+ * smb2_signing_encrypt_pdu_prepare() fills the transform header and
+ * sets up the cipher handle. It returns NT_STATUS_NOT_SUPPORTED if
+ * the message can't be encrypted in place, the caller should use
+ * smb2_signing_encrypt_pdu() instead.
+ *
+ * smb2_signing_encrypt_pdu_inplace() does the actual encryption. It
+ * neither allocates talloc memory nor calls the debug system, so it
+ * can run in a helper thread, as long as nothing else touches the
+ * key and the vectors in the meantime. It returns a gnutls error
+ * code.
+ */
+NTSTATUS smb2_signing_encrypt_pdu_prepare(struct smb2_signing_key *encryption_key,
+					  struct iovec *vector,
+					  int count);
+int smb2_signing_encrypt_pdu_inplace(struct smb2_signing_key *encryption_key,
+				     struct iovec *vector,
+				     int count);
 NTSTATUS smb2_signing_decrypt_pdu(struct smb2_signing_key *decryption_key,
 				  struct iovec *vector,
 				  int count);
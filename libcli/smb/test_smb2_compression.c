@@ -0,0 +1,520 @@
+/*
+ * Unix SMB/CIFS implementation.
+ *
+ * Tests for the SMB2 compression transform
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "includes.h"
+#include <talloc.h>
+#include "libcli/smb/smb_common.h"
+#include "libcli/smb/smb2_compression.h"
+
+#define PREFIX_LEN (SMB2_HDR_BODY + 0x10)
+
+static const struct smb3_compression_capabilities caps_lz77 = {
+	.flags = SMB2_COMPRESSION_CAPABILITIES_FLAG_NONE,
+	.num_algos = 1,
+	.algos = { SMB2_COMPRESSION_LZ77, },
+};
+
+static const struct smb3_compression_capabilities caps_chained = {
+	.flags = SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED,
+	.num_algos = 2,
+	.algos = { SMB2_COMPRESSION_LZ77, SMB2_COMPRESSION_PATTERN_V1, },
+};
+
+static void fill_text(uint8_t *buf, size_t len)
+{
+	const char *words[] = {
+		"alpha ", "beta ", "gamma ", "delta ", "epsilon ",
+	};
+	size_t i = 0;
+	size_t w = 0;
+
+	while (i < len) {
+		const char *s = words[w % ARRAY_SIZE(words)];
+		size_t n = MIN(strlen(s), len - i);
+
+		memcpy(buf + i, s, n);
+		i += n;
+		w = (w * 7 + 3) % 11;
+	}
+}
+
+static void fill_random(uint8_t *buf, size_t len)
+{
+	uint32_t x = 0x12345678;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		x = x * 1103515245 + 12345;
+		buf[i] = x >> 16;
+	}
+}
+
+static void round_trip(const struct smb3_compression_capabilities *caps,
+		       const uint8_t *data,
+		       size_t data_len,
+		       size_t *comp_len)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	uint8_t prefix[PREFIX_LEN];
+	DATA_BLOB comp = data_blob_null;
+	DATA_BLOB dec = data_blob_null;
+	NTSTATUS status;
+	size_t i;
+
+	for (i = 0; i < sizeof(prefix); i++) {
+		prefix[i] = i;
+	}
+
+	status = smb2_compression_compress(frame,
+					   caps,
+					   prefix,
+					   sizeof(prefix),
+					   data,
+					   data_len,
+					   &comp);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_true(comp.length < sizeof(prefix) + data_len);
+	assert_int_equal(IVAL(comp.data, 0), SMB2_COMP_TF_MAGIC);
+
+	status = smb2_compression_decompress(frame,
+					     caps,
+					     comp.data,
+					     comp.length,
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(dec.length, sizeof(prefix) + data_len);
+	assert_memory_equal(dec.data, prefix, sizeof(prefix));
+	assert_memory_equal(dec.data + sizeof(prefix), data, data_len);
+
+	*comp_len = comp.length;
+	TALLOC_FREE(frame);
+}
+
+static void test_unchained_round_trip(void **state)
+{
+	uint8_t data[0x10000];
+	size_t comp_len;
+
+	fill_text(data, sizeof(data));
+	round_trip(&caps_lz77, data, sizeof(data), &comp_len);
+	assert_true(comp_len < sizeof(data) / 2);
+}
+
+static void test_chained_round_trip(void **state)
+{
+	uint8_t data[0x10000];
+	size_t comp_len;
+
+	/* leading and trailing runs go as Pattern_V1 */
+	memset(data, 0, 0x1000);
+	fill_text(data + 0x1000, 0x8000);
+	memset(data + 0x9000, 0xff, sizeof(data) - 0x9000);
+	round_trip(&caps_chained, data, sizeof(data), &comp_len);
+	assert_true(comp_len < 0x8000 / 2);
+
+	/* a single run is just header + prefix + pattern */
+	memset(data, 0x42, sizeof(data));
+	round_trip(&caps_chained, data, sizeof(data), &comp_len);
+	assert_int_equal(comp_len,
+			 SMB2_COMP_TF_ALGO +
+			 SMB2_COMP_CHAINED_HDR_SIZE + PREFIX_LEN +
+			 SMB2_COMP_CHAINED_HDR_SIZE +
+			 SMB2_COMP_PATTERN_V1_SIZE);
+
+	/* incompressible data surrounded by runs */
+	memset(data, 0, sizeof(data));
+	fill_random(data + 0x100, 0x4000);
+	round_trip(&caps_chained, data, sizeof(data), &comp_len);
+}
+
+static void test_incompressible(void **state)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	uint8_t prefix[PREFIX_LEN] = { 0, };
+	uint8_t data[0x4000];
+	DATA_BLOB comp = data_blob_null;
+	NTSTATUS status;
+
+	fill_random(data, sizeof(data));
+
+	status = smb2_compression_compress(frame,
+					   &caps_lz77,
+					   prefix,
+					   sizeof(prefix),
+					   data,
+					   sizeof(data),
+					   &comp);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_BUFFER_TOO_SMALL));
+
+	status = smb2_compression_compress(frame,
+					   &caps_chained,
+					   prefix,
+					   sizeof(prefix),
+					   data,
+					   sizeof(data),
+					   &comp);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_BUFFER_TOO_SMALL));
+
+	/* too small to bother */
+	memset(data, 0, sizeof(data));
+	status = smb2_compression_compress(frame,
+					   &caps_chained,
+					   prefix,
+					   sizeof(prefix),
+					   data,
+					   SMB2_COMPRESSION_MIN_SIZE - 1,
+					   &comp);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_BUFFER_TOO_SMALL));
+
+	TALLOC_FREE(frame);
+}
+
+static void test_chained_decompress(void **state)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	uint8_t buf[SMB2_COMP_TF_ALGO +
+		    SMB2_COMP_CHAINED_HDR_SIZE + 4 +
+		    SMB2_COMP_CHAINED_HDR_SIZE + SMB2_COMP_PATTERN_V1_SIZE];
+	uint8_t *p = buf;
+	DATA_BLOB dec = data_blob_null;
+	NTSTATUS status;
+	size_t i;
+
+	SIVAL(p, SMB2_COMP_TF_PROTOCOL_ID, SMB2_COMP_TF_MAGIC);
+	SIVAL(p, SMB2_COMP_TF_ORIG_SIZE, 4 + 100);
+	p += SMB2_COMP_TF_ALGO;
+
+	SSVAL(p, SMB2_COMP_CHAINED_ALGO, SMB2_COMPRESSION_NONE);
+	SSVAL(p, SMB2_COMP_CHAINED_FLAGS, SMB2_COMPRESSION_FLAG_CHAINED);
+	SIVAL(p, SMB2_COMP_CHAINED_LENGTH, 4);
+	p += SMB2_COMP_CHAINED_HDR_SIZE;
+	memcpy(p, "SMB2", 4);
+	p += 4;
+
+	SSVAL(p, SMB2_COMP_CHAINED_ALGO, SMB2_COMPRESSION_PATTERN_V1);
+	SSVAL(p, SMB2_COMP_CHAINED_FLAGS, SMB2_COMPRESSION_FLAG_NONE);
+	SIVAL(p, SMB2_COMP_CHAINED_LENGTH, SMB2_COMP_PATTERN_V1_SIZE);
+	p += SMB2_COMP_CHAINED_HDR_SIZE;
+	SCVAL(p, SMB2_COMP_PATTERN_V1_PATTERN, 'x');
+	SCVAL(p, 1, 0);
+	SSVAL(p, 2, 0);
+	SIVAL(p, SMB2_COMP_PATTERN_V1_REPS, 100);
+
+	status = smb2_compression_decompress(frame,
+					     &caps_chained,
+					     buf,
+					     sizeof(buf),
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(dec.length, 104);
+	assert_memory_equal(dec.data, "SMB2", 4);
+	for (i = 4; i < dec.length; i++) {
+		assert_int_equal(dec.data[i], 'x');
+	}
+
+	/* The result would exceed the limit */
+	status = smb2_compression_decompress(frame,
+					     &caps_chained,
+					     buf,
+					     sizeof(buf),
+					     103,
+					     &dec);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	/* Pattern_V1 was not negotiated */
+	status = smb2_compression_decompress(frame,
+					     &caps_lz77,
+					     buf,
+					     sizeof(buf),
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	/* The payloads produce more than announced */
+	SIVAL(buf, SMB2_COMP_TF_ORIG_SIZE, 4 + 99);
+	status = smb2_compression_decompress(frame,
+					     &caps_chained,
+					     buf,
+					     sizeof(buf),
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	/* The payloads produce less than announced */
+	SIVAL(buf, SMB2_COMP_TF_ORIG_SIZE, 4 + 101);
+	status = smb2_compression_decompress(frame,
+					     &caps_chained,
+					     buf,
+					     sizeof(buf),
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	/* Truncated payload header */
+	SIVAL(buf, SMB2_COMP_TF_ORIG_SIZE, 4 + 100);
+	status = smb2_compression_decompress(frame,
+					     &caps_chained,
+					     buf,
+					     sizeof(buf) - 1,
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	TALLOC_FREE(frame);
+}
+
+/*
+ * LZ77 streams from the "Plain LZ77 Compression" examples in
+ * [MS-XCA] 3.1, wrapped in SMB2_COMPRESSION_TRANSFORM headers
+ * laid out as in [MS-SMB2] 2.2.42.
+ */
+#define MS_XCA_DATA1 "abcdefghijklmnopqrstuvwxyz"
+#define MS_XCA_COMP1 \
+	0x3f, 0x00, 0x00, 0x00, 0x61, 0x62, 0x63, 0x64, \
+	0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, \
+	0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72, 0x73, 0x74, \
+	0x75, 0x76, 0x77, 0x78, 0x79, 0x7a
+
+/* "abc" repeated 100 times */
+#define MS_XCA_COMP2 \
+	0xff, 0xff, 0xff, 0x1f, 0x61, 0x62, 0x63, 0x17, \
+	0x00, 0x0f, 0xff, 0x26, 0x01
+
+static void check_ms_xca_data2(const uint8_t *p)
+{
+	size_t i;
+
+	for (i = 0; i < 100; i++) {
+		assert_memory_equal(p + i * 3, "abc", 3);
+	}
+}
+
+static void test_known_answer_unchained(void **state)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	const uint8_t msg[] = {
+		/* ProtocolId */
+		0xfc, 0x53, 0x4d, 0x42,
+		/* OriginalCompressedSegmentSize: 300 */
+		0x2c, 0x01, 0x00, 0x00,
+		/* CompressionAlgorithm: LZ77 */
+		0x02, 0x00,
+		/* Flags: SMB2_COMPRESSION_FLAG_NONE */
+		0x00, 0x00,
+		/* Offset: 4 */
+		0x04, 0x00, 0x00, 0x00,
+		/* uncompressed */
+		0xfe, 0x53, 0x4d, 0x42,
+		/* compressed */
+		MS_XCA_COMP2
+	};
+	DATA_BLOB dec = data_blob_null;
+	NTSTATUS status;
+
+	status = smb2_compression_decompress(frame,
+					     &caps_lz77,
+					     msg,
+					     sizeof(msg),
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(dec.length, 4 + 300);
+	assert_memory_equal(dec.data, "\xfeSMB", 4);
+	check_ms_xca_data2(dec.data + 4);
+
+	TALLOC_FREE(frame);
+}
+
+static void test_known_answer_chained(void **state)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	const uint8_t msg[] = {
+		/* ProtocolId */
+		0xfc, 0x53, 0x4d, 0x42,
+		/* OriginalCompressedSegmentSize: 4 + 26 + 4096 + 300 */
+		0x4a, 0x11, 0x00, 0x00,
+
+		/* NONE, CHAINED, Length: 4 */
+		0x00, 0x00, 0x01, 0x00, 0x04, 0x00, 0x00, 0x00,
+		0xfe, 0x53, 0x4d, 0x42,
+
+		/* LZ77, CHAINED, Length: 4 + 30 */
+		0x02, 0x00, 0x01, 0x00, 0x22, 0x00, 0x00, 0x00,
+		/* OriginalPayloadSize: 26 */
+		0x1a, 0x00, 0x00, 0x00,
+		MS_XCA_COMP1,
+
+		/* Pattern_V1, CHAINED, Length: 8 */
+		0x04, 0x00, 0x01, 0x00, 0x08, 0x00, 0x00, 0x00,
+		/* Pattern: 0x00, Reserved1, Reserved2, Repetitions: 4096 */
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00,
+
+		/* LZ77, NONE, Length: 4 + 13 */
+		0x02, 0x00, 0x00, 0x00, 0x11, 0x00, 0x00, 0x00,
+		/* OriginalPayloadSize: 300 */
+		0x2c, 0x01, 0x00, 0x00,
+		MS_XCA_COMP2
+	};
+	DATA_BLOB dec = data_blob_null;
+	NTSTATUS status;
+	size_t i;
+
+	status = smb2_compression_decompress(frame,
+					     &caps_chained,
+					     msg,
+					     sizeof(msg),
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(dec.length, 4 + 26 + 4096 + 300);
+	assert_memory_equal(dec.data, "\xfeSMB", 4);
+	assert_memory_equal(dec.data + 4, MS_XCA_DATA1, 26);
+	for (i = 0; i < 4096; i++) {
+		assert_int_equal(dec.data[4 + 26 + i], 0);
+	}
+	check_ms_xca_data2(dec.data + 4 + 26 + 4096);
+
+	TALLOC_FREE(frame);
+}
+
+static void test_known_answer_pattern_v1(void **state)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	const uint8_t prefix[] = { 0xfe, 0x53, 0x4d, 0x42 };
+	const uint8_t expected[] = {
+		/* ProtocolId */
+		0xfc, 0x53, 0x4d, 0x42,
+		/* OriginalCompressedSegmentSize: 4 + 4096 */
+		0x04, 0x10, 0x00, 0x00,
+
+		/* NONE, CHAINED, Length: 4 */
+		0x00, 0x00, 0x01, 0x00, 0x04, 0x00, 0x00, 0x00,
+		0xfe, 0x53, 0x4d, 0x42,
+
+		/* Pattern_V1, CHAINED, Length: 8 */
+		0x04, 0x00, 0x01, 0x00, 0x08, 0x00, 0x00, 0x00,
+		/* Pattern: 0xaa, Reserved1, Reserved2, Repetitions: 4096 */
+		0xaa, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00,
+	};
+	uint8_t data[4096];
+	DATA_BLOB comp = data_blob_null;
+	NTSTATUS status;
+
+	memset(data, 0xaa, sizeof(data));
+
+	status = smb2_compression_compress(frame,
+					   &caps_chained,
+					   prefix,
+					   sizeof(prefix),
+					   data,
+					   sizeof(data),
+					   &comp);
+	assert_true(NT_STATUS_IS_OK(status));
+	assert_int_equal(comp.length, sizeof(expected));
+	assert_memory_equal(comp.data, expected, sizeof(expected));
+
+	TALLOC_FREE(frame);
+}
+
+static void test_unchained_decompress_invalid(void **state)
+{
+	TALLOC_CTX *frame = talloc_new(NULL);
+	uint8_t buf[SMB2_COMP_TF_HDR_SIZE + 8] = { 0, };
+	DATA_BLOB dec = data_blob_null;
+	NTSTATUS status;
+
+	SIVAL(buf, SMB2_COMP_TF_PROTOCOL_ID, SMB2_COMP_TF_MAGIC);
+	SIVAL(buf, SMB2_COMP_TF_ORIG_SIZE, 8);
+	SSVAL(buf, SMB2_COMP_TF_ALGO, SMB2_COMPRESSION_LZ77);
+	SSVAL(buf, SMB2_COMP_TF_FLAGS, SMB2_COMPRESSION_FLAG_NONE);
+
+	/* Offset beyond the end of the message */
+	SIVAL(buf, SMB2_COMP_TF_OFFSET, 9);
+	status = smb2_compression_decompress(frame,
+					     &caps_lz77,
+					     buf,
+					     sizeof(buf),
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	/* Pattern_V1 is only valid in chained mode */
+	SIVAL(buf, SMB2_COMP_TF_OFFSET, 0);
+	SSVAL(buf, SMB2_COMP_TF_ALGO, SMB2_COMPRESSION_PATTERN_V1);
+	status = smb2_compression_decompress(frame,
+					     &caps_chained,
+					     buf,
+					     sizeof(buf),
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	/* Chained compression was not negotiated */
+	SSVAL(buf, SMB2_COMP_TF_FLAGS, SMB2_COMPRESSION_FLAG_CHAINED);
+	status = smb2_compression_decompress(frame,
+					     &caps_lz77,
+					     buf,
+					     sizeof(buf),
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	/* Not a compression transform */
+	status = smb2_compression_decompress(frame,
+					     &caps_lz77,
+					     buf + 1,
+					     sizeof(buf) - 1,
+					     0xFFFFFF,
+					     &dec);
+	assert_true(NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER));
+
+	TALLOC_FREE(frame);
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_unchained_round_trip),
+		cmocka_unit_test(test_chained_round_trip),
+		cmocka_unit_test(test_incompressible),
+		cmocka_unit_test(test_chained_decompress),
+		cmocka_unit_test(test_known_answer_unchained),
+		cmocka_unit_test(test_known_answer_chained),
+		cmocka_unit_test(test_known_answer_pattern_v1),
+		cmocka_unit_test(test_unchained_decompress_invalid),
+	};
+
+	if (argc == 2) {
+		cmocka_set_test_filter(argv[1]);
+	}
+	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
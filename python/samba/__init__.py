@@ -108,6 +108,13 @@ class Ldb(_Ldb):
             if nosync_p is not None and nosync_p:
                 flags |= ldb.FLG_NOSYNC
 
+            # Unpack records in helper threads during full scans and
+            # re-indexing (e.g. dbcheck --reindex)
+            scan_threads_p = lp.get("ldb:scan threads")
+            if scan_threads_p is not None and int(scan_threads_p) > 0:
+                options = list(options or [])
+                options.append("scan_threads:%d" % int(scan_threads_p))
+
         self.set_create_perms(0o600)
 
         if url is not None:
@@ -1805,6 +1805,8 @@ sub setup_fileserver
 
 	get quota command = $prefix_abs/getset_quota.py
 	set quota command = $prefix_abs/getset_quota.py
+
+	smb2 crypto offload size = 4096
 [tarmode]
 	path = $tarmode_sharedir
 	comment = tar test share
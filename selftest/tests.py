@@ -408,9 +408,13 @@ plantestsuite("samba.unittests.smb1cli_session", "none",
               [os.path.join(bindir(), "default/libcli/smb/test_smb1cli_session")])
 plantestsuite("samba.unittests.smb_util_translate", "none",
               [os.path.join(bindir(), "default/libcli/smb/test_util_translate")])
+plantestsuite("samba.unittests.smb2_compression", "none",
+              [os.path.join(bindir(), "default/libcli/smb/test_smb2_compression")])
 
 plantestsuite("samba.unittests.talloc_keep_secret", "none",
               [os.path.join(bindir(), "default/lib/util/test_talloc_keep_secret")])
+plantestsuite("samba.unittests.talloc_pprof", "none",
+              [os.path.join(bindir(), "default/lib/util/test_talloc_pprof")])
 
 plantestsuite("samba.unittests.tldap", "none",
               [os.path.join(bindir(), "default/source3/test_tldap")])
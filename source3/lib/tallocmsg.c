@@ -19,6 +19,9 @@
 #include "includes.h"
 #include "messages.h"
 #include "lib/util/talloc_report_printf.h"
+#include "lib/util/talloc_pprof.h"
+#include "lib/util/sys_rw_data.h"
+#include "lib/util/smb_strtox.h"
 
 static bool pool_usage_filter(struct messaging_rec *rec, void *private_data)
 {
@@ -83,3 +86,106 @@ void register_msg_pool_usage(
 	}
 	DEBUG(2, ("Registered MSG_REQ_POOL_USAGE\n"));
 }
+
+static void talloc_profile_dump(int fd)
+{
+	uint8_t *buf = NULL;
+	size_t len = 0;
+	ssize_t written;
+
+	buf = talloc_pprof(talloc_tos(), NULL, &len);
+	if (buf == NULL) {
+		DBG_WARNING("talloc_pprof failed\n");
+		return;
+	}
+
+	written = write_data(fd, buf, len);
+	if (written == -1) {
+		DBG_DEBUG("write_data failed: %s\n", strerror(errno));
+	}
+	TALLOC_FREE(buf);
+}
+
+static bool talloc_profile_filter(struct messaging_rec *rec,
+				  void *private_data)
+{
+	const char *cmd = NULL;
+	size_t len = rec->buf.length;
+
+	if (rec->msg_type != MSG_REQ_TALLOC_PROFILE) {
+		return false;
+	}
+
+	if (len == 0 || rec->buf.data[len-1] != '\0') {
+		DBG_DEBUG("Invalid MSG_REQ_TALLOC_PROFILE command\n");
+		return false;
+	}
+	cmd = (const char *)rec->buf.data;
+
+	DBG_DEBUG("Got MSG_REQ_TALLOC_PROFILE %s\n", cmd);
+
+	if (strcmp(cmd, "dump") == 0) {
+		if (rec->num_fds != 1) {
+			DBG_DEBUG("Got %"PRIu8" fds, expected one\n",
+				  rec->num_fds);
+			return false;
+		}
+		talloc_profile_dump(rec->fds[0]);
+	} else if (strncmp(cmd, "enable ", 7) == 0) {
+		unsigned long long interval;
+		int error = 0;
+		int ret;
+
+		interval = smb_strtoull(cmd + 7,
+					NULL,
+					10,
+					&error,
+					SMB_STR_FULL_STR_CONV);
+		if (error != 0 || interval == 0 || interval > SIZE_MAX) {
+			DBG_WARNING("Invalid sample interval %s\n", cmd + 7);
+			return false;
+		}
+		ret = talloc_profile_set_interval(interval);
+		if (ret != 0) {
+			DBG_WARNING("talloc_profile_set_interval failed: %s\n",
+				    strerror(errno));
+			return false;
+		}
+		DBG_NOTICE("talloc allocation sampling enabled, "
+			   "interval %llu bytes\n",
+			   interval);
+	} else if (strcmp(cmd, "disable") == 0) {
+		talloc_profile_set_interval(0);
+		DBG_NOTICE("talloc allocation sampling disabled\n");
+	} else if (strcmp(cmd, "reset") == 0) {
+		talloc_profile_reset();
+	} else {
+		DBG_DEBUG("Unknown MSG_REQ_TALLOC_PROFILE command %s\n", cmd);
+	}
+
+	/*
+	 * Like pool_usage_filter(), stay registered.
+	 */
+	return false;
+}
+
+/**
+ * Register handler for MSG_REQ_TALLOC_PROFILE
+ **/
+void register_msg_talloc_profile(
+	TALLOC_CTX *mem_ctx, struct messaging_context *msg_ctx)
+{
+	struct tevent_req *req = NULL;
+
+	req = messaging_filtered_read_send(
+		mem_ctx,
+		messaging_tevent_context(msg_ctx),
+		msg_ctx,
+		talloc_profile_filter,
+		NULL);
+	if (req == NULL) {
+		DBG_WARNING("messaging_filtered_read_send failed\n");
+		return;
+	}
+	DBG_INFO("Registered MSG_REQ_TALLOC_PROFILE\n");
+}
@@ -373,6 +373,7 @@ void brl_init(bool read_only)
 		TDB_DEFAULT|
 		TDB_VOLATILE|
 		TDB_CLEAR_IF_FIRST|
+		TDB_GROW_HASH_SIZE|
 		TDB_INCOMPATIBLE_HASH|
 		TDB_SEQNUM;
 
@@ -50,6 +50,7 @@ bool leases_db_init(bool read_only)
 			    TDB_DEFAULT|
 			    TDB_VOLATILE|
 			    TDB_CLEAR_IF_FIRST|
+			    TDB_GROW_HASH_SIZE|
 			    TDB_SEQNUM|
 			    TDB_INCOMPATIBLE_HASH,
 			    read_only ? O_RDONLY : O_RDWR|O_CREAT, 0644,
@@ -87,6 +87,7 @@ static bool locking_init_internal(bool read_only)
 			  TDB_DEFAULT|
 			  TDB_VOLATILE|
 			  TDB_CLEAR_IF_FIRST|
+			  TDB_GROW_HASH_SIZE|
 			  TDB_INCOMPATIBLE_HASH|
 			  TDB_SEQNUM,
 			  read_only?O_RDONLY:O_RDWR|O_CREAT, 0644,
@@ -208,67 +209,6 @@ static enum ndr_err_code get_share_mode_blob_header(
 	return NDR_ERR_SUCCESS;
 }
 
-struct fsp_update_share_mode_flags_state {
-	enum ndr_err_code ndr_err;
-	uint16_t share_mode_flags;
-};
-
-static void fsp_update_share_mode_flags_fn(
-	const uint8_t *buf,
-	size_t buflen,
-	bool *modified_dependent,
-	void *private_data)
-{
-	struct fsp_update_share_mode_flags_state *state = private_data;
-	uint64_t seq;
-
-	state->ndr_err = get_share_mode_blob_header(
-		buf, buflen, &seq, &state->share_mode_flags);
-}
-
-static NTSTATUS fsp_update_share_mode_flags(struct files_struct *fsp)
-{
-	struct fsp_update_share_mode_flags_state state = {0};
-	int seqnum = g_lock_seqnum(lock_ctx);
-	NTSTATUS status;
-
-	if (seqnum == fsp->share_mode_flags_seqnum) {
-		return NT_STATUS_OK;
-	}
-
-	status = share_mode_do_locked(
-		fsp->file_id, fsp_update_share_mode_flags_fn, &state);
-	if (!NT_STATUS_IS_OK(status)) {
-		DBG_DEBUG("share_mode_do_locked returned %s\n",
-			  nt_errstr(status));
-		return status;
-	}
-
-	if (!NDR_ERR_CODE_IS_SUCCESS(state.ndr_err)) {
-		DBG_DEBUG("get_share_mode_blob_header returned %s\n",
-			  ndr_errstr(state.ndr_err));
-		return ndr_map_error2ntstatus(state.ndr_err);
-	}
-
-	fsp->share_mode_flags_seqnum = seqnum;
-	fsp->share_mode_flags = state.share_mode_flags;
-
-	return NT_STATUS_OK;
-}
-
-bool file_has_read_lease(struct files_struct *fsp)
-{
-	NTSTATUS status;
-
-	status = fsp_update_share_mode_flags(fsp);
-	if (!NT_STATUS_IS_OK(status)) {
-		/* Safe default for leases */
-		return true;
-	}
-
-	return (fsp->share_mode_flags & SHARE_MODE_LEASE_READ) != 0;
-}
-
 static int share_mode_data_nofree_destructor(struct share_mode_data *d)
 {
 	return -1;
@@ -459,6 +399,98 @@ static bool locking_tdb_data_get(
 	return true;
 }
 
+struct fsp_update_share_mode_flags_state {
+	NTSTATUS status;
+	uint16_t share_mode_flags;
+};
+
+static void fsp_update_share_mode_flags_fn(
+	struct server_id exclusive,
+	size_t num_shared,
+	struct server_id *shared,
+	const uint8_t *data,
+	size_t datalen,
+	void *private_data)
+{
+	struct fsp_update_share_mode_flags_state *state = private_data;
+	struct locking_tdb_data ltdb = { 0 };
+	enum ndr_err_code ndr_err;
+	uint64_t seq;
+	bool ok;
+
+	ok = locking_tdb_data_get(&ltdb, data, datalen);
+	if (!ok) {
+		state->status = NT_STATUS_INTERNAL_DB_CORRUPTION;
+		return;
+	}
+
+	ndr_err = get_share_mode_blob_header(
+		ltdb.share_mode_data_buf,
+		ltdb.share_mode_data_len,
+		&seq,
+		&state->share_mode_flags);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		DBG_DEBUG("get_share_mode_blob_header returned %s\n",
+			  ndr_errstr(ndr_err));
+		state->status = ndr_map_error2ntstatus(ndr_err);
+		return;
+	}
+
+	state->status = NT_STATUS_OK;
+}
+
+/*
+ * This is called for every write on a file with leases, so it must
+ * be cheap. We don't take the g_lock on the record, instead this
+ * works like a seqlock: We sample the database sequence number
+ * before parsing the record. Writers are serialized by the g_lock
+ * and every record update is atomic, so we always see a consistent
+ * record. If a writer changed it in the meantime, the sequence
+ * number has moved on and the next call parses the record again.
+ */
+static NTSTATUS fsp_update_share_mode_flags(struct files_struct *fsp)
+{
+	struct fsp_update_share_mode_flags_state state = {
+		.status = NT_STATUS_INTERNAL_ERROR,
+	};
+	int seqnum = g_lock_seqnum(lock_ctx);
+	TDB_DATA key = locking_key(&fsp->file_id);
+	NTSTATUS status;
+
+	if (seqnum == fsp->share_mode_flags_seqnum) {
+		return NT_STATUS_OK;
+	}
+
+	status = g_lock_dump(
+		lock_ctx, key, fsp_update_share_mode_flags_fn, &state);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("g_lock_dump returned %s\n",
+			  nt_errstr(status));
+		return status;
+	}
+	if (!NT_STATUS_IS_OK(state.status)) {
+		return state.status;
+	}
+
+	fsp->share_mode_flags_seqnum = seqnum;
+	fsp->share_mode_flags = state.share_mode_flags;
+
+	return NT_STATUS_OK;
+}
+
+bool file_has_read_lease(struct files_struct *fsp)
+{
+	NTSTATUS status;
+
+	status = fsp_update_share_mode_flags(fsp);
+	if (!NT_STATUS_IS_OK(status)) {
+		/* Safe default for leases */
+		return true;
+	}
+
+	return (fsp->share_mode_flags & SHARE_MODE_LEASE_READ) != 0;
+}
+
 struct locking_tdb_data_fetch_state {
 	TALLOC_CTX *mem_ctx;
 	uint8_t *data;
@@ -34,7 +34,17 @@ struct vfs_io_uring_request;
 
 struct vfs_io_uring_config {
 	struct io_uring uring;
+	struct tevent_context *ev;
 	struct tevent_fd *fde;
+	/* submits all requests queued in one event loop iteration */
+	struct tevent_immediate *im;
+	bool sqpoll;
+	/* the kernel supports IORING_OP_[F]GETXATTR */
+	bool have_getxattr;
+	/* registered file table, see vfs_io_uring_fixed_file() */
+	unsigned num_fixed_files;
+	unsigned num_free_slots;
+	int *free_slots;
 	/* recursion guard. See comment above vfs_io_uring_queue_run() */
 	bool busy;
 	/* recursion guard. See comment above vfs_io_uring_queue_run() */
@@ -121,12 +131,36 @@ static void vfs_io_uring_config_destroy(struct vfs_io_uring_config *config,
 	}
 }
 
+/*
+ * Per fsp extension, only present if the fd of the fsp
+ * got a slot in the registered file table.
+ */
+struct vfs_io_uring_fsp_ext {
+	int slot;
+};
+
 static int vfs_io_uring_config_destructor(struct vfs_io_uring_config *config)
 {
 	vfs_io_uring_config_destroy(config, -EUCLEAN, __location__);
 	return 0;
 }
 
+/*
+ * A queued request is not known to the kernel yet,
+ * so its state can simply go away.
+ */
+static int vfs_io_uring_request_state_queue_destructor(void *_state)
+{
+	struct __vfs_io_uring_generic_state {
+		struct vfs_io_uring_request ur;
+	} *state = (struct __vfs_io_uring_generic_state *)_state;
+	struct vfs_io_uring_request *cur = &state->ur;
+
+	DLIST_REMOVE(cur->config->queue, cur);
+	cur->list_head = NULL;
+	return 0;
+}
+
 static int vfs_io_uring_request_state_deny_destructor(void *_state)
 {
 	struct __vfs_io_uring_generic_state {
@@ -201,6 +235,23 @@ static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
 	}
 
 	talloc_set_destructor(config, vfs_io_uring_config_destructor);
+	config->sqpoll = sqpoll;
+
+#ifdef HAVE_IO_URING_PREP_GETXATTR
+	{
+		struct io_uring_probe *probe = NULL;
+
+		probe = io_uring_get_probe_ring(&config->uring);
+		if (probe != NULL) {
+			config->have_getxattr =
+				io_uring_opcode_supported(probe,
+						IORING_OP_GETXATTR) &&
+				io_uring_opcode_supported(probe,
+						IORING_OP_FGETXATTR);
+			io_uring_free_probe(probe);
+		}
+	}
+#endif /* HAVE_IO_URING_PREP_GETXATTR */
 
 #ifdef HAVE_IO_URING_RING_DONTFORK
 	ret = io_uring_ring_dontfork(&config->uring);
@@ -211,7 +262,59 @@ static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
 	}
 #endif /* HAVE_IO_URING_RING_DONTFORK */
 
-	config->fde = tevent_add_fd(handle->conn->sconn->ev_ctx,
+	config->num_fixed_files = lp_parm_ulong(SNUM(handle->conn),
+						"io_uring",
+						"fixed_files",
+						0);
+	if (config->num_fixed_files > 0) {
+		int *fds = NULL;
+		unsigned i;
+
+		fds = talloc_array(config, int, config->num_fixed_files);
+		config->free_slots = talloc_array(config,
+						  int,
+						  config->num_fixed_files);
+		if (fds == NULL || config->free_slots == NULL) {
+			SMB_VFS_NEXT_DISCONNECT(handle);
+			errno = ENOMEM;
+			return -1;
+		}
+
+		/*
+		 * Start with an empty table, fds are only added
+		 * once they are used for io.
+		 */
+		for (i = 0; i < config->num_fixed_files; i++) {
+			fds[i] = -1;
+			config->free_slots[i] = config->num_fixed_files - 1 - i;
+		}
+		config->num_free_slots = config->num_fixed_files;
+
+		ret = io_uring_register_files(&config->uring,
+					      fds,
+					      config->num_fixed_files);
+		TALLOC_FREE(fds);
+		if (ret < 0) {
+			DBG_NOTICE("io_uring_register_files(%u) failed: %s, "
+				   "not using fixed files\n",
+				   config->num_fixed_files,
+				   strerror(-ret));
+			config->num_fixed_files = 0;
+			config->num_free_slots = 0;
+			TALLOC_FREE(config->free_slots);
+		}
+	}
+
+	config->ev = handle->conn->sconn->ev_ctx;
+
+	config->im = tevent_create_immediate(config);
+	if (config->im == NULL) {
+		SMB_VFS_NEXT_DISCONNECT(handle);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	config->fde = tevent_add_fd(config->ev,
 				    config,
 				    config->uring.ring_fd,
 				    TEVENT_FD_READ,
@@ -342,6 +445,9 @@ static void _vfs_io_uring_queue_run(struct vfs_io_uring_config *config)
  * vfs_io_uring_queue_run() won't think it's a recursed call
  * and return.
  *
+ * Note that vfs_io_uring_request_submit() only schedules an
+ * immediate event nowadays, so the recursion described above
+ * is only possible via vfs_io_uring_request_submit_now().
  */
 
 static void vfs_io_uring_queue_run(struct vfs_io_uring_config *config)
@@ -372,6 +478,27 @@ static void vfs_io_uring_queue_run(struct vfs_io_uring_config *config)
 	config->busy = false;
 }
 
+static void vfs_io_uring_queue_run_immediate(struct tevent_context *ev,
+					     struct tevent_immediate *im,
+					     void *private_data)
+{
+	struct vfs_io_uring_config *config = talloc_get_type_abort(
+		private_data, struct vfs_io_uring_config);
+
+	vfs_io_uring_queue_run(config);
+}
+
+/*
+ * Requests are only queued here, the queue is submitted from
+ * an immediate event. That way all requests created within
+ * one event loop iteration (e.g. all reads of a compound
+ * request or the reads of a multi-credit client) end up in
+ * a single io_uring_submit() syscall.
+ *
+ * Note that the request is submitted with the credentials
+ * we have when the immediate event runs, that's fine for
+ * requests on already open file descriptors.
+ */
 static void vfs_io_uring_request_submit(struct vfs_io_uring_request *cur)
 {
 	struct vfs_io_uring_config *config = cur->config;
@@ -379,10 +506,139 @@ static void vfs_io_uring_request_submit(struct vfs_io_uring_request *cur)
 	io_uring_sqe_set_data(&cur->sqe, cur);
 	DLIST_ADD_END(config->queue, cur);
 	cur->list_head = &config->queue;
+	talloc_set_destructor(_tevent_req_data(cur->req),
+			      vfs_io_uring_request_state_queue_destructor);
+
+	tevent_schedule_immediate(config->im,
+				  config->ev,
+				  vfs_io_uring_queue_run_immediate,
+				  config);
+}
+
+/*
+ * Queue and submit a request right away, this is required for
+ * requests doing permission checks, which need to run with the
+ * credentials of the current user.
+ */
+static void vfs_io_uring_request_submit_now(struct vfs_io_uring_request *cur)
+{
+	struct vfs_io_uring_config *config = cur->config;
+
+	io_uring_sqe_set_data(&cur->sqe, cur);
+	DLIST_ADD_END(config->queue, cur);
+	cur->list_head = &config->queue;
+	talloc_set_destructor(_tevent_req_data(cur->req),
+			      vfs_io_uring_request_state_queue_destructor);
 
 	vfs_io_uring_queue_run(config);
 }
 
+/*
+ * Returns the slot of the fsp's fd in the registered file table,
+ * adding it if there's a free slot. This saves the kernel the fd
+ * lookup and reference counting for each request.
+ *
+ * Returns -1 if the plain fd needs to be used.
+ */
+static int vfs_io_uring_fixed_file(struct vfs_handle_struct *handle,
+				   struct vfs_io_uring_config *config,
+				   struct files_struct *fsp)
+{
+	struct vfs_io_uring_fsp_ext *ext = NULL;
+	int fd;
+	int slot;
+	int ret;
+
+	if (config->num_fixed_files == 0) {
+		return -1;
+	}
+
+	ext = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	if (ext != NULL) {
+		return ext->slot;
+	}
+
+	if (config->num_free_slots == 0 || config->uring.ring_fd == -1) {
+		return -1;
+	}
+
+	fd = fsp_get_io_fd(fsp);
+	if (fd == -1) {
+		return -1;
+	}
+
+	ext = VFS_ADD_FSP_EXTENSION(handle, fsp,
+				    struct vfs_io_uring_fsp_ext,
+				    NULL);
+	if (ext == NULL) {
+		return -1;
+	}
+
+	slot = config->free_slots[config->num_free_slots - 1];
+
+	ret = io_uring_register_files_update(&config->uring, slot, &fd, 1);
+	if (ret != 1) {
+		DBG_DEBUG("io_uring_register_files_update(%d) failed: %s\n",
+			  slot, strerror(-ret));
+		VFS_REMOVE_FSP_EXTENSION(handle, fsp);
+		return -1;
+	}
+
+	config->num_free_slots -= 1;
+	ext->slot = slot;
+	return slot;
+}
+
+static void vfs_io_uring_release_fixed_file(struct vfs_handle_struct *handle,
+					    struct vfs_io_uring_config *config,
+					    struct files_struct *fsp)
+{
+	struct vfs_io_uring_fsp_ext *ext = NULL;
+	int fd = -1;
+
+	ext = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	if (ext == NULL) {
+		return;
+	}
+
+	/*
+	 * The registered file table holds a reference on the file,
+	 * it needs to go before the fd is closed.
+	 */
+	if (config->uring.ring_fd != -1) {
+		int ret;
+
+		ret = io_uring_register_files_update(&config->uring,
+						     ext->slot,
+						     &fd,
+						     1);
+		if (ret != 1) {
+			DBG_ERR("io_uring_register_files_update(%d) "
+				"failed: %s\n",
+				ext->slot, strerror(-ret));
+		}
+	}
+
+	config->free_slots[config->num_free_slots] = ext->slot;
+	config->num_free_slots += 1;
+
+	VFS_REMOVE_FSP_EXTENSION(handle, fsp);
+}
+
+static int vfs_io_uring_close(struct vfs_handle_struct *handle,
+			      struct files_struct *fsp)
+{
+	struct vfs_io_uring_config *config = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	vfs_io_uring_release_fixed_file(handle, config, fsp);
+
+	return SMB_VFS_NEXT_CLOSE(handle, fsp);
+}
+
 static void vfs_io_uring_fd_handler(struct tevent_context *ev,
 				    struct tevent_fd *fde,
 				    uint16_t flags,
@@ -401,6 +657,7 @@ static void vfs_io_uring_fd_handler(struct tevent_context *ev,
 struct vfs_io_uring_pread_state {
 	struct vfs_io_uring_request ur;
 	struct files_struct *fsp;
+	int fixed_slot;
 	off_t offset;
 	struct iovec iov;
 	size_t nread;
@@ -446,6 +703,7 @@ static struct tevent_req *vfs_io_uring_pread_send(struct vfs_handle_struct *hand
 	}
 
 	state->fsp = fsp;
+	state->fixed_slot = vfs_io_uring_fixed_file(handle, config, fsp);
 	state->offset = offset;
 	state->iov.iov_base = (void *)data;
 	state->iov.iov_len = n;
@@ -461,10 +719,18 @@ static struct tevent_req *vfs_io_uring_pread_send(struct vfs_handle_struct *hand
 
 static void vfs_io_uring_pread_submit(struct vfs_io_uring_pread_state *state)
 {
-	io_uring_prep_readv(&state->ur.sqe,
-			    fsp_get_io_fd(state->fsp),
-			    &state->iov, 1,
-			    state->offset);
+	if (state->fixed_slot != -1) {
+		io_uring_prep_readv(&state->ur.sqe,
+				    state->fixed_slot,
+				    &state->iov, 1,
+				    state->offset);
+		io_uring_sqe_set_flags(&state->ur.sqe, IOSQE_FIXED_FILE);
+	} else {
+		io_uring_prep_readv(&state->ur.sqe,
+				    fsp_get_io_fd(state->fsp),
+				    &state->iov, 1,
+				    state->offset);
+	}
 	vfs_io_uring_request_submit(&state->ur);
 }
 
@@ -549,6 +815,7 @@ static ssize_t vfs_io_uring_pread_recv(struct tevent_req *req,
 struct vfs_io_uring_pwrite_state {
 	struct vfs_io_uring_request ur;
 	struct files_struct *fsp;
+	int fixed_slot;
 	off_t offset;
 	struct iovec iov;
 	size_t nwritten;
@@ -594,6 +861,7 @@ static struct tevent_req *vfs_io_uring_pwrite_send(struct vfs_handle_struct *han
 	}
 
 	state->fsp = fsp;
+	state->fixed_slot = vfs_io_uring_fixed_file(handle, config, fsp);
 	state->offset = offset;
 	state->iov.iov_base = discard_const(data);
 	state->iov.iov_len = n;
@@ -609,10 +877,18 @@ static struct tevent_req *vfs_io_uring_pwrite_send(struct vfs_handle_struct *han
 
 static void vfs_io_uring_pwrite_submit(struct vfs_io_uring_pwrite_state *state)
 {
-	io_uring_prep_writev(&state->ur.sqe,
-			     fsp_get_io_fd(state->fsp),
-			     &state->iov, 1,
-			     state->offset);
+	if (state->fixed_slot != -1) {
+		io_uring_prep_writev(&state->ur.sqe,
+				     state->fixed_slot,
+				     &state->iov, 1,
+				     state->offset);
+		io_uring_sqe_set_flags(&state->ur.sqe, IOSQE_FIXED_FILE);
+	} else {
+		io_uring_prep_writev(&state->ur.sqe,
+				     fsp_get_io_fd(state->fsp),
+				     &state->iov, 1,
+				     state->offset);
+	}
 	vfs_io_uring_request_submit(&state->ur);
 }
 
@@ -709,6 +985,7 @@ static struct tevent_req *vfs_io_uring_fsync_send(struct vfs_handle_struct *hand
 	struct tevent_req *req = NULL;
 	struct vfs_io_uring_fsync_state *state = NULL;
 	struct vfs_io_uring_config *config = NULL;
+	int fixed_slot;
 
 	SMB_VFS_HANDLE_GET_DATA(handle, config,
 				struct vfs_io_uring_config,
@@ -727,9 +1004,17 @@ static struct tevent_req *vfs_io_uring_fsync_send(struct vfs_handle_struct *hand
 				     state->ur.profile_bytes, 0);
 	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->ur.profile_bytes);
 
-	io_uring_prep_fsync(&state->ur.sqe,
-			    fsp_get_io_fd(fsp),
-			    0); /* fsync_flags */
+	fixed_slot = vfs_io_uring_fixed_file(handle, config, fsp);
+	if (fixed_slot != -1) {
+		io_uring_prep_fsync(&state->ur.sqe,
+				    fixed_slot,
+				    0); /* fsync_flags */
+		io_uring_sqe_set_flags(&state->ur.sqe, IOSQE_FIXED_FILE);
+	} else {
+		io_uring_prep_fsync(&state->ur.sqe,
+				    fsp_get_io_fd(fsp),
+				    0); /* fsync_flags */
+	}
 	vfs_io_uring_request_submit(&state->ur);
 
 	if (!tevent_req_is_in_progress(req)) {
@@ -786,14 +1071,298 @@ static int vfs_io_uring_fsync_recv(struct tevent_req *req,
 	return 0;
 }
 
+#ifdef HAVE_IO_URING_PREP_GETXATTR
+
+struct vfs_io_uring_getxattrat_state {
+	struct vfs_io_uring_request ur;
+	char *path;
+	char *xattr_name;
+	uint8_t *xattr_value;
+	ssize_t xattr_size;
+	/* only used if we passed the request to the next module */
+	bool passed_on;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static void vfs_io_uring_getxattrat_completion(struct vfs_io_uring_request *cur,
+					       const char *location);
+static void vfs_io_uring_getxattrat_next_done(struct tevent_req *subreq);
+
+/*
+ * Returns the /proc/self/fd path of a pathref fsp or NULL if
+ * there's none, the caller needs to fall back to the next
+ * module then. A path relative to the share would be resolved
+ * by the kernel later, with whatever the working directory is
+ * then, and following symlinks again.
+ */
+static char *vfs_io_uring_getxattrat_path(TALLOC_CTX *mem_ctx,
+					  struct files_struct *fsp,
+					  int fd)
+{
+	char buf[PATH_MAX];
+	const char *p = NULL;
+
+	if (!fsp->fsp_flags.have_proc_fds) {
+		return NULL;
+	}
+
+	p = sys_proc_fd_path(fd, buf, sizeof(buf));
+	if (p == NULL) {
+		return NULL;
+	}
+	return talloc_strdup(mem_ctx, p);
+}
+
+static struct tevent_req *vfs_io_uring_getxattrat_send(
+			TALLOC_CTX *mem_ctx,
+			struct tevent_context *ev,
+			struct vfs_handle_struct *handle,
+			files_struct *dir_fsp,
+			const struct smb_filename *smb_fname,
+			const char *xattr_name,
+			size_t alloc_hint)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct vfs_io_uring_getxattrat_state *state = NULL;
+	struct vfs_io_uring_config *config = NULL;
+	struct files_struct *fsp = NULL;
+	bool use_uring;
+	int fd = -1;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct vfs_io_uring_getxattrat_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ur.config = config;
+	state->ur.req = req;
+	state->ur.completion_fn = vfs_io_uring_getxattrat_completion;
+	state->xattr_size = -1;
+
+	/*
+	 * With IORING_SETUP_SQPOLL the kernel thread submits the
+	 * request with the credentials of the ring creator, not with
+	 * the ones of the current user, so we can't use it for path
+	 * based calls.
+	 */
+	use_uring = config->have_getxattr && !config->sqpoll && !config->busy;
+
+	if (use_uring) {
+		/*
+		 * This follows vfswrap_fgetxattr()
+		 */
+		fsp = metadata_fsp(smb_fname->fsp);
+		fd = fsp_get_pathref_fd(fsp);
+	}
+
+	if (use_uring && fsp->fsp_flags.is_pathref) {
+		/*
+		 * Only the /proc/self/fd path refers to
+		 * exactly the file the pathref fd has open.
+		 */
+		state->path = vfs_io_uring_getxattrat_path(state, fsp, fd);
+		if (state->path == NULL) {
+			use_uring = false;
+		}
+	}
+
+	if (use_uring) {
+		/*
+		 * Submit everything that is already queued, we need a
+		 * free submission queue entry while we still run with
+		 * the credentials of the current user.
+		 */
+		vfs_io_uring_queue_run(config);
+		if ((config->queue != NULL) ||
+		    (config->uring.ring_fd == -1) ||
+		    (io_uring_sq_space_left(&config->uring) == 0))
+		{
+			use_uring = false;
+		}
+	}
+
+	if (!use_uring) {
+		state->passed_on = true;
+		subreq = SMB_VFS_NEXT_GETXATTRAT_SEND(state,
+						      ev,
+						      handle,
+						      dir_fsp,
+						      smb_fname,
+						      xattr_name,
+						      alloc_hint);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq,
+					vfs_io_uring_getxattrat_next_done,
+					req);
+		return req;
+	}
+
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_getxattrat, profile_p,
+				     state->ur.profile_bytes, 0);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->ur.profile_bytes);
+
+	if (fsp_get_pathref_fd(dir_fsp) == -1) {
+		DBG_ERR("Need a valid directory fd\n");
+		tevent_req_error(req, EINVAL);
+		return tevent_req_post(req, ev);
+	}
+
+	/*
+	 * Everything the kernel looks at needs to live
+	 * as long as the request is pending.
+	 */
+	state->xattr_name = talloc_strdup(state, xattr_name);
+	if (tevent_req_nomem(state->xattr_name, req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	if (alloc_hint > 0) {
+		state->xattr_value = talloc_zero_array(state,
+						       uint8_t,
+						       alloc_hint);
+		if (tevent_req_nomem(state->xattr_value, req)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
+	if (!fsp->fsp_flags.is_pathref) {
+		io_uring_prep_fgetxattr(&state->ur.sqe,
+					fd,
+					state->xattr_name,
+					(char *)state->xattr_value,
+					talloc_array_length(state->xattr_value));
+	} else {
+		io_uring_prep_getxattr(&state->ur.sqe,
+				       state->xattr_name,
+				       (char *)state->xattr_value,
+				       state->path,
+				       talloc_array_length(state->xattr_value));
+	}
+
+	vfs_io_uring_request_submit_now(&state->ur);
+
+	if (!tevent_req_is_in_progress(req)) {
+		return tevent_req_post(req, ev);
+	}
+
+	tevent_req_defer_callback(req, ev);
+	return req;
+}
+
+static void vfs_io_uring_getxattrat_completion(struct vfs_io_uring_request *cur,
+					       const char *location)
+{
+	struct vfs_io_uring_getxattrat_state *state = tevent_req_data(
+		cur->req, struct vfs_io_uring_getxattrat_state);
+
+	/*
+	 * We rely on being inside the _send() function
+	 * or tevent_req_defer_callback() being called
+	 * already.
+	 */
+
+	if (cur->cqe.res < 0) {
+		int err = -cur->cqe.res;
+		_tevent_req_error(cur->req, err, location);
+		return;
+	}
+
+	state->xattr_size = cur->cqe.res;
+
+	if (state->xattr_value == NULL) {
+		/*
+		 * The caller only wanted the size.
+		 */
+		tevent_req_done(cur->req);
+		return;
+	}
+
+	/*
+	 * shrink the buffer to the returned size.
+	 * (can't fail). It means NULL if size is 0.
+	 */
+	state->xattr_value = talloc_realloc(state,
+					    state->xattr_value,
+					    uint8_t,
+					    state->xattr_size);
+
+	tevent_req_done(cur->req);
+}
+
+static void vfs_io_uring_getxattrat_next_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfs_io_uring_getxattrat_state *state = tevent_req_data(
+		req, struct vfs_io_uring_getxattrat_state);
+
+	state->xattr_size = SMB_VFS_NEXT_GETXATTRAT_RECV(subreq,
+							 &state->vfs_aio_state,
+							 state,
+							 &state->xattr_value);
+	TALLOC_FREE(subreq);
+	if (state->xattr_size == -1) {
+		tevent_req_error(req, state->vfs_aio_state.error);
+		return;
+	}
+
+	tevent_req_done(req);
+}
+
+static ssize_t vfs_io_uring_getxattrat_recv(struct tevent_req *req,
+					    struct vfs_aio_state *aio_state,
+					    TALLOC_CTX *mem_ctx,
+					    uint8_t **xattr_value)
+{
+	struct vfs_io_uring_getxattrat_state *state = tevent_req_data(
+		req, struct vfs_io_uring_getxattrat_state);
+	ssize_t xattr_size;
+
+	if (state->passed_on) {
+		*aio_state = state->vfs_aio_state;
+	} else {
+		SMBPROFILE_BYTES_ASYNC_END(state->ur.profile_bytes);
+		aio_state->duration = nsec_time_diff(&state->ur.end_time,
+						     &state->ur.start_time);
+	}
+
+	if (tevent_req_is_unix_error(req, &aio_state->error)) {
+		tevent_req_received(req);
+		return -1;
+	}
+
+	aio_state->error = 0;
+	xattr_size = state->xattr_size;
+	if (xattr_value != NULL) {
+		*xattr_value = talloc_move(mem_ctx, &state->xattr_value);
+	}
+
+	tevent_req_received(req);
+	return xattr_size;
+}
+
+#endif /* HAVE_IO_URING_PREP_GETXATTR */
+
 static struct vfs_fn_pointers vfs_io_uring_fns = {
 	.connect_fn = vfs_io_uring_connect,
+	.close_fn = vfs_io_uring_close,
 	.pread_send_fn = vfs_io_uring_pread_send,
 	.pread_recv_fn = vfs_io_uring_pread_recv,
 	.pwrite_send_fn = vfs_io_uring_pwrite_send,
 	.pwrite_recv_fn = vfs_io_uring_pwrite_recv,
 	.fsync_send_fn = vfs_io_uring_fsync_send,
 	.fsync_recv_fn = vfs_io_uring_fsync_recv,
+#ifdef HAVE_IO_URING_PREP_GETXATTR
+	.getxattrat_send_fn = vfs_io_uring_getxattrat_send,
+	.getxattrat_recv_fn = vfs_io_uring_getxattrat_recv,
+#endif /* HAVE_IO_URING_PREP_GETXATTR */
 };
 
 static_decl_vfs;
@@ -293,6 +293,8 @@ NTSTATUS smbd_smb2_request_verify_sizes(struct smbd_smb2_request *req,
 void smb2_request_set_async_internal(struct smbd_smb2_request *req,
 				     bool async_internal);
 
+void smbd_smb2_key_cache_flush(struct smbXsrv_client *client);
+
 enum protocol_types smbd_smb2_protocol_dialect_match(const uint8_t *indyn,
 		                                     const int dialect_count,
 						     uint16_t *dialect);
@@ -467,9 +469,24 @@ struct smbXsrv_connection {
 			size_t pktlen;
 			uint8_t *pktbuf;
 		} request_read_state;
+		/* see smbd_smb2_recv() */
+		struct smbd_smb2_readahead {
+			uint8_t *buf;
+			size_t ofs;
+			size_t len;
+			struct tevent_immediate *im;
+		} readahead;
 		struct smbd_smb2_send_queue *send_queue;
 		size_t send_queue_len;
 
+		/*
+		 * The last per request copies of an encryption
+		 * and a signing key, including their initialized
+		 * gnutls handles, see smbd_smb2_key_cache_get().
+		 */
+		struct smb2_signing_key *enc_key_cache;
+		struct smb2_signing_key *sign_key_cache;
+
 		struct {
 			/*
 			 * seq_low is the lowest sequence number
@@ -535,6 +552,8 @@ struct smbXsrv_connection {
 			uint32_t max_write;
 			uint16_t sign_algo;
 			uint16_t cipher;
+			struct smb3_compression_capabilities compression;
+			uint32_t max_decompressed_size;
 			bool posix_extensions_negotiated;
 		} server;
 
@@ -688,6 +707,12 @@ struct smbd_smb2_send_queue {
 		uint64_t required_acked_bytes;
 	} ack;
 
+	/*
+	 * The response is still being encrypted or signed
+	 * by a helper thread, it can't be sent yet.
+	 */
+	bool crypto_pending;
+
 	TALLOC_CTX *mem_ctx;
 };
 
@@ -713,6 +738,16 @@ struct smbd_smb2_request {
 	bool was_encrypted;
 	/* Should we encrypt? */
 	bool do_encryption;
+	/* Did the client ask for a compressed response? */
+	bool do_compression;
+	/* see smbd_smb2_request_crypto_offload_send() */
+	struct {
+		struct iovec *vector;
+		int count;
+		int rc;
+		bool orphaned;
+		struct smb2_signing_key *sign_key;
+	} crypto_offload;
 	struct tevent_timer *async_te;
 	bool compound_related;
 	NTSTATUS compound_create_err;
@@ -801,6 +836,11 @@ struct smbd_smb2_request {
 
 #define SMBD_SMB2_SHORT_RECEIVEFILE_WRITE_LEN (SMB2_HDR_BODY + 0x30)
 
+/* see smbd_smb2_flush_send_queue() */
+#define SMBD_SMB2_MAX_SEND_IOV 64
+/* see smbd_smb2_recv() */
+#define SMBD_SMB2_READAHEAD_SIZE 16384
+
 	struct {
 		/*
 		 * vector[0] TRANSPORT HEADER (empty)
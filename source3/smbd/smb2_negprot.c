@@ -160,12 +160,16 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 	struct smb2_negotiate_context *in_preauth = NULL;
 	struct smb2_negotiate_context *in_cipher = NULL;
 	struct smb2_negotiate_context *in_sign_algo = NULL;
+	struct smb2_negotiate_context *in_compression = NULL;
 	struct smb2_negotiate_contexts out_c = { .num_contexts = 0, };
 	struct smb2_negotiate_context *in_posix = NULL;
 	const struct smb311_capabilities default_smb3_capabilities =
 		smb311_capabilities_parse("server",
 			lp_server_smb3_signing_algorithms(),
 			lp_server_smb3_encryption_algorithms());
+	const struct smb3_compression_capabilities default_smb3_compression =
+		smb3_compression_capabilities_parse("server",
+			lp_server_smb3_compression_algorithms());
 	DATA_BLOB out_negotiate_context_blob = data_blob_null;
 	uint32_t out_negotiate_context_offset = 0;
 	uint16_t out_negotiate_context_count = 0;
@@ -349,6 +353,8 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 					SMB2_ENCRYPTION_CAPABILITIES);
 	in_sign_algo = smb2_negotiate_context_find(&in_c,
 					SMB2_SIGNING_CAPABILITIES);
+	in_compression = smb2_negotiate_context_find(&in_c,
+					SMB2_COMPRESSION_CAPABILITIES);
 
 	/* negprot_spnego() returns a the server guid in the first 16 bytes */
 	negprot_spnego_blob = negprot_spnego(req, xconn);
@@ -656,6 +662,122 @@ NTSTATUS smbd_smb2_request_process_negprot(struct smbd_smb2_request *req)
 		}
 	}
 
+	if ((in_compression != NULL) &&
+	    (default_smb3_compression.num_algos > 0))
+	{
+		const struct smb3_compression_capabilities *srv_algos =
+			&default_smb3_compression;
+		struct smb3_compression_capabilities *sel =
+			&xconn->smb2.server.compression;
+		size_t needed = 8;
+		uint16_t algo_count;
+		uint32_t in_flags;
+		const uint8_t *p;
+		uint8_t buf[8 + 2 * SMB3_COMPRESSION_CAPABILITIES_MAX_ALGOS];
+		size_t si;
+		size_t i;
+
+		if (in_compression->data.length < needed) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		algo_count = SVAL(in_compression->data.data, 0);
+		in_flags = IVAL(in_compression->data.data, 4);
+		if (algo_count == 0) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		p = in_compression->data.data + needed;
+		needed += algo_count * 2;
+
+		if (in_compression->data.length < needed) {
+			return smbd_smb2_request_error(req,
+					NT_STATUS_INVALID_PARAMETER);
+		}
+
+		ZERO_STRUCTP(sel);
+		if (in_flags & SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED) {
+			/*
+			 * We support chained compression, but
+			 * only use it if the client asked for it.
+			 */
+			sel->flags = SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED;
+		}
+
+		/*
+		 * The server algorithms are listed
+		 * with the lowest idx being preferred.
+		 */
+		for (si = 0; si < srv_algos->num_algos; si++) {
+			uint16_t algo = srv_algos->algos[si];
+			bool found = false;
+
+			if ((algo == SMB2_COMPRESSION_PATTERN_V1) &&
+			    !(sel->flags &
+			      SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED))
+			{
+				/* only possible with chained compression */
+				continue;
+			}
+
+			for (i = 0; i < algo_count; i++) {
+				if (SVAL(p, i * 2) == algo) {
+					found = true;
+					break;
+				}
+			}
+
+			if (found) {
+				sel->algos[sel->num_algos] = algo;
+				sel->num_algos += 1;
+			}
+		}
+
+		if (sel->num_algos == 0) {
+			sel->flags = SMB2_COMPRESSION_CAPABILITIES_FLAG_NONE;
+		}
+
+		/*
+		 * The largest valid request is a WRITE or an
+		 * IOCTL/SET_INFO with max_write or max_trans bytes
+		 * of payload, leave some room for the headers and
+		 * the other requests of a compound chain. This
+		 * limits what a client can make us allocate with a
+		 * small compressed message.
+		 */
+		xconn->smb2.server.max_decompressed_size =
+			MIN(MAX(max_trans, max_write) +
+			    SMB2_COMPRESSION_MAX_OVERHEAD,
+			    0xFFFFFF);
+
+		SSVAL(buf, 0, MAX(sel->num_algos, 1)); /* AlgorithmCount */
+		SSVAL(buf, 2, 0); /* Padding */
+		SIVAL(buf, 4, sel->flags);
+		SSVAL(buf, 8, SMB2_COMPRESSION_NONE);
+		for (i = 0; i < sel->num_algos; i++) {
+			SSVAL(buf, 8 + i * 2, sel->algos[i]);
+		}
+
+		DBG_DEBUG("Negotiated %"PRIu16" compression algorithms, "
+			  "preferred [%s], flags 0x%08"PRIx32"\n",
+			  sel->num_algos,
+			  smb3_compression_algorithm_name(sel->num_algos > 0 ?
+					sel->algos[0] : SMB2_COMPRESSION_NONE),
+			  sel->flags);
+
+		status = smb2_negotiate_context_add(
+			req,
+			&out_c,
+			SMB2_COMPRESSION_CAPABILITIES,
+			buf,
+			8 + 2 * MAX(sel->num_algos, 1));
+		if (!NT_STATUS_IS_OK(status)) {
+			return smbd_smb2_request_error(req, status);
+		}
+	}
+
 	status = smb311_capabilities_check(&default_smb3_capabilities,
 					   "smb2srv_negprot",
 					   DBGLVL_NOTICE,
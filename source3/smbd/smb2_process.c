@@ -1743,6 +1743,33 @@ static void smbd_tevent_trace_callback(enum tevent_trace_point point,
 	errno = 0;
 }
 
+/****************************************************************************
+ Apply "aio thread affinity" to the aio thread pool
+****************************************************************************/
+
+static void smbd_set_aio_thread_affinity(struct pthreadpool_tevent *pool)
+{
+	const char *value = lp_aio_thread_affinity();
+	enum pthreadpool_affinity affinity;
+	int ret;
+
+	if ((value[0] == '\0') || strequal(value, "none")) {
+		return;
+	}
+
+	if (strequal(value, "node")) {
+		affinity = PTHREADPOOL_AFFINITY_NODE;
+	} else {
+		affinity = PTHREADPOOL_AFFINITY_CPUS;
+	}
+
+	ret = pthreadpool_tevent_set_affinity(pool, affinity, value);
+	if (ret != 0) {
+		DBG_WARNING("Could not set aio thread affinity '%s': %s\n",
+			    value, strerror(ret));
+	}
+}
+
 /****************************************************************************
  Process commands from the client
 ****************************************************************************/
@@ -1798,6 +1825,8 @@ void smbd_process(struct tevent_context *ev_ctx,
 		exit_server("pthreadpool_tevent_init() failed.");
 	}
 
+	smbd_set_aio_thread_affinity(sconn->pool);
+
 #if defined(WITH_SMB1SERVER)
 	if (lp_server_max_protocol() >= PROTOCOL_SMB2_02) {
 #endif
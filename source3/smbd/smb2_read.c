@@ -97,6 +97,12 @@ NTSTATUS smbd_smb2_request_process_read(struct smbd_smb2_request *req)
 		return smbd_smb2_request_error(req, NT_STATUS_FILE_CLOSED);
 	}
 
+	if ((in_flags & SMB2_READFLAG_REQUEST_COMPRESSED) &&
+	    (xconn->smb2.server.compression.num_algos > 0))
+	{
+		req->do_compression = true;
+	}
+
 	subreq = smbd_smb2_read_send(req, req->sconn->ev_ctx,
 				     req, in_fsp,
 				     in_flags,
@@ -351,6 +357,7 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	 * We cannot use sendfile if...
 	 * We were not configured to do so OR
 	 * Signing is active OR
+	 * The client asked for a compressed response OR
 	 * This is a compound SMB2 operation OR
 	 * fsp is a STREAM file OR
 	 * We're using a write cache OR
@@ -359,11 +366,23 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	 * there's not enough data in the file.
 	 * Phew :-). Luckily this means most
 	 * reads on most normal files. JRA.
+	 *
+	 * Signed and encrypted reads go through
+	 * the normal path: pread() into out_data,
+	 * which is then signed or encrypted in
+	 * place (see smb2_signing.c) and copied
+	 * once more by the kernel on sendmsg().
+	 * There's no MSG_ZEROCOPY/splice variant:
+	 * the buffer would need to stay alive
+	 * until the completion shows up on the
+	 * socket error queue and tevent doesn't
+	 * watch that queue.
 	*/
 
 	if (!lp__use_sendfile(SNUM(fsp->conn)) ||
 	    smb2req->do_signing ||
 	    smb2req->do_encryption ||
+	    smb2req->do_compression ||
 	    smbd_smb2_is_compound(smb2req) ||
 	    fsp_is_alternate_stream(fsp) ||
 	    (!S_ISREG(fsp->fsp_name->st.st_ex_mode)) ||
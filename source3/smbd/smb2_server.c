@@ -35,6 +35,7 @@
 #include "auth.h"
 #include "libcli/smb/smbXcli_base.h"
 #include "source3/lib/substitute.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
 
 #if defined(LINUX)
 /* SIOCOUTQ TIOCOUTQ are the same */
@@ -59,6 +60,9 @@ static void smbd_smb2_connection_handler(struct tevent_context *ev,
 					 uint16_t flags,
 					 void *private_data);
 static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn);
+static void smbd_smb2_readahead_immediate(struct tevent_context *ctx,
+					  struct tevent_immediate *im,
+					  void *private_data);
 
 static const struct smbd_smb2_dispatch_table {
 	uint16_t opcode;
@@ -299,41 +303,134 @@ static bool smb2_setup_nbt_length(struct iovec *vector, int count)
 
 static int smbd_smb2_request_destructor(struct smbd_smb2_request *req)
 {
+	if (req->queue_entry.crypto_pending) {
+		/*
+		 * A helper thread is still encrypting or
+		 * signing the response buffers in place, so we
+		 * can't free them yet.
+		 * smbd_smb2_request_crypto_done() frees the
+		 * request once the job is done.
+		 */
+		req->crypto_offload.orphaned = true;
+		return -1;
+	}
+
 	TALLOC_FREE(req->first_enc_key);
 	TALLOC_FREE(req->last_sign_key);
 	return 0;
 }
 
+/*
+ * Every request needs its own copy of the session's encryption
+ * key, as the session may go away before the response is
+ * encrypted. The same is true for signing keys used by a
+ * helper thread. Setting up a gnutls cipher or hmac handle
+ * (key schedule, GHASH tables) for each copy costs about as
+ * much as encrypting a small response. So we keep the last
+ * copy, together with its handles, on the connection and hand
+ * it to the next request using the same key.
+ */
+static NTSTATUS smbd_smb2_key_cache_get(struct smb2_signing_key **cache,
+					TALLOC_CTX *mem_ctx,
+					const struct smb2_signing_key *src,
+					struct smb2_signing_key **_dst)
+{
+	struct smb2_signing_key *key = *cache;
+
+	if (key != NULL &&
+	    key->sign_algo_id == src->sign_algo_id &&
+	    key->cipher_algo_id == src->cipher_algo_id &&
+	    data_blob_equal_const_time(&key->blob, &src->blob))
+	{
+		*cache = NULL;
+		*_dst = talloc_move(mem_ctx, &key);
+		return NT_STATUS_OK;
+	}
+
+	return smb2_signing_key_copy(mem_ctx, src, _dst);
+}
+
+static void smbd_smb2_key_cache_put(struct smb2_signing_key **cache,
+				    TALLOC_CTX *mem_ctx,
+				    struct smb2_signing_key **_key)
+{
+	if (*_key == NULL) {
+		return;
+	}
+
+	if (*cache != NULL) {
+		TALLOC_FREE(*_key);
+		return;
+	}
+
+	*cache = talloc_move(mem_ctx, _key);
+}
+
+/*
+ * The cached keys must not outlive the session they were
+ * copied from, this is called on logoff and reauth.
+ * Requests in flight keep their own copies.
+ */
+void smbd_smb2_key_cache_flush(struct smbXsrv_client *client)
+{
+	struct smbXsrv_connection *xconn = NULL;
+
+	for (xconn = client->connections; xconn != NULL; xconn = xconn->next) {
+		TALLOC_FREE(xconn->smb2.enc_key_cache);
+		TALLOC_FREE(xconn->smb2.sign_key_cache);
+	}
+}
+
+static NTSTATUS smbd_smb2_request_get_enc_key(struct smbd_smb2_request *req,
+					      struct smb2_signing_key *encryption_key)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+
+	return smbd_smb2_key_cache_get(&xconn->smb2.enc_key_cache,
+				       req,
+				       encryption_key,
+				       &req->first_enc_key);
+}
+
+static void smbd_smb2_request_put_enc_key(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+
+	smbd_smb2_key_cache_put(&xconn->smb2.enc_key_cache,
+				xconn,
+				&req->first_enc_key);
+}
+
 void smb2_request_set_async_internal(struct smbd_smb2_request *req,
 				     bool async_internal)
 {
 	req->async_internal = async_internal;
 }
 
+/*
+ * A smbd_smb2_request is allocated and freed for every PDU, keep the
+ * freed ones around instead of going through malloc() each time.
+ */
+static struct talloc_slab *smbd_smb2_request_slab;
+
 static struct smbd_smb2_request *smbd_smb2_request_allocate(TALLOC_CTX *mem_ctx)
 {
-	TALLOC_CTX *mem_pool;
 	struct smbd_smb2_request *req;
 
-#if 0
-	/* Enable this to find subtle valgrind errors. */
-	mem_pool = talloc_init("smbd_smb2_request_allocate");
-#else
-	mem_pool = talloc_tos();
-#endif
-	if (mem_pool == NULL) {
-		return NULL;
+	if (smbd_smb2_request_slab == NULL) {
+		smbd_smb2_request_slab = talloc_slab_create(
+			NULL, struct smbd_smb2_request, 64);
+		if (smbd_smb2_request_slab == NULL) {
+			return NULL;
+		}
 	}
 
-	req = talloc_zero(mem_pool, struct smbd_smb2_request);
+	req = talloc_slab_zero(mem_ctx,
+			       smbd_smb2_request_slab,
+			       struct smbd_smb2_request);
 	if (req == NULL) {
-		talloc_free(mem_pool);
 		return NULL;
 	}
-	talloc_reparent(mem_pool, mem_ctx, req);
-#if 0
-	TALLOC_FREE(mem_pool);
-#endif
 
 	req->last_session_id = UINT64_MAX;
 	req->last_tid = UINT32_MAX;
@@ -359,6 +456,7 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 	size_t verified_buflen = 0;
 	uint8_t *tf = NULL;
 	size_t tf_len = 0;
+	bool decompressed = false;
 
 	/*
 	 * Note: index '0' is reserved for the transport protocol
@@ -466,6 +564,49 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 			len = enc_len;
 		}
 
+		if ((len >= 4) && (IVAL(hdr, 0) == SMB2_COMP_TF_MAGIC)) {
+			DATA_BLOB dec = data_blob_null;
+			NTSTATUS status;
+
+			/*
+			 * A compressed message is only valid as
+			 * a whole, either as the full PDU or
+			 * as the full content of a SMB2_TRANSFORM.
+			 */
+			if (decompressed ||
+			    ((taken != 0) && (taken != tf_len)) ||
+			    (taken + len != buflen))
+			{
+				DEBUG(1, ("Got unexpected "
+					  "SMB2_COMPRESSION_TRANSFORM "
+					  "header\n"));
+				goto inval;
+			}
+
+			status = smb2_compression_decompress(
+					mem_ctx,
+					&xconn->smb2.server.compression,
+					hdr,
+					len,
+					xconn->smb2.server.max_decompressed_size,
+					&dec);
+			if (!NT_STATUS_IS_OK(status)) {
+				DEBUG(1, ("Decompression failed: %s\n",
+					  nt_errstr(status)));
+				goto inval;
+			}
+			decompressed = true;
+
+			first_hdr = dec.data;
+			buflen = dec.length;
+			taken = 0;
+			hdr = first_hdr;
+			len = dec.length;
+			if (tf != NULL) {
+				verified_buflen = dec.length;
+			}
+		}
+
 		/*
 		 * We need the header plus the body length field
 		 */
@@ -2073,7 +2214,7 @@ NTSTATUS smbd_smb2_request_pending_queue(struct smbd_smb2_request *req,
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
-		TALLOC_FREE(req->first_enc_key);
+		smbd_smb2_request_put_enc_key(req);
 
 		req->current_idx = 1;
 
@@ -3533,6 +3674,324 @@ static void smbd_smb2_request_reply_update_counts(struct smbd_smb2_request *req)
 	}
 }
 
+static NTSTATUS smbd_smb2_request_compress(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	int first_idx = 1;
+	struct iovec *outhdr = SMBD_SMB2_IDX_HDR_IOV(req,out,first_idx);
+	struct iovec *outbody = SMBD_SMB2_IDX_BODY_IOV(req,out,first_idx);
+	struct iovec *outdyn = SMBD_SMB2_IDX_DYN_IOV(req,out,first_idx);
+	uint8_t prefix[SMB2_HDR_BODY + 0x20];
+	size_t prefix_len;
+	DATA_BLOB comp = data_blob_null;
+	NTSTATUS status;
+	bool ok;
+
+	/*
+	 * We only compress the data of single (non compound)
+	 * responses, which are not going to use sendfile.
+	 */
+	if (req->out.vector_count != 1 + SMBD_SMB2_NUM_IOV_PER_REQ) {
+		return NT_STATUS_OK;
+	}
+	if (outdyn->iov_base == NULL) {
+		return NT_STATUS_OK;
+	}
+
+	prefix_len = outhdr->iov_len + outbody->iov_len;
+	if (prefix_len > sizeof(prefix)) {
+		return NT_STATUS_OK;
+	}
+	memcpy(prefix, outhdr->iov_base, outhdr->iov_len);
+	memcpy(prefix + outhdr->iov_len, outbody->iov_base, outbody->iov_len);
+
+	status = smb2_compression_compress(req,
+					   &xconn->smb2.server.compression,
+					   prefix,
+					   prefix_len,
+					   outdyn->iov_base,
+					   outdyn->iov_len,
+					   &comp);
+	if (NT_STATUS_EQUAL(status, NT_STATUS_BUFFER_TOO_SMALL)) {
+		/*
+		 * Not worth it, send it uncompressed.
+		 */
+		return NT_STATUS_OK;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	DBG_DEBUG("Compressed %zu bytes into %zu bytes\n",
+		  prefix_len + outdyn->iov_len, comp.length);
+
+	outhdr->iov_base = (void *)comp.data;
+	outhdr->iov_len = comp.length;
+	outbody->iov_base = NULL;
+	outbody->iov_len = 0;
+	outdyn->iov_base = NULL;
+	outdyn->iov_len = 0;
+
+	ok = smb2_setup_nbt_length(req->out.vector, req->out.vector_count);
+	if (!ok) {
+		return NT_STATUS_INVALID_PARAMETER_MIX;
+	}
+
+	return NT_STATUS_OK;
+}
+
+static void smbd_smb2_request_crypto_job(void *private_data);
+static void smbd_smb2_request_crypto_done(struct tevent_req *subreq);
+
+/*
+ * Large responses can be encrypted or signed in a helper
+ * thread, so that a single process isn't limited by the
+ * crypto speed of one CPU core. This matters most for
+ * multichannel clients, as all their channels are served
+ * by one smbd process.
+ */
+static bool smbd_smb2_request_crypto_offload_possible(struct smbd_smb2_request *req,
+						      const struct iovec *vector,
+						      int count)
+{
+	struct smbd_server_connection *sconn = req->sconn;
+	size_t offload_size = lp_smb2_crypto_offload_size();
+	ssize_t len;
+
+	if (offload_size == 0) {
+		return false;
+	}
+
+	if (req->preauth != NULL) {
+		/*
+		 * The preauth hash is calculated
+		 * over the final response.
+		 */
+		return false;
+	}
+
+	if (sconn->pool == NULL) {
+		return false;
+	}
+	if (pthreadpool_tevent_max_threads(sconn->pool) == 0) {
+		return false;
+	}
+
+	len = iov_buflen(vector, count);
+	if (len == -1 || (size_t)len < offload_size) {
+		return false;
+	}
+
+	return true;
+}
+
+static bool smbd_smb2_request_crypto_offload_send(struct smbd_smb2_request *req,
+						  struct iovec *vector,
+						  int count)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smbd_server_connection *sconn = req->sconn;
+	struct tevent_req *subreq = NULL;
+
+	req->crypto_offload.vector = vector;
+	req->crypto_offload.count = count;
+	req->crypto_offload.rc = 0;
+
+	/*
+	 * The job doesn't need any impersonation,
+	 * so we use the raw event context.
+	 */
+	subreq = pthreadpool_tevent_job_send(req,
+					     xconn->client->raw_ev_ctx,
+					     sconn->pool,
+					     smbd_smb2_request_crypto_job,
+					     req);
+	if (subreq == NULL) {
+		return false;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_request_crypto_done, req);
+
+	/*
+	 * This keeps the response in the send queue until
+	 * the job is done, so the order of responses doesn't
+	 * change.
+	 */
+	req->queue_entry.crypto_pending = true;
+	return true;
+}
+
+/*
+ * If these return false, the caller needs to encrypt or
+ * sign the response itself.
+ */
+static bool smbd_smb2_request_encrypt_offload(struct smbd_smb2_request *req,
+					      struct iovec *firsttf,
+					      int count)
+{
+	NTSTATUS status;
+	bool ok;
+
+	ok = smbd_smb2_request_crypto_offload_possible(req,
+						       firsttf + 1,
+						       count - 1);
+	if (!ok) {
+		return false;
+	}
+
+	status = smb2_signing_encrypt_pdu_prepare(req->first_enc_key,
+						  firsttf,
+						  count);
+	if (!NT_STATUS_IS_OK(status)) {
+		/*
+		 * smb2_signing_encrypt_pdu() will either
+		 * handle it or report the error.
+		 */
+		return false;
+	}
+
+	return smbd_smb2_request_crypto_offload_send(req, firsttf, count);
+}
+
+static bool smbd_smb2_request_sign_offload(struct smbd_smb2_request *req,
+					   struct smb2_signing_key *signing_key,
+					   struct iovec *outhdr,
+					   int count)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	NTSTATUS status;
+	bool ok;
+
+	if (req->do_compression) {
+		/*
+		 * Compression happens after signing.
+		 */
+		return false;
+	}
+
+	if (!smb2_signing_key_valid(signing_key)) {
+		return false;
+	}
+
+	ok = smbd_smb2_request_crypto_offload_possible(req, outhdr, count);
+	if (!ok) {
+		return false;
+	}
+
+	/*
+	 * The hmac handle of the session's signing key
+	 * keeps state, so the helper thread needs its
+	 * own copy.
+	 */
+	status = smbd_smb2_key_cache_get(&xconn->smb2.sign_key_cache,
+					 req,
+					 signing_key,
+					 &req->crypto_offload.sign_key);
+	if (!NT_STATUS_IS_OK(status)) {
+		return false;
+	}
+
+	status = smb2_signing_sign_pdu_prepare(req->crypto_offload.sign_key,
+					       outhdr,
+					       count);
+	if (NT_STATUS_IS_OK(status)) {
+		ok = smbd_smb2_request_crypto_offload_send(req, outhdr, count);
+	} else {
+		/*
+		 * smb2_signing_sign_pdu() will either
+		 * handle it or report the error.
+		 */
+		ok = false;
+	}
+	if (!ok) {
+		smbd_smb2_key_cache_put(&xconn->smb2.sign_key_cache,
+					xconn,
+					&req->crypto_offload.sign_key);
+		return false;
+	}
+
+	return true;
+}
+
+static void smbd_smb2_request_crypto_job(void *private_data)
+{
+	struct smbd_smb2_request *req = talloc_get_type_abort(
+		private_data, struct smbd_smb2_request);
+
+	/*
+	 * This runs in a helper thread, it must not
+	 * use talloc or the debug system.
+	 */
+	if (req->crypto_offload.sign_key != NULL) {
+		req->crypto_offload.rc = smb2_signing_sign_pdu_inplace(
+			req->crypto_offload.sign_key,
+			req->crypto_offload.vector,
+			req->crypto_offload.count);
+		return;
+	}
+
+	req->crypto_offload.rc = smb2_signing_encrypt_pdu_inplace(
+		req->first_enc_key,
+		req->crypto_offload.vector,
+		req->crypto_offload.count);
+}
+
+static void smbd_smb2_request_crypto_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_request *req = tevent_req_callback_data(
+		subreq, struct smbd_smb2_request);
+	struct smbXsrv_connection *xconn = req->xconn;
+	NTSTATUS status;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+
+	if (req->crypto_offload.orphaned) {
+		/*
+		 * The connection is gone,
+		 * see smbd_smb2_request_destructor().
+		 */
+		req->queue_entry.crypto_pending = false;
+		TALLOC_FREE(req);
+		return;
+	}
+
+	if (ret == EAGAIN) {
+		/*
+		 * If we get EAGAIN from pthreadpool_tevent_job_recv() this
+		 * means the lower level pthreadpool failed to create a new
+		 * thread. Fallback to sync processing in that case.
+		 */
+		smbd_smb2_request_crypto_job(req);
+		ret = 0;
+	}
+
+	req->queue_entry.crypto_pending = false;
+	smbd_smb2_request_put_enc_key(req);
+	smbd_smb2_key_cache_put(&xconn->smb2.sign_key_cache,
+				xconn,
+				&req->crypto_offload.sign_key);
+
+	if (ret != 0) {
+		status = map_nt_error_from_unix_common(ret);
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+
+	if (req->crypto_offload.rc < 0) {
+		status = gnutls_error_to_ntstatus(req->crypto_offload.rc,
+						  NT_STATUS_INTERNAL_ERROR);
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+
+	status = smbd_smb2_flush_send_queue(xconn);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
 static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 {
 	struct smbXsrv_connection *xconn = req->xconn;
@@ -3580,9 +4039,7 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		 * we are sure that we do not change
 		 * the header again.
 		 */
-		status = smb2_signing_key_copy(req,
-					       encryption_key,
-					       &req->first_enc_key);
+		status = smbd_smb2_request_get_enc_key(req, encryption_key);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
@@ -3689,26 +4146,51 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	/*
 	 * now check if we need to sign the current response
 	 */
-	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
-		status = smb2_signing_encrypt_pdu(req->first_enc_key,
-					firsttf,
-					req->out.vector_count - first_idx);
-		if (!NT_STATUS_IS_OK(status)) {
-			return status;
-		}
-	} else if (req->do_signing) {
+	if ((firsttf->iov_len != SMB2_TF_HDR_SIZE) && req->do_signing) {
 		struct smbXsrv_session *x = req->session;
 		struct smb2_signing_key *signing_key =
 			smbd_smb2_signing_key(x, xconn, NULL);
 
-		status = smb2_signing_sign_pdu(signing_key,
-					       outhdr,
-					       SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		ok = smbd_smb2_request_sign_offload(req,
+					signing_key,
+					outhdr,
+					SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		if (!ok) {
+			status = smb2_signing_sign_pdu(signing_key,
+					outhdr,
+					SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+			if (!NT_STATUS_IS_OK(status)) {
+				return status;
+			}
+		}
+	}
+
+	/*
+	 * Compression happens after signing,
+	 * but before encryption.
+	 */
+	if (req->do_compression) {
+		status = smbd_smb2_request_compress(req);
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
 	}
-	TALLOC_FREE(req->first_enc_key);
+
+	if (firsttf->iov_len == SMB2_TF_HDR_SIZE &&
+	    !smbd_smb2_request_encrypt_offload(req,
+					firsttf,
+					req->out.vector_count - first_idx))
+	{
+		status = smb2_signing_encrypt_pdu(req->first_enc_key,
+					firsttf,
+					req->out.vector_count - first_idx);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+	if (!req->queue_entry.crypto_pending) {
+		smbd_smb2_request_put_enc_key(req);
+	}
 
 	if (req->preauth != NULL) {
 		gnutls_hash_hd_t hash_hnd = NULL;
@@ -4517,6 +4999,18 @@ static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn
 
 	TEVENT_FD_READABLE(xconn->transport.fde);
 
+	if (xconn->smb2.readahead.len > 0) {
+		/*
+		 * The next request is already in the readahead
+		 * buffer, the socket may not become readable
+		 * again before we process it.
+		 */
+		tevent_schedule_immediate(xconn->smb2.readahead.im,
+					  xconn->client->raw_ev_ctx,
+					  smbd_smb2_readahead_immediate,
+					  xconn);
+	}
+
 	return NT_STATUS_OK;
 }
 
@@ -4662,6 +5156,12 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 
 	while (xconn->smb2.send_queue != NULL) {
 		struct smbd_smb2_send_queue *e = xconn->smb2.send_queue;
+		struct smbd_smb2_send_queue *f = NULL;
+		struct iovec iov[SMBD_SMB2_MAX_SEND_IOV];
+		int iovcnt = 0;
+		int flags = 0;
+		bool full = false;
+		size_t sent;
 		bool ok;
 		struct msghdr msg;
 
@@ -4677,6 +5177,16 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 			continue;
 		}
 
+		if (e->crypto_pending) {
+			/*
+			 * smbd_smb2_request_crypto_done() flushes
+			 * the queue again, we keep reading new
+			 * requests in the meantime.
+			 */
+			TEVENT_FD_NOT_WRITEABLE(xconn->transport.fde);
+			break;
+		}
+
 		if (e->sendfile_header != NULL) {
 			size_t size = 0;
 			size_t i = 0;
@@ -4730,12 +5240,61 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 			continue;
 		}
 
-		msg = (struct msghdr) {
-			.msg_iov = e->vector,
-			.msg_iovlen = e->count,
-		};
+		/*
+		 * Send as many queued responses as possible with a
+		 * single syscall, this matters for clients sending
+		 * a lot of small (compound) requests.
+		 */
+		for (f = e; f != NULL; f = f->next) {
+			if (f->crypto_pending || f->sendfile_header != NULL) {
+				break;
+			}
+			if ((size_t)(iovcnt + f->count) > ARRAY_SIZE(iov)) {
+				full = true;
+				break;
+			}
+			memcpy(&iov[iovcnt], f->vector,
+			       sizeof(struct iovec) * f->count);
+			iovcnt += f->count;
+		}
+
+		if (iovcnt == 0) {
+			/*
+			 * e has too many vectors for
+			 * the iov array, send it alone.
+			 */
+			msg = (struct msghdr) {
+				.msg_iov = e->vector,
+				.msg_iovlen = e->count,
+			};
+			f = e->next;
+			full = true;
+		} else {
+			msg = (struct msghdr) {
+				.msg_iov = iov,
+				.msg_iovlen = iovcnt,
+			};
+		}
+
+#ifdef MSG_MORE
+		if (f != NULL && !full &&
+		    !f->crypto_pending && f->sendfile_header == NULL)
+		{
+			/*
+			 * We'll send the next entry
+			 * directly after this one.
+			 *
+			 * A full iov array is likely to
+			 * be a short write, the rest is
+			 * only sent once the socket is
+			 * writable again, so we must not
+			 * hold back the tail of it.
+			 */
+			flags |= MSG_MORE;
+		}
+#endif
 
-		ret = sendmsg(xconn->transport.sock, &msg, 0);
+		ret = sendmsg(xconn->transport.sock, &msg, flags);
 		if (ret == 0) {
 			/* propagate end of file */
 			return NT_STATUS_INTERNAL_ERROR;
@@ -4753,29 +5312,45 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 			return status;
 		}
 
-		xconn->ack.unacked_bytes += ret;
+		sent = ret;
 
-		ok = iov_advance(&e->vector, &e->count, ret);
-		if (!ok) {
-			return NT_STATUS_INTERNAL_ERROR;
-		}
+		while (sent > 0) {
+			ssize_t len;
+			size_t n;
 
-		if (e->count > 0) {
-			/* we have more to write */
-			TEVENT_FD_WRITEABLE(xconn->transport.fde);
-			return NT_STATUS_OK;
-		}
+			e = xconn->smb2.send_queue;
+
+			len = iov_buflen(e->vector, e->count);
+			if (len == -1) {
+				return NT_STATUS_INTERNAL_ERROR;
+			}
+			n = MIN((size_t)len, sent);
 
-		xconn->smb2.send_queue_len--;
-		DLIST_REMOVE(xconn->smb2.send_queue, e);
+			xconn->ack.unacked_bytes += n;
+			sent -= n;
 
-		if (e->ack.req == NULL) {
-			talloc_free(e->mem_ctx);
-			continue;
-		}
+			ok = iov_advance(&e->vector, &e->count, n);
+			if (!ok) {
+				return NT_STATUS_INTERNAL_ERROR;
+			}
+
+			if (e->count > 0) {
+				/* we have more to write */
+				TEVENT_FD_WRITEABLE(xconn->transport.fde);
+				return NT_STATUS_OK;
+			}
+
+			xconn->smb2.send_queue_len--;
+			DLIST_REMOVE(xconn->smb2.send_queue, e);
 
-		e->ack.required_acked_bytes = xconn->ack.unacked_bytes;
-		DLIST_ADD_END(xconn->ack.queue, e);
+			if (e->ack.req == NULL) {
+				talloc_free(e->mem_ctx);
+				continue;
+			}
+
+			e->ack.required_acked_bytes = xconn->ack.unacked_bytes;
+			DLIST_ADD_END(xconn->ack.queue, e);
+		}
 	}
 
 	/*
@@ -4791,6 +5366,112 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 	return NT_STATUS_OK;
 }
 
+static bool smbd_smb2_readahead_possible(struct smbXsrv_connection *xconn)
+{
+	if (lp_min_receive_file_size() != 0) {
+		/*
+		 * Receivefile needs the data
+		 * of SMB2 writes on the socket.
+		 */
+		return false;
+	}
+
+	if (xconn->protocol < PROTOCOL_SMB2_02) {
+		return false;
+	}
+
+	if (xconn->client->server_multi_channel_enabled &&
+	    !xconn->smb2.client.guid_verified)
+	{
+		/*
+		 * The connection might still be passed
+		 * to another process, we must not
+		 * consume any data from the socket
+		 * that we can't pass along.
+		 */
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Reading small PDUs with one recvmsg for the NBT header and another
+ * one for the body means two syscalls per request. If possible we
+ * read ahead into a per connection buffer, so that several small
+ * requests can be received with one syscall.
+ */
+static ssize_t smbd_smb2_recv(struct smbXsrv_connection *xconn,
+			      const struct iovec *vector)
+{
+	struct smbd_smb2_readahead *ra = &xconn->smb2.readahead;
+	uint8_t *base = (uint8_t *)vector->iov_base;
+	size_t len = vector->iov_len;
+	size_t copied = 0;
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t ret;
+
+	if (ra->len > 0) {
+		copied = MIN(ra->len, len);
+		memcpy(base, ra->buf + ra->ofs, copied);
+		ra->ofs += copied;
+		ra->len -= copied;
+
+		if (copied == len) {
+			return copied;
+		}
+	}
+
+	iov[0] = (struct iovec) {
+		.iov_base = base + copied,
+		.iov_len = len - copied,
+	};
+	msg = (struct msghdr) {
+		.msg_iov = iov,
+		.msg_iovlen = 1,
+	};
+
+	if (iov[0].iov_len < SMBD_SMB2_READAHEAD_SIZE &&
+	    smbd_smb2_readahead_possible(xconn))
+	{
+		if (ra->buf == NULL) {
+			ra->buf = talloc_array(xconn,
+					       uint8_t,
+					       SMBD_SMB2_READAHEAD_SIZE);
+			ra->im = tevent_create_immediate(xconn);
+			if (ra->buf == NULL || ra->im == NULL) {
+				TALLOC_FREE(ra->buf);
+				TALLOC_FREE(ra->im);
+			}
+		}
+		if (ra->buf != NULL) {
+			iov[1] = (struct iovec) {
+				.iov_base = ra->buf,
+				.iov_len = SMBD_SMB2_READAHEAD_SIZE,
+			};
+			msg.msg_iovlen = 2;
+		}
+	}
+
+	ret = recvmsg(xconn->transport.sock, &msg, 0);
+	if (ret > 0 && (size_t)ret > iov[0].iov_len) {
+		ra->ofs = 0;
+		ra->len = ret - iov[0].iov_len;
+		ret = iov[0].iov_len;
+	}
+
+	if (copied > 0) {
+		/*
+		 * Errors and end of file are
+		 * reported by the next call.
+		 */
+		return copied + MAX(ret, 0);
+	}
+
+	return ret;
+}
+
 static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
 				     uint16_t fde_flags)
 {
@@ -4803,7 +5484,6 @@ static NTSTATUS smbd_smb2_io_handler(struct smbXsrv_connection *xconn,
 	bool retry;
 	NTSTATUS status;
 	NTTIME now;
-	struct msghdr msg;
 
 	if (!NT_STATUS_IS_OK(xconn->transport.status)) {
 		/*
@@ -4838,12 +5518,7 @@ again:
 		state->vector.iov_len = NBT_HDR_SIZE;
 	}
 
-	msg = (struct msghdr) {
-		.msg_iov = &state->vector,
-		.msg_iovlen = 1,
-	};
-
-	ret = recvmsg(xconn->transport.sock, &msg, 0);
+	ret = smbd_smb2_recv(xconn, &state->vector);
 	if (ret == 0) {
 		/* propagate end of file */
 		status = NT_STATUS_END_OF_FILE;
@@ -4918,7 +5593,11 @@ again:
 		goto got_full;
 	}
 
-	if (state->min_recv_size != 0) {
+	if (state->min_recv_size != 0 && xconn->smb2.readahead.len == 0) {
+		/*
+		 * Receivefile is not possible if parts of
+		 * the PDU are already in the readahead buffer.
+		 */
 		min_recvfile_size = SMBD_SMB2_SHORT_RECEIVEFILE_WRITE_LEN;
 		min_recvfile_size += state->min_recv_size;
 	}
@@ -5032,6 +5711,22 @@ got_full:
 	return NT_STATUS_OK;
 }
 
+static void smbd_smb2_readahead_immediate(struct tevent_context *ctx,
+					  struct tevent_immediate *im,
+					  void *private_data)
+{
+	struct smbXsrv_connection *xconn =
+		talloc_get_type_abort(private_data,
+		struct smbXsrv_connection);
+	NTSTATUS status;
+
+	status = smbd_smb2_io_handler(xconn, TEVENT_FD_READ);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
 static void smbd_smb2_connection_handler(struct tevent_context *ev,
 					 struct tevent_fd *fde,
 					 uint16_t flags,
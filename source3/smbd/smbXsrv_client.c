@@ -74,6 +74,7 @@ NTSTATUS smbXsrv_client_global_init(void)
 			  0, /* hash_size */
 			  TDB_DEFAULT |
 			  TDB_CLEAR_IF_FIRST |
+			  TDB_GROW_HASH_SIZE |
 			  TDB_INCOMPATIBLE_HASH,
 			  O_RDWR | O_CREAT, 0600,
 			  DBWRAP_LOCK_ORDER_1,
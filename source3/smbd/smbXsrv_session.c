@@ -77,6 +77,7 @@ NTSTATUS smbXsrv_session_global_init(struct messaging_context *msg_ctx)
 			  0, /* hash_size */
 			  TDB_DEFAULT |
 			  TDB_CLEAR_IF_FIRST |
+			  TDB_GROW_HASH_SIZE |
 			  TDB_INCOMPATIBLE_HASH,
 			  O_RDWR | O_CREAT, 0600,
 			  DBWRAP_LOCK_ORDER_1,
@@ -1802,6 +1803,7 @@ NTSTATUS smbXsrv_session_logoff(struct smbXsrv_session *session)
 	session->table = NULL;
 
 	sconn = session->client->sconn;
+	smbd_smb2_key_cache_flush(session->client);
 	session->client = NULL;
 	session->status = NT_STATUS_USER_SESSION_DELETED;
 
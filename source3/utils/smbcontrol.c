@@ -903,6 +903,63 @@ static bool do_poolusage(struct tevent_context *ev_ctx,
 	return true;
 }
 
+/* Control talloc allocation sampling or dump a profile */
+
+static bool do_talloc_profile(struct tevent_context *ev_ctx,
+			      struct messaging_context *msg_ctx,
+			      const struct server_id dst,
+			      const int argc, const char **argv)
+{
+	pid_t pid = procid_to_pid(&dst);
+	int stdout_fd = 1;
+	char *cmd = NULL;
+	bool ok;
+
+	if (argc == 1 || (argc == 2 && strequal(argv[1], "dump"))) {
+		struct iovec iov = {
+			.iov_base = discard_const_p(char, "dump"),
+			.iov_len = strlen("dump") + 1,
+		};
+		NTSTATUS status;
+
+		if (pid == 0) {
+			fprintf(stderr, "Can only dump a specific PID\n");
+			return false;
+		}
+
+		status = messaging_send_iov(
+			msg_ctx,
+			dst,
+			MSG_REQ_TALLOC_PROFILE,
+			&iov,
+			1,
+			&stdout_fd,
+			1);
+		return NT_STATUS_IS_OK(status);
+	}
+
+	if (argc == 3 && strequal(argv[1], "enable")) {
+		cmd = talloc_asprintf(talloc_tos(), "enable %s", argv[2]);
+	} else if (argc == 2 && strequal(argv[1], "disable")) {
+		cmd = talloc_strdup(talloc_tos(), "disable");
+	} else if (argc == 2 && strequal(argv[1], "reset")) {
+		cmd = talloc_strdup(talloc_tos(), "reset");
+	} else {
+		fprintf(stderr,
+			"Usage: smbcontrol <dest> talloc-profile "
+			"[dump|enable <sample-bytes>|disable|reset]\n");
+		return false;
+	}
+	if (cmd == NULL) {
+		return false;
+	}
+
+	ok = send_message(msg_ctx, dst, MSG_REQ_TALLOC_PROFILE,
+			  cmd, strlen(cmd) + 1);
+	TALLOC_FREE(cmd);
+	return ok;
+}
+
 static bool do_rpc_dump_status(
 	struct tevent_context *ev_ctx,
 	struct messaging_context *msg_ctx,
@@ -1512,6 +1569,12 @@ static const struct {
 		.fn   = do_poolusage,
 		.help = "Display talloc memory usage",
 	},
+	{
+		.name = "talloc-profile",
+		.fn   = do_talloc_profile,
+		.help = "Control talloc allocation sampling, dump a pprof "
+			"profile",
+	},
 	{
 		.name = "rpc-dump-status",
 		.fn   = do_rpc_dump_status,
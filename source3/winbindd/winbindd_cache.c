@@ -3068,7 +3068,7 @@ static bool init_wcache(void)
 	/* when working offline we must not clear the cache on restart */
 	wcache->tdb = tdb_open_log(db_path,
 				WINBINDD_CACHE_TDB_DEFAULT_HASH_SIZE, 
-				TDB_INCOMPATIBLE_HASH |
+				TDB_INCOMPATIBLE_HASH | TDB_BINNED_FREELIST |
 					(lp_winbind_offline_logon() ? TDB_DEFAULT : (TDB_DEFAULT | TDB_CLEAR_IF_FIRST)),
 				O_RDWR|O_CREAT, 0600);
 	TALLOC_FREE(db_path);
@@ -3291,7 +3291,7 @@ static void wcache_flush_cache(void)
 	/* when working offline we must not clear the cache on restart */
 	wcache->tdb = tdb_open_log(db_path,
 				WINBINDD_CACHE_TDB_DEFAULT_HASH_SIZE,
-				TDB_INCOMPATIBLE_HASH |
+				TDB_INCOMPATIBLE_HASH | TDB_BINNED_FREELIST |
 				(lp_winbind_offline_logon() ? TDB_DEFAULT : (TDB_DEFAULT | TDB_CLEAR_IF_FIRST)),
 				O_RDWR|O_CREAT, 0600);
 	TALLOC_FREE(db_path);
@@ -4121,7 +4121,7 @@ int winbindd_validate_cache(void)
 
 	tdb = tdb_open_log(tdb_path,
 			   WINBINDD_CACHE_TDB_DEFAULT_HASH_SIZE,
-			   TDB_INCOMPATIBLE_HASH |
+			   TDB_INCOMPATIBLE_HASH | TDB_BINNED_FREELIST |
 			   ( lp_winbind_offline_logon()
 			     ? TDB_DEFAULT
 			     : TDB_DEFAULT | TDB_CLEAR_IF_FIRST ),
@@ -1267,6 +1267,7 @@ static const struct ldap_control_handler ldap_known_controls[] = {
 	{ LDB_CONTROL_BYPASS_OPERATIONAL_OID, NULL, NULL },
 	{ DSDB_CONTROL_CHANGEREPLMETADATA_OID, NULL, NULL },
 	{ LDB_CONTROL_PROVISION_OID, NULL, NULL },
+	{ LDB_CONTROL_SEARCH_EXPLAIN_OID, NULL, NULL },
 	{ DSDB_EXTENDED_REPLICATED_OBJECTS_OID, NULL, NULL },
 	{ DSDB_EXTENDED_SCHEMA_UPDATE_NOW_OID, NULL, NULL },
 	{ DSDB_EXTENDED_ALLOCATE_RID_POOL, NULL, NULL },